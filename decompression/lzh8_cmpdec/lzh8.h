@@ -0,0 +1,101 @@
+#ifndef _LZH8_H_INCLUDED
+#define _LZH8_H_INCLUDED
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* LZH8 compression and decompression in memory
+
+   lzh8_compress and lzh8_decompress work from one buffer to another.
+   For input that arrives a piece at a time, or output too big to hold,
+   a decoder can be fed chunks of input and drained through a ring
+   buffer, see lzh8_decode.
+
+   Nothing here prints or exits on bad input, failures come back as a
+   status; running out of memory still exits, as elsewhere. */
+
+enum lzh8_status
+{
+    LZH8_OK = 0,            /* finished */
+    LZH8_NEED_INPUT,        /* lzh8_decode: used all the input given */
+    LZH8_OUTPUT_FULL,       /* lzh8_decode: the ring is full */
+
+    LZH8_ERROR_NOT_LZH8,
+    LZH8_ERROR_TRUNCATED,
+    LZH8_ERROR_BAD_CODE,            /* a code the trees don't have */
+    LZH8_ERROR_BAD_BACKREFERENCE,   /* from before the start of output */
+    LZH8_ERROR_OUTPUT_SIZE,         /* output buffer smaller than needed */
+    LZH8_ERROR_RING,                /* ring too small or out of step */
+    LZH8_ERROR_TOO_LARGE,           /* input too big to compress */
+    LZH8_ERROR_OPTIONS,
+};
+
+const char *lzh8_status_string(enum lzh8_status status);
+
+/* compression */
+
+struct lzh8_options
+{
+    bool strict;        /* reproduce Nintendo's compressor exactly */
+    bool optimal;       /* choose symbols by what they cost to code, for
+                           smaller output (slower, not with strict) */
+    int threads;        /* for the match search, output is the same */
+    bool progress;      /* report LZSS progress on stderr */
+};
+
+/* strict, one thread, quiet */
+void lzh8_default_options(struct lzh8_options *options);
+
+/* compress in_size bytes from in into a new buffer at *out_p (free it
+   when done), options NULL for the defaults */
+enum lzh8_status lzh8_compress(const uint8_t *in, long in_size,
+        uint8_t **out_p, long *out_size_p,
+        const struct lzh8_options *options);
+
+/* decompression */
+
+/* the size the header says in will decompress to */
+enum lzh8_status lzh8_decompressed_size(const uint8_t *in, long in_size,
+        unsigned long *size_p);
+
+/* decompress all of in to out, which has room for out_size bytes, at
+   least what lzh8_decompressed_size gives */
+enum lzh8_status lzh8_decompress(const uint8_t *in, long in_size,
+        uint8_t *out, unsigned long out_size);
+
+/* incremental decoding */
+
+/* backreferences reach 0x10000 back, the ring has to hold that much
+   and a backreference more */
+enum {LZH8_RING_MIN = 0x20000};
+
+/* the caller's output buffer: the decoder adds at write, the caller takes
+   from read; both count bytes since the start of output and wrap at size,
+   which is a power of two at least LZH8_RING_MIN */
+struct lzh8_ring
+{
+    uint8_t *data;
+    unsigned long size;
+    unsigned long read;
+    unsigned long write;
+};
+
+struct lzh8_decoder;
+
+struct lzh8_decoder *lzh8_decoder_new(void);
+void lzh8_decoder_free(struct lzh8_decoder *d);
+
+/* decode what can be from in_size bytes at in, *in_used_p is set to how
+   many were taken (the rest have to be given again next time); last says
+   no input follows this.
+   Returns LZH8_OK when all output is in the ring, LZH8_NEED_INPUT when
+   it took all of in and needs more, LZH8_OUTPUT_FULL when the ring needs
+   draining, or an error, after which it will only return that error. */
+enum lzh8_status lzh8_decode(struct lzh8_decoder *d,
+        const uint8_t *in, unsigned long in_size, unsigned long *in_used_p,
+        bool last, struct lzh8_ring *ring);
+
+/* the size of the output, once the header has been decoded */
+bool lzh8_decoder_size(const struct lzh8_decoder *d, unsigned long *size_p);
+
+#endif /* _LZH8_H_INCLUDED */
@@ -32,18 +32,25 @@
    3c) If displacement length is > 1, displacement is next displen-1 bits,
        with an extra 1 on the front (normalized).
 
+   The decoding itself is lzh8_decode.c's, fed from the input file a chunk
+   at a time and written out from its ring, so neither file needs to fit in
+   memory. The old bit at a time tree walk is kept here as a reference,
+   lzh8_dec -b times it against the in memory and incremental decoders.
+
    Reverse engineered by hcs.
    This software is released to the public domain as of November 2, 2009.
 */
 
 #include <stdio.h>
+#include <time.h>
 
 #include "util.h"
 #include "error_stuff.h"
+#include "lzh8.h"
 
-#define VERSION "0.8 " __DATE__
+#define VERSION "0.9 " __DATE__
 
-/* debug output options */
+/* debug output options, for the tree walking decoder */
 #define SHOW_SYMBOLS        0
 #define SHOW_FREQUENCIES    0
 #define SHOW_TREE           0
@@ -55,43 +62,151 @@ enum {DISPBITS = 5};
 enum {LENCNT = (1 << LENBITS)};
 enum {DISPCNT = (1 << DISPBITS)};
 
-void analyze_LZH8(FILE *infile, FILE *outfile, long file_length);
+/* input read at a time */
+enum {CHUNK_SIZE = 0x8000};
+
+/* decode passes over the input for -b */
+enum {BENCH_ROUNDS = 10};
+
+/* what the tree walker needs, from the header and tables */
+struct LZH8_header
+{
+    unsigned long uncompressed_length;
+
+    /* flattened trees, as stored, in 16 bits per node */
+    uint16_t *length_decode_table;
+    long length_decode_table_count;
+    uint16_t *displen_decode_table;
+    long displen_decode_table_count;
+
+    /* where the compressed bitstream starts */
+    long data_offset;
+};
+
+void read_LZH8_header(const uint8_t *inbuf, long file_length,
+        struct LZH8_header *h);
+void decode_LZH8_stream(FILE *infile, FILE *outfile);
+void decode_LZH8_tree(const struct LZH8_header *h,
+        const uint8_t *inbuf, long file_length, uint8_t *outbuf);
+void free_LZH8_header(struct LZH8_header *h);
+
+void bench_LZH8(const uint8_t *inbuf, long file_length);
 
 int main(int argc, char **argv)
 {
-    if (argc != 3)
+    const char *infile_name = NULL, *outfile_name = NULL;
+    int bench = 0;
+
+    if (argc == 3 && strcmp(argv[1], "-b"))
+    {
+        infile_name = argv[1];
+        outfile_name = argv[2];
+    }
+    else if (argc == 3)
+    {
+        bench = 1;
+        infile_name = argv[2];
+    }
+    else
     {
         printf("lzh8_dec %s\n\n", VERSION);
         printf("Usage: %s infile outfile\n",argv[0]);
+        printf("       %s -b infile   (time against the tree walker)\n",
+                argv[0]);
         exit(EXIT_FAILURE);
     }
 
     /* open file */
-    FILE *infile = fopen(argv[1], "rb");
+    FILE *infile = fopen(infile_name, "rb");
     CHECK_ERRNO(!infile, "fopen");
 
-    FILE *outfile = fopen(argv[2], "wb");
-    CHECK_ERRNO(!infile, "fopen");
+    if (bench)
+    {
+        /* get file size */
+        CHECK_ERRNO(fseek(infile, 0 , SEEK_END) != 0, "fseek");
+        long file_length = ftell(infile);
+        CHECK_ERRNO(file_length == -1, "ftell");
+
+        rewind(infile);
 
-    /* get file size */
-    CHECK_ERRNO(fseek(infile, 0 , SEEK_END) != 0, "fseek");
-    long file_length = ftell(infile);
-    CHECK_ERRNO(file_length == -1, "ftell");
+        /* the whole thing, so the decoders needn't go through stdio */
+        uint8_t * const inbuf = malloc(file_length > 0 ? file_length : 1);
+        CHECK_ERRNO(NULL == inbuf, "malloc");
+        get_bytes(infile, inbuf, file_length);
 
-    rewind(infile);
+        bench_LZH8(inbuf, file_length);
+        free(inbuf);
+    }
+    else
+    {
+        FILE *outfile = fopen(outfile_name, "wb");
+        CHECK_ERRNO(!outfile, "fopen");
 
-    analyze_LZH8(infile, outfile, file_length);
+        decode_LZH8_stream(infile, outfile);
 
-    CHECK_ERRNO(fclose(outfile) == EOF, "fclose");
+        CHECK_ERRNO(fclose(outfile) == EOF, "fclose");
+    }
 
     CHECK_ERRNO(fclose(infile) == EOF, "fclose");
 
     exit(EXIT_SUCCESS);
 }
 
-/* read MSB->LSB order */
+/* write out what's in the ring */
+static void drain_ring(struct lzh8_ring *ring, FILE *outfile)
+{
+    while (ring->read != ring->write)
+    {
+        const unsigned long start = ring->read & (ring->size - 1);
+        unsigned long n = ring->write - ring->read;
+        if (n > ring->size - start) n = ring->size - start;
+
+        put_bytes(outfile, &ring->data[start], n);
+        ring->read += n;
+    }
+}
+
+void decode_LZH8_stream(FILE *infile, FILE *outfile)
+{
+    struct lzh8_decoder * const d = lzh8_decoder_new();
+    struct lzh8_ring ring = {NULL, LZH8_RING_MIN, 0, 0};
+    ring.data = malloc(ring.size);
+    CHECK_ERRNO(NULL == ring.data, "malloc");
+
+    uint8_t inbuf[CHUNK_SIZE];
+    unsigned long in_pos = 0, in_have = 0;
+    bool last = false;
+    enum lzh8_status status;
+
+    do
+    {
+        if (in_pos == in_have && !last)
+        {
+            in_have = fread(inbuf, 1, CHUNK_SIZE, infile);
+            CHECK_FILE(ferror(infile), infile, "fread");
+            in_pos = 0;
+            last = (0 != feof(infile));
+        }
+
+        unsigned long used;
+        status = lzh8_decode(d, &inbuf[in_pos], in_have - in_pos, &used,
+                last, &ring);
+        in_pos += used;
+
+        drain_ring(&ring, outfile);
+    }
+    while (LZH8_NEED_INPUT == status || LZH8_OUTPUT_FULL == status);
+
+    CHECK_ERROR(LZH8_OK != status, lzh8_status_string(status));
+
+    free(ring.data);
+    lzh8_decoder_free(d);
+}
+
+/* read MSB->LSB order, a byte at a time */
 static inline uint16_t get_next_bits(
-        FILE *infile,
+        const uint8_t *inbuf,
+        long file_length,
         long * const offset_p,
         uint8_t * const bit_pool_p,
         int * const bits_left_p,
@@ -103,7 +218,8 @@ static inline uint16_t get_next_bits(
     {
         if (0 == *bits_left_p)
         {
-            *bit_pool_p = get_byte_seek(*offset_p, infile);
+            CHECK_ERROR(*offset_p >= file_length, "unexpected end of input");
+            *bit_pool_p = inbuf[*offset_p];
             *bits_left_p = 8;
             ++*offset_p;
         }
@@ -127,105 +243,118 @@ static inline uint16_t get_next_bits(
 }
 
 #define GET_NEXT_BITS(bit_count) \
-    get_next_bits(infile, &input_offset, &bit_pool, &bits_left, bit_count)
+    get_next_bits(inbuf, file_length, \
+            &input_offset, &bit_pool, &bits_left, bit_count)
 
-void analyze_LZH8(FILE *infile, FILE *outfile, long file_length)
+static uint32_t get_32_le_mem(const uint8_t *inbuf, long file_length,
+        long offset)
 {
-    unsigned long uncompressed_length;
+    CHECK_ERROR(offset + 4 > file_length, "unexpected end of input");
+    return read_32_le((unsigned char *)&inbuf[offset]);
+}
 
-    long input_offset = 0;
+/* read a flattened tree of count nodes, bit_count bits each, that takes
+   up (first byte(s), size in words - 1) * 4 bytes from table_offset */
+static uint16_t *read_decode_table(const uint8_t *inbuf, long file_length,
+        long table_offset, int size_bytes, int bit_count, long count,
+        long *table_count_p, long *end_offset_p)
+{
+    CHECK_ERROR(table_offset + size_bytes > file_length,
+            "unexpected end of input");
+
+    uint32_t table_bytes = inbuf[table_offset];
+    if (2 == size_bytes)
+    {
+        table_bytes |= inbuf[table_offset+1] << 8;
+    }
+    table_bytes = (table_bytes + 1) * 4;
+
+    uint16_t * const table = calloc(count, sizeof(uint16_t));
+    CHECK_ERRNO(NULL == table, "calloc");
+
+    long input_offset = table_offset + size_bytes;
     uint8_t bit_pool = 0;
     int bits_left = 0;
+    long i = 1;
+    while (input_offset - table_offset < table_bytes)
+    {
+        if (i >= count)
+        {
+            break;
+        }
+        table[i++] = GET_NEXT_BITS(bit_count);
+#if SHOW_TABLE
+        printf("%ld: %d\n", i-1, (int)table[i-1]);
+#endif
+    }
+#if SHOW_TABLE
+    printf("done at 0x%lx\n", (unsigned long)(table_offset + table_bytes));
+    fflush(stdout);
+#endif
+
+    *table_count_p = i;
+    *end_offset_p = table_offset + table_bytes;
+
+    return table;
+}
+
+void read_LZH8_header(const uint8_t *inbuf, long file_length,
+        struct LZH8_header *h)
+{
+    long input_offset = 0;
 
     /* read header */
     {
         uint32_t header;
-        header = get_32_le_seek(input_offset, infile);
+        header = get_32_le_mem(inbuf, file_length, input_offset);
         input_offset += 4;
         CHECK_ERROR ((header & 0xFF) != 0x40, "not LZH8");
-        uncompressed_length = header >> 8;
-        if (0 == uncompressed_length)
+        h->uncompressed_length = header >> 8;
+        if (0 == h->uncompressed_length)
         {
-            uncompressed_length = get_32_le_seek(input_offset, infile);
+            h->uncompressed_length =
+                get_32_le_mem(inbuf, file_length, input_offset);
             input_offset += 4;
         }
     }
 
-    /* allocate output buffer */
-    uint8_t * const outbuf = malloc(uncompressed_length);
-    CHECK_ERRNO(NULL == outbuf, "malloc");
-
-    /* allocate backreference length decode table */
-    const uint32_t length_table_bytes =
-        (get_16_le_seek(input_offset, infile) + 1) * 4;
-    input_offset += 2;
-    const long length_decode_table_size = LENCNT * 2;
-    uint16_t * const length_decode_table =
-        malloc(length_decode_table_size*sizeof(uint16_t));
-    CHECK_ERRNO(NULL == length_decode_table, "malloc");
-
     /* read backreference length decode table */
 #if SHOW_TABLE
     printf("backreference length table\n");
 #endif
-    {
-        long start_input_offset = input_offset-2;
-        long i = 1;
-        bits_left = 0;
-        while (input_offset - start_input_offset < length_table_bytes)
-        {
-            if (i >= length_decode_table_size)
-            {
-                break;
-            }
-            length_decode_table[i++] = GET_NEXT_BITS(LENBITS);
-#if SHOW_TABLE
-            printf("%ld: %d\n", i-1, (int)length_decode_table[i-1]);
-#endif
-        }
-        input_offset = start_input_offset + length_table_bytes;
-        bits_left = 0;
-    }
-#if SHOW_TABLE
-    printf("done at 0x%lx\n", (unsigned long)input_offset);
-    fflush(stdout);
-#endif
-
-    /* allocate backreference displacement length decode table */
-    const uint32_t displen_table_bytes =
-        (get_byte_seek(input_offset, infile) + 1) * 4;
-    input_offset ++;
-    const long displen_decode_table_size = DISPCNT * 2;
-    uint8_t * const displen_decode_table =
-        malloc(displen_decode_table_size*sizeof(uint8_t));
-    CHECK_ERRNO(NULL == displen_decode_table, "malloc");
+    h->length_decode_table = read_decode_table(inbuf, file_length,
+            input_offset, 2, LENBITS, LENCNT * 2,
+            &h->length_decode_table_count, &input_offset);
 
     /* read backreference displacement length decode table */
 #if SHOW_TABLE
     printf("backreference displacement length table\n");
 #endif
-    {
-        long start_input_offset = input_offset-1;
-        long i = 1;
-        bits_left = 0;
-        while (input_offset - start_input_offset < displen_table_bytes)
-        {
-            if (i >= length_decode_table_size)
-            {
-                break;
-            }
-            displen_decode_table[i++] = GET_NEXT_BITS(DISPBITS);
-#if SHOW_TABLE
-            printf("%ld: %d\n", i-1, (int)displen_decode_table[i-1]);
-#endif
-        }
-        input_offset = start_input_offset + displen_table_bytes;
-        bits_left = 0;
-    }
-#if SHOW_TABLE
-    printf("done at 0x%lx\n", (unsigned long)input_offset);
-    fflush(stdout);
-#endif
+    h->displen_decode_table = read_decode_table(inbuf, file_length,
+            input_offset, 1, DISPBITS, DISPCNT * 2,
+            &h->displen_decode_table_count, &input_offset);
+
+    h->data_offset = input_offset;
+}
+
+void free_LZH8_header(struct LZH8_header *h)
+{
+    free(h->length_decode_table);
+    free(h->displen_decode_table);
+}
+
+/* reference decoder, walks the trees a bit at a time */
+
+void decode_LZH8_tree(const struct LZH8_header *h,
+        const uint8_t *inbuf, long file_length, uint8_t *outbuf)
+{
+    const unsigned long uncompressed_length = h->uncompressed_length;
+    const uint16_t * const length_decode_table = h->length_decode_table;
+    const uint16_t * const displen_decode_table = h->displen_decode_table;
+
+    long input_offset = h->data_offset;
+    uint8_t bit_pool = 0;
+    int bits_left = 0;
 
     unsigned long bytes_decoded = 0;
 
@@ -420,10 +549,122 @@ void analyze_LZH8(FILE *infile, FILE *outfile, long file_length)
         printf("%d: %ld\n", i, back_displen_count[i]);
     }
 #endif
+}
 
-    put_bytes(outfile, outbuf, uncompressed_length);
+static double seconds(clock_t start)
+{
+    return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
 
-    free(outbuf);
-    free(length_decode_table);
-    free(displen_decode_table);
+/* the incremental decoder on inbuf, a chunk at a time, out of the ring
+   into outbuf */
+static void decode_LZH8_chunks(const uint8_t *inbuf, long file_length,
+        uint8_t *outbuf, struct lzh8_ring *ring)
+{
+    struct lzh8_decoder * const d = lzh8_decoder_new();
+    unsigned long in_pos = 0;
+    enum lzh8_status status;
+
+    ring->read = ring->write = 0;
+
+    do
+    {
+        unsigned long n = file_length - in_pos;
+        if (n > CHUNK_SIZE) n = CHUNK_SIZE;
+
+        unsigned long used;
+        status = lzh8_decode(d, &inbuf[in_pos], n, &used,
+                in_pos + n == (unsigned long)file_length, ring);
+        in_pos += used;
+
+        while (ring->read != ring->write)
+        {
+            const unsigned long start = ring->read & (ring->size - 1);
+            unsigned long m = ring->write - ring->read;
+            if (m > ring->size - start) m = ring->size - start;
+
+            memcpy(&outbuf[ring->read], &ring->data[start], m);
+            ring->read += m;
+        }
+    }
+    while (LZH8_NEED_INPUT == status || LZH8_OUTPUT_FULL == status);
+
+    CHECK_ERROR(LZH8_OK != status, lzh8_status_string(status));
+
+    lzh8_decoder_free(d);
+}
+
+static void print_rate(const char *name, double seconds, double mb)
+{
+    printf("%-12s%8.3f s  %8.2f MB/s\n", name, seconds,
+            seconds > 0 ? mb / seconds : 0);
+}
+
+/* time the table decoders against the tree walker, checking they agree */
+void bench_LZH8(const uint8_t *inbuf, long file_length)
+{
+    unsigned long uncompressed_length;
+    enum lzh8_status status =
+        lzh8_decompressed_size(inbuf, file_length, &uncompressed_length);
+    CHECK_ERROR(LZH8_OK != status, lzh8_status_string(status));
+
+    const size_t size = uncompressed_length > 0 ? uncompressed_length : 1;
+    uint8_t * const table_out = malloc(size);
+    CHECK_ERRNO(NULL == table_out, "malloc");
+
+    /* the tree walker trusts its input, so only give it what the table
+       decoder takes */
+    status = lzh8_decompress(inbuf, file_length, table_out, size);
+    CHECK_ERROR(LZH8_OK != status, lzh8_status_string(status));
+
+    struct LZH8_header h;
+    read_LZH8_header(inbuf, file_length, &h);
+
+    uint8_t * const chunk_out = malloc(size);
+    CHECK_ERRNO(NULL == chunk_out, "malloc");
+    uint8_t * const tree_out = malloc(size);
+    CHECK_ERRNO(NULL == tree_out, "malloc");
+
+    struct lzh8_ring ring = {NULL, LZH8_RING_MIN, 0, 0};
+    ring.data = malloc(ring.size);
+    CHECK_ERRNO(NULL == ring.data, "malloc");
+
+    clock_t start = clock();
+    for (int i = 0; i < BENCH_ROUNDS; i++)
+    {
+        decode_LZH8_tree(&h, inbuf, file_length, tree_out);
+    }
+    const double tree_seconds = seconds(start);
+
+    start = clock();
+    for (int i = 0; i < BENCH_ROUNDS; i++)
+    {
+        status = lzh8_decompress(inbuf, file_length, table_out, size);
+        CHECK_ERROR(LZH8_OK != status, lzh8_status_string(status));
+    }
+    const double table_seconds = seconds(start);
+
+    start = clock();
+    for (int i = 0; i < BENCH_ROUNDS; i++)
+    {
+        decode_LZH8_chunks(inbuf, file_length, chunk_out, &ring);
+    }
+    const double chunk_seconds = seconds(start);
+
+    CHECK_ERROR(memcmp(table_out, tree_out, h.uncompressed_length) != 0,
+            "decoders disagree");
+    CHECK_ERROR(memcmp(chunk_out, tree_out, h.uncompressed_length) != 0,
+            "incremental decoder disagrees");
+
+    const double mb = (double)h.uncompressed_length * BENCH_ROUNDS / 1e6;
+    printf("%lu bytes, %d rounds\n", h.uncompressed_length, BENCH_ROUNDS);
+    print_rate("tree walk:", tree_seconds, mb);
+    print_rate("tables:", table_seconds, mb);
+    print_rate("chunked:", chunk_seconds, mb);
+
+    free(ring.data);
+    free(table_out);
+    free(chunk_out);
+    free(tree_out);
+    free_LZH8_header(&h);
 }
@@ -0,0 +1,861 @@
+/*
+   LZH8 decompression, in memory
+
+   An implementation of LZSS, with symbols stored via two Huffman codes:
+   - one for backreference lengths and literal bytes (8 bits each)
+   - one for backreference displacement lengths (bits - 1)
+
+   Layout of the compression:
+
+   0x00:        0x40 (LZH8 identifier)
+   0x01-0x03:   uncompressed size (little endian)
+   0x04-0x07:   optional 32-bit size if 0x01-0x03 is 0
+   followed by:
+
+   9-bit prefix coding tree table (for literal bytes and backreference lengths)
+   0x00-0x01:   Tree table size in 32-bit words, -1
+   0x02-:       Bit packed 9-bit inner nodes and leaves, stored as in Huff8
+   Total size:  2 ^ (leaf count + 1)
+
+   5-bit prefix coding tree table (for backreference displacement lengths)
+   0x00:        Tree table size in 32-bit words, -1
+   0x01-:       Bit packed 5-bit inner nodes and leaves, stored as in Huff8
+   Total size:  2 ^ (leaf count + 1)
+
+   Followed by compressed data bitstream:
+   1) Get a symbol from the 9-bit tree, if < 0x100 is a literal byte, repeat 1.
+   2) If 1 wasn't a literal byte, symbol - 0x100 + 3 is the backreference length
+   3) Get a symbol from the 5-bit tree, this is the length of the backreference
+      displacement.
+   3a) If displacement length is zero, displacement is zero
+   3b) If displacement length is one, displacement is one
+   3c) If displacement length is > 1, displacement is next displen-1 bits,
+       with an extra 1 on the front (normalized).
+
+   The trees are turned into lookup tables before decoding: a primary table
+   indexed by the next few bits of the stream, with subtables for the codes
+   too long for it.
+
+   The decoder is a state machine over whatever input it has been given, so
+   it can stop when that runs out or the output is full and carry on from
+   there next time. It only decodes a symbol when it has enough input for
+   the longest one the trees allow, or there's no more to come.
+
+   Reverse engineered by hcs.
+   This software is released to the public domain as of November 2, 2009.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "error_stuff.h"
+#include "lzh8.h"
+
+enum {LENBITS = 9};
+enum {DISPBITS = 5};
+enum {LENCNT = (1 << LENBITS)};
+enum {DISPCNT = (1 << DISPBITS)};
+
+/* lookup table sizes, in bits of the stream looked at */
+enum {LEN_TABLE_BITS = 10};
+enum {DISPLEN_TABLE_BITS = 8};
+enum {SUB_TABLE_BITS = 6};
+
+/* caller's input held on to between lzh8_decode calls */
+enum {PENDING_SIZE = 0x10000};
+
+/* table decoding */
+
+/* a flattened tree: each node holds the offset to its pair of children,
+   and a flag for each child saying whether it's a leaf */
+struct flat_tree
+{
+    const uint16_t *node;
+    long count;
+    unsigned int payload_mask;
+    unsigned int leaf_flags;    /* for the 0 child, the 1 child's is >> 1 */
+
+    int *depth;     /* the longest code below each node */
+    long *sub;      /* the subtable for each node, -1 if not built yet */
+};
+
+enum entry_kind {ENTRY_BAD, ENTRY_LEAF, ENTRY_LINK};
+
+/* a leaf: the symbol, and the length of its code (within this table)
+   a link: where the subtable starts, and how many bits index it */
+struct decode_entry
+{
+    uint32_t value;
+    uint8_t bits;
+    uint8_t kind;
+};
+
+struct decode_table
+{
+    struct decode_entry *entry;
+    long count;
+    long capacity;
+    int bits;       /* of the primary table, at entry 0 */
+};
+
+/* the child of node, or -1 if it's outside the tree */
+static long tree_child(const struct flat_tree *t, long node, int child,
+        int *is_leaf)
+{
+    const unsigned int v = t->node[node];
+    const long offset =
+        (node / 2 * 2) + ((v & t->payload_mask) + 1) * 2 + child;
+
+    *is_leaf = (v & (t->leaf_flags >> child)) != 0;
+
+    return (offset < t->count) ? offset : -1;
+}
+
+/* children always come after their parent, so working back from the end
+   each node's children are done before it */
+static void tree_depths(struct flat_tree *t)
+{
+    for (long node = t->count - 1; node >= 1; node--)
+    {
+        int depth = 0;
+
+        for (int child = 0; child < 2; child++)
+        {
+            int is_leaf;
+            long offset = tree_child(t, node, child, &is_leaf);
+            int d = 1;
+
+            if (offset >= 0 && !is_leaf)
+            {
+                d += t->depth[offset];
+            }
+
+            if (d > depth) depth = d;
+        }
+
+        t->depth[node] = depth;
+    }
+}
+
+static long build_table(struct decode_table *dt, struct flat_tree *t,
+        long node, int bits);
+
+/* fill the part of the table at base for codes starting with code (depth
+   bits long, leading to node) */
+static void fill_table(struct decode_table *dt, struct flat_tree *t,
+        long node, long base, int bits, int depth, unsigned long code)
+{
+    for (int child = 0; child < 2; child++)
+    {
+        int is_leaf;
+        const long offset = tree_child(t, node, child, &is_leaf);
+        const unsigned long child_code = code << 1 | child;
+        const int child_depth = depth + 1;
+
+        if (offset < 0)
+        {
+            /* left as ENTRY_BAD, only an error if it's ever decoded */
+            continue;
+        }
+
+        if (is_leaf)
+        {
+            const long first = base + (child_code << (bits - child_depth));
+            const long span = 1L << (bits - child_depth);
+
+            for (long i = 0; i < span; i++)
+            {
+                dt->entry[first + i].value = t->node[offset];
+                dt->entry[first + i].bits = child_depth;
+                dt->entry[first + i].kind = ENTRY_LEAF;
+            }
+        }
+        else if (child_depth == bits)
+        {
+            int sub_bits = t->depth[offset];
+            if (sub_bits > SUB_TABLE_BITS) sub_bits = SUB_TABLE_BITS;
+
+            /* nodes can be shared, they only need one subtable (building
+               it may move dt->entry) */
+            if (t->sub[offset] < 0)
+            {
+                t->sub[offset] = build_table(dt, t, offset, sub_bits);
+            }
+
+            dt->entry[base + child_code].value = t->sub[offset];
+            dt->entry[base + child_code].bits = sub_bits;
+            dt->entry[base + child_code].kind = ENTRY_LINK;
+        }
+        else
+        {
+            fill_table(dt, t, offset, base, bits, child_depth, child_code);
+        }
+    }
+}
+
+/* add a table for the codes below node, returns where it starts */
+static long build_table(struct decode_table *dt, struct flat_tree *t,
+        long node, int bits)
+{
+    const long base = dt->count;
+    const long size = 1L << bits;
+
+    if (dt->count + size > dt->capacity)
+    {
+        while (dt->count + size > dt->capacity)
+        {
+            dt->capacity = dt->capacity ? dt->capacity * 2 : size;
+        }
+        dt->entry = realloc(dt->entry,
+                dt->capacity * sizeof(struct decode_entry));
+        CHECK_ERRNO(NULL == dt->entry, "realloc");
+    }
+
+    memset(&dt->entry[base], 0, size * sizeof(struct decode_entry));
+    dt->count += size;
+
+    fill_table(dt, t, node, base, bits, 0, 0);
+
+    return base;
+}
+
+/* returns the longest code */
+static int init_decode_table(struct decode_table *dt,
+        const uint16_t *node, long count, int node_bits, int bits)
+{
+    dt->entry = NULL;
+    dt->count = dt->capacity = 0;
+    dt->bits = bits;
+
+    if (count <= 1)
+    {
+        /* no tree, everything is bad */
+        dt->entry = calloc(1L << bits, sizeof(struct decode_entry));
+        CHECK_ERRNO(NULL == dt->entry, "calloc");
+        dt->count = 1L << bits;
+        return 0;
+    }
+
+    struct flat_tree t = {
+        .node = node,
+        .count = count,
+        .payload_mask = (1 << (node_bits - 2)) - 1,
+        .leaf_flags = 1 << (node_bits - 1),
+    };
+
+    t.depth = malloc(count * sizeof(int));
+    CHECK_ERRNO(NULL == t.depth, "malloc");
+    t.sub = malloc(count * sizeof(long));
+    CHECK_ERRNO(NULL == t.sub, "malloc");
+    for (long i = 0; i < count; i++)
+    {
+        t.sub[i] = -1;
+    }
+
+    tree_depths(&t);
+    build_table(dt, &t, 1, bits);
+
+    const int longest = t.depth[1];
+
+    free(t.depth);
+    free(t.sub);
+
+    return longest;
+}
+
+/* the decoder */
+
+enum decoder_state
+{
+    STATE_HEADER,
+    STATE_LENGTH_TREE,
+    STATE_DISPLEN_TREE,
+    STATE_DATA,
+    STATE_DONE,
+};
+
+struct lzh8_decoder
+{
+    enum decoder_state state;
+    enum lzh8_status error;     /* once there's been one, it sticks */
+
+    /* input being decoded: the caller's, or pending */
+    const uint8_t *src;
+    unsigned long src_pos;
+    unsigned long src_end;
+    bool last;                  /* nothing comes after src_end */
+    unsigned long skip;         /* of a tree table, still to pass over */
+    unsigned long padding;      /* zero bytes read past the end */
+
+    uint8_t *pending;
+    unsigned long pending_end;
+
+    /* from the header */
+    unsigned long uncompressed_length;
+    uint16_t length_tree[LENCNT * 2];
+    long length_tree_count;
+    uint16_t displen_tree[DISPCNT * 2];
+    long displen_tree_count;
+
+    struct decode_table length_table;
+    struct decode_table displen_table;
+    unsigned long margin;       /* input that covers any one symbol */
+
+    /* bit reservoir, MSB first */
+    uint64_t bit_buffer;
+    int bit_count;
+
+    /* output */
+    unsigned long bytes_decoded;
+    unsigned long copy_left;    /* of a backreference the output cut off */
+    unsigned long copy_distance;
+};
+
+static inline enum lzh8_status short_input(const struct lzh8_decoder *d)
+{
+    return d->last ? LZH8_ERROR_TRUNCATED : LZH8_NEED_INPUT;
+}
+
+static uint32_t read_32_le_mem(const uint8_t *p)
+{
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 |
+        (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+/* bit_count bits, MSB first, from bit_offset bits into p */
+static unsigned int read_bits_mem(const uint8_t *p, unsigned long bit_offset,
+        int bit_count)
+{
+    unsigned int v = 0;
+
+    for (int i = 0; i < bit_count; i++)
+    {
+        const unsigned long b = bit_offset + i;
+        v = v << 1 | ((p[b / 8] >> (7 - b % 8)) & 1);
+    }
+
+    return v;
+}
+
+static enum lzh8_status decode_header(struct lzh8_decoder *d)
+{
+    const uint8_t * const p = &d->src[d->src_pos];
+    const unsigned long avail = d->src_end - d->src_pos;
+
+    if (avail < 4) return short_input(d);
+
+    const uint32_t header = read_32_le_mem(p);
+    if ((header & 0xFF) != 0x40) return LZH8_ERROR_NOT_LZH8;
+
+    d->uncompressed_length = header >> 8;
+    if (0 == d->uncompressed_length)
+    {
+        if (avail < 8) return short_input(d);
+
+        d->uncompressed_length = read_32_le_mem(p + 4);
+        d->src_pos += 4;
+    }
+    d->src_pos += 4;
+
+    return LZH8_OK;
+}
+
+/* read a flattened tree of fewer than count nodes, bit_count bits each,
+   that takes up (first byte(s), size in words - 1) * 4 bytes; the nodes
+   can be read from a little past that, and start at 1 */
+static enum lzh8_status decode_tree(struct lzh8_decoder *d,
+        int size_bytes, int bit_count, long count,
+        uint16_t *node, long *node_count_p)
+{
+    const uint8_t * const p = &d->src[d->src_pos];
+    const unsigned long avail = d->src_end - d->src_pos;
+
+    if (avail < (unsigned long)size_bytes) return short_input(d);
+
+    unsigned long table_bytes = p[0];
+    if (2 == size_bytes)
+    {
+        table_bytes |= p[1] << 8;
+    }
+    table_bytes = (table_bytes + 1) * 4;
+
+    /* nodes are read while what's been read is within the table */
+    unsigned long bits = 0;
+    long i = 1;
+    while (size_bytes + (bits + 7) / 8 < table_bytes && i < count)
+    {
+        bits += bit_count;
+        i++;
+    }
+
+    if (avail < size_bytes + (bits + 7) / 8) return short_input(d);
+
+    node[0] = 0;
+    for (long j = 1; j < i; j++)
+    {
+        node[j] = read_bits_mem(p + size_bytes, (j - 1) * bit_count,
+                bit_count);
+    }
+    *node_count_p = i;
+
+    if (table_bytes > avail)
+    {
+        d->src_pos += avail;
+        d->skip = table_bytes - avail;
+    }
+    else
+    {
+        d->src_pos += table_bytes;
+    }
+
+    return LZH8_OK;
+}
+
+static void start_data(struct lzh8_decoder *d)
+{
+    const int length_depth = init_decode_table(&d->length_table,
+            d->length_tree, d->length_tree_count,
+            LENBITS, LEN_TABLE_BITS);
+    const int displen_depth = init_decode_table(&d->displen_table,
+            d->displen_tree, d->displen_tree_count,
+            DISPBITS, DISPLEN_TABLE_BITS);
+
+    /* the longest symbol is both codes and 30 displacement bits, and the
+       reservoir reads up to 8 bytes ahead */
+    d->margin = (length_depth + displen_depth + 30 + 7) / 8 + 8;
+}
+
+/* copy a backreference, in chunks that don't overlap: the repeating part
+   doubles each time, unless the end of the ring cuts a chunk short */
+static inline void copy_backreference(uint8_t *out, unsigned long mask,
+        unsigned long pos, unsigned long distance, unsigned long length)
+{
+    unsigned long src = pos - distance;
+
+    while (length > 0)
+    {
+        unsigned long chunk = pos - src;
+        if (chunk > length) chunk = length;
+
+        const unsigned long to = pos & mask;
+        const unsigned long from = src & mask;
+        if (chunk - 1 > mask - to) chunk = mask - to + 1;
+        if (chunk - 1 > mask - from) chunk = mask - from + 1;
+
+        memcpy(&out[to], &out[from], chunk);
+
+        /* keep pos - src a whole number of repeats */
+        if (chunk % distance != 0) src += chunk;
+
+        pos += chunk;
+        length -= chunk;
+    }
+}
+
+/* keeps at least 57 bits in the reservoir, zeroes past the end */
+#define REFILL() \
+    do { \
+        while (bit_count <= 56) \
+        { \
+            uint64_t next = 0; \
+            if (src_pos < src_end) \
+                next = src[src_pos++]; \
+            else \
+                padding ++; \
+            bit_buffer |= next << (56 - bit_count); \
+            bit_count += 8; \
+        } \
+    } while (0)
+
+#define DROP_BITS(n) \
+    do { bit_buffer <<= (n); bit_count -= (n); } while (0)
+
+/* look a symbol up, at most 57 bits (more links than that and it refills) */
+#define DECODE_SYMBOL(dt, symbol) \
+    do { \
+        const struct decode_entry *e_ = \
+            &(dt).entry[bit_buffer >> (64 - (dt).bits)]; \
+        while (ENTRY_LINK == e_->kind) \
+        { \
+            const int bits_ = e_->bits; \
+            const uint32_t base_ = e_->value; \
+            DROP_BITS(last_bits_); \
+            if (bit_count < 32) REFILL(); \
+            e_ = &(dt).entry[base_ + (bit_buffer >> (64 - bits_))]; \
+            last_bits_ = bits_; \
+        } \
+        if (ENTRY_LEAF != e_->kind) \
+        { \
+            status = LZH8_ERROR_BAD_CODE; \
+            goto stop; \
+        } \
+        DROP_BITS(e_->bits); \
+        (symbol) = e_->value; \
+    } while (0)
+
+/* decode symbols into out (indexes wrap with mask), adding no more than
+   room bytes */
+static enum lzh8_status decode_data(struct lzh8_decoder *d,
+        uint8_t *out, unsigned long mask, unsigned long room)
+{
+    const uint8_t * const src = d->src;
+    const unsigned long src_end = d->src_end;
+    const unsigned long margin = d->last ? 0 : d->margin;
+    const unsigned long uncompressed_length = d->uncompressed_length;
+    const struct decode_table length_table = d->length_table;
+    const struct decode_table displen_table = d->displen_table;
+
+    unsigned long src_pos = d->src_pos;
+    unsigned long padding = d->padding;
+    uint64_t bit_buffer = d->bit_buffer;
+    int bit_count = d->bit_count;
+    unsigned long bytes_decoded = d->bytes_decoded;
+
+    unsigned long limit = uncompressed_length - bytes_decoded;
+    if (limit > room) limit = room;
+    limit += bytes_decoded;
+
+    enum lzh8_status status = LZH8_OK;
+
+    /* the rest of a backreference from last time */
+    if (d->copy_left > 0)
+    {
+        unsigned long length = d->copy_left;
+        if (length > limit - bytes_decoded) length = limit - bytes_decoded;
+
+        copy_backreference(out, mask, bytes_decoded, d->copy_distance,
+                length);
+        bytes_decoded += length;
+        d->copy_left -= length;
+    }
+
+    while (0 == d->copy_left)
+    {
+        if (bytes_decoded == uncompressed_length)
+        {
+            d->state = STATE_DONE;
+            break;
+        }
+        if (bytes_decoded == limit)
+        {
+            status = LZH8_OUTPUT_FULL;
+            break;
+        }
+        if (src_end - src_pos < margin)
+        {
+            status = LZH8_NEED_INPUT;
+            break;
+        }
+
+        unsigned int symbol;
+        int last_bits_;
+
+        REFILL();
+
+        /* get next backreference length or literal byte */
+        last_bits_ = length_table.bits;
+        DECODE_SYMBOL(length_table, symbol);
+
+        if (0x100 > symbol)
+        {
+            /* literal byte */
+            if (padding * 8 > (unsigned long)bit_count)
+            {
+                status = LZH8_ERROR_TRUNCATED;
+                break;
+            }
+
+            out[bytes_decoded & mask] = symbol;
+            bytes_decoded++;
+            continue;
+        }
+
+        /* backreference */
+        unsigned long length = (symbol & 0xFF) + 3;
+        unsigned int displen;
+        uint16_t displacement = 0;
+
+        if (bit_count < 32) REFILL();
+
+        /* get backreference displacement length */
+        last_bits_ = displen_table.bits;
+        DECODE_SYMBOL(displen_table, displen);
+
+        if (displen != 0)
+        {
+            /* normalized, with the rest of the bits at once (there are at
+               most 30, refilled to be sure they're here) */
+            const int extra = displen - 1;
+            uint32_t v = 1;
+
+            if (extra > 0)
+            {
+                if (bit_count < 32) REFILL();
+                v = v << extra | (uint32_t)(bit_buffer >> (64 - extra));
+                DROP_BITS(extra);
+            }
+
+            /* as wide as the original decoder's */
+            displacement = v;
+        }
+
+        /* the original would have run off the end reading these */
+        if (padding * 8 > (unsigned long)bit_count)
+        {
+            status = LZH8_ERROR_TRUNCATED;
+            break;
+        }
+
+        const unsigned long distance = (unsigned long)displacement + 1;
+        if (distance > bytes_decoded)
+        {
+            status = LZH8_ERROR_BAD_BACKREFERENCE;
+            break;
+        }
+
+        if (length > uncompressed_length - bytes_decoded)
+        {
+            length = uncompressed_length - bytes_decoded;
+        }
+
+        /* as much as there's room for, the rest next time */
+        unsigned long now = length;
+        if (now > limit - bytes_decoded) now = limit - bytes_decoded;
+
+        copy_backreference(out, mask, bytes_decoded, distance, now);
+        bytes_decoded += now;
+
+        d->copy_left = length - now;
+        d->copy_distance = distance;
+    }
+
+    if (LZH8_OK == status && d->copy_left > 0)
+    {
+        status = LZH8_OUTPUT_FULL;
+    }
+
+stop:
+    d->src_pos = src_pos;
+    d->padding = padding;
+    d->bit_buffer = bit_buffer;
+    d->bit_count = bit_count;
+    d->bytes_decoded = bytes_decoded;
+
+    return status;
+}
+
+#undef DECODE_SYMBOL
+#undef DROP_BITS
+#undef REFILL
+
+/* as far as the input goes */
+static enum lzh8_status run_decoder(struct lzh8_decoder *d,
+        uint8_t *out, unsigned long mask, unsigned long room)
+{
+    enum lzh8_status status = LZH8_OK;
+
+    while (LZH8_OK == status)
+    {
+        if (d->skip > 0)
+        {
+            unsigned long n = d->src_end - d->src_pos;
+            if (n > d->skip) n = d->skip;
+            d->src_pos += n;
+            d->skip -= n;
+
+            if (d->skip > 0)
+            {
+                if (!d->last) return LZH8_NEED_INPUT;
+
+                /* a tree can't start past the end, but data can (only an
+                   error if it's decoded) */
+                if (STATE_DATA != d->state) return LZH8_ERROR_TRUNCATED;
+                d->padding += d->skip;
+                d->skip = 0;
+            }
+        }
+
+        switch (d->state)
+        {
+            case STATE_HEADER:
+                status = decode_header(d);
+                if (LZH8_OK == status) d->state = STATE_LENGTH_TREE;
+                break;
+            case STATE_LENGTH_TREE:
+                status = decode_tree(d, 2, LENBITS, LENCNT * 2,
+                        d->length_tree, &d->length_tree_count);
+                if (LZH8_OK == status) d->state = STATE_DISPLEN_TREE;
+                break;
+            case STATE_DISPLEN_TREE:
+                status = decode_tree(d, 1, DISPBITS, DISPCNT * 2,
+                        d->displen_tree, &d->displen_tree_count);
+                if (LZH8_OK == status)
+                {
+                    start_data(d);
+                    d->state = STATE_DATA;
+                }
+                break;
+            case STATE_DATA:
+                return decode_data(d, out, mask, room);
+            case STATE_DONE:
+                return LZH8_OK;
+        }
+    }
+
+    return status;
+}
+
+struct lzh8_decoder *lzh8_decoder_new(void)
+{
+    struct lzh8_decoder *d = calloc(1, sizeof(struct lzh8_decoder));
+    CHECK_ERRNO(NULL == d, "calloc");
+
+    d->state = STATE_HEADER;
+    d->error = LZH8_OK;
+
+    return d;
+}
+
+void lzh8_decoder_free(struct lzh8_decoder *d)
+{
+    if (!d) return;
+
+    free(d->length_table.entry);
+    free(d->displen_table.entry);
+    free(d->pending);
+    free(d);
+}
+
+bool lzh8_decoder_size(const struct lzh8_decoder *d, unsigned long *size_p)
+{
+    if (STATE_HEADER == d->state) return false;
+
+    *size_p = d->uncompressed_length;
+    return true;
+}
+
+enum lzh8_status lzh8_decode(struct lzh8_decoder *d,
+        const uint8_t *in, unsigned long in_size, unsigned long *in_used_p,
+        bool last, struct lzh8_ring *ring)
+{
+    *in_used_p = 0;
+
+    if (LZH8_OK != d->error) return d->error;
+    if (STATE_DONE == d->state) return LZH8_OK;
+
+    if (ring->size < LZH8_RING_MIN || 0 != (ring->size & (ring->size - 1)) ||
+            ring->write != d->bytes_decoded ||
+            ring->write - ring->read > ring->size)
+    {
+        return d->error = LZH8_ERROR_RING;
+    }
+
+    if (NULL == d->pending)
+    {
+        d->pending = malloc(PENDING_SIZE);
+        CHECK_ERRNO(NULL == d->pending, "malloc");
+    }
+
+    unsigned long used = 0;
+    enum lzh8_status status;
+
+    for (;;)
+    {
+        /* take as much as there's room for */
+        unsigned long n = in_size - used;
+        if (n > PENDING_SIZE - d->pending_end)
+        {
+            n = PENDING_SIZE - d->pending_end;
+        }
+        memcpy(&d->pending[d->pending_end], &in[used], n);
+        d->pending_end += n;
+        used += n;
+
+        d->src = d->pending;
+        d->src_end = d->pending_end;
+        d->last = last && used == in_size;
+
+        status = run_decoder(d, ring->data, ring->size - 1,
+                ring->size - (ring->write - ring->read));
+        ring->write = d->bytes_decoded;
+
+        /* keep what's left for next time */
+        memmove(d->pending, &d->pending[d->src_pos],
+                d->pending_end - d->src_pos);
+        d->pending_end -= d->src_pos;
+        d->src_pos = 0;
+
+        if (LZH8_NEED_INPUT != status || used == in_size) break;
+    }
+
+    *in_used_p = used;
+
+    if (status > LZH8_OUTPUT_FULL)
+    {
+        d->error = status;
+    }
+
+    return status;
+}
+
+enum lzh8_status lzh8_decompressed_size(const uint8_t *in, long in_size,
+        unsigned long *size_p)
+{
+    struct lzh8_decoder d = {
+        .src = in,
+        .src_end = in_size > 0 ? in_size : 0,
+        .last = true,
+    };
+
+    const enum lzh8_status status = decode_header(&d);
+    if (LZH8_OK == status)
+    {
+        *size_p = d.uncompressed_length;
+    }
+
+    return status;
+}
+
+enum lzh8_status lzh8_decompress(const uint8_t *in, long in_size,
+        uint8_t *out, unsigned long out_size)
+{
+    unsigned long size;
+    enum lzh8_status status = lzh8_decompressed_size(in, in_size, &size);
+
+    if (LZH8_OK != status) return status;
+    if (out_size < size) return LZH8_ERROR_OUTPUT_SIZE;
+
+    /* straight from the caller's input, the output never wraps */
+    struct lzh8_decoder * const d = lzh8_decoder_new();
+    d->src = in;
+    d->src_end = in_size;
+    d->last = true;
+
+    status = run_decoder(d, out, ULONG_MAX, ULONG_MAX);
+
+    lzh8_decoder_free(d);
+
+    return status;
+}
+
+const char *lzh8_status_string(enum lzh8_status status)
+{
+    switch (status)
+    {
+        case LZH8_OK:                       return "ok";
+        case LZH8_NEED_INPUT:               return "needs more input";
+        case LZH8_OUTPUT_FULL:              return "output full";
+        case LZH8_ERROR_NOT_LZH8:           return "not LZH8";
+        case LZH8_ERROR_TRUNCATED:          return "unexpected end of input";
+        case LZH8_ERROR_BAD_CODE:           return "bad code";
+        case LZH8_ERROR_BAD_BACKREFERENCE:
+            return "backreference before start of output";
+        case LZH8_ERROR_OUTPUT_SIZE:        return "output buffer too small";
+        case LZH8_ERROR_RING:               return "bad output ring";
+        case LZH8_ERROR_TOO_LARGE:          return "input is too large";
+        case LZH8_ERROR_OPTIONS:            return "bad options";
+    }
+
+    return "unknown status";
+}
@@ -0,0 +1,1868 @@
+/* 
+   LZH8 compressor, in memory
+
+   An implementation of LZSS, with symbols stored via two Huffman codes:
+   - one for backreference lengths and literal bytes (8 bits each)
+   - one for backreference displacement lengths (bits - 1)
+
+   Note that the goal here is to reproduce exactly the compression used in
+   Nintendo Virtual Console games. I've tried to point out with "POLICY:"
+   comments places where I have determined particular behavioral oddities of
+   Nintendo's implementation.
+
+   The hashing method used to speed up LZSS was suggested by
+   Michael Dipperstein, on his LZSS discussion site:
+      http://michael.dipperstein.com/lzss/
+   I have used exactly the hash function he recommends, referenced from:
+      K. Sadakane and H. Imai
+      Improving the Speed of LZ77 Compression by Hashing and Suffix Sorting,
+      IEICE Trans. Fundamentals, Vol. E83-A, No. 12, pp. 2689--2798, 2000.
+
+   The method for flattening the Huffman tree is based on Nintendo's
+   Huffman compressor for 8 and 4 bit (with 8 bit tables), by Makoto Takano.
+   It is implemented a little differently in LZH8, however.
+  
+   All else by hcs.
+   This software is released to the public domain as of November 2, 2009.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "error_stuff.h"
+#include "lzh8.h"
+
+/* debug output options */
+#define SHOW_SYMBOLS        0
+#define SHOW_FREQUENCIES    0
+#define SHOW_TREE_BITS      0
+#define SHOW_TREE           0
+#define SHOW_TABLE          0
+#define EXPLAIN_TABLE       0
+
+/* dump of lzss stage output */
+#define MAKE_DUMP           0
+#define READ_DUMP           0
+
+/* Use hashes to generate LZSS faster */
+#define LZSS_HASH           1
+
+/* Constants */
+
+enum {LENBITS = 9};
+enum {DISPBITS = 5};
+enum {LENCNT = ( 1 << LENBITS )};
+enum {DISPCNT = ( 1 << DISPBITS )};
+
+/* Structures */
+
+struct lzss_symbol
+{
+    /* flag, 0 = literal, 1 = reference */
+    uint8_t  is_reference;
+    /* length of backreference -3, or literal byte */
+    uint8_t length_or_literal;
+    /* displacement of reference -1, unused if literal */
+    uint16_t offset;
+};
+
+struct huff_node
+{
+    /* Indexes of children.
+       -1 if no children, either both or neither should be -1 */
+    int lchild, rchild;
+
+    /* stored value for the code leading to this node, if a leaf (lchild=-1,
+       rchild=-1), otherwise unused */
+    uint16_t leaf;
+
+    /* Number of nodes under this, thus table entries required to
+       store the entire subtree. Importantly, this includes the cost of
+       the root. 0 for leaves, as they do not get stored independently. */
+    uint16_t subtree_size;
+};
+
+struct huff_table_ctrl
+{
+    /* index of associated huff_node */
+    int node_idx;
+    /* flag to show if what I point to has been placed */
+    bool placed : 1;
+};
+
+/* the compressed output, grown as it's written */
+struct output_buffer
+{
+    uint8_t *data;
+    long length;
+    long capacity;
+};
+
+struct huff_symbol
+{
+    /* length of prefix key */
+    uint16_t key_len;
+    /* bits of the key, MSBit->LSBit order, aligned to the LSBit end */
+    uint32_t key_bits;
+};
+
+/* Prototypes */
+
+int LZH8_displen_length(uint16_t displacement);
+
+/* LZSS prototypes */
+
+void LZH8_LZSS_compress(
+        const unsigned char *input_data,
+        long input_length,
+        struct lzss_symbol **lzss_stream_p,
+        long *lzss_length_p,
+        const struct lzh8_options *options);
+
+/* Huffman prototypes */
+
+void LZH8_Huff_produce_encodings(
+        struct lzss_symbol * const lzss_stream,
+        long lzss_length,
+        struct huff_symbol *back_litlen_table,
+        struct huff_symbol *back_displen_table,
+        struct output_buffer *out);
+
+int LZH8_Huff_build_Huffman_tree(
+    int *node_remains,
+    long *freq,
+    struct huff_node *node_array,
+    int symbol_count);
+
+void LZH8_Huff_compute_prefix(
+        const struct huff_node *node_array,
+        int root_idx,
+        struct huff_symbol *sym_array,
+        uint32_t key_bits,
+        int key_len);
+
+int LZH8_Huff_flatten_tree(
+    const struct huff_node *node_array,
+    uint16_t *tree_table,
+    int root_idx,
+    const int offset_bits);
+
+void LZH8_Huff_flatten_single_node(
+    const struct huff_node *node_array,
+    struct huff_table_ctrl *ctrl,
+    uint16_t *tree_table,
+    const int offset_bits,
+    unsigned int parent_idx,
+    unsigned int *table_idx_p,
+    unsigned int *outstanding_nodes_p);
+
+bool LZH8_Huff_could_satisfy_outstanding_nodes(
+    const struct huff_table_ctrl *ctrl,
+    int table_idx,
+    uint16_t proposed_size,
+    int proposed_idx,
+    const int offset_bits);
+
+/* Bitstream writing, 4 byte blocks */
+
+/* room for bytes more at the end */
+static void output_reserve(struct output_buffer *out, long bytes)
+{
+    if (out->length + bytes > out->capacity)
+    {
+        while (out->length + bytes > out->capacity)
+        {
+            out->capacity = out->capacity ? out->capacity * 2 : 0x1000;
+        }
+        out->data = realloc(out->data, out->capacity);
+        CHECK_ERRNO( NULL == out->data, "realloc" );
+    }
+}
+
+static void output_32_le(struct output_buffer *out, uint32_t value)
+{
+    output_reserve(out, 4);
+    for (int i=0; i < 4; i++)
+    {
+        out->data[out->length++] = value >> (i * 8);
+    }
+}
+
+/* empty bit pool into out (if it wasn't empty already) */
+static inline void flush_bits(
+        struct output_buffer * const out,
+        uint32_t * const bit_pool_p,
+        int * const bits_written_p)
+{
+    if (0 != *bits_written_p)
+    {
+        output_reserve(out, 4);
+        for (int i=3; i >= 0; i--)
+        {
+            out->data[out->length++] = *bit_pool_p >> (i * 8);
+        }
+        *bits_written_p = 0;
+        *bit_pool_p = 0;
+    }
+}
+
+/* write MSB->LSB order, 4 bytes at a time */
+static inline void write_bits(
+        struct output_buffer * const out,
+        uint32_t * const bit_pool_p,
+        int * const bits_written_p,
+        const uint32_t bits_to_write,
+        const int bit_count)
+{
+    int num_bits_produced = 0;
+    CHECK_ERROR( bit_count > 32, "too many bits" );
+#if SHOW_TREE_BITS
+        printf("write ");
+        for (int i=bit_count-1; i>=0; i--)
+        {
+            printf("%c", (bits_to_write&(1<<i)) ? '1' : '0');
+        }
+        printf("\n");
+#endif
+    while (num_bits_produced < bit_count)
+    {
+        if (32 == *bits_written_p)
+        {
+            flush_bits(out, bit_pool_p, bits_written_p);
+        }
+
+        int bits_this_round;
+        if (*bits_written_p + (bit_count - num_bits_produced) <= 32)
+            bits_this_round = bit_count - num_bits_produced;
+        else
+            bits_this_round = 32 - *bits_written_p;
+
+        uint32_t selected_bits = 
+            bits_to_write >> (bit_count - bits_this_round - num_bits_produced);
+        selected_bits &= ((1 << bits_this_round) - 1);
+        *bit_pool_p |= selected_bits << (32 - bits_this_round - *bits_written_p);
+
+        *bits_written_p += bits_this_round;
+        num_bits_produced += bits_this_round;
+    }
+}
+
+#define WRITE_BITS(bits_to_write, bit_count) \
+    write_bits(out, &bit_pool, &bits_written, bits_to_write, bit_count)
+
+/* Main LZH8 compression function */
+
+void lzh8_default_options(struct lzh8_options *options)
+{
+    options->strict = true;
+    options->optimal = false;
+    options->threads = 1;
+    options->progress = false;
+}
+
+enum lzh8_status lzh8_compress(const uint8_t *in, long in_size,
+        uint8_t **out_p, long *out_size_p,
+        const struct lzh8_options *options)
+{
+    struct lzh8_options defaults;
+    if (NULL == options)
+    {
+        lzh8_default_options(&defaults);
+        options = &defaults;
+    }
+
+    if (options->optimal && options->strict) return LZH8_ERROR_OPTIONS;
+    if (options->threads < 1) return LZH8_ERROR_OPTIONS;
+    if ((unsigned long)in_size > UINT32_MAX) return LZH8_ERROR_TOO_LARGE;
+
+    struct output_buffer output = {NULL, 0, 0};
+    struct output_buffer * const out = &output;
+
+    /*
+       Step 0: Output header
+    */
+    {
+        if (UINT32_C(0x1000000) > in_size && 0 != in_size)
+        {
+            output_32_le(out, (((uint32_t)in_size) << 8) | 0x40);
+        }
+        else
+        {
+            /* >= 0x1000000 needs 4 extra bytes */
+            output_32_le(out, 0x40);
+            output_32_le(out, in_size);
+        }
+    }
+
+    /*
+       Step 1: LZSS with:
+        reference length 3 <= length <= 2^8 - 1 + 3
+        2^15 byte window
+       Produce a series of symbols, literal byte and backreference length+offset
+    */
+    struct lzss_symbol *lzss_stream = NULL;
+    long lzss_length = 0;    /* length in symbols */
+
+#if !READ_DUMP
+    {
+        LZH8_LZSS_compress(in, in_size, &lzss_stream, &lzss_length, options);
+
+#if MAKE_DUMP
+        // temp, dump LZSS stuff to file
+        {
+            FILE *lzss_dump = fopen("lzss.dump", "wb");
+            CHECK_ERRNO(NULL == lzss_dump, "fopen");
+
+            CHECK_FILE(lzss_length != fwrite(lzss_stream,
+                    sizeof(struct lzss_symbol), lzss_length, lzss_dump),
+                    lzss_dump, "fwrite");
+
+            CHECK_ERRNO(EOF == fclose(lzss_dump), "fclose");
+        }
+#endif
+    }
+#else
+    // temp, read LZSS stuff from file
+    {
+        FILE *lzss_dump = fopen("lzss.dump", "rb");
+        CHECK_ERRNO(NULL == lzss_dump, "fopen");
+
+        /* get dump size */
+        CHECK_ERRNO(fseek(lzss_dump, 0 , SEEK_END) != 0, "fseek");
+        long lzss_dump_length = ftell(lzss_dump);
+        CHECK_ERRNO(lzss_dump_length == -1, "ftell");
+        rewind(lzss_dump);
+
+        lzss_stream = malloc(lzss_dump_length);
+        CHECK_ERRNO(NULL == lzss_stream, "malloc");
+
+        lzss_length = lzss_dump_length / sizeof(struct lzss_symbol);
+
+        CHECK_FILE(lzss_length != fread(lzss_stream,
+                sizeof(struct lzss_symbol), lzss_length, lzss_dump),
+                lzss_dump, "fread");
+
+        CHECK_ERRNO(EOF == fclose(lzss_dump), "fclose");
+    }
+#endif
+
+    /*
+       Step 2: Count frequencies and build Huffman codes, output flat trees
+    */
+    struct huff_symbol back_litlen_table[LENCNT];
+    struct huff_symbol back_displen_table[DISPCNT];
+    {
+        LZH8_Huff_produce_encodings(lzss_stream, lzss_length, back_litlen_table,
+                back_displen_table, out);
+    }
+
+    /*
+       Step 3: Output the encoded symbol stream
+    */
+    {
+        uint32_t bit_pool = 0;
+        int bits_written = 0;
+
+#if SHOW_SYMBOLS
+        long data_offset = 0;
+#endif
+        for (long i=0; i < lzss_length; i++)
+        {
+            struct huff_symbol litlen_symbol =
+                back_litlen_table[
+                    (lzss_stream[i].is_reference << 8) |
+                     lzss_stream[i].length_or_literal ];
+#if SHOW_SYMBOLS
+            printf("%08lx symbol %ld: ", (unsigned long)data_offset, i);
+#endif
+            WRITE_BITS(litlen_symbol.key_bits, litlen_symbol.key_len);
+
+            if (lzss_stream[i].is_reference)
+            {
+                uint16_t offset = lzss_stream[i].offset;
+                int displen_length = LZH8_displen_length(offset);
+
+                struct huff_symbol displen_symbol =
+                    back_displen_table[displen_length];
+                WRITE_BITS(displen_symbol.key_bits, displen_symbol.key_len);
+
+                if (offset > 1)
+                {
+                    WRITE_BITS(offset,displen_length-1);
+                }
+#if SHOW_SYMBOLS
+                printf("%d bytes, offset %d\n",
+                    (int)lzss_stream[i].length_or_literal + 3,
+                    (int)lzss_stream[i].offset+1);
+                data_offset += lzss_stream[i].length_or_literal + 3;
+#endif
+            }
+#if SHOW_SYMBOLS
+            else
+            {
+                printf("literal %02"PRIX8"\n",lzss_stream[i].length_or_literal);
+                data_offset ++;
+            }
+#endif
+        }
+
+        flush_bits(out, &bit_pool, &bits_written);
+    }
+
+    free(lzss_stream);
+
+    *out_p = output.data;
+    *out_size_p = output.length;
+
+    return LZH8_OK;
+}
+
+#if LZSS_HASH
+
+/* LZSS with hash chains
+
+   POLICY: at each position the match taken is the longest in the window,
+   the most recent of those, so it depends only on the position. That lets
+   the input be split into shards that are parsed on their own threads,
+   each starting with the window before it. Where the parse running into
+   a shard doesn't land on one of the shard's symbols it's continued one
+   symbol at a time until it does, then the rest of the shard's symbols
+   are the same. */
+
+/* POLICY: parameters for this coding */
+enum {MIN_MATCH = 3};
+enum {MAX_MATCH = (1 << 8) - 1 + 3};
+enum {STRICT_WINDOW = (1 << 15)};
+enum {MAX_WINDOW = (1 << 16)};
+
+enum {MATCH_HASH_BITS = 16};
+enum {PREV_SIZE = (1 << 16)};
+
+/* smallest shard worth a thread of its own */
+enum {MIN_SHARD = 0x100000};
+
+/* how far down a chain the optimal parse looks, it looks at every byte */
+enum {OPTIMAL_MAX_CHAIN = 256};
+
+/* a match this long is taken without looking at what starts inside it */
+enum {OPTIMAL_NICE_LENGTH = 128};
+
+/* rounds of optimal parsing, each with costs from the one before */
+enum {OPTIMAL_ROUNDS = 2};
+
+struct match_finder
+{
+    const unsigned char *data;
+    long length;
+    long max_chain;     /* candidates looked at per position, 0 for all */
+    bool strict;
+    long window;
+
+    long *head;         /* latest position with each hash, -1 for none */
+    uint16_t *prev;     /* by position mod PREV_SIZE: distance back to the
+                           one before with the same hash, 0 for none */
+    long next;          /* next position to add */
+};
+
+static void init_match_finder(struct match_finder *mf,
+        const unsigned char *data, long length, long max_chain, bool strict)
+{
+    mf->data = data;
+    mf->length = length;
+    mf->max_chain = max_chain;
+    mf->strict = strict;
+    mf->window = strict ? STRICT_WINDOW : MAX_WINDOW;
+    mf->next = 0;
+
+    mf->head = malloc((1 << MATCH_HASH_BITS) * sizeof(long));
+    CHECK_ERRNO( NULL == mf->head, "malloc" );
+    for (long i=0; i < (1 << MATCH_HASH_BITS); i++)
+    {
+        mf->head[i] = -1;
+    }
+
+    mf->prev = malloc(PREV_SIZE * sizeof(uint16_t));
+    CHECK_ERRNO( NULL == mf->prev, "malloc" );
+}
+
+static void free_match_finder(struct match_finder *mf)
+{
+    free(mf->head);
+    free(mf->prev);
+}
+
+static inline unsigned int match_hash(const unsigned char *p)
+{
+    const uint32_t key = (uint32_t)p[0] << 16 | (uint32_t)p[1] << 8 | p[2];
+    return (uint32_t)(key * UINT32_C(2654435761)) >> (32 - MATCH_HASH_BITS);
+}
+
+/* add every position before pos that's in the window; positions that
+   were skipped over are out of reach anyway */
+static void match_catch_up(struct match_finder *mf, long pos)
+{
+    long last = pos;
+    if (last > mf->length - MIN_MATCH + 1)
+    {
+        last = mf->length - MIN_MATCH + 1;
+    }
+    if (mf->next < pos - mf->window)
+    {
+        mf->next = pos - mf->window;
+    }
+
+    for (; mf->next < last; mf->next++)
+    {
+        const long q = mf->next;
+        const unsigned int h = match_hash(&mf->data[q]);
+        const long back = q - mf->head[h];
+
+        mf->prev[q % PREV_SIZE] =
+            (-1 != mf->head[h] && back < PREV_SIZE) ? back : 0;
+        mf->head[h] = q;
+    }
+}
+
+/* the longest match for pos, most recent first; each time a longer one is
+   found, report it via lengths/offsets (if not NULL) as the offset for
+   all lengths up to it, returns the longest length (< MIN_MATCH for none)
+   and sets *offset_p to its start */
+static int match_find(struct match_finder *mf, long pos, long *offset_p,
+        uint16_t *offsets)
+{
+    const unsigned char * const data = mf->data;
+    long limit = mf->length - pos;
+    if (limit > MAX_MATCH) limit = MAX_MATCH;
+
+    int best = MIN_MATCH - 1;
+    if (limit < MIN_MATCH) return 0;
+
+    match_catch_up(mf, pos);
+
+    const unsigned char * const input = &data[pos];
+    long q = mf->head[match_hash(input)];
+    long chain = 0;
+
+    while (q >= 0 && pos - q <= mf->window)
+    {
+        /* POLICY: not -1 when strict; and it can only be longer if it
+           matches where best ends */
+        if ( (q != pos - 1 || !mf->strict) && data[q + best] == input[best])
+        {
+            long match_length = 0;
+            while (match_length < limit &&
+                    data[q + match_length] == input[match_length])
+            {
+                match_length++;
+            }
+
+            if (match_length > best)
+            {
+                if (offsets)
+                {
+                    for (long l = best + 1; l <= match_length; l++)
+                    {
+                        offsets[l] = pos - q - 1;
+                    }
+                }
+
+                best = match_length;
+                *offset_p = q;
+
+                if (best == limit) break;
+            }
+        }
+
+        if (mf->max_chain && ++chain >= mf->max_chain) break;
+
+        const uint16_t back = mf->prev[q % PREV_SIZE];
+        if (0 == back) break;
+        q -= back;
+    }
+
+    return best;
+}
+
+/* the output stream */
+struct lzss_output
+{
+    struct lzss_symbol *stream;
+    long length;
+    long capacity;
+};
+
+static void lzss_append(struct lzss_output *out, struct lzss_symbol symbol)
+{
+    /* check that there's room for a new symbol */
+    if (out->length >= out->capacity)
+    {
+        if (0 == out->capacity)
+            out->capacity = 0x800;
+        else
+            out->capacity *= 2;
+        out->stream = realloc(out->stream,
+                out->capacity*sizeof(struct lzss_symbol));
+        CHECK_ERRNO( NULL == out->stream, "realloc" );
+    }
+
+    out->stream[out->length++] = symbol;
+}
+
+static inline long lzss_symbol_size(const struct lzss_symbol *symbol)
+{
+    return symbol->is_reference ? symbol->length_or_literal + 3 : 1;
+}
+
+/* the symbol for pos, returns the bytes it covers */
+static long LZSS_greedy_symbol(struct match_finder *mf, long pos,
+        struct lzss_output *out)
+{
+    long longest_match_offset = 0;
+    const int longest_match = match_find(mf, pos, &longest_match_offset, NULL);
+    struct lzss_symbol symbol;
+
+    /* record the new symbol */
+    if (longest_match < MIN_MATCH)
+    {
+        /* no backreference possible */
+        symbol.is_reference = 0;
+        symbol.length_or_literal = mf->data[pos];
+        symbol.offset = 0;
+        lzss_append(out, symbol);
+        return 1;
+    }
+    else
+    {
+        /* generate a backreference */
+        symbol.is_reference = 1;
+        symbol.length_or_literal = longest_match - 3;
+        symbol.offset = pos - longest_match_offset - 1;
+        lzss_append(out, symbol);
+        return longest_match;
+    }
+}
+
+/* shared by the shards' threads */
+struct lzss_progress
+{
+    pthread_mutex_t lock;
+    long done;
+    long total;
+    long last_report;
+};
+
+static void report_progress(struct lzss_progress *progress, long bytes)
+{
+    if (NULL == progress) return;
+
+    pthread_mutex_lock(&progress->lock);
+    progress->done += bytes;
+    if (progress->done - progress->last_report >= 0x40000l)
+    {
+        fprintf(stderr,"%ld bytes done (%.0f%%)\n", progress->done,
+                (float)progress->done/progress->total*100);
+        progress->last_report = progress->done;
+    }
+    pthread_mutex_unlock(&progress->lock);
+}
+
+/* one piece of the input, and how it parsed */
+struct lzss_shard
+{
+    const unsigned char *data;
+    long length;
+    long start, end;
+    bool strict;
+    bool optimal;
+    struct lzss_progress *progress;     /* NULL for none */
+    const uint8_t *litlen_cost;     /* for optimal */
+    const uint8_t *displen_cost;
+
+    struct lzss_output out;
+    long stop;      /* where the last symbol ends, >= end */
+};
+
+/* code length of each symbol, if a Huffman code were built for the
+   symbols in out */
+static void LZSS_costs(const struct lzss_output *out,
+        uint8_t *litlen_cost, uint8_t *displen_cost);
+
+static long LZSS_cost_bits(const struct lzss_output *out);
+
+static void LZSS_optimal_shard(struct lzss_shard *sh);
+
+static void *LZSS_shard_worker(void *v)
+{
+    struct lzss_shard *sh = v;
+
+    if (sh->optimal)
+    {
+        LZSS_optimal_shard(sh);
+        return NULL;
+    }
+
+    struct match_finder mf;
+    init_match_finder(&mf, sh->data, sh->length, 0, sh->strict);
+
+    long pos = sh->start;
+    long last_report = pos;
+    while (pos < sh->end)
+    {
+        pos += LZSS_greedy_symbol(&mf, pos, &sh->out);
+
+        if (pos - last_report >= 0x10000l)
+        {
+            report_progress(sh->progress, pos - last_report);
+            last_report = pos;
+        }
+    }
+    report_progress(sh->progress, sh->end - last_report);
+
+    sh->stop = pos;
+
+    free_match_finder(&mf);
+
+    return NULL;
+}
+
+/* parse every shard, on as many threads as there are shards */
+static void LZSS_run_shards(struct lzss_shard *shards, int shard_count)
+{
+    if (1 == shard_count)
+    {
+        LZSS_shard_worker(&shards[0]);
+        return;
+    }
+
+    pthread_t *threads = malloc(shard_count * sizeof(pthread_t));
+    CHECK_ERRNO( NULL == threads, "malloc" );
+
+    for (int i=0; i < shard_count; i++)
+    {
+        errno = pthread_create(&threads[i], NULL, LZSS_shard_worker,
+                &shards[i]);
+        CHECK_ERRNO( 0 != errno, "pthread_create" );
+    }
+    for (int i=0; i < shard_count; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    free(threads);
+}
+
+/* join the shards' symbols into out, fixing up where the parse coming
+   into a shard doesn't meet the shard's own */
+static void LZSS_stitch_shards(struct lzss_shard *shards, int shard_count,
+        struct lzss_output *out)
+{
+    struct match_finder mf;
+    init_match_finder(&mf, shards[0].data, shards[0].length, 0,
+            shards[0].strict);
+
+    *out = shards[0].out;
+    long pos = shards[0].stop;
+
+    for (int k=1; k < shard_count; k++)
+    {
+        struct lzss_shard * const sh = &shards[k];
+        long t = sh->start;
+        long i = 0;
+
+        while (pos < sh->end)
+        {
+            /* find where the shard's parse reaches pos */
+            while (i < sh->out.length && t < pos)
+            {
+                t += lzss_symbol_size(&sh->out.stream[i]);
+                i++;
+            }
+
+            if (t == pos)
+            {
+                /* in step, the rest is the same */
+                for (; i < sh->out.length; i++)
+                {
+                    lzss_append(out, sh->out.stream[i]);
+                }
+                pos = sh->stop;
+                break;
+            }
+
+            /* not yet, one more symbol */
+            pos += LZSS_greedy_symbol(&mf, pos, out);
+        }
+
+        free(sh->out.stream);
+    }
+
+    free_match_finder(&mf);
+}
+
+/* split [0, input_length) into shards */
+static int LZSS_make_shards(const unsigned char *input_data,
+        long input_length, int threads, bool strict,
+        struct lzss_progress *progress, struct lzss_shard **shards_p)
+{
+    long shard_size = (input_length + threads - 1) / threads;
+    if (shard_size < MIN_SHARD) shard_size = MIN_SHARD;
+
+    int shard_count = (input_length + shard_size - 1) / shard_size;
+    if (0 == shard_count) shard_count = 1;
+
+    struct lzss_shard *shards = calloc(shard_count, sizeof(struct lzss_shard));
+    CHECK_ERRNO( NULL == shards, "calloc" );
+
+    for (int i=0; i < shard_count; i++)
+    {
+        shards[i].data = input_data;
+        shards[i].length = input_length;
+        shards[i].start = i * shard_size;
+        shards[i].end = (i == shard_count - 1) ?
+            input_length : (i + 1) * shard_size;
+        shards[i].strict = strict;
+        shards[i].progress = progress;
+    }
+
+    *shards_p = shards;
+    return shard_count;
+}
+
+void LZH8_LZSS_compress(
+        const unsigned char *input_data,
+        long input_length,
+        struct lzss_symbol **lzss_stream_p,
+        long *lzss_length_p,
+        const struct lzh8_options *options)
+{
+    CHECK_ERROR( NULL != *lzss_stream_p || 0 != *lzss_length_p,
+            "should start with nothing");
+
+    struct lzss_progress progress = {
+        PTHREAD_MUTEX_INITIALIZER, 0, input_length, -0x40000l
+    };
+    if (options->progress)
+    {
+        report_progress(&progress, 0);
+    }
+
+    struct lzss_shard *shards;
+    const int shard_count =
+        LZSS_make_shards(input_data, input_length, options->threads,
+                options->strict, options->progress ? &progress : NULL,
+                &shards);
+
+    struct lzss_output out = {NULL, 0, 0};
+
+    LZSS_run_shards(shards, shard_count);
+    LZSS_stitch_shards(shards, shard_count, &out);
+
+    if (options->optimal)
+    {
+        /* the greedy parse gives the first costs, each round's parse gives
+           the next; keep whichever would code smallest */
+        uint8_t litlen_cost[LENCNT], displen_cost[DISPCNT];
+        long best_bits = LZSS_cost_bits(&out);
+
+        for (int round=0; round < OPTIMAL_ROUNDS; round++)
+        {
+            LZSS_costs(&out, litlen_cost, displen_cost);
+
+            for (int i=0; i < shard_count; i++)
+            {
+                shards[i].optimal = true;
+                shards[i].litlen_cost = litlen_cost;
+                shards[i].displen_cost = displen_cost;
+                shards[i].out.stream = NULL;
+                shards[i].out.length = shards[i].out.capacity = 0;
+            }
+
+            LZSS_run_shards(shards, shard_count);
+
+            /* optimal shards end exactly at their ends */
+            struct lzss_output round_out = {NULL, 0, 0};
+            for (int i=0; i < shard_count; i++)
+            {
+                for (long j=0; j < shards[i].out.length; j++)
+                {
+                    lzss_append(&round_out, shards[i].out.stream[j]);
+                }
+                free(shards[i].out.stream);
+            }
+
+            const long round_bits = LZSS_cost_bits(&round_out);
+            if (round_bits < best_bits)
+            {
+                free(out.stream);
+                out = round_out;
+                best_bits = round_bits;
+            }
+            else
+            {
+                free(round_out.stream);
+                break;
+            }
+        }
+    }
+
+    free(shards);
+
+    *lzss_length_p = out.length;
+    *lzss_stream_p = out.stream;
+}
+
+/* optimal parse: cheapest way to code each prefix of the shard, with
+   costs in bits from the code lengths */
+
+static void LZSS_optimal_shard(struct lzss_shard *sh)
+{
+    const long start = sh->start;
+    const long span = sh->end - sh->start;
+
+    uint32_t *price = malloc((span + 1) * sizeof(uint32_t));
+    CHECK_ERRNO( NULL == price, "malloc" );
+    /* how each position was best reached: length (1 for literal), offset */
+    uint16_t *from_length = malloc((span + 1) * sizeof(uint16_t));
+    CHECK_ERRNO( NULL == from_length, "malloc" );
+    uint16_t *from_offset = malloc((span + 1) * sizeof(uint16_t));
+    CHECK_ERRNO( NULL == from_offset, "malloc" );
+
+    price[0] = 0;
+    for (long i=1; i <= span; i++)
+    {
+        price[i] = UINT32_MAX;
+    }
+
+    struct match_finder mf;
+    init_match_finder(&mf, sh->data, sh->length, OPTIMAL_MAX_CHAIN,
+            sh->strict);
+
+    uint16_t offsets[MAX_MATCH + 1];
+
+    long last_report = 0;
+    for (long i=0; i < span; i++)
+    {
+        const long pos = start + i;
+        const uint32_t here = price[i];
+
+        /* literal */
+        {
+            const uint32_t p = here + sh->litlen_cost[sh->data[pos]];
+            if (p < price[i+1])
+            {
+                price[i+1] = p;
+                from_length[i+1] = 1;
+            }
+        }
+
+        /* backreferences, each length at its nearest offset, not past the
+           end of the shard */
+        long match_offset;
+        int longest = match_find(&mf, pos, &match_offset, offsets);
+        if (longest > span - i) longest = span - i;
+
+        for (int l = MIN_MATCH; l <= longest; l++)
+        {
+            const int displen = LZH8_displen_length(offsets[l]);
+            const uint32_t p = here +
+                sh->litlen_cost[0x100 | (l - 3)] +
+                sh->displen_cost[displen] +
+                (displen > 1 ? displen - 1 : 0);
+
+            if (p < price[i+l])
+            {
+                price[i+l] = p;
+                from_length[i+l] = l;
+                from_offset[i+l] = offsets[l];
+            }
+        }
+
+        if (longest >= OPTIMAL_NICE_LENGTH)
+        {
+            i += longest - 1;
+        }
+
+        if (i - last_report >= 0x10000l)
+        {
+            report_progress(sh->progress, i - last_report);
+            last_report = i;
+        }
+    }
+    report_progress(sh->progress, span - last_report);
+
+    free_match_finder(&mf);
+
+    /* walk back from the end, then emit forward */
+    long symbol_count = 0;
+    for (long i=span; i > 0; i -= from_length[i])
+    {
+        symbol_count++;
+    }
+
+    sh->out.stream = malloc((symbol_count > 0 ? symbol_count : 1) *
+            sizeof(struct lzss_symbol));
+    CHECK_ERRNO( NULL == sh->out.stream, "malloc" );
+    sh->out.length = sh->out.capacity = symbol_count;
+
+    for (long i=span, s=symbol_count-1; i > 0; i -= from_length[i], s--)
+    {
+        struct lzss_symbol * const symbol = &sh->out.stream[s];
+        const long l = from_length[i];
+
+        if (1 == l)
+        {
+            symbol->is_reference = 0;
+            symbol->length_or_literal = sh->data[start + i - 1];
+            symbol->offset = 0;
+        }
+        else
+        {
+            symbol->is_reference = 1;
+            symbol->length_or_literal = l - 3;
+            symbol->offset = from_offset[i];
+        }
+    }
+
+    sh->stop = sh->end;
+
+    free(price);
+    free(from_length);
+    free(from_offset);
+}
+
+static void LZSS_count(const struct lzss_output *out,
+        long *length_freq, long *displen_freq)
+{
+    for (long i=0; i < out->length; i++)
+    {
+        length_freq[ (out->stream[i].is_reference << 8) |
+                      out->stream[i].length_or_literal ] ++;
+
+        if (out->stream[i].is_reference)
+        {
+            displen_freq[ LZH8_displen_length(out->stream[i].offset) ] ++;
+        }
+    }
+}
+
+/* code lengths from a Huffman tree built as the real one will be, unused
+   symbols get one bit more than the longest */
+static void LZSS_code_lengths(long *freq, int symbol_count, uint8_t *lengths)
+{
+    int node_remains[LENCNT*2-1];
+    struct huff_node node_array[LENCNT*2-1];
+    struct huff_symbol sym_array[LENCNT];
+
+    for (int i=0; i < symbol_count; i++)
+    {
+        sym_array[i].key_len = 0;
+    }
+
+    int root_idx = LZH8_Huff_build_Huffman_tree(
+            node_remains, freq, node_array, symbol_count);
+    LZH8_Huff_compute_prefix(node_array, root_idx, sym_array, 0, 0);
+
+    int longest = 0;
+    for (int i=0; i < symbol_count; i++)
+    {
+        if (sym_array[i].key_len > longest) longest = sym_array[i].key_len;
+    }
+
+    for (int i=0; i < symbol_count; i++)
+    {
+        lengths[i] = sym_array[i].key_len ? sym_array[i].key_len : longest + 1;
+    }
+}
+
+static void LZSS_costs(const struct lzss_output *out,
+        uint8_t *litlen_cost, uint8_t *displen_cost)
+{
+    long length_freq[LENCNT*2-1] = {0};
+    long displen_freq[DISPCNT*2-1] = {0};
+
+    LZSS_count(out, length_freq, displen_freq);
+
+    LZSS_code_lengths(length_freq, LENCNT, litlen_cost);
+    LZSS_code_lengths(displen_freq, DISPCNT, displen_cost);
+}
+
+/* bits the stream would take to code */
+static long LZSS_cost_bits(const struct lzss_output *out)
+{
+    uint8_t litlen_cost[LENCNT], displen_cost[DISPCNT];
+    long bits = 0;
+
+    LZSS_costs(out, litlen_cost, displen_cost);
+
+    for (long i=0; i < out->length; i++)
+    {
+        const struct lzss_symbol * const symbol = &out->stream[i];
+
+        bits += litlen_cost[ (symbol->is_reference << 8) |
+                             symbol->length_or_literal ];
+
+        if (symbol->is_reference)
+        {
+            const int displen = LZH8_displen_length(symbol->offset);
+            bits += displen_cost[displen] + (displen > 1 ? displen - 1 : 0);
+        }
+    }
+
+    return bits;
+}
+
+#else
+
+/* LZSS with dumb linear search, greedy and on one thread only */
+void LZH8_LZSS_compress(
+        const unsigned char *input_data,
+        long input_length,
+        struct lzss_symbol **lzss_stream_p,
+        long *lzss_length_p,
+        const struct lzh8_options *options)
+{
+    CHECK_ERROR( options->optimal, "no optimal parse without LZSS_HASH" );
+
+    /* POLICY: parameters for this coding */
+    const int min_length = 3;
+    const int max_length = (1 << 8) - 1 + 3;
+    const long max_window_size = options->strict ? (1l << 15) : (1l << 16);
+
+    /* the output stream */
+    struct lzss_symbol *lzss_stream = *lzss_stream_p;
+    long lzss_length = *lzss_length_p;
+    long lzss_stream_capacity = 0;
+    CHECK_ERROR( NULL != lzss_stream || 0 != lzss_length,
+            "should start with nothing");
+
+    long bytes_done = 0;    /* bytes of input successfully encoded */
+    long window_size = 0;   /* bytes (before bytes_done) of dictionary */
+    long next_input_offset; /* next input byte to read */
+
+    for (bytes_done = 0; bytes_done < input_length; )
+    {
+        int longest_match = 0;
+        long longest_match_offset = 0;
+
+        if (options->progress && 0 == lzss_length % (5*0x400))
+        {
+            fprintf(stderr,"%ld bytes done (%f%%)\n", bytes_done, (float)bytes_done/input_length*100);
+        }
+        
+        /* grab as many input bytes as possible */
+        next_input_offset = bytes_done + max_length;
+        if (next_input_offset > input_length)
+        {
+            next_input_offset = input_length;
+        }
+
+        /* consider window */
+        window_size = bytes_done;
+        if (max_window_size < window_size)
+        {
+            window_size = max_window_size;
+        }
+
+        /* search for a match for what's currently in the input */
+        for (long search_offset =
+                  bytes_done - (options->strict ? 2 : 1), /* POLICY: not -1 */
+                  search_end = bytes_done - 1 - window_size;
+             search_offset > search_end;
+             search_offset--)
+        {
+            long match_length = 0;
+            for (long match_check_offset = search_offset,
+                      input_check_offset = bytes_done;
+                 input_check_offset < next_input_offset &&
+                 input_data[input_check_offset] ==
+                    input_data[match_check_offset];
+                 input_check_offset ++, match_check_offset++, match_length++)
+            {}
+
+            /* POLICY: prefer long matches, then first matches */
+            if (match_length > longest_match)
+            {
+                longest_match = match_length;
+                longest_match_offset = search_offset;
+            }
+        }
+
+        /* check that there's room for a new symbol */
+        if (lzss_length >= lzss_stream_capacity)
+        {
+            if (0 == lzss_stream_capacity)
+                lzss_stream_capacity = 0x800;
+            else
+                lzss_stream_capacity *= 2;
+            lzss_stream = realloc(lzss_stream,
+                    lzss_stream_capacity*sizeof(struct lzss_symbol));
+            CHECK_ERRNO( NULL == lzss_stream, "realloc" );
+        }
+
+        long bytes_in_this_symbol;
+
+        /* record the new symbol */
+        if (longest_match < min_length)
+        {
+            /* no backreference possible */
+            lzss_stream[lzss_length].is_reference = 0;
+            lzss_stream[lzss_length].length_or_literal = input_data[bytes_done];
+            lzss_length++;
+            bytes_in_this_symbol = 1;
+        }
+        else
+        {
+            /* generate a backreference */
+            lzss_stream[lzss_length].is_reference = 1;
+            lzss_stream[lzss_length].length_or_literal = longest_match - 3;
+            lzss_stream[lzss_length].offset = bytes_done-longest_match_offset-1;
+            lzss_length++;
+            bytes_in_this_symbol = longest_match;
+        }
+
+        /* update state */
+        bytes_done += bytes_in_this_symbol;
+    }
+
+    *lzss_length_p = lzss_length;
+    *lzss_stream_p = lzss_stream;
+}
+#endif
+
+int LZH8_displen_length(uint16_t displacement)
+{
+    int bits = 0;
+    while (displacement)
+    {
+        displacement >>= 1;
+        bits ++;
+    }
+
+    return bits;
+}
+
+/* Build the Huffman code to be used for this file. Also produce the
+   flattened tables and output them. */
+void LZH8_Huff_produce_encodings(
+        struct lzss_symbol * const lzss_stream,
+        long lzss_length,
+        struct huff_symbol *back_litlen_table,
+        struct huff_symbol *back_displen_table,
+        struct output_buffer *out)
+{
+    /* Count frequencies */
+    long length_freq[LENCNT*2-1] = {0};
+    long displen_freq[DISPCNT*2-1] = {0};
+
+    for (long i=0; i < lzss_length; i++)
+    {
+        length_freq[ (lzss_stream[i].is_reference << 8) |
+                      lzss_stream[i].length_or_literal ] ++;
+
+        if (lzss_stream[i].is_reference)
+        {
+            displen_freq[ LZH8_displen_length(lzss_stream[i].offset) ] ++;
+        }
+    }
+
+#if SHOW_FREQUENCIES
+    for (int i=0; i < LENCNT; i++)
+    {
+        printf("%d: %ld\n", i, length_freq[i]);
+    }
+    for (int i=0; i < DISPCNT; i++)
+    {
+        printf("%d: %ld\n", i, displen_freq[i]);
+    }
+#endif
+
+    /* Build Huffman codes for length/literal */
+    {
+        int node_remains[LENCNT*2-1];
+        struct huff_node node_array[LENCNT*2-1];
+#if SHOW_TREE
+        printf("\nlength/literal tree:\n");
+#endif
+        int root_idx = LZH8_Huff_build_Huffman_tree(
+                node_remains, length_freq, node_array, LENCNT);
+
+#if SHOW_TREE_BITS
+        printf("\nlength/literal tree:\n");
+#endif
+
+        LZH8_Huff_compute_prefix(
+                node_array, root_idx, back_litlen_table, 0, 0);
+
+        uint16_t tree_table[LENCNT*2] = {0};
+        int table_size =
+            LZH8_Huff_flatten_tree(node_array, tree_table, root_idx, LENBITS-2);
+
+        long start_output_offset = out->length;
+
+        /* write bit packed table */
+#if SHOW_TABLE
+        printf("backreference length table:\n");
+#endif
+        uint32_t bit_pool = 0;
+        int bits_written = 16;   /* leave space for length */
+        for (int i=1; i < table_size; i++)
+        {
+#if SHOW_TABLE
+            printf("%d: %d\n", i, (int)tree_table[i]);
+#endif
+            WRITE_BITS(tree_table[i], LENBITS);
+        }
+        flush_bits(out, &bit_pool, &bits_written);
+
+        long table_bytes = (out->length - start_output_offset) / 4 - 1;
+        CHECK_ERROR( UINT16_MAX <= table_bytes, "length table too big" );
+        out->data[start_output_offset] = table_bytes & 0xFF;
+        out->data[start_output_offset+1] = table_bytes >> 8;
+
+#if SHOW_TABLE
+        printf("done at 0x%lx\n\n", out->length);
+#endif
+    }
+
+    /* Build Huffman codes for displacement length */
+    {
+        int node_remains[DISPCNT*2-1];
+        struct huff_node node_array[DISPCNT*2-1];
+#if SHOW_TREE
+        printf("\ndisplacement length tree:\n");
+#endif
+        int root_idx = LZH8_Huff_build_Huffman_tree(
+                node_remains, displen_freq, node_array, DISPCNT);
+
+#if SHOW_TREE_BITS
+        printf("\ndisplacement length tree:\n");
+#endif
+
+        LZH8_Huff_compute_prefix(
+                node_array, root_idx, back_displen_table, 0, 0);
+
+        uint16_t tree_table[DISPCNT*2] = {0};
+        int table_size =
+            LZH8_Huff_flatten_tree(node_array, tree_table, root_idx,
+            DISPBITS-2);
+
+        /* write out table size placeholder */
+        long start_output_offset = out->length;
+
+        /* write bit packed table */
+#if SHOW_TABLE
+        printf("backreference displacement length table:\n");
+#endif
+        uint32_t bit_pool = 0;
+        int bits_written = 8;   /* leave space for size */
+        for (int i=1; i < table_size; i++)
+        {
+#if SHOW_TABLE
+            printf("%d: %d\n", i, (int)tree_table[i]);
+#endif
+            WRITE_BITS(tree_table[i], DISPBITS);
+        }
+        flush_bits(out, &bit_pool, &bits_written);
+
+        long table_bytes = (out->length - start_output_offset) / 4 - 1 ;
+
+        CHECK_ERROR( UINT8_MAX <= table_bytes, "displen table too big" );
+        out->data[start_output_offset] = table_bytes;
+
+#if SHOW_TABLE
+        printf("done at 0x%lx\n\n", out->length);
+#endif
+    }
+
+}
+
+/* Build tree for Huffman coding based on symbol frequencies. */
+int LZH8_Huff_build_Huffman_tree(
+    int *node_remains,
+    long *freq,
+    struct huff_node *node_array,
+    int symbol_count
+    )
+{
+    int nodes_left = 0;
+    int next_new_node_idx = symbol_count;
+    for (int i=0; i < symbol_count; i++)
+    {
+        if (0 != freq[i])
+        {
+            node_remains[i] = 1;
+            nodes_left ++;
+        }
+        else
+        {
+            node_remains[i] = 0;
+        }
+        node_array[i].lchild = -1;
+        node_array[i].rchild = -1;
+        node_array[i].leaf = i;
+        node_array[i].subtree_size = 0;
+    }
+    for (int i=symbol_count; i < symbol_count*2-1; i++)
+    {
+        node_remains[i] = 0;
+    }
+
+    int root_idx = 0;
+
+    if ( 0 == nodes_left )
+    {
+        /* Cheat for zero nodes, return bad root_idx to avoid doing anything
+           else with this tree. */
+
+        return -1;
+    }
+
+    if ( 1 == nodes_left )
+    {
+        /* Cheat for one node */
+
+        /* Find only symbol */
+        int i;
+        for (i = 0; i < symbol_count; i++)
+        {
+            if (node_remains[i])
+            {
+                break;
+            }
+        }
+
+        /* root points to it twice */
+        node_array[next_new_node_idx].lchild = i;
+        node_array[next_new_node_idx].rchild = i;
+        node_array[next_new_node_idx].subtree_size = 1;
+
+        root_idx = next_new_node_idx;
+    }
+
+    for (; nodes_left > 1; nodes_left --)
+    {
+        /* find smallest two (POLICY: favor infrequency, then low index) */
+        int smallest_idx = -1, next_smallest_idx = -1;
+        {
+            long smallest = -1, next_smallest = -1;
+            for (int i=0; i < next_new_node_idx; i++)
+            {
+                if (node_remains[i])
+                {
+                    if (freq[i] < smallest || -1 == smallest)
+                    {
+                        next_smallest = smallest;
+                        next_smallest_idx = smallest_idx;
+                        smallest = freq[i];
+                        smallest_idx = i;
+                    }
+                    else if (freq[i] < next_smallest || -1 == next_smallest)
+                    {
+                        next_smallest = freq[i];
+                        next_smallest_idx = i;
+                    }
+                }
+            }
+        }
+
+        /* construct new node to join the two */
+        /* POLICY: smallest on left */
+        struct huff_node sum_node;
+        sum_node.lchild = smallest_idx;
+        sum_node.rchild = next_smallest_idx;
+        sum_node.leaf = 0;
+        sum_node.subtree_size =
+            node_array[smallest_idx].subtree_size + 
+            node_array[next_smallest_idx].subtree_size + 1;
+
+        /* new node has combined frequency of children */
+        long total_freq = freq[smallest_idx] + freq[next_smallest_idx];
+
+        /* POLICY: new node goes to end of queue */
+        int sum_node_idx = next_new_node_idx;
+        freq[sum_node_idx] = total_freq;
+        node_remains[sum_node_idx] = 1;
+        node_remains[smallest_idx] = 0;
+        node_remains[next_smallest_idx] = 0;
+
+        node_array[sum_node_idx] = sum_node;
+
+        root_idx = sum_node_idx;
+
+        next_new_node_idx ++;
+    }
+
+#if SHOW_TREE
+    for (int i = next_new_node_idx-1; i >= 0; i--)
+    {
+        printf("node %d: ", i);
+        if (-1 == node_array[i].lchild)
+        {
+            printf("leaf (%x)\n", (unsigned)node_array[i].leaf);
+        }
+        else
+        {
+            printf("lchild %d rchild %d\n",
+                    node_array[i].lchild,
+                    node_array[i].rchild);
+        }
+    }
+    printf("\n");
+#endif
+
+    return root_idx;
+}
+
+/* Build the prefix codes for everything under root_idx, assuming
+   key_bits (low key_len bits) has prefix so far. */
+void LZH8_Huff_compute_prefix(
+        const struct huff_node *node_array,
+        int root_idx,
+        struct huff_symbol *sym_array,
+        uint32_t key_bits,
+        int key_len)
+{
+    const struct huff_node *root = &node_array[root_idx];
+
+    if ( -1 == root_idx )
+    {
+        /* no tree */
+        return;
+    }
+
+    CHECK_ERROR(32 <= key_len, "key too long");
+    CHECK_ERROR(
+            (-1 == root->lchild && -1 != root->rchild) ||
+            (-1 != root->lchild && -1 == root->rchild),
+            "node not inner with two children or leaf");
+    if (-1 != root->lchild)
+    {
+        key_len ++;
+        LZH8_Huff_compute_prefix(node_array, root->lchild, sym_array,
+                key_bits<<1, key_len);
+        LZH8_Huff_compute_prefix(node_array, root->rchild, sym_array,
+                (key_bits<<1)|1, key_len);
+    }
+    else
+    {
+        sym_array[root->leaf].key_len = key_len;
+        sym_array[root->leaf].key_bits = key_bits;
+#if SHOW_TREE_BITS
+        printf("%d: ", root->leaf);
+        for (int i=key_len-1; i>=0; i--)
+        {
+            printf("%c", (key_bits&(1<<i)) ? '1' : '0');
+        }
+        printf("\n");
+#endif
+    }
+}
+
+/* Generate the flat table for decoding. */
+int LZH8_Huff_flatten_tree(
+    const struct huff_node *node_array,
+    uint16_t *tree_table,
+    int root_idx,
+    const int offset_bits)
+{
+    if ( -1 == root_idx )
+    {
+        /* no tree */
+        return 0;
+    }
+
+    /* root_idx is leaf count + inner node count - 1, we need a maximum of
+       leaf count + inner node count + 1 (extra to align pairs to even idx) */
+    struct huff_table_ctrl *ctrl =
+        malloc(sizeof(struct huff_table_ctrl) * (root_idx+2));
+    CHECK_ERRNO(NULL == ctrl, "malloc");
+
+    /* known unplaced nodes */
+    unsigned int outstanding_nodes = 0;
+    /* where the next entry goes */
+    unsigned int table_idx;
+
+    /* place root node */
+    {
+        outstanding_nodes = 1;
+        ctrl[0].placed = true;
+
+        ctrl[1].node_idx = root_idx;
+        ctrl[1].placed = false;
+
+        table_idx = 2;
+    }
+
+    while (0 < outstanding_nodes)
+    {
+#if EXPLAIN_TABLE
+        printf("New round, table_idx = %d, outstanding_nodes = %d\n",
+                table_idx, outstanding_nodes);
+#endif
+        uint16_t fitting_subtree_size = 0;
+        uint16_t fitting_subtree_idx = table_idx;
+
+        /* try to find a subtree that will fit, starting with most recent */
+        for (int i = table_idx-1; i >= 0; i--)
+        {
+            if ( !ctrl[i].placed )
+            {
+                const struct huff_node *candidate =
+                    &node_array[ctrl[i].node_idx];
+
+#if EXPLAIN_TABLE
+                printf(" considering %d, size %d (limit %d)\n", i,
+                        candidate->subtree_size,
+                        (1 << offset_bits) - outstanding_nodes);
+#endif
+
+                /* we'd like to place the whole subtree this points at */
+                if ( candidate->subtree_size + outstanding_nodes <=
+                        (1 << offset_bits) &&
+                     LZH8_Huff_could_satisfy_outstanding_nodes(
+                        ctrl, table_idx, candidate->subtree_size, i,
+                        offset_bits )
+                    )
+                {
+                    /* We can safely place this subtree (see note at
+                       could_satisfy_outstanding_nodes) */
+
+                    /* POLICY: use most recent (favoring right children) */
+                    fitting_subtree_size = candidate->subtree_size;
+                    fitting_subtree_idx = i;
+                    break;
+                }
+            }
+        }
+
+        if ( fitting_subtree_idx != table_idx )
+        {
+            /* We found a subtree that wasn't too large,
+               insert it at the end of the table */
+#if EXPLAIN_TABLE
+            printf(" found fitting subtree, %d, size %d\n",
+                    fitting_subtree_idx, fitting_subtree_size );
+#endif
+
+            /* POLICY: breadth first traversal, left child first */
+            /* (other traversals would work as well; we know the tree is small
+               enough to be entirely skipped by a single offset) */
+
+            /* we want to start the traversal on the new nodes added by placing
+               the children of the root, so set the loop index to where the
+               first (if any) will be placed */
+            unsigned int i = table_idx;
+
+            /* place the root */
+            LZH8_Huff_flatten_single_node(
+                node_array, ctrl, tree_table, offset_bits, fitting_subtree_idx,
+                &table_idx, &outstanding_nodes);
+
+            /* Consider any unplaced children. table_idx will continue to
+               increase as the table is expanded with descendants of our
+               original root. */
+            for ( ; i < table_idx; i++ )
+            {
+                if ( !ctrl[i].placed )
+                {
+                    LZH8_Huff_flatten_single_node(
+                        node_array, ctrl, tree_table, offset_bits, i,
+                        &table_idx, &outstanding_nodes);
+                }
+            }
+        }
+        else
+        {
+            /* Not able to fit a whole subtree at this time. */
+#if 0
+            CHECK_ERROR(!  could_satisfy_outstanding_nodes(
+                        ctrl, table_idx, 0, -1, offset_bits ),
+                        "attempting to add impossible!");
+#endif
+            
+            /* POLICY: Break up one outstanding subtree which is too large
+                to deal with at once (any of them). Prefer the farthest, as it
+                is the nearest to being unable to store. */
+
+            for ( unsigned int i = 0; i < table_idx; i+=2 )
+            {
+                unsigned int node_to_break = table_idx;
+
+                /* POLICY: If there are siblings (which are automatically at
+                the same distance), choose the one with the largest subtree,
+                favoring the left child in a tie. */
+                if ( !ctrl[i+0].placed )
+                {
+                    if ( !ctrl[i+1].placed &&
+                         node_array[ctrl[i+1].node_idx].subtree_size >
+                         node_array[ctrl[i+0].node_idx].subtree_size )
+                    {
+                        node_to_break = i+1;
+                    }
+                    else
+                    {
+                        node_to_break = i+0;
+                    }
+                }
+                else if ( !ctrl[i+1].placed )
+                {
+                    node_to_break = i+1;
+                }
+
+                if (node_to_break != table_idx)
+                {
+#if EXPLAIN_TABLE
+                    printf(" couldn't fit subtree, storing %d\n",
+                            node_to_break);
+#endif
+                    LZH8_Huff_flatten_single_node(
+                        node_array, ctrl, tree_table, offset_bits,
+                        node_to_break, &table_idx, &outstanding_nodes);
+                    break;
+                }
+            }
+        }
+    }   /* end while 0 < outstanding_nodes */
+
+    free(ctrl);
+
+    return table_idx;
+}
+
+/* Place immediate children of a node into the tree table */
+/* Node must not be a leaf. */
+void LZH8_Huff_flatten_single_node(
+    const struct huff_node *node_array,
+    struct huff_table_ctrl *ctrl,
+    uint16_t *tree_table,
+    const int offset_bits,
+    unsigned int parent_idx,          /* whose children we're placing */
+    unsigned int *table_idx_p,        /* where to place (updated) */
+    unsigned int *outstanding_nodes_p)/* count of unplaced nodes (updated) */
+{
+    uint8_t leaf_flags = 0;
+    const struct huff_node *parent_node =
+        &node_array[ctrl[parent_idx].node_idx];
+
+    CHECK_ERROR( ctrl[parent_idx].placed, "trying to re-locate" );
+    CHECK_ERROR( 0 != (*table_idx_p) % 2, "uneven table index");
+
+    if (node_array[parent_node->lchild].lchild != -1)
+    {
+        /* left node is not a leaf */
+        tree_table[*table_idx_p] = 0;
+        ctrl[*table_idx_p].placed = false;
+        ctrl[*table_idx_p].node_idx = parent_node->lchild;
+        (*outstanding_nodes_p) ++;
+    }
+    else
+    {
+        /* left node is a leaf */
+        tree_table[*table_idx_p] = node_array[parent_node->lchild].leaf;
+        ctrl[*table_idx_p].placed = true;
+        leaf_flags |= 2;    /* high bit, left node is leaf */
+    }
+    (*table_idx_p) ++;
+
+    if (node_array[parent_node->rchild].lchild != -1)
+    {
+        /* right node is not a leaf */
+        tree_table[*table_idx_p] = 0;
+        ctrl[*table_idx_p].placed = false;
+        ctrl[*table_idx_p].node_idx = parent_node->rchild;
+        (*outstanding_nodes_p) ++;
+    }
+    else
+    {
+        /* right node is a leaf */
+        tree_table[*table_idx_p] = node_array[parent_node->rchild].leaf;
+        ctrl[*table_idx_p].placed = true;
+        leaf_flags |= 1;    /* low bit, right node is leaf */
+    }
+    (*table_idx_p) ++;
+
+    /* set link from parent table entry*/
+    uint16_t offset = (((*table_idx_p) - 2) - parent_idx / 2 * 2) / 2 - 1;
+    CHECK_ERROR( (1 << offset_bits) <= offset, "offset too large" );
+    tree_table[parent_idx] = (leaf_flags << offset_bits) | offset;
+
+    ctrl[parent_idx].placed = true;
+
+    (*outstanding_nodes_p) --;
+}
+
+/* Simulation to find: 
+    Given the current end of the table, if we were to store a table of
+    proposed_size entries, would it still be possible to store offsets for
+    the currently outstanding (unplaced) entries?
+
+   Note: The size of a subtree includes its root node, which will also satisfy
+   one of the outstanding entries. However, also note that the max_offset is
+   counted from the beginning of the entry pair, it can only actually skip one
+   fewer nodes than the offset.
+
+   While this will be overcautious if there is only a single outstanding entry,
+   that pointing at the proposed subtree, it is otherwise needed to ensure
+   that the subtree can be skipped. Also in the single outstanding entry
+   case, it will be the only check on the size of the subtree (which could
+   potentially be too large to store in one go), though it remains somewhat
+   overcautious.
+
+   The check before can_satisfy_single_nodes up in LZH8_huff_flatten_tree is a
+   shortcut to avoid calling this function if it would be impossible to satisfy
+   the outstanding nodes even in the most generous case: the only outstanding
+   node (thus the one placed first) is the last in the table (thus having the
+   shortest possible offset required to jump the proposed subtree).
+*/
+bool LZH8_Huff_could_satisfy_outstanding_nodes(
+    const struct huff_table_ctrl *ctrl,
+    int table_idx,
+    uint16_t proposed_size,
+    int proposed_idx,
+    const int offset_bits)
+{
+    /* jump is 2^offset_bits-1, +1 as it is assumed to proceed at least to the
+       next entry pair */
+    const int max_offset = (1 << offset_bits);
+
+    CHECK_ERROR( 0 != table_idx % 2, "odd table index" );
+
+    /* start from the end of the table (this is where we would start when
+       actually adding the nodes) */
+    for (unsigned int i = 0; i < table_idx; i++)
+    {
+        if (!ctrl[i].placed)
+        {
+            uint16_t dest_offset = table_idx/2 + proposed_size;
+
+#if EXPLAIN_TABLE
+            printf(" -simulate adding %d, table end = %d, "
+                   "distance would be %d (limit %d)\n",
+                   i, dest_offset, dest_offset - i / 2, max_offset);
+#endif
+            if (max_offset >= dest_offset - i / 2)
+            {
+                /* place that entry at the end, another one to jump over */
+                proposed_size ++;
+            }
+            else
+            {
+#if EXPLAIN_TABLE
+                printf(" *failed\n");
+#endif
+
+                /* cannot be placed */
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
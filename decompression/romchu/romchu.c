@@ -1,65 +1,175 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
 
-/* romchu 0.6 */
+/* romchu 0.8 */
 /* a decompressor for type 2 romc */
 /* reversed by hcs from the Wii VC wad for Super Smash Bros EU. */
 /* this code is public domain, have at it */
 
-#define VERSION "0.6"
+/* Each compressed block carries its own Huffman tables, so decoding them
+   into literals and backreferences (stage one) is spread over worker
+   threads. Backreferences can reach into earlier blocks, so applying them
+   to the output (stage two) is done in order on the main thread. Workers
+   stay at most BLOCKS_AHEAD blocks per thread ahead of stage two. */
+
+#define VERSION "0.8"
+
+#define BLOCKS_AHEAD 4
+
+/* decode passes over the input for -b */
+#define BENCH_ROUNDS 10
 
-struct bitstream;
+/* bitstream reader, LSB first */
+struct bitstream
+{
+    const unsigned char *pool;  /* next byte to buffer */
+    const unsigned char *end;
+    uint64_t buf;               /* next bit is bit 0 */
+    int buf_bits;
+    long bits_left;             /* unread, buffered or not */
+};
 
-struct bitstream *init_bitstream(const unsigned char *pool, unsigned long pool_size);
+void init_bitstream(struct bitstream *bs, const unsigned char *pool, unsigned long pool_size);
 uint32_t get_bits(struct bitstream *bs, int bits);
 int bitstream_eof(struct bitstream *bs);
-void free_bitstream(struct bitstream *bs);
+
+/* Huffman codes are canonical, sent as a length for each symbol.
+   They're decoded with a lookup table (huftable). The tree they used to
+   be walked in (huftree) is kept, for -b to check against and for the
+   bit patterns an incomplete code leaves out. */
+#define MAX_SYMBOLS 0x11D
 
 struct huftable;
+struct huftree;
+
+void read_lengths(struct bitstream *bs, int symbols, int *length_of, int *len_count);
 
 struct huftable *load_table(struct bitstream *bs, int symbols);
-int huf_lookup(struct bitstream *bs, struct huftable *ht);
+int huf_lookup(struct bitstream *bs, const struct huftable *ht);
 void free_table(struct huftable *);
 
+struct huftree *load_tree(struct bitstream *bs, int symbols);
+int tree_lookup(struct bitstream *bs, const struct huftree *ht);
+void free_tree(struct huftree *);
+
 struct {
     unsigned int bits;
     unsigned int base;
 } backref_len[0x1D], backref_disp[0x1E];
 
+/* a byte literal or a backreference */
+struct token
+{
+    uint16_t len;       /* 0 for a literal */
+    uint32_t value;     /* the byte, or the displacement */
+};
+
+struct block
+{
+    int compressed;
+    const unsigned char *payload;
+    uint32_t payload_bytes;
+    int payload_bits;
+
+    /* from stage one */
+    struct token *tokens;
+    long token_count;
+    int decoded;
+};
+
+struct pipeline
+{
+    struct block *blocks;
+    long block_count;
+
+    pthread_mutex_t lock;
+    pthread_cond_t decoded;     /* a block has been decoded */
+    pthread_cond_t applied;     /* a block has been applied */
+    long next_block;            /* the next one for a worker to decode */
+    long applied_count;
+    long ahead;
+};
+
+void *decode_worker(void *v);
+void decode_block(struct block *b, int walk_trees);
+int apply_block(const struct block *b, unsigned char *out_buf,
+        uint64_t nominal_size, long *out_offset_p);
+void bench_romc(struct block *blocks, long block_count, uint64_t nominal_size);
+
 int main(int argc, char **argv)
 {
     FILE *infile;
-    FILE *outfile;
+    FILE *outfile = NULL;
     unsigned char head_buf[4];
-    unsigned char payload_buf[0x10000];
-    int block_count = 0;
+    unsigned char *in_buf;
+    long in_size;
+    struct block *blocks = NULL;
+    long block_count = 0;
     unsigned char *out_buf;
     long out_offset = 0;
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    const char *infile_name, *outfile_name = NULL;
+    int bench = 0;
 
     uint64_t nominal_size;
     int romc_type;
 
-    if (argc != 3)
+    if (argc == 5 && !strcmp(argv[1], "-j"))
+    {
+        threads = strtol(argv[2], NULL, 10);
+        if (threads < 1 || threads > 1024)
+        {
+            fprintf(stderr, "invalid thread count\n");
+            return 1;
+        }
+        infile_name = argv[3];
+        outfile_name = argv[4];
+    }
+    else if (argc == 3 && !strcmp(argv[1], "-b"))
+    {
+        bench = 1;
+        infile_name = argv[2];
+    }
+    else if (argc == 3)
+    {
+        infile_name = argv[1];
+        outfile_name = argv[2];
+    }
+    else
     {
         fprintf(stderr, "romchu " VERSION" - romc type 2 decompressor\n");
-        fprintf(stderr, "usage: romchu romc out.n64\n");
+        fprintf(stderr, "usage: romchu [-j threads] romc out.n64\n");
+        fprintf(stderr, "       romchu -b romc   (time against the tree walker)\n");
         return 1;
     }
 
-    infile = fopen(argv[1], "rb");
+    if (threads < 1)
+    {
+        threads = 1;
+    }
+
+    infile = fopen(infile_name, "rb");
     if (!infile)
     {
         perror("fopen input");
         return 1;
     }
-    outfile = fopen(argv[2], "wb");
-    if (!outfile)
+    if (!bench)
     {
-        perror("fopen output");
-        return 1;
+        outfile = fopen(outfile_name, "wb");
+        if (!outfile)
+        {
+            perror("fopen output");
+            return 1;
+        }
     }
 
     // read header
@@ -134,197 +244,187 @@ int main(int argc, char **argv)
         }
     }
 
-    // be lazy and just allocate memory for the whole file
-    out_buf = malloc(nominal_size);
-    if (!out_buf)
+    // read the blocks into memory
     {
-        perror("malloc big outbuf buffer");
-        return 1;
+        long start = ftell(infile);
+        if (start < 0 || fseek(infile, 0, SEEK_END) != 0 ||
+                (in_size = ftell(infile)) < 0 ||
+                fseek(infile, start, SEEK_SET) != 0)
+        {
+            perror("finding input size");
+            return 1;
+        }
+        in_size -= start;
+
+        in_buf = malloc(in_size > 0 ? in_size : 1);
+        if (!in_buf)
+        {
+            perror("malloc input buffer");
+            return 1;
+        }
+        if (in_size > 0 && 1 != fread(in_buf, in_size, 1, infile))
+        {
+            perror("fread input");
+            return 1;
+        }
     }
-    out_offset = 0;
 
-    // decode each block
-    while (1 == fread(head_buf, 4, 1, infile))
+    // find each block
+    for (long offset = 0; offset + 4 <= in_size; block_count++)
     {
-        int compression_flag;
-        uint32_t payload_bytes;
-        int payload_bits;
+        struct bitstream head_bs;
+        struct block *b;
         uint32_t read_size;
 
-        struct bitstream *head_bs;
-
-#if 0
-        printf("%08lx=%08lx\n",
-            (unsigned long)(ftell(infile)-4),
-            (unsigned long)block_count*block_mult);
-#endif
+        if (0 == (block_count & (block_count - 1)))
+        {
+            blocks = realloc(blocks,
+                    sizeof(struct block) * (block_count ? block_count*2 : 1));
+            if (!blocks)
+            {
+                perror("realloc blocks");
+                return 1;
+            }
+        }
+        b = &blocks[block_count];
 
-        head_bs = init_bitstream(head_buf, 4*8);
+        init_bitstream(&head_bs, in_buf + offset, 4*8);
+        offset += 4;
 
-        compression_flag = get_bits(head_bs, 1);
-        if (compression_flag)
+        b->compressed = get_bits(&head_bs, 1);
+        if (b->compressed)
         {
             /* compressed */
 
             uint32_t block_size;
 
             /* bits, including this header */
-            block_size = get_bits(head_bs, 31) - 32;
+            block_size = get_bits(&head_bs, 31) - 32;
 
-            payload_bytes = block_size/8;
-            payload_bits = block_size%8;
+            b->payload_bytes = block_size/8;
+            b->payload_bits = block_size%8;
         }
         else
         {
             /* uncompressed */
 
-            uint32_t block_size;
-
             /* bytes */
-            block_size = get_bits(head_bs, 31);
-
-            payload_bytes = block_size;
-            payload_bits = 0;
+            b->payload_bytes = get_bits(&head_bs, 31);
+            b->payload_bits = 0;
         }
 
-        free_bitstream(head_bs);
-        head_bs = NULL;
-
-        /* read payload */
-        read_size = payload_bytes;
-        if (payload_bits > 0)
+        read_size = b->payload_bytes;
+        if (b->payload_bits > 0)
         {
             read_size ++;
         }
 
-        if (read_size > sizeof(payload_buf))
+        if (read_size > 0x10000)
         {
             fprintf(stderr, "payload too large\n");
             return 1;
         }
-        if (1 != fread(payload_buf, read_size, 1, infile))
+        if (read_size > in_size - offset)
         {
-            int save_errno = errno;
-            if (feof(infile))
-            {
-                fprintf(stderr, "fread of payload: unexpected EOF\n");
-            }
-            else
-            {
-                errno = save_errno;
-                perror("fread of payload");
-            }
+            fprintf(stderr, "fread of payload: unexpected EOF\n");
             return 1;
         }
 
-        /* attempt to parse... */
-
-        if (compression_flag)
-        {
-            uint16_t tab1_size, tab2_size;
-            uint32_t body_size;
-            unsigned long tab1_offset, tab2_offset, body_offset;
-            struct bitstream *bs;
-            struct huftable *table1, *table2;
-            
-            /* read table 1 size */
-            tab1_offset = 0;
-            bs = init_bitstream(payload_buf + tab1_offset, payload_bytes*8+payload_bits);
-            tab1_size = get_bits(bs, 16);
-            free_bitstream(bs);
-
-            /* load table 1 */
-            bs = init_bitstream(payload_buf + tab1_offset + 2, tab1_size);
-            table1 = load_table(bs, 0x11D);
-            free_bitstream(bs);
-
-            /* read table 2 size */
-            tab2_offset = tab1_offset + 2 + (tab1_size+7) / 8;
-            bs = init_bitstream(payload_buf + tab2_offset, 2*8);
-            tab2_size = get_bits(bs, 16);
-            free_bitstream(bs);
-
-            /* load table 2 */
-            bs = init_bitstream(payload_buf + tab2_offset + 2, tab2_size);
-            table2 = load_table(bs, 0x1E);
-            free_bitstream(bs);
-
-            /* decode body */
-            body_offset = tab2_offset + 2 + (tab2_size+7) / 8;
-            body_size = payload_bytes*8 + payload_bits - body_offset*8;
-            bs = init_bitstream(payload_buf + body_offset, body_size);
-
-            while (!bitstream_eof(bs))
-            {
-                int symbol = huf_lookup(bs, table1);
+        b->payload = in_buf + offset;
+        b->tokens = NULL;
+        b->token_count = 0;
+        b->decoded = 0;
 
-                if (symbol < 0x100)
-                {
-                    /* byte literal */
-                    unsigned char b = symbol;
-                    if (out_offset >= nominal_size)
-                    {
-                        fprintf(stderr, "generated too many bytes\n");
-                        return 1;
-                    }
-                    out_buf[out_offset++] = b;
-                }
-                else
-                {
-                    /* backreference */
-                    unsigned int len_bits = backref_len[symbol-0x100].bits;
-                    unsigned int len = backref_len[symbol-0x100].base;
-                    if (len_bits > 0)
-                    {
-                        len += get_bits(bs, len_bits);
-                    }
-                    len += 3;
-
-                    int symbol2 = huf_lookup(bs, table2);
-
-                    unsigned int disp_bits = backref_disp[symbol2].bits;
-                    unsigned int disp = backref_disp[symbol2].base;
-                    if (disp_bits > 0)
-                    {
-                        disp += get_bits(bs, disp_bits);
-                    }
-                    disp ++;
-
-                    if (disp > out_offset)
-                    {
-                        fprintf(stderr, "backreference too far\n");
-                        return 1;
-                    }
-                    if (out_offset+len > nominal_size)
-                    {
-                        fprintf(stderr, "generated too many bytes\n");
-                        return 1;
-                    }
-                    for (unsigned int i = 0; i < len; i++, out_offset++)
-                    {
-                        out_buf[out_offset] = out_buf[out_offset-disp];
-                    }
-                }
-            }
+        offset += read_size;
+    }
+
+    if (bench)
+    {
+        bench_romc(blocks, block_count, nominal_size);
+
+        free(blocks);
+        free(in_buf);
+        fclose(infile);
 
-            free_table(table1);
-            free_table(table2);
-            free_bitstream(bs);
+        return 0;
+    }
+
+    // be lazy and just allocate memory for the whole file
+    out_buf = malloc(nominal_size);
+    if (!out_buf)
+    {
+        perror("malloc big outbuf buffer");
+        return 1;
+    }
+    out_offset = 0;
+
+    // decode blocks on the workers, apply them here in order
+    {
+        struct pipeline p;
+        pthread_t *workers;
+
+        p.blocks = blocks;
+        p.block_count = block_count;
+        pthread_mutex_init(&p.lock, NULL);
+        pthread_cond_init(&p.decoded, NULL);
+        pthread_cond_init(&p.applied, NULL);
+        p.next_block = 0;
+        p.applied_count = 0;
+        p.ahead = threads * BLOCKS_AHEAD;
+
+        workers = malloc(sizeof(pthread_t) * threads);
+        if (!workers)
+        {
+            perror("malloc workers");
+            return 1;
         }
-        else
+        for (long i = 0; i < threads; i++)
         {
-            if (out_offset + payload_bytes > nominal_size)
+            errno = pthread_create(&workers[i], NULL, decode_worker, &p);
+            if (errno)
             {
-                fprintf(stderr, "generated too many bytes\n");
+                perror("pthread_create");
                 return 1;
             }
-            memcpy(out_buf+out_offset, payload_buf, payload_bytes);
-            out_offset += payload_bytes;
         }
 
-        block_count ++;
+        for (long i = 0; i < block_count; i++)
+        {
+            pthread_mutex_lock(&p.lock);
+            while (!blocks[i].decoded)
+            {
+                pthread_cond_wait(&p.decoded, &p.lock);
+            }
+            pthread_mutex_unlock(&p.lock);
+
+            if (!apply_block(&blocks[i], out_buf, nominal_size, &out_offset))
+            {
+                return 1;
+            }
+
+            free(blocks[i].tokens);
+            blocks[i].tokens = NULL;
+
+            pthread_mutex_lock(&p.lock);
+            p.applied_count = i + 1;
+            pthread_cond_broadcast(&p.applied);
+            pthread_mutex_unlock(&p.lock);
+        }
+
+        for (long i = 0; i < threads; i++)
+        {
+            pthread_join(workers[i], NULL);
+        }
+        free(workers);
+
+        pthread_mutex_destroy(&p.lock);
+        pthread_cond_destroy(&p.decoded);
+        pthread_cond_destroy(&p.applied);
     }
 
+    free(blocks);
+    free(in_buf);
+
     if (out_offset != nominal_size)
     {
         fprintf(stderr, "size mismatch\n");
@@ -349,117 +449,407 @@ int main(int argc, char **argv)
     return 0;
 }
 
-/* bitstream reader */
-struct bitstream
+/* stage one: decode blocks until there are none left to take */
+void *decode_worker(void *v)
 {
-    const unsigned char *pool;
-    long bits_left;
-    uint8_t first_byte;
-    int first_byte_bits;
-};
+    struct pipeline *p = v;
 
-struct bitstream *init_bitstream(const unsigned char *pool, unsigned long pool_size)
-{
-    struct bitstream *bs = malloc(sizeof(struct bitstream));
-    if (!bs)
+    pthread_mutex_lock(&p->lock);
+    for (;;)
     {
-        perror("bitstream malloc");
-        exit(EXIT_FAILURE);
+        long i;
+
+        while (p->next_block < p->block_count &&
+               p->next_block >= p->applied_count + p->ahead)
+        {
+            pthread_cond_wait(&p->applied, &p->lock);
+        }
+        if (p->next_block >= p->block_count)
+        {
+            break;
+        }
+
+        i = p->next_block++;
+        pthread_mutex_unlock(&p->lock);
+
+        decode_block(&p->blocks[i], 0);
+
+        pthread_mutex_lock(&p->lock);
+        p->blocks[i].decoded = 1;
+        pthread_cond_broadcast(&p->decoded);
     }
+    pthread_mutex_unlock(&p->lock);
 
-    bs->pool = pool;
-    bs->bits_left = pool_size;
-    bs->first_byte_bits = 0;
+    return NULL;
+}
 
-    /* check that padding bits are 0 (to ensure we aren't ignoring anything) */
-    if (pool_size%8)
+static void add_token(struct block *b, long *capacity, unsigned int len, uint32_t value)
+{
+    if (b->token_count == *capacity)
     {
-        if (pool[pool_size/8] & ~((1<<(pool_size%8))-1))
+        *capacity = *capacity ? *capacity*2 : 0x1000;
+        b->tokens = realloc(b->tokens, sizeof(struct token) * *capacity);
+        if (!b->tokens)
         {
-            fprintf(stderr, "nonzero padding at end of bitstream\n");
+            perror("realloc tokens");
             exit(EXIT_FAILURE);
         }
     }
 
-    return bs;
+    b->tokens[b->token_count].len = len;
+    b->tokens[b->token_count].value = value;
+    b->token_count ++;
 }
 
-uint32_t get_bits(struct bitstream *bs, int bits)
+/* decode a block's body, looking symbols up in tables or (for -b)
+   walking trees */
+static inline void decode_body(struct block *b, struct bitstream *bs,
+        const void *table1, const void *table2, int walk_trees)
 {
-    uint32_t accum = 0;
+    long capacity = 0;
 
-    if (bits > 32)
+    while (!bitstream_eof(bs))
     {
-        fprintf(stderr, "get_bits() supports max 32\n");
-        exit(EXIT_FAILURE);
+        int symbol = walk_trees ? tree_lookup(bs, table1) : huf_lookup(bs, table1);
+
+        if (symbol < 0x100)
+        {
+            /* byte literal */
+            add_token(b, &capacity, 0, symbol);
+        }
+        else
+        {
+            /* backreference */
+            unsigned int len_bits = backref_len[symbol-0x100].bits;
+            unsigned int len = backref_len[symbol-0x100].base;
+            if (len_bits > 0)
+            {
+                len += get_bits(bs, len_bits);
+            }
+            len += 3;
+
+            int symbol2 = walk_trees ? tree_lookup(bs, table2) : huf_lookup(bs, table2);
+
+            unsigned int disp_bits = backref_disp[symbol2].bits;
+            unsigned int disp = backref_disp[symbol2].base;
+            if (disp_bits > 0)
+            {
+                disp += get_bits(bs, disp_bits);
+            }
+            disp ++;
+
+            add_token(b, &capacity, len, disp);
+        }
     }
-    if (bits > bs->bits_left + bs->first_byte_bits)
+}
+
+/* corrupt table sizes can point past the end of the block */
+static void check_in_block(unsigned long bit_offset, unsigned long total_bits)
+{
+    if (bit_offset > total_bits)
     {
-        fprintf(stderr, "get_bits() underflow\n");
+        fprintf(stderr, "table overruns block\n");
         exit(EXIT_FAILURE);
     }
+}
+
+void decode_block(struct block *b, int walk_trees)
+{
+    const unsigned char *payload_buf = b->payload;
+    const uint32_t payload_bytes = b->payload_bytes;
+    const int payload_bits = b->payload_bits;
+    const unsigned long total_bits = payload_bytes*8UL + payload_bits;
+
+    uint16_t tab1_size, tab2_size;
+    uint32_t body_size;
+    unsigned long tab1_offset, tab2_offset, body_offset;
+    struct bitstream bs;
+    void *table1, *table2;
+
+    if (!b->compressed)
+    {
+        return;
+    }
+
+    /* read table 1 size */
+    tab1_offset = 0;
+    init_bitstream(&bs, payload_buf + tab1_offset, total_bits);
+    tab1_size = get_bits(&bs, 16);
+
+    /* load table 1 */
+    check_in_block(tab1_offset*8 + 16 + tab1_size, total_bits);
+    init_bitstream(&bs, payload_buf + tab1_offset + 2, tab1_size);
+    table1 = walk_trees ? (void *)load_tree(&bs, 0x11D) : (void *)load_table(&bs, 0x11D);
+
+    /* read table 2 size */
+    tab2_offset = tab1_offset + 2 + (tab1_size+7) / 8;
+    check_in_block(tab2_offset*8 + 16, total_bits);
+    init_bitstream(&bs, payload_buf + tab2_offset, 2*8);
+    tab2_size = get_bits(&bs, 16);
+
+    /* load table 2 */
+    check_in_block(tab2_offset*8 + 16 + tab2_size, total_bits);
+    init_bitstream(&bs, payload_buf + tab2_offset + 2, tab2_size);
+    table2 = walk_trees ? (void *)load_tree(&bs, 0x1E) : (void *)load_table(&bs, 0x1E);
+
+    /* decode body */
+    body_offset = tab2_offset + 2 + (tab2_size+7) / 8;
+    check_in_block(body_offset*8, total_bits);
+    body_size = total_bits - body_offset*8;
+    init_bitstream(&bs, payload_buf + body_offset, body_size);
+
+    if (walk_trees)
+    {
+        decode_body(b, &bs, table1, table2, 1);
+        free_tree(table1);
+        free_tree(table2);
+    }
+    else
+    {
+        decode_body(b, &bs, table1, table2, 0);
+        free_table(table1);
+        free_table(table2);
+    }
+}
+
+/* stage two: add a block to the output, 0 on error */
+int apply_block(const struct block *b, unsigned char *out_buf,
+        uint64_t nominal_size, long *out_offset_p)
+{
+    long out_offset = *out_offset_p;
 
-    for (int i = 0; i < bits; i++)
+    if (!b->compressed)
     {
-        if (bs->first_byte_bits == 0)
+        if (out_offset + b->payload_bytes > nominal_size)
         {
-            bs->first_byte = *bs->pool;
-            bs->pool ++;
-            if (bs->bits_left >= 8)
+            fprintf(stderr, "generated too many bytes\n");
+            return 0;
+        }
+        memcpy(out_buf+out_offset, b->payload, b->payload_bytes);
+        *out_offset_p = out_offset + b->payload_bytes;
+        return 1;
+    }
+
+    for (long t = 0; t < b->token_count; t++)
+    {
+        const unsigned int len = b->tokens[t].len;
+
+        if (0 == len)
+        {
+            /* byte literal */
+            if (out_offset >= nominal_size)
             {
-                bs->first_byte_bits = 8;
-                bs->bits_left -= 8;
+                fprintf(stderr, "generated too many bytes\n");
+                return 0;
+            }
+            out_buf[out_offset++] = b->tokens[t].value;
+        }
+        else
+        {
+            /* backreference */
+            const uint32_t disp = b->tokens[t].value;
+
+            if (disp > out_offset)
+            {
+                fprintf(stderr, "backreference too far\n");
+                return 0;
+            }
+            if (out_offset+len > nominal_size)
+            {
+                fprintf(stderr, "generated too many bytes\n");
+                return 0;
+            }
+            if (disp >= len)
+            {
+                memcpy(out_buf+out_offset, out_buf+out_offset-disp, len);
+                out_offset += len;
             }
             else
             {
-                bs->first_byte_bits = bs->bits_left;
-                bs->bits_left = 0;
+                for (unsigned int i = 0; i < len; i++, out_offset++)
+                {
+                    out_buf[out_offset] = out_buf[out_offset-disp];
+                }
             }
         }
+    }
 
-        accum >>= 1;
-        accum |= (bs->first_byte & 1)<<31;
-        bs->first_byte >>= 1;
-        bs->first_byte_bits --;
+    *out_offset_p = out_offset;
+    return 1;
+}
+
+static double seconds(clock_t start)
+{
+    return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+static void print_rate(const char *name, double seconds, double mb)
+{
+    printf("%-12s%8.3f s  %8.2f MB/s\n", name, seconds,
+            seconds > 0 ? mb / seconds : 0);
+}
+
+/* both stages over every block, on this thread */
+static void decode_all(struct block *blocks, long block_count,
+        unsigned char *out_buf, uint64_t nominal_size, int walk_trees)
+{
+    long out_offset = 0;
+
+    for (long i = 0; i < block_count; i++)
+    {
+        decode_block(&blocks[i], walk_trees);
+        if (!apply_block(&blocks[i], out_buf, nominal_size, &out_offset))
+        {
+            exit(EXIT_FAILURE);
+        }
+
+        free(blocks[i].tokens);
+        blocks[i].tokens = NULL;
+        blocks[i].token_count = 0;
     }
 
-    return accum>>(32-bits);
+    if (out_offset != nominal_size)
+    {
+        fprintf(stderr, "size mismatch\n");
+        exit(EXIT_FAILURE);
+    }
 }
 
-int bitstream_eof(struct bitstream *bs)
+/* time the lookup tables against the tree walker, checking they agree */
+void bench_romc(struct block *blocks, long block_count, uint64_t nominal_size)
 {
-    return (bs->bits_left + bs->first_byte_bits == 0);
+    unsigned char *tree_out, *table_out;
+    clock_t start;
+    double tree_seconds, table_seconds, mb;
+
+    tree_out = malloc(nominal_size > 0 ? nominal_size : 1);
+    table_out = malloc(nominal_size > 0 ? nominal_size : 1);
+    if (!tree_out || !table_out)
+    {
+        perror("malloc bench buffers");
+        exit(EXIT_FAILURE);
+    }
+
+    start = clock();
+    for (int i = 0; i < BENCH_ROUNDS; i++)
+    {
+        decode_all(blocks, block_count, tree_out, nominal_size, 1);
+    }
+    tree_seconds = seconds(start);
+
+    start = clock();
+    for (int i = 0; i < BENCH_ROUNDS; i++)
+    {
+        decode_all(blocks, block_count, table_out, nominal_size, 0);
+    }
+    table_seconds = seconds(start);
+
+    if (memcmp(tree_out, table_out, nominal_size) != 0)
+    {
+        fprintf(stderr, "decoders disagree\n");
+        exit(EXIT_FAILURE);
+    }
+
+    mb = (double)nominal_size * BENCH_ROUNDS / 1e6;
+    printf("%lu bytes, %ld blocks, %d rounds\n",
+            (unsigned long)nominal_size, block_count, BENCH_ROUNDS);
+    print_rate("tree walk:", tree_seconds, mb);
+    print_rate("tables:", table_seconds, mb);
+
+    free(tree_out);
+    free(table_out);
+}
+
+void init_bitstream(struct bitstream *bs, const unsigned char *pool, unsigned long pool_size)
+{
+    bs->pool = pool;
+    bs->end = pool + (pool_size+7)/8;
+    bs->buf = 0;
+    bs->buf_bits = 0;
+    bs->bits_left = pool_size;
+
+    /* check that padding bits are 0 (to ensure we aren't ignoring anything) */
+    if (pool_size%8)
+    {
+        if (pool[pool_size/8] & ~((1<<(pool_size%8))-1))
+        {
+            fprintf(stderr, "nonzero padding at end of bitstream\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+/* buffer at least 56 bits (or all that are left), only call with
+   buf_bits < 32. Past the end of the stream are zeroes. */
+static inline void refill(struct bitstream *bs)
+{
+    if (bs->end - bs->pool >= 8)
+    {
+        /* take 8 bytes, the last one or two won't entirely fit and are
+           taken again next time (the bits that did fit are the same) */
+        uint64_t next = 0;
+        for (int i = 7; i >= 0; i--)
+        {
+            next = (next << 8) | bs->pool[i];
+        }
+
+        bs->buf |= next << bs->buf_bits;
+        bs->pool += (63 - bs->buf_bits) >> 3;
+        bs->buf_bits |= 56;
+    }
+    else
+    {
+        while (bs->buf_bits <= 56 && bs->pool < bs->end)
+        {
+            bs->buf |= (uint64_t)*bs->pool << bs->buf_bits;
+            bs->pool ++;
+            bs->buf_bits += 8;
+        }
+    }
+}
+
+static inline void drop_bits(struct bitstream *bs, int bits)
+{
+    if (bits > bs->bits_left)
+    {
+        fprintf(stderr, "get_bits() underflow\n");
+        exit(EXIT_FAILURE);
+    }
+
+    bs->buf >>= bits;
+    bs->buf_bits -= bits;
+    bs->bits_left -= bits;
+}
+
+uint32_t get_bits(struct bitstream *bs, int bits)
+{
+    uint32_t accum;
+
+    if (bs->buf_bits < 32)
+    {
+        refill(bs);
+    }
+
+    accum = bs->buf & ((UINT64_C(1) << bits) - 1);
+    drop_bits(bs, bits);
+
+    return accum;
 }
 
-void free_bitstream(struct bitstream *bs)
+int bitstream_eof(struct bitstream *bs)
 {
-    free(bs);
+    return (bs->bits_left == 0);
 }
 
 /* Huffman code handling */
-struct hufnode {
-    int is_leaf;
-    union {
-        struct {
-            int left, right;
-        } inner;
-        struct {
-            int symbol;
-        } leaf;
-    } u;
-};
-struct huftable {
-    int symbols;
-    struct hufnode *t;
-};
 
-struct huftable *load_table(struct bitstream *bs, int symbols)
+/* read the code length of each symbol, and count how many have each */
+void read_lengths(struct bitstream *bs, int symbols, int *length_of, int *len_count)
 {
-    int len_count[32] = {0};
-    uint32_t codes[32];
-    int length_of[symbols];
-    struct huftable *ht;
-    int next_free_node;
+    for (int i = 0; i < 32; i++)
+    {
+        len_count[i] = 0;
+    }
 
     for (int i = 0; i < symbols; )
     {
@@ -469,6 +859,12 @@ struct huftable *load_table(struct bitstream *bs, int symbols)
             int count = get_bits(bs, 7) + 2;
             int length = get_bits(bs, 5);
 
+            if (count > symbols - i)
+            {
+                fprintf(stderr, "too many lengths in table\n");
+                exit(EXIT_FAILURE);
+            }
+
             len_count[length] += count;
             for (int j = 0; j < count; j++, i++)
             {
@@ -480,6 +876,12 @@ struct huftable *load_table(struct bitstream *bs, int symbols)
             /* set of inequal lengths */
             int count = get_bits(bs, 7) + 1;
 
+            if (count > symbols - i)
+            {
+                fprintf(stderr, "too many lengths in table\n");
+                exit(EXIT_FAILURE);
+            }
+
             for (int j = 0; j < count; j++, i++)
             {
                 int length = get_bits(bs, 5);
@@ -495,20 +897,234 @@ struct huftable *load_table(struct bitstream *bs, int symbols)
         exit(EXIT_FAILURE);
     }
 
-    /* compute the first canonical Huffman code for each length */
-    len_count[0] = 0; // not strictly necessary
+    // 0 length indicates absent symbol
+    len_count[0] = 0;
+}
+
+/* compute the first canonical Huffman code for each length */
+static void first_codes(const int *len_count, uint32_t *codes)
+{
+    codes[0] = 0;
     for (uint32_t i = 1, accum = 0; i < 32; i++)
     {
         accum = codes[i] = (accum + len_count[i-1]) << 1;
     }
+}
+
+/* lookup table */
+
+static struct huftree *build_tree(const int *length_of, const int *len_count, int symbols);
+
+#define FAST_BITS 10
+#define FAST_SIZE (1<<FAST_BITS)
+
+struct huftable {
+    /* indexed by the next FAST_BITS bits: symbol<<5 | code length, or 0
+       for codes longer than FAST_BITS */
+    uint16_t fast[FAST_SIZE];
+
+    /* longer codes: those of each length run from first up to limit, for
+       the symbols in sorted from offset */
+    uint32_t first[32];
+    uint32_t limit[32];
+    int offset[32];
+    int max_length;
+    uint16_t sorted[MAX_SYMBOLS];
+
+    /* unless the code is complete, what isn't a code (or if codes
+       overlap, everything) is left to the tree walker, which goes back
+       to the root where a code is missing */
+    struct huftree *tree;
+};
+
+/* codes are read first bit first, which the bitstream puts lowest */
+static uint32_t reverse_bits(uint32_t code, int length)
+{
+    uint32_t reversed = 0;
+
+    for (int i = 0; i < length; i++, code >>= 1)
+    {
+        reversed = (reversed << 1) | (code & 1);
+    }
+
+    return reversed;
+}
+
+struct huftable *load_table(struct bitstream *bs, int symbols)
+{
+    int len_count[32];
+    uint32_t codes[32];
+    int length_of[symbols];
+    int next_sorted[32];
+    int sorted_count = 0;
+    int64_t unused = 1;
+    struct huftable *ht;
+
+    read_lengths(bs, symbols, length_of, len_count);
 
-    /* allocate space for the tree */
     ht = malloc(sizeof(struct huftable));
     if (!ht)
     {
         perror("malloc of huftable");
         exit(EXIT_FAILURE);
     }
+    memset(ht->fast, 0, sizeof(ht->fast));
+    ht->max_length = 0;
+    ht->tree = NULL;
+
+    for (int i = 1; i < 32 && unused >= 0; i++)
+    {
+        unused = unused*2 - len_count[i];
+    }
+    if (unused != 0)
+    {
+        ht->tree = build_tree(length_of, len_count, symbols);
+    }
+    if (unused < 0)
+    {
+        /* oversubscribed, codes overlap, only the tree can say which
+           symbol wins */
+        return ht;
+    }
+
+    first_codes(len_count, codes);
+
+    for (int i = 1; i < 32; i++)
+    {
+        ht->first[i] = codes[i];
+        ht->limit[i] = codes[i] + len_count[i];
+        ht->offset[i] = next_sorted[i] = sorted_count;
+        sorted_count += len_count[i];
+        if (len_count[i] > 0)
+        {
+            ht->max_length = i;
+        }
+    }
+
+    for (int i = 0; i < symbols; i++)
+    {
+        const int length = length_of[i];
+        uint32_t code;
+
+        if (0 == length)
+        {
+            continue;
+        }
+
+        code = codes[length]++;
+        ht->sorted[next_sorted[length]++] = i;
+
+        if (length <= FAST_BITS)
+        {
+            for (uint32_t j = reverse_bits(code, length); j < FAST_SIZE; j += 1<<length)
+            {
+                ht->fast[j] = (i<<5) | length;
+            }
+        }
+    }
+
+    return ht;
+}
+
+int huf_lookup(struct bitstream *bs, const struct huftable *ht)
+{
+    int length, symbol;
+    uint16_t entry;
+
+    if (bs->buf_bits < 32)
+    {
+        refill(bs);
+    }
+
+    entry = ht->fast[bs->buf & (FAST_SIZE-1)];
+    if (entry)
+    {
+        length = entry & 0x1F;
+        symbol = entry >> 5;
+    }
+    else
+    {
+        /* a longer code, find the length it's in range for */
+        uint32_t code = 0;
+
+        for (length = 1; length <= FAST_BITS; length++)
+        {
+            code = (code << 1) | ((bs->buf >> (length-1)) & 1);
+        }
+        for (;; length++)
+        {
+            if (length > ht->max_length)
+            {
+                return tree_lookup(bs, ht->tree);
+            }
+
+            code = (code << 1) | ((bs->buf >> (length-1)) & 1);
+            if (code < ht->limit[length])
+            {
+                break;
+            }
+        }
+
+        symbol = ht->sorted[ht->offset[length] + code - ht->first[length]];
+    }
+
+    drop_bits(bs, length);
+
+    return symbol;
+}
+
+void free_table(struct huftable *ht)
+{
+    if (ht)
+    {
+        free_tree(ht->tree);
+    }
+    free(ht);
+}
+
+/* tree, decoded a bit at a time */
+
+struct hufnode {
+    int is_leaf;
+    union {
+        struct {
+            int left, right;
+        } inner;
+        struct {
+            int symbol;
+        } leaf;
+    } u;
+};
+struct huftree {
+    int symbols;
+    struct hufnode *t;
+};
+
+struct huftree *load_tree(struct bitstream *bs, int symbols)
+{
+    int len_count[32];
+    int length_of[symbols];
+
+    read_lengths(bs, symbols, length_of, len_count);
+
+    return build_tree(length_of, len_count, symbols);
+}
+
+static struct huftree *build_tree(const int *length_of, const int *len_count, int symbols)
+{
+    uint32_t codes[32];
+    struct huftree *ht;
+    int next_free_node;
+
+    first_codes(len_count, codes);
+
+    /* allocate space for the tree */
+    ht = malloc(sizeof(struct huftree));
+    if (!ht)
+    {
+        perror("malloc of huftree");
+        exit(EXIT_FAILURE);
+    }
     ht->symbols = symbols;
     ht->t = malloc(sizeof(struct hufnode) * symbols * 2);
     if (!ht->t)
@@ -542,7 +1158,7 @@ struct huftable *load_table(struct bitstream *bs, int symbols)
                 exit(EXIT_FAILURE);
             }
 
-            if (codes[length_of[i]]&(1<<j))
+            if (codes[length_of[i]]&(UINT32_C(1)<<j))
             {
                 // 1 == right
                 next = ht->t[cur].u.inner.right;
@@ -561,6 +1177,12 @@ struct huftable *load_table(struct bitstream *bs, int symbols)
                 }
             }
 
+            if (next >= symbols*2)
+            {
+                fprintf(stderr, "oversubscribed Huffman table\n");
+                exit(EXIT_FAILURE);
+            }
+
             cur = next;
         }
 
@@ -573,7 +1195,7 @@ struct huftable *load_table(struct bitstream *bs, int symbols)
     return ht;
 }
 
-int huf_lookup(struct bitstream *bs, struct huftable *ht)
+int tree_lookup(struct bitstream *bs, const struct huftree *ht)
 {
     int cur = 0;
     while (!ht->t[cur].is_leaf)
@@ -593,7 +1215,7 @@ int huf_lookup(struct bitstream *bs, struct huftable *ht)
     return ht->t[cur].u.leaf.symbol;
 }
 
-void free_table(struct huftable *ht)
+void free_tree(struct huftree *ht)
 {
     if (ht)
     {
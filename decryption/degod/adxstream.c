@@ -0,0 +1,72 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "adxstream.h"
+
+int adx_stream_init(adx_stream * s, int start, int mult, int add) {
+    /* index+1 of where each value was first seen */
+    unsigned short * seen = calloc(0x8000, sizeof(unsigned short));
+    int xor = start & 0x7fff;
+    int n;
+
+    s->start = start;
+    s->mult = mult;
+    s->add = add;
+    s->xor = malloc(0x8000 * sizeof(unsigned short));
+    if (!seen || !s->xor) {
+        free(seen);
+        free(s->xor);
+        s->xor = NULL;
+        return 1;
+    }
+
+    for (n = 0; !seen[xor]; n++) {
+        s->xor[n] = xor;
+        seen[xor] = n + 1;
+        xor = (xor * mult + add) & 0x7fff;
+    }
+
+    s->tail = seen[xor] - 1;
+    s->period = n - s->tail;
+
+    free(seen);
+    return 0;
+}
+
+void adx_stream_free(adx_stream * s) {
+    free(s->xor);
+    s->xor = NULL;
+}
+
+long adx_stream_score(const adx_stream * s, long first, const int * scales, int count, int mask) {
+    long total = 0;
+    long n = first;
+    int i;
+
+    /* walk the table instead of the LCG, wrapping at the end of the cycle */
+    if (n >= s->tail) n = s->tail + (n - s->tail) % s->period;
+    for (i = 0; i < count; i++) {
+        if (scales[i] != 0)
+            total += (scales[i] ^ s->xor[n]) & mask;
+        if (++n == s->tail + s->period) n = s->tail;
+    }
+    return total;
+}
+
+long adx_stream_apply(const adx_stream * s, long first, unsigned char * frames, long count, int every_other, int mask) {
+    long n = first;
+    long i;
+    int step = every_other ? 2 : 1;
+
+    if (n >= s->tail) n = s->tail + (n - s->tail) % s->period;
+    for (i = 0; i < count; i += step, first++) {
+        unsigned char * frame = frames + i * 18;
+        int scale = ((frame[0] << 8) | frame[1]) ^ s->xor[n];
+
+        scale &= mask;
+        frame[0] = scale >> 8;
+        frame[1] = scale & 0xff;
+        if (++n == s->tail + s->period) n = s->tail;
+    }
+    return first;
+}
@@ -0,0 +1,34 @@
+#ifndef _ADXSTREAM_H_INCLUDED
+#define _ADXSTREAM_H_INCLUDED
+
+/* The xor stream of an ADX key (xor = xor*mult+add, 15 bits) has at most
+ * 0x8000 distinct values, so it can be generated once up to where it starts
+ * repeating and then read for any frame directly. */
+
+typedef struct {
+    int start, mult, add;
+    int tail;               /* values before the cycle (0 unless mult is even) */
+    int period;             /* length of the cycle */
+    unsigned short * xor;   /* tail+period values */
+} adx_stream;
+
+int adx_stream_init(adx_stream * s, int start, int mult, int add);
+void adx_stream_free(adx_stream * s);
+
+/* xor for the nth encrypted frame */
+static inline int adx_stream_at(const adx_stream * s, long n) {
+    if (n >= s->tail) n = s->tail + (n - s->tail) % s->period;
+    return s->xor[n];
+}
+
+/* total of decrypted scales[0..count) which are frames first..first+count
+ * of the stream, zero (silent, unencrypted) scales skipped */
+long adx_stream_score(const adx_stream * s, long first, const int * scales, int count, int mask);
+
+/* xor the scales of count 18-byte frames, the first being stream frame
+ * first; with every_other only every second frame (starting with the
+ * first) is touched, the rest aren't counted in the stream.
+ * returns the stream frame after the last */
+long adx_stream_apply(const adx_stream * s, long first, unsigned char * frames, long count, int every_other, int mask);
+
+#endif
@@ -1,6 +1,18 @@
+#define _POSIX_C_SOURCE 200112L
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <malloc.h>
+#include <limits.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+#include "adxstream.h"
 
 int read16(unsigned char * buf) {
     return (buf[0]<<8)|buf[1];
@@ -44,23 +56,26 @@ void guess_xor(int * scales, int scalecount, int startset, int startguess, int a
 int guess_from_start(int * scales, int scalecount, int start, int minestimate, int mask);
 int guess_from_low(int * scales, int scalecount, int start, int minestimate, int mask, int addguess, int multguess);
 int guess_from_mult(int * scales, int scalecount, int start, int minestimate, int mask, int multguess);
+int guess_dir(const char * dirname, int bruteframe, int bruteframecount, int topk, int startset, int startguess, int addset, int addguess, int multset, int multguess, int mask);
 
 void usage(const char * binname, int showkeys) {
     int i;
-    printf("degod 0.5\n");
+    printf("degod 0.7\n");
     if (!showkeys) {
-        printf("usage: %s (-k n)|(-s x -m x -a x) -M [-b [-f n] [-n n] [-d 0|1]] [-o outfile.adx] [-e] infile.adx\n\n",binname);
+        printf("usage: %s (-k n)|(-s x -m x -a x) -M [-b [-f n] [-n n] [-d 0|1] [-K n]] [-o outfile.adx] [-e] infile.adx|dir\n\n",binname);
         printf("Options:\n");
-        printf("\t-k n\tspecify a key id (use -k ? for a list of keys)\n");
+        printf("\t-k n\tspecify a key id (use -k ? for a list of keys,\n\t\t-k a to pick the best one, scored on -f/-n frames)\n");
         printf("\t-s x -m x -a x\tspecify a key by components\n");
         printf("\t-M\tmask out unused high bits (cannot be undone)\n");
         printf("\t-b\tattempt to brute force a key\n");
         printf("\t-f n\tfirst frame to brute force from\n");
         printf("\t-n n\tnumber of frames to use in brutal attack\n");
         printf("\t-d 0|1\tdifferent keys per channel, do channel 0 or 1\n");
+        printf("\t-K n\twith -b on a directory, how many keys to keep (default 16)\n");
         printf("\t-o outfile.adx\toutput to a different file\n\t\t(default is to modify original)\n");
         printf("\t-e\tencrypt, rather than decrypt\n");
         printf("\tinfile.adx\tthe ADX file to work with\n");
+        printf("\tdir\twith -b, brute force one key for all ADX files in dir\n");
     } else {
         printf("known keys:\n\n");
         for (i=0;i<KEY_COUNT;i++) {
@@ -74,10 +89,89 @@ void usage(const char * binname, int showkeys) {
     printf("\n");
 }
 
+enum {FRAME_CHUNK = 0x1000};    /* frames written at a time, even */
+
+/* the whole input, mapped if possible, otherwise read in */
+#ifndef _WIN32
+static int input_mapped = 0;
+#endif
+unsigned char * map_input(FILE * infile, long * length) {
+    unsigned char * data;
+
+    fseek(infile,0,SEEK_END);
+    *length=ftell(infile);
+    if (*length<=0) return NULL;
+
+#ifndef _WIN32
+    data=mmap(NULL,*length,PROT_READ,MAP_SHARED,fileno(infile),0);
+    if (data!=MAP_FAILED) {
+        input_mapped=1;
+        return data;
+    }
+#endif
+
+    data=malloc(*length);
+    if (!data) return NULL;
+    fseek(infile,0,SEEK_SET);
+    if (fread(data,1,*length,infile)!=*length) {free(data); return NULL;}
+    return data;
+}
+
+void unmap_input(unsigned char * data, long length) {
+#ifndef _WIN32
+    if (input_mapped) {
+        munmap(data,length);
+        return;
+    }
+#endif
+    free(data);
+}
+
+/* score each known key over a window of frames and return the best one's id;
+ * the stream tables let any window be scored without running the LCG up to it */
+int pick_key(const unsigned char * data, int startoff, int endoff, int firstframe, int framecount, int different, int diffwhich) {
+    int framesin=(endoff-startoff)/18;
+    int * scales = malloc(sizeof(int)*(framesin>0 ? framesin : 1));
+    int scalecount=0, first=-1;
+    int i, best=-1;
+    long besttotal=0;
+
+    if (!scales) return -1;
+    for (i=firstframe;i<framesin && (framecount<0 || scalecount<framecount);i++) {
+        if (different && (i&1)!=diffwhich) continue;
+        if (first<0) first = different ? i/2 : i;
+        scales[scalecount++]=read16((unsigned char *)data+startoff+i*18);
+    }
+    if (scalecount==0) {free(scales); return -1;}
+
+    for (i=0;i<KEY_COUNT;i++) {
+        adx_stream stream;
+        long total;
+
+        if (adx_stream_init(&stream,keys[i].start,keys[i].mult,keys[i].add)) {free(scales); return -1;}
+        total=adx_stream_score(&stream,first,scales,scalecount,0x7fff);
+        adx_stream_free(&stream);
+
+        printf("key %d\t%ld\t%s\n",i,total/scalecount,keys[i].name);
+        if (best<0 || total<besttotal) {best=i; besttotal=total;}
+    }
+    printf("using key %d\n",best);
+
+    free(scales);
+    return best;
+}
+
+/* sscanf %x wants an unsigned int */
+static int read_hex(const char * s, int * val) {
+    unsigned int u;
+    if (sscanf(s,"%x",&u)!=1) return 0;
+    *val=(int)u;
+    return 1;
+}
+
 int main(int argc, char ** argv) {
     FILE * infile = NULL, * outfile = NULL;
     int off,i;
-    int xor;
     int keyid=0;
     int xorstart;
     int xormult;
@@ -93,8 +187,12 @@ int main(int argc, char ** argv) {
     int startoff, endoff;
     int mask=0x7fff;
     int different=0;
-    int diffwhich;
+    int diffwhich=0;
     char * infilename = NULL, * outfilename = NULL;
+    int topk=16;
+    int keyauto=0;
+    unsigned char * data;
+    long length;
 
     if (argc<2) {
         usage(argv[0],0);
@@ -111,6 +209,7 @@ int main(int argc, char ** argv) {
                     if (addset || multset || startset) {printf("use only -k or all of -s, -m, and -a\n"); return 1;}
                     if (i+1>=argc) {printf("-k needs a key id\n"); return 1;}
                     if (argv[i+1][0]=='?') {usage(argv[0],1); return 1;}
+                    if (!strcmp(argv[i+1],"a")) {keyauto=1; keyidset=1; i++; break;}
                     if (sscanf(argv[i+1],"%d",&keyid)!=1 || keyid<0 || keyid>=KEY_COUNT) {printf("bad key id given to -k\n"); return 1;}
                     keyidset=1;
                     i++;
@@ -118,7 +217,7 @@ int main(int argc, char ** argv) {
                 case 's':
                 case 'm':
                 case 'a':
-                    if (keyid) {printf("use only -k or all of -s, -m, and -a\n"); return 1;}
+                    if (keyidset) {printf("use only -k or all of -s, -m, and -a\n"); return 1;}
                     {
                         int * setted;
                         int * val;
@@ -126,7 +225,7 @@ int main(int argc, char ** argv) {
                         if (argv[i][1]=='m') {setted=&multset; val=&xormult;}
                         if (argv[i][1]=='a') {setted=&addset; val=&xoradd;}
                         if (*setted) {printf("duplicate %s\n",argv[i]); return 1;}
-                        if (i+1>=argc || sscanf(argv[i+1],"%x",val)!=1) {printf("%s needs a hex value\n",argv[i]); return 1;}
+                        if (i+1>=argc || !read_hex(argv[i+1],val)) {printf("%s needs a hex value\n",argv[i]); return 1;}
                         *setted=1;
                         i++;
                     }
@@ -140,16 +239,16 @@ int main(int argc, char ** argv) {
                     brute=1;
                     break;
                 case 'f':
-                    if (i+1>=argc || sscanf(argv[i+1],"%x",&bruteframe)!=1) {printf("-f needs a frame number\n"); return 1;}
+                    if (i+1>=argc || !read_hex(argv[i+1],&bruteframe)) {printf("-f needs a frame number\n"); return 1;}
                     i++;
                     break;
                 case 'n':
-                    if (i+1>=argc || sscanf(argv[i+1],"%x",&bruteframecount)!=1) {printf("-n needs a frame count\n"); return 1;}
+                    if (i+1>=argc || !read_hex(argv[i+1],&bruteframecount)) {printf("-n needs a frame count\n"); return 1;}
                     i++;
                     break;
                 case 'd':
                     if (different) {printf("duplicate -d\n"); return 1;}
-                    if (i+1>=argc || sscanf(argv[i+1],"%x",&diffwhich)!=1 || (diffwhich!=0 && diffwhich!=1)) {printf("-d needs a channel number, 0 or 1\n"); return 1;}
+                    if (i+1>=argc || !read_hex(argv[i+1],&diffwhich) || (diffwhich!=0 && diffwhich!=1)) {printf("-d needs a channel number, 0 or 1\n"); return 1;}
                     different=1;
                     i++;
                     break;
@@ -159,6 +258,10 @@ int main(int argc, char ** argv) {
                     outfilename=argv[i+1];
                     i++;
                     break;
+                case 'K':
+                    if (i+1>=argc || sscanf(argv[i+1],"%d",&topk)!=1 || topk<1) {printf("-K needs a key count\n"); return 1;}
+                    i++;
+                    break;
                 case 'M':
                     if (mask==0x1fff) {printf("duplicate -M\n"); return 1;}
                     mask=0x1fff;
@@ -179,11 +282,13 @@ int main(int argc, char ** argv) {
     if (!infilename) {printf("must specify an input file\n"); return 1;}
     if (outfilename && !strcmp(infilename,outfilename)) {printf("using the same file for input and output in this manner will not work\n"); return 1;}
 
-    /* fetch the particular key by id */
-    if (keyidset) {
-        xorstart=keys[keyid].start;
-        xormult=keys[keyid].mult;
-        xoradd=keys[keyid].add;
+    /* a directory of files from one game, which should share a key */
+    if (brute) {
+        struct stat st;
+        if (stat(infilename,&st)==0 && S_ISDIR(st.st_mode)) {
+            if (different) {printf("-d doesn't work with a directory\n"); return 1;}
+            return guess_dir(infilename,bruteframe,bruteframecount,topk,startset,xorstart,addset,xoradd,multset,xormult,mask);
+        }
     }
 
     /* open files */
@@ -198,32 +303,26 @@ int main(int argc, char ** argv) {
     }
     if (!infile) {printf("failed to open input file %s\n",infilename); return 1;}
 
-    /* copy input file to output file */
-    if (outfilename) {
-#define DUMPBUFSIZE 512
-        char dumpbuf[DUMPBUFSIZE];
-        int dumped;
-        while (dumped=fread(dumpbuf,1,DUMPBUFSIZE,infile))
-            if (fwrite(dumpbuf,1,dumped,outfile)!=dumped) {printf("error writing output file %s\n",outfilename); return 1;}
-    }
+    /* everything is read from the mapped input from here on */
+    data=map_input(infile,&length);
+    if (!data) {printf("failed to read input file %s\n",infilename); return 1;}
 
     /* read header */
-    fseek(infile,0,SEEK_SET);
-    fread(buf,16,1,infile);
-    if (buf[0]!=0x80 || buf[1]!=0x00) {
+    if (length<0x14 || data[0]!=0x80 || data[1]!=0x00) {
         printf("%s is not ADX\n",infilename);
         return 1;
     }
-    if (buf[5]!=18) {
+    if (data[5]!=18) {
         printf("%s does not have 18-byte frames, how odd... FAIL\n",infilename);
         return 1;
     }
 
-    startoff=read16(buf+2)+4;
-    endoff=(read32(buf+12)+31)/32*18*buf[7]+startoff;
+    startoff=read16(data+2)+4;
+    endoff=(read32(data+12)+31)/32*18*data[7]+startoff;
+    if (endoff>length) endoff=startoff+(length-startoff)/18*18;
 
     /* get version, encryption flag */
-    fread(buf,4,1,infile);
+    memcpy(buf,data+0x10,4);
     if (!encrypt) {
         if (buf[3]!=8) {printf("%s doesn't seem to be encrypted\n",infilename); return 1;}
         buf[3]=0;
@@ -232,40 +331,76 @@ int main(int argc, char ** argv) {
         buf[3]=8;
     }
 
-    if (!brute) {
-        /* clear/set encryption flag */
-        fseek(outfile,0x10,SEEK_SET);
-        fwrite(buf,4,1,outfile);
-    }
-
-    if (!brute) xor=xorstart;
     if (brute) {
-        int framecount=endoff-startoff/18;
+        int framecount=(endoff-startoff)/18;
         if (framecount<bruteframecount || bruteframecount<0) bruteframecount=framecount;
         scales = malloc(sizeof(int) * bruteframecount);
         if (!scales) {printf("out of memory, try a smaller -n\n"); return 1;}
         scalecount=0;
+        for (off=startoff,i=0;off<endoff;off+=18,i++) {
+            if (different && (i&1)!=diffwhich) continue;
+            if (i>=bruteframe && scalecount<bruteframecount)
+                scales[scalecount++]=read16(data+off);
+        }
+
+        guess_xor(scales,scalecount,startset,xorstart,addset,xoradd,multset,xormult,mask);
+        return 0;
     }
-    for (off=startoff,i=0;off<endoff;off+=18,i++) {
-        fseek(infile,off,SEEK_SET);
-        fread(buf,18,1,infile);
 
-        if (different && (i&1)!=diffwhich) continue;
-        if (!brute) {
-            write16((read16(buf)^xor)&mask,buf);
-            fseek(outfile,off,SEEK_SET);
-            fwrite(buf,18,1,outfile);
+    /* fetch the particular key by id */
+    if (keyauto) {
+        keyid=pick_key(data,startoff,endoff,bruteframe,bruteframecount,different,diffwhich);
+        if (keyid<0) {printf("no frames to score keys with\n"); return 1;}
+    }
+    if (keyidset) {
+        xorstart=keys[keyid].start;
+        xormult=keys[keyid].mult;
+        xoradd=keys[keyid].add;
+    }
 
-            xor=(xor*xormult+xoradd)&0x7fff;
+    {
+        adx_stream stream;
+        unsigned char * chunk = malloc(FRAME_CHUNK*18);
+        long n = 0;
+
+        if (!chunk || adx_stream_init(&stream,xorstart,xormult,xoradd)) {printf("out of memory\n"); return 1;}
+
+        /* header, with the encryption flag cleared/set */
+        if (outfilename) {
+            if (fwrite(data,1,0x10,outfile)!=0x10 ||
+                fwrite(buf,1,4,outfile)!=4 ||
+                fwrite(data+0x14,1,startoff-0x14,outfile)!=startoff-0x14) {printf("error writing output file %s\n",outfilename); return 1;}
         } else {
-            if (i>=bruteframe && scalecount<bruteframecount)
-                scales[scalecount++]=read16(buf);
+            fseek(outfile,0x10,SEEK_SET);
+            fwrite(buf,4,1,outfile);
+            fseek(outfile,startoff,SEEK_SET);
         }
-    }
 
-    if (brute) {
-        guess_xor(scales,scalecount,startset,xorstart,addset,xoradd,multset,xormult,mask);
+        /* frames, a chunk at a time; chunks are an even number of frames so
+         * -d keeps to the same channel */
+        for (off=startoff;off<endoff;off+=FRAME_CHUNK*18) {
+            long frames = (endoff-off)/18 < FRAME_CHUNK ? (endoff-off)/18 : FRAME_CHUNK;
+            int skip = different ? diffwhich : 0;
+
+            memcpy(chunk,data+off,frames*18);
+            if (frames>skip)
+                n=adx_stream_apply(&stream,n,chunk+skip*18,frames-skip,different,mask);
+            if (fwrite(chunk,18,frames,outfile)!=frames) {printf("error writing output file\n"); return 1;}
+        }
+
+        /* anything after the frames */
+        if (outfilename && length>endoff) {
+            if (fwrite(data+endoff,1,length-endoff,outfile)!=length-endoff) {printf("error writing output file %s\n",outfilename); return 1;}
+        }
+
+        adx_stream_free(&stream);
+        free(chunk);
     }
+
+    if (fclose(outfile)) {printf("error writing output file\n"); return 1;}
+    if (outfile!=infile) fclose(infile);
+    unmap_input(data,length);
+    return 0;
 }
 
 /* Brute force estimation. I assume that the correct value will have the lowest total scales (as they will all be within reasonable levels). */
@@ -363,3 +498,229 @@ int guess_from_mult(int * scales, int scalecount, int start, int minestimate, in
     }
     return minestimate;
 }
+
+/* Brute forcing with a whole directory of files. Every file from a game is
+ * encrypted with the same key starting from its first frame, so the first
+ * few scales of all of them can be pooled and a key scored against all at
+ * once, which is much more selective than one file's worth. The cheap pass
+ * keeps only the best few keys in a heap; those are then scored again over
+ * every frame of every file. */
+
+typedef struct {
+    int start, mult, add;
+    long total;
+} candidate;
+
+typedef struct {
+    int ** scales;          /* from bruteframe on, per file */
+    int * scalecount;
+    int files;
+    int poolcount;          /* frames per file in the cheap pass */
+    int mask;
+
+    candidate * heap;       /* max-heap on total, the worst kept key on top */
+    int heapsize, topk;
+} pool;
+
+/* Total of the decrypted scales, lower is better. Silent frames are left
+ * unencrypted (see the guessadx readme), so zero scales don't count.
+ * Gives up once the total is over limit. */
+long score(int start, int mult, int add, const int * scales, int scalecount, int mask, long limit) {
+    int xor = start;
+    int i;
+    long total = 0;
+    for (i=0;i<scalecount && total<=limit;i++) {
+        if (scales[i] != 0)
+            total += (scales[i] ^ xor)&mask;
+        xor = (xor * mult + add)&0x7fff;
+    }
+    return total;
+}
+
+static void heap_down(candidate * heap, int size, int i) {
+    for (;;) {
+        int big = i, l = 2*i+1, r = 2*i+2;
+        candidate t;
+        if (l<size && heap[l].total>heap[big].total) big = l;
+        if (r<size && heap[r].total>heap[big].total) big = r;
+        if (big == i) return;
+        t = heap[i]; heap[i] = heap[big]; heap[big] = t;
+        i = big;
+    }
+}
+
+static void pool_try(pool * p, int start, int mult, int add) {
+    long limit = p->heapsize < p->topk ? LONG_MAX : p->heap[0].total;
+    long total = 0;
+    int f;
+
+    for (f=0;f<p->files && total<=limit;f++) {
+        int count = p->scalecount[f] < p->poolcount ? p->scalecount[f] : p->poolcount;
+        total += score(start,mult,add,p->scales[f],count,p->mask,limit-total);
+    }
+    if (total > limit) return;
+
+    if (p->heapsize < p->topk) {
+        /* not full yet, sift up */
+        int i = p->heapsize++;
+        p->heap[i].start = start; p->heap[i].mult = mult; p->heap[i].add = add;
+        p->heap[i].total = total;
+        while (i>0 && p->heap[(i-1)/2].total < p->heap[i].total) {
+            candidate t = p->heap[i];
+            p->heap[i] = p->heap[(i-1)/2];
+            p->heap[(i-1)/2] = t;
+            i = (i-1)/2;
+        }
+    } else if (total < p->heap[0].total) {
+        p->heap[0].start = start; p->heap[0].mult = mult; p->heap[0].add = add;
+        p->heap[0].total = total;
+        heap_down(p->heap,p->heapsize,0);
+    }
+}
+
+/* the same key spaces guess_xor searches */
+static void pool_start(pool * p, int start, int addset, int addguess, int multset, int multguess) {
+    int add, mult;
+    int step = (addset && multset) ? 0x100 : 1;
+
+    start &= 0x7fff;
+    for (add=(addset && multset) ? addguess : 0;add<p->mask+1;add+=step) {
+        if (multset && !addset) {
+            pool_try(p,start,multguess,add);
+            continue;
+        }
+        for (mult=(addset && multset) ? multguess : 0;mult<p->mask+1;mult+=step) {
+            pool_try(p,start,mult,add);
+        }
+    }
+}
+
+static int compare_candidate(const void * a, const void * b) {
+    const candidate * ca = a, * cb = b;
+    if (ca->total != cb->total) return ca->total < cb->total ? -1 : 1;
+    if (ca->start != cb->start) return ca->start - cb->start;
+    if (ca->mult != cb->mult) return ca->mult - cb->mult;
+    return ca->add - cb->add;
+}
+
+/* all scales of an encrypted ADX from frame bruteframe on, NULL if it isn't one */
+static int * read_adx_scales(const char * name, int bruteframe, int * count) {
+    FILE * infile = fopen(name,"rb");
+    unsigned char buf[20];
+    unsigned char * data;
+    int * scales;
+    int startoff, endoff, framecount, i;
+
+    if (!infile) return NULL;
+    if (fread(buf,20,1,infile)!=1 || buf[0]!=0x80 || buf[1]!=0x00 ||
+            buf[5]!=18 || buf[19]!=8) {
+        fclose(infile);
+        return NULL;
+    }
+
+    startoff=read16(buf+2)+4;
+    endoff=(read32(buf+12)+31)/32*18*buf[7]+startoff;
+    framecount=(endoff-startoff)/18-bruteframe;
+    if (framecount<=0) {fclose(infile); return NULL;}
+
+    /* one read for the whole body */
+    data = malloc((size_t)framecount*18);
+    scales = malloc(sizeof(int)*framecount);
+    if (!data || !scales) {printf("out of memory reading %s\n",name); exit(1);}
+    fseek(infile,startoff+bruteframe*18,SEEK_SET);
+    framecount = fread(data,18,framecount,infile);
+    fclose(infile);
+    if (framecount<=0) {free(data); free(scales); return NULL;}
+
+    for (i=0;i<framecount;i++) scales[i]=read16(data+i*18);
+    free(data);
+
+    *count = framecount;
+    return scales;
+}
+
+int guess_dir(const char * dirname, int bruteframe, int bruteframecount, int topk, int startset, int startguess, int addset, int addguess, int multset, int multguess, int mask) {
+    pool p;
+    DIR * dir;
+    struct dirent * ent;
+    long pooled = 0;
+    int startoff, start_firstguess;
+    int i;
+
+    p.scales = NULL;
+    p.scalecount = NULL;
+    p.files = 0;
+    p.mask = mask;
+    p.poolcount = bruteframecount<0 ? 16 : bruteframecount;
+    p.topk = topk;
+    p.heapsize = 0;
+    p.heap = malloc(sizeof(candidate)*topk);
+    if (!p.heap) {printf("out of memory, try a smaller -K\n"); return 1;}
+
+    dir = opendir(dirname);
+    if (!dir) {printf("failed to open directory %s\n",dirname); return 1;}
+    while ((ent = readdir(dir))) {
+        char * name = malloc(strlen(dirname)+1+strlen(ent->d_name)+1);
+        int * scales;
+        int count;
+
+        if (!name) {printf("out of memory\n"); return 1;}
+        sprintf(name,"%s/%s",dirname,ent->d_name);
+        scales = read_adx_scales(name,bruteframe,&count);
+        free(name);
+        if (!scales) continue;
+
+        p.scales = realloc(p.scales,sizeof(int *)*(p.files+1));
+        p.scalecount = realloc(p.scalecount,sizeof(int)*(p.files+1));
+        if (!p.scales || !p.scalecount) {printf("out of memory\n"); return 1;}
+        p.scales[p.files] = scales;
+        p.scalecount[p.files] = count;
+        p.files++;
+        pooled += count < p.poolcount ? count : p.poolcount;
+    }
+    closedir(dir);
+
+    if (p.files == 0) {printf("no encrypted ADX files in %s\n",dirname); return 1;}
+    printf("%d files, %ld frames pooled\n",p.files,pooled);
+
+    /* same starting guesses as guess_xor, around the first file's first scale */
+    if (startset) start_firstguess=startguess;
+    else {
+        for (i=0;i<p.files && p.scalecount[i]<=0;i++);
+        start_firstguess=p.scales[i][0];
+    }
+
+    pool_start(&p,start_firstguess,addset,addguess,multset,multguess);
+    for (startoff=1;startoff<0x1000;startoff++) {
+        pool_start(&p,start_firstguess+startoff,addset,addguess,multset,multguess);
+        pool_start(&p,start_firstguess-startoff,addset,addguess,multset,multguess);
+    }
+
+    /* verify the survivors against every frame */
+    for (i=0;i<p.heapsize;i++) {
+        int f;
+        p.heap[i].total = 0;
+        for (f=0;f<p.files;f++) {
+            p.heap[i].total += score(p.heap[i].start,p.heap[i].mult,p.heap[i].add,
+                    p.scales[f],p.scalecount[f],mask,LONG_MAX);
+        }
+    }
+    qsort(p.heap,p.heapsize,sizeof(candidate),compare_candidate);
+
+    {
+        long framecount = 0;
+        for (i=0;i<p.files;i++) framecount += p.scalecount[i];
+        printf("best %d, over all %ld frames:\n",p.heapsize,framecount);
+        for (i=0;i<p.heapsize;i++) {
+            printf("-s %04x -m %04x -a %04x\tscaletotal\t%ld\t%ld\n",
+                    p.heap[i].start,p.heap[i].mult,p.heap[i].add,
+                    p.heap[i].total,p.heap[i].total/framecount);
+        }
+    }
+
+    for (i=0;i<p.files;i++) free(p.scales[i]);
+    free(p.scales);
+    free(p.scalecount);
+    free(p.heap);
+    return 0;
+}
@@ -1,25 +1,25 @@
 #include <stdio.h>
-#include <string.h>
 
-char been[65536];
+#include "adxstream.h"
 
 int main(int argc, char ** argv) {
 	int i;
-	int xor;
-	int xorstart,xormult,xoradd;
+	unsigned int xorstart,xormult,xoradd;
+	adx_stream stream;
 
 	if (argc!=4) {printf("Usage: %s start mult add\n",argv[0]); return 1;}
 
-	memset(been,0,sizeof(been));
-
 	sscanf(argv[1],"%x",&xorstart);
 	sscanf(argv[2],"%x",&xormult);
 	sscanf(argv[3],"%x",&xoradd);
 
-	for (i=0,xor=xorstart;!been[xor];i++) {
-		printf("%d\t%04x\n",i,xor);
-		been[xor]=1;
-		xor=((xor*xormult)+xoradd)&0x7fff;
-	}
-	printf("%d\t%04x\n",i,xor);
+	if (adx_stream_init(&stream,xorstart,xormult,xoradd)) {printf("out of memory\n"); return 1;}
+
+	for (i=0;i<stream.tail+stream.period;i++)
+		printf("%d\t%04x\n",i,stream.xor[i]);
+	/* the first repeat */
+	printf("%d\t%04x\n",i,stream.xor[stream.tail]);
+
+	adx_stream_free(&stream);
+	return 0;
 }
@@ -1,5 +1,5 @@
 /*
- * guessadx 0.4
+ * guessadx 0.5
  * by hcs
  *
  * find all possible encryption keys for an ADX file
@@ -7,6 +7,7 @@
  * Search is restricted to prime multipliers and increments.
  */
 
+#define _POSIX_C_SOURCE 200112L
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -14,6 +15,10 @@
 #include <limits.h>
 #include <time.h>
 #include <errno.h>
+#include <pthread.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
 enum {PRIMES_UP_TO = 0x8000};   /* noninclusive */
 
@@ -26,9 +31,15 @@ int read32(unsigned char * buf) {
 }
 
 void usage(const char * binname) {
-    fprintf(stderr,"guessadx 0.4\n");
-    fprintf(stderr,"usage: %s infile.adx [node_id total_nodes]\n",binname);
+    fprintf(stderr,"guessadx 0.5\n");
+    fprintf(stderr,"usage: %s [options] infile.adx [node_id total_nodes]\n",binname);
     fprintf(stderr,
+" -j threads     run the search on that many threads\n"
+" -c file        keep a checkpoint of finished starts and found keys in file\n"
+" --resume       skip the starts the checkpoint says are finished\n"
+" -u first-last  only search these starts (hex, 0-1fff)\n"
+" --work-units n print the unfinished starts as -u ranges of n starts, then\n"
+"                exit\n"
 " For parallel processing, total_nodes is the number of guessadx instances,\n"
 " and node_id is an integer from 0 to total_nodes-1 uniquely identifying this\n"
 " instance.\n\n");
@@ -46,6 +57,349 @@ int score(int start, int mult, int add, unsigned short * scales, int scalecount)
     return total;
 }
 
+enum {START_COUNT = 0x2000};     /* low bits of start we guess */
+enum {CHECKPOINT_SECONDS = 60};
+
+struct found_line {
+    int start;
+    char line[64];
+};
+
+/* shared state for the search, the (start, mult) space is handed out to
+ * threads in chunks and every add is tried at once for each pair */
+struct search {
+    unsigned short * scales;
+    unsigned short * scalebits;     /* scales&0x6000, what the LCG must match */
+    int scales_to_do;
+    unsigned short * prescales;
+    int bruteframe;
+
+    int * primes;
+    unsigned short * adds;          /* primes again, as 16-bit lanes */
+    int primecount;
+
+    int * todo;                     /* start values (low bits) to search */
+    long next, total, done;
+    int running;
+
+    /* for the checkpoint: (start, mult) pairs done for each start, and
+     * every key line printed, with the start it was found from */
+    unsigned short * mults_done;
+    unsigned char * start_done;
+    struct found_line * found;
+    int foundcount, foundsize;
+
+    pthread_mutex_t lock;           /* guards the above and output */
+    pthread_cond_t progress;
+    int noback;
+};
+
+enum {CHUNK = 64};  /* (start, mult) pairs per grab */
+
+/* remember a key line for the checkpoint, call with the lock held */
+static void add_found(struct search * sr, int start, const char * line) {
+    if (sr->foundcount == sr->foundsize) {
+        sr->foundsize = sr->foundsize ? sr->foundsize*2 : 16;
+        sr->found = realloc(sr->found, sr->foundsize*sizeof(struct found_line));
+        if (!sr->found) {
+            fprintf(stderr,"error allocating memory for keys\n");
+            exit(1);
+        }
+    }
+    sr->found[sr->foundcount].start = start;
+    snprintf(sr->found[sr->foundcount].line, sizeof(sr->found[0].line), "%s", line);
+    sr->foundcount++;
+}
+
+static void print_key(struct search * sr, int start, const char * line) {
+    pthread_mutex_lock(&sr->lock);
+    printf("%s\n",line);
+    fflush(stdout);
+    add_found(sr,start,line);
+    pthread_mutex_unlock(&sr->lock);
+}
+
+/* print one key (all real starts for it, if we aren't on the first frame) */
+static void found_key(struct search * sr, int start, int mult, int add) {
+    pthread_mutex_lock(&sr->lock);
+    fprintf(stderr,"\n");
+    fflush(stderr);
+    sr->noback=1;
+    pthread_mutex_unlock(&sr->lock);
+
+    /* if our "start" isn't actually on the first frame,
+     * find possible real start values */
+    if (sr->bruteframe>0) {
+        int realstart;
+        int i;
+        for (realstart = 0; realstart < 0x7fff; realstart++) {
+            int xor = realstart;
+            for (i=0;i<sr->bruteframe &&
+                    ((sr->prescales[i]&0x6000)==(xor&0x6000) ||
+                     sr->prescales[i]==0);
+                    i++) {
+                xor = xor * mult + add;
+            }
+
+            if (i==sr->bruteframe && (xor&0x7fff)==start) {
+                char line[64];
+                snprintf(line,sizeof(line),"-s %4x -m %4x -a %4x (error %d)",realstart,mult,add,score(start,mult,add,sr->scales,sr->scales_to_do)+score(realstart,mult,add,sr->prescales,sr->bruteframe));
+                print_key(sr,start&(START_COUNT-1),line);
+            }
+        }
+    } else {
+        char line[64];
+        snprintf(line,sizeof(line),"-s %4x -m %4x -a %4x (error %d)",start,mult,add,score(start,mult,add,sr->scales,sr->scales_to_do));
+        print_key(sr,start&(START_COUNT-1),line);
+    }
+}
+
+/* Try every prime increment for this start and mult. The LCG only matters
+ * mod 0x8000, so 16-bit lanes are enough: 16 (AVX2) or 8 (SSE2) increments
+ * step together until every lane has missed a scale. */
+static void try_adds(struct search * sr, int start, int mult) {
+    const unsigned short * scalebits = sr->scalebits;
+    const int scales_to_do = sr->scales_to_do;
+    int k = 0;
+
+#if defined(__AVX2__)
+    {
+        const __m256i vmult = _mm256_set1_epi16(mult);
+        const __m256i vstart = _mm256_set1_epi16(start);
+        const __m256i mask = _mm256_set1_epi16(0x6000);
+
+        for (; k+16 <= sr->primecount; k+=16) {
+            const __m256i add = _mm256_loadu_si256((const __m256i *)(sr->adds+k));
+            __m256i xor = vstart;
+            __m256i alive = _mm256_set1_epi16(-1);
+            int s;
+
+            for (s=1;s<scales_to_do;s++) {
+                xor = _mm256_add_epi16(_mm256_mullo_epi16(xor, vmult), add);
+                alive = _mm256_and_si256(alive, _mm256_cmpeq_epi16(
+                            _mm256_and_si256(xor, mask),
+                            _mm256_set1_epi16(scalebits[s])));
+                if (!_mm256_movemask_epi8(alive)) break;
+            }
+
+            if (s==scales_to_do) {
+                unsigned int hits = _mm256_movemask_epi8(alive);
+                for (int lane=0;lane<16;lane++) {
+                    if (hits & (1U<<(lane*2))) found_key(sr,start,mult,sr->primes[k+lane]);
+                }
+            }
+        }
+    }
+#elif defined(__SSE2__)
+    {
+        const __m128i vmult = _mm_set1_epi16(mult);
+        const __m128i vstart = _mm_set1_epi16(start);
+        const __m128i mask = _mm_set1_epi16(0x6000);
+
+        for (; k+8 <= sr->primecount; k+=8) {
+            const __m128i add = _mm_loadu_si128((const __m128i *)(sr->adds+k));
+            __m128i xor = vstart;
+            __m128i alive = _mm_set1_epi16(-1);
+            int s;
+
+            for (s=1;s<scales_to_do;s++) {
+                xor = _mm_add_epi16(_mm_mullo_epi16(xor, vmult), add);
+                alive = _mm_and_si128(alive, _mm_cmpeq_epi16(
+                            _mm_and_si128(xor, mask),
+                            _mm_set1_epi16(scalebits[s])));
+                if (!_mm_movemask_epi8(alive)) break;
+            }
+
+            if (s==scales_to_do) {
+                unsigned int hits = _mm_movemask_epi8(alive);
+                for (int lane=0;lane<8;lane++) {
+                    if (hits & (1U<<(lane*2))) found_key(sr,start,mult,sr->primes[k+lane]);
+                }
+            }
+        }
+    }
+#endif
+
+    /* whatever is left over (or everything, without SIMD) */
+    for (; k<sr->primecount; k++) {
+        int add = sr->primes[k];
+        int xor = start;
+        int s;
+
+        /* test */
+        for (s=1;s<scales_to_do &&
+                scalebits[s]==((xor = xor * mult + add)&0x6000);s++) {}
+
+        /* if we tested all values, we have a match */
+        if (s==scales_to_do) found_key(sr,start,mult,add);
+    }
+}
+
+static void * search_worker(void * arg) {
+    struct search * sr = arg;
+
+    for (;;) {
+        long first, n, end;
+
+        pthread_mutex_lock(&sr->lock);
+        first = sr->next;
+        sr->next += CHUNK;
+        pthread_mutex_unlock(&sr->lock);
+
+        if (first >= sr->total) break;
+        end = first+CHUNK > sr->total ? sr->total : first+CHUNK;
+
+        for (n=first; n<end; n++) {
+            int i = sr->todo[n / sr->primecount];
+            int start = i+(sr->scales[0]&0x6000);
+
+            /* it is assumed that only prime multipliers are used */
+            try_adds(sr, start, sr->primes[n % sr->primecount]);
+        }
+
+        pthread_mutex_lock(&sr->lock);
+        sr->done += end - first;
+        for (n=first; n<end; n++) {
+            int i = sr->todo[n / sr->primecount];
+            if (++sr->mults_done[i] == sr->primecount) sr->start_done[i] = 1;
+        }
+        pthread_mutex_unlock(&sr->lock);
+    }
+
+    pthread_mutex_lock(&sr->lock);
+    sr->running--;
+    pthread_cond_signal(&sr->progress);
+    pthread_mutex_unlock(&sr->lock);
+
+    return NULL;
+}
+
+/* identifies the file and frames being searched, so a checkpoint isn't
+ * resumed against the wrong search */
+static unsigned long search_id(const struct search * sr) {
+    unsigned long hash = 2166136261UL;
+    int i;
+    for (i=0;i<sr->scales_to_do;i++) {
+        hash = ((hash ^ sr->scales[i]) * 16777619UL) & 0xffffffffUL;
+    }
+    return hash;
+}
+
+/* Checkpoints are plain text:
+ *   guessadx checkpoint <id> <bruteframe> <scales>
+ *   done <first>-<last>        finished starts, hex
+ *   key <start> <key line>     a key found from that start
+ * Every line of a checkpoint is independent, so checkpoints from different
+ * work units of the same file can simply be concatenated. */
+static void write_checkpoint(const struct search * sr, const char * name) {
+    char * tmpname = malloc(strlen(name)+5);
+    FILE * outfile;
+    int i;
+
+    if (!tmpname) {
+        fprintf(stderr,"error allocating memory for checkpoint\n");
+        exit(1);
+    }
+    sprintf(tmpname,"%s.tmp",name);
+
+    outfile = fopen(tmpname,"w");
+    if (!outfile) {
+        perror(tmpname);
+        exit(1);
+    }
+
+    fprintf(outfile,"guessadx checkpoint %08lx %d %d\n",
+            search_id(sr),sr->bruteframe,sr->scales_to_do);
+    for (i=0;i<START_COUNT;i++) {
+        if (sr->start_done[i]) {
+            int last = i;
+            while (last+1<START_COUNT && sr->start_done[last+1]) last++;
+            fprintf(outfile,"done %04x-%04x\n",i,last);
+            i = last;
+        }
+    }
+    /* keys from an unfinished start will be found again */
+    for (i=0;i<sr->foundcount;i++) {
+        if (sr->start_done[sr->found[i].start]) {
+            fprintf(outfile,"key %04x %s\n",sr->found[i].start,sr->found[i].line);
+        }
+    }
+
+    if (fclose(outfile)) {
+        perror(tmpname);
+        exit(1);
+    }
+
+    /* replace the old checkpoint only once the new one is complete */
+    if (rename(tmpname,name)) {
+        remove(name);
+        if (rename(tmpname,name)) {
+            perror(name);
+            exit(1);
+        }
+    }
+    free(tmpname);
+}
+
+/* mark done starts and print their keys to keyfile; a missing file is just
+ * empty */
+static void read_checkpoint(struct search * sr, const char * name, FILE * keyfile) {
+    FILE * ckfile = fopen(name,"r");
+    char line[256];
+    unsigned long id = search_id(sr);
+
+    if (!ckfile) {
+        if (errno == ENOENT) return;
+        perror(name);
+        exit(1);
+    }
+
+    while (fgets(line,sizeof(line),ckfile)) {
+        unsigned long file_id;
+        int bruteframe, scales_to_do;
+        unsigned int first, last, start;
+        int keyat;
+        char * newline = strchr(line,'\n');
+
+        if (newline) *newline = '\0';
+
+        if (3 == sscanf(line,"guessadx checkpoint %lx %d %d",&file_id,&bruteframe,&scales_to_do)) {
+            if (file_id != id || bruteframe != sr->bruteframe || scales_to_do != sr->scales_to_do) {
+                fprintf(stderr,"%s is a checkpoint for a different search\n",name);
+                exit(1);
+            }
+        } else if (2 == sscanf(line,"done %x-%x",&first,&last) &&
+                first <= last && last < START_COUNT) {
+            for (;first<=last;first++) sr->start_done[first] = 1;
+        } else if (1 == sscanf(line,"key %x %n",&start,&keyat) && start < START_COUNT) {
+            add_found(sr,start,line+keyat);
+        } else if (line[0] != '\0') {
+            fprintf(stderr,"bad line in %s: %s\n",name,line);
+            exit(1);
+        }
+    }
+    fclose(ckfile);
+
+    /* concatenated checkpoints may repeat keys */
+    {
+        int i, j, kept = 0;
+        for (i=0;i<sr->foundcount;i++) {
+            if (!sr->start_done[sr->found[i].start]) continue;
+            for (j=0;j<kept;j++) {
+                if (!strcmp(sr->found[j].line,sr->found[i].line)) break;
+            }
+            if (j<kept) continue;
+            sr->found[kept++] = sr->found[i];
+        }
+        sr->foundcount = kept;
+    }
+
+    for (int i=0;i<sr->foundcount;i++) {
+        fprintf(keyfile,"%s\n",sr->found[i].line);
+    }
+    fflush(keyfile);
+}
+
 int main(int argc, char ** argv) {
     FILE * infile = NULL;
     int bruteframe=0,bruteframecount=-1;
@@ -56,9 +410,61 @@ int main(int argc, char ** argv) {
     int isprime[PRIMES_UP_TO];
     int primecount;
     long node_id = 0, total_nodes = 1;
+    long jobs = 1;
+    const char * checkpoint = NULL;
+    int resume = 0;
+    unsigned long unit_first = 0, unit_last = START_COUNT-1;
+    long unit_size = 0;
+    int have_unit = 0;
 
     /* parse command line */
 
+    while (argc >= 3 && argv[1][0] == '-') {
+        char *endptr;
+        int used = 2;
+
+        errno = 0;
+        if (!strcmp(argv[1],"-j")) {
+            jobs = strtol(argv[2], &endptr, 10);
+            if ( 0 != errno || argv[2] + strlen(argv[2]) != endptr || '\0' == argv[2][0] ||
+                    jobs <= 0 || jobs > 1024 ) {
+                fprintf(stderr, "invalid thread count\n");
+                return 1;
+            }
+        } else if (!strcmp(argv[1],"-c")) {
+            checkpoint = argv[2];
+        } else if (!strcmp(argv[1],"--resume")) {
+            resume = 1;
+            used = 1;
+        } else if (!strcmp(argv[1],"-u")) {
+            if (2 != sscanf(argv[2],"%lx-%lx",&unit_first,&unit_last) ||
+                    unit_first > unit_last || unit_last >= START_COUNT) {
+                fprintf(stderr, "invalid work unit\n");
+                return 1;
+            }
+            have_unit = 1;
+        } else if (!strcmp(argv[1],"--work-units")) {
+            unit_size = strtol(argv[2], &endptr, 0);
+            if ( 0 != errno || argv[2] + strlen(argv[2]) != endptr || '\0' == argv[2][0] ||
+                    unit_size <= 0 ) {
+                fprintf(stderr, "invalid work unit size\n");
+                return 1;
+            }
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+
+        argv[used] = argv[0];
+        argv += used;
+        argc -= used;
+    }
+
+    if (resume && !checkpoint) {
+        fprintf(stderr, "--resume needs a checkpoint (-c)\n");
+        return 1;
+    }
+
     if (argc != 2) {
         if (argc != 4) {
             usage(argv[0]);
@@ -106,6 +512,11 @@ int main(int argc, char ** argv) {
                 fprintf(stderr, "node_id out of range\n");
                 return 1;
             }
+
+            if (have_unit) {
+                fprintf(stderr, "use either -u or node_id total_nodes\n");
+                return 1;
+            }
         }
     }
 
@@ -203,7 +614,6 @@ int main(int argc, char ** argv) {
         unsigned short * prescales = NULL;
         int scales_to_do;
         static time_t starttime;
-        int noback=1;
 
         /* allocate storage for scales */
         scales_to_do = (bruteframecount > MAX_FRAMES ? MAX_FRAMES : bruteframecount);
@@ -249,11 +659,66 @@ int main(int argc, char ** argv) {
         }
 
         /* determine limits of search */
-        int scales_per_node = (0x2000+total_nodes-1) / total_nodes;
-        int start_scale = scales_per_node * node_id;
-        int end_scale = scales_per_node * (node_id+1);
-        if (end_scale > 0x2000) {
-            end_scale = 0x2000;
+        int start_scale, end_scale;
+        if (have_unit) {
+            start_scale = unit_first;
+            end_scale = unit_last+1;
+        } else {
+            int scales_per_node = (START_COUNT+total_nodes-1) / total_nodes;
+            start_scale = scales_per_node * node_id;
+            end_scale = scales_per_node * (node_id+1);
+            if (end_scale > START_COUNT) {
+                end_scale = START_COUNT;
+            }
+        }
+
+        struct search sr;
+        sr.scales = scales;
+        sr.scales_to_do = scales_to_do;
+        sr.prescales = prescales;
+        sr.bruteframe = bruteframe;
+        sr.primes = primes;
+        sr.primecount = primecount;
+        sr.next = 0;
+        sr.done = 0;
+        sr.noback = 1;
+        sr.found = NULL;
+        sr.foundcount = sr.foundsize = 0;
+
+        sr.scalebits = malloc(scales_to_do*sizeof(unsigned short));
+        sr.adds = malloc(primecount*sizeof(unsigned short));
+        sr.todo = malloc(START_COUNT*sizeof(int));
+        sr.mults_done = calloc(START_COUNT,sizeof(unsigned short));
+        sr.start_done = calloc(START_COUNT,1);
+        if (!sr.scalebits || !sr.adds || !sr.todo || !sr.mults_done || !sr.start_done) {
+            fprintf(stderr,"error allocating memory for search\n");
+            return 1;
+        }
+        for (int i=0;i<scales_to_do;i++) sr.scalebits[i] = scales[i]&0x6000;
+        for (int i=0;i<primecount;i++) sr.adds[i] = primes[i];
+
+        /* with --work-units, stdout is only -u lines */
+        if (resume) {
+            read_checkpoint(&sr, checkpoint, unit_size ? stderr : stdout);
+        }
+
+        /* only hand out starts that aren't finished */
+        int todocount = 0;
+        for (int i=start_scale;i<end_scale;i++) {
+            if (!sr.start_done[i]) sr.todo[todocount++] = i;
+        }
+        sr.total = (long)todocount * primecount;
+
+        if (unit_size) {
+            /* split what's left into units, as runs of unfinished starts */
+            for (int i=0;i<todocount;) {
+                int j = i;
+                while (j+1 < todocount && j+1-i < unit_size &&
+                        sr.todo[j+1] == sr.todo[j]+1) j++;
+                printf("-u %04x-%04x\n",sr.todo[i],sr.todo[j]);
+                i = j+1;
+            }
+            return 0;
         }
 
         fprintf(stderr,"checking from %x to %x\n",start_scale,end_scale);
@@ -261,81 +726,77 @@ int main(int argc, char ** argv) {
         starttime = time(NULL);
 
         /* do it! */
+        pthread_t * threads = malloc(jobs*sizeof(pthread_t));
+        if (!threads ||
+                pthread_mutex_init(&sr.lock, NULL) ||
+                pthread_cond_init(&sr.progress, NULL)) {
+            fprintf(stderr,"error setting up threads\n");
+            return 1;
+        }
+        sr.running = jobs;
+        for (long t=0;t<jobs;t++) {
+            if (pthread_create(&threads[t], NULL, search_worker, &sr)) {
+                fprintf(stderr,"error starting thread\n");
+                return 1;
+            }
+        }
 
-        /* guess possible low bits for start */
-        for (int i=start_scale;i<end_scale;i++) {
-            int start = i+(scales[0]&0x6000);
-            /* status report */
-            if (i>=start_scale+1) {
+        /* status report about once a second, in start values done */
+        time_t checkpoint_time = time(NULL);
+        pthread_mutex_lock(&sr.lock);
+        while (sr.running > 0) {
+            struct timespec wake;
+            wake.tv_sec = time(NULL)+1;
+            wake.tv_nsec = 0;
+            pthread_cond_timedwait(&sr.progress, &sr.lock, &wake);
+
+            int starts_done = sr.done / primecount;
+            if (starts_done>=1 && sr.running > 0) {
                 char messagebuf[100];
                 time_t etime = time(NULL)-starttime;
-                time_t donetime = scales_per_node*etime/(i-start_scale)-etime;
+                time_t donetime = (time_t)((double)sr.total*etime/sr.done)-etime;
 
                 sprintf(messagebuf,"%4x %3d%% %8ld minute%c elapsed %8ld minute%c left (maybe)",
-                        i-start_scale,
-                        (i-start_scale)*100/scales_per_node,
-                        (etime/60),
+                        starts_done,
+                        (int)(sr.done*100/sr.total),
+                        (long)(etime/60),
                         (etime/60)!=1 ? 's' : ' ',
-                        (donetime/60),
+                        (long)(donetime/60),
                         (donetime/60)!=1 ? 's' : ' ');
-                if (!noback) {
+                if (!sr.noback) {
                     int i;
                     for (i=0;i<strlen(messagebuf);i++)
                         fprintf(stderr,"\b");
                 }
                 fprintf(stderr,"%s",messagebuf);
                 fflush(stderr);
-                noback=0;
+                sr.noback=0;
             }
 
-            /* guess multiplier */
-            /* it is assumed that only prime multipliers are used */
-            for (int j=0;j<primecount;j++) {
-                int mult = primes[j];
-
-                /* guess increment */
-                for (int k=0;k<primecount;k++) {
-                    int add = primes[k];
-                    int xor = start;
-                    int s;
-
-                    /* test */
-                    for (s=1;s<scales_to_do &&
-                            (scales[s]&0x6000)==
-                            ((xor = xor * mult + add)&0x6000);s++) {}
-
-                    /* if we tested all values, we have a match */
-                    if (s==scales_to_do) {
-                        fprintf(stderr,"\n");
-                        fflush(stderr);
-                        noback=1;
-
-                        /* if our "start" isn't actually on the first frame,
-                         * find possible real start values */
-                        if (bruteframe>0) {
-                            int realstart;
-                            int i;
-                            for (realstart = 0; realstart < 0x7fff; realstart++) {
-                                int xor = realstart;
-                                for (i=0;i<bruteframe &&
-                                        ((prescales[i]&0x6000)==(xor&0x6000) ||
-                                         prescales[i]==0);
-                                        i++) {
-                                    xor = xor * mult + add;
-                                }
-
-                                if (i==bruteframe && (xor&0x7fff)==start) {
-                                    printf("-s %4x -m %4x -a %4x (error %d)\n",realstart,mult,add,score(start,mult,add,scales,scales_to_do)+score(realstart,mult,add,prescales,bruteframe));
-                                }
-                            }
-                        } else {
-                            printf("-s %4x -m %4x -a %4x (error %d)\n",start,mult,add,score(start,mult,add,scales,scales_to_do));
-                        }
-                        fflush(stdout);
-                    }
-                } /* end add for loop */
-            } /* end mult for loop */
-        } /* end start for loop */
+            if (checkpoint && time(NULL)-checkpoint_time >= CHECKPOINT_SECONDS) {
+                write_checkpoint(&sr, checkpoint);
+                checkpoint_time = time(NULL);
+            }
+        }
+        pthread_mutex_unlock(&sr.lock);
+
+        for (long t=0;t<jobs;t++) {
+            pthread_join(threads[t], NULL);
+        }
+
+        if (checkpoint) {
+            write_checkpoint(&sr, checkpoint);
+        }
+
+        pthread_cond_destroy(&sr.progress);
+        pthread_mutex_destroy(&sr.lock);
+        free(threads);
+        free(sr.found);
+        free(sr.start_done);
+        free(sr.mults_done);
+        free(sr.todo);
+        free(sr.adds);
+        free(sr.scalebits);
     } /* end key guess section */
     fprintf(stderr,"\n");
     return 0;
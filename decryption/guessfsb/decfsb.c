@@ -1,53 +1,27 @@
 #include <stdio.h>
 #include "error_stuff.h"
 #include "util.h"
+#include "swapxor.h"
 
-// SwapByteBits from GHIII FSB Decryptor v1.0 by Invo
-unsigned char SwapByteBits(unsigned char cInput)
+// decrypt a mapped file, a chunk at a time
+void dump_xor(const uint8_t *indata, FILE *outfile, size_t size, const struct swap_xor_key *key)
 {
-   unsigned char nResult=0;
+    enum {CHUNK_SIZE = 0x10000};
+    uint8_t *buf = malloc(CHUNK_SIZE);
+    CHECK_ERRNO(!buf, "malloc");
 
-   for(int i=0; i<8; i++)
-   {
-      nResult = nResult << 1;
-      nResult |= (cInput & 1);
-      cInput = cInput >> 1;
-   }
-
-   return (nResult);
-}
-
-void dump_xor(FILE *infile, FILE *outfile, long offset, size_t size, unsigned char const * const key, size_t key_size)
-{
-    unsigned char buf[0x800];
-    int key_index = 0;
-    uint_fast8_t swap_table[0x100];
-
-    for (int i=0;i<0x100;i++)
-        swap_table[i] = SwapByteBits(i);
-
-    CHECK_ERRNO(fseek(infile, offset, SEEK_SET) != 0, "fseek");
-
-    while (size > 0)
+    for (size_t offset = 0; offset < size; offset += CHUNK_SIZE)
     {
-        size_t bytes_to_copy = sizeof(buf);
-        if (bytes_to_copy > size) bytes_to_copy = size;
+        size_t bytes_to_copy = CHUNK_SIZE;
+        if (bytes_to_copy > size - offset) bytes_to_copy = size - offset;
 
-        size_t bytes_read = fread(buf, 1, bytes_to_copy, infile);
-        CHECK_FILE(bytes_read != bytes_to_copy, infile, "fread");
-
-        for (int i = 0; i < bytes_to_copy; i++)
-        {
-            buf[i] = swap_table[buf[i]] ^ key[key_index];
-            key_index++;
-            if (key_index == key_size) key_index = 0;
-        }
+        swap_xor(buf, indata + offset, bytes_to_copy, key, offset);
 
         size_t bytes_written = fwrite(buf, 1, bytes_to_copy, outfile);
         CHECK_FILE(bytes_written != bytes_to_copy, outfile, "fwrite");
-
-        size -= bytes_to_copy;
     }
+
+    free(buf);
 }
 
 int main(int argc, char **argv)
@@ -55,7 +29,7 @@ int main(int argc, char **argv)
     unsigned char *key = NULL;
     size_t key_length = 0;
 
-    printf("decfsb 0.2\n");
+    printf("decfsb 0.3\n");
     if (argc != 4)
     {
         if (argc < 5 || strcmp(argv[3],"-x"))
@@ -85,13 +59,18 @@ int main(int argc, char **argv)
     FILE *outfile = fopen(argv[2],"wb");
     CHECK_ERRNO(!outfile, "error opening outfile");
 
-    CHECK_ERRNO(-1 == fseek(infile, 0, SEEK_END), "fseek");
-    const long file_size = ftell(infile);
-    CHECK_ERRNO(-1 == file_size, "ftell");
+    long file_size;
+    int mapped;
+    uint8_t *indata = map_whole_file(infile, &file_size, &mapped);
+    CHECK_ERRNO(EOF == fclose(infile), "fclose infile");
 
-    dump_xor(infile, outfile, 0, file_size, key, key_length);
+    struct swap_xor_key xor_key;
+    swap_xor_key_init(&xor_key, key, key_length);
 
-    CHECK_ERRNO(EOF == fclose(infile), "fclose infile");
+    dump_xor(indata, outfile, file_size, &xor_key);
+
+    swap_xor_key_free(&xor_key);
+    unmap_whole_file(indata, file_size, mapped);
     CHECK_ERRNO(EOF == fclose(outfile), "fclose outfile");
 
     if (argc != 4)
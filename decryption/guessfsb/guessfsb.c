@@ -1,12 +1,17 @@
+#define _POSIX_C_SOURCE 200112L
 #include <stdio.h>
 #include <stdint.h>
 #include <ctype.h>
 #include <limits.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
 #include "error_stuff.h"
 #include "util.h"
 
 
-// guessfsb 0.3 - fmod .fsb decryption key guesser
+// guessfsb 0.4 - fmod .fsb decryption key guesser
 
 enum {FSB_TYPES = 2};
 const int header_sizes[FSB_TYPES] = {0x18, 0x30};
@@ -14,20 +19,32 @@ const uint8_t fsb_magics[FSB_TYPES][4] = {"FSB3", "FSB4"};
 
 uint8_t swap_table[0x100];
 
+// keys found so far, a set of each key's shortest repeating unit so that
+// synonymous keys (the same key repeated) are only reported once
 struct match_s
 {
     int length;
     uint8_t *key;
-} *matches = NULL;
+    int root_length;
+    uint_fast32_t stream_count; // what the header guess assumed, 0 if by padding
+    int count;                  // order found
+};
 
-int match_count = 0;
+struct key_set
+{
+    struct match_s *slots;  // open addressing, key NULL if free
+    size_t capacity;
+    int count;
+    pthread_mutex_t lock;
+} matches = {NULL, 0, 0, PTHREAD_MUTEX_INITIALIZER};
 
 uint8_t SwapByteBits(uint8_t cInput);
 
 void init_swap_table(void);
 
 void analyze_header(const uint8_t * const indata,
-                    long whole_file_size, long max_streams, FILE *outfile);
+                    long whole_file_size, long max_streams, FILE *outfile,
+                    long jobs, long max_seconds);
 
 void analyze_tail(const uint8_t * const indata, long whole_file_size,
                   FILE *outfile);
@@ -48,21 +65,51 @@ static inline uint_fast32_t read_32_le_xor(const uint8_t *bytes, const long offs
 static inline uint_fast16_t read_16_le_xor(const uint8_t *bytes, const long offset, const uint8_t *key, const int key_length);
 
 int process_matching_key(const uint8_t *indata, long whole_file_size,
-              uint8_t const * key, size_t key_length, FILE *outfile);
+              uint8_t const * key, size_t key_length, FILE *outfile,
+              uint_fast32_t stream_count);
+
+void print_matches(void);
+
+void usage(void);
 
 int main(int argc, char **argv)
 {
-    printf("guessfsb 0.3\n");
+    printf("guessfsb 0.4\n");
 
     int max_streams = 0;
+    long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    long max_seconds = 0;
 
     const char *infile_name = NULL;
     const char *outfile_name = NULL;
 
+    if (jobs < 1) jobs = 1;
+
+    while (argc >= 3 && argv[1][0] == '-')
+    {
+        if (!strcmp(argv[1], "-j"))
+        {
+            jobs = read_long(argv[2]);
+            CHECK_ERROR(jobs < 1 || jobs > 1024, "invalid thread count");
+        }
+        else if (!strcmp(argv[1], "--max-seconds"))
+        {
+            max_seconds = read_long(argv[2]);
+            CHECK_ERROR(max_seconds < 1, "invalid time limit");
+        }
+        else
+        {
+            usage();
+        }
+
+        argv[2] = argv[0];
+        argv += 2;
+        argc -= 2;
+    }
+
     if (argc != 2)
     {
-        printf("usage: guessfsb infile.fsb\n");
-        exit(EXIT_FAILURE);
+        usage();
     }
 
     infile_name = argv[1];
@@ -98,109 +145,286 @@ int main(int argc, char **argv)
 
     analyze_tail(indata, file_size, outfile);
 
-    analyze_header(indata, file_size, max_streams, outfile);
+    analyze_header(indata, file_size, max_streams, outfile, jobs, max_seconds);
+
+    print_matches();
 
     free(indata); indata = NULL;
 
     printf("done!\n");
 }
 
-// By guessing values for the header, we can find keys < 16 bytes
-void analyze_header(const uint8_t * const indata,
-                    long whole_file_size, long max_streams_input, FILE *outfile)
+void usage(void)
 {
-    enum {EASY_HEADER_SIZE = 16};   // We can make good guesses for these
-    uint8_t key[EASY_HEADER_SIZE];
-    uint8_t guessed_header[EASY_HEADER_SIZE];
+    printf("usage: guessfsb [-j threads] [--max-seconds n] infile.fsb\n");
+    exit(EXIT_FAILURE);
+}
+
+// The header guess searches (stream count, FSB type, table size), handed
+// out to the threads a range of table sizes at a time, lowest stream count
+// first as those are the most likely.
+enum {EASY_HEADER_SIZE = 16};   // We can make good guesses for these
+enum {TABLE_SIZES_PER_ITEM = 0x10000};
+
+struct header_search
+{
+    const uint8_t *indata;
+    long whole_file_size;
+    FILE *outfile;
+    uint_fast32_t max_stream_count;
+
+    pthread_mutex_t lock;
+    pthread_cond_t finished;
+    int running;
+    int stop;
+
+    // next item
+    uint_fast32_t stream_count;
+    int fsb_type;
+    uint_fast32_t table_size;
+};
+
+struct header_item
+{
+    uint_fast32_t stream_count;
+    int fsb_type;
+    uint_fast32_t first_table_size, last_table_size;
+};
+
+// largest table size worth trying, leaving no room for a negative body
+static uint_fast32_t max_table_size(const struct header_search *hs,
+        uint_fast32_t stream_count, int fsb_type)
+{
+    uint_fast32_t max = UINT32_MAX;
+
+    if (UINT64_C(0xffff)*stream_count < max)
+    {
+        max = 0xffff*stream_count;
+    }
+    if (hs->whole_file_size < header_sizes[fsb_type])
+    {
+        max = 0;
+    }
+    else if ((uint64_t)(hs->whole_file_size - header_sizes[fsb_type]) < max)
+    {
+        max = hs->whole_file_size - header_sizes[fsb_type];
+    }
+
+    return max;
+}
+
+// 0 if there is no more work
+static int next_header_item(struct header_search *hs, struct header_item *item)
+{
+    int found = 0;
+
+    pthread_mutex_lock(&hs->lock);
 
-    // begin guessing
+    while (!hs->stop && !found && hs->stream_count <= hs->max_stream_count)
     {
-        // Guess a stream count, starting from 1
-        // (max out at file size/0x28 which would be the whole file filled
-        // with minimal table entries)
-
-        uint_fast32_t max_stream_count = whole_file_size / 0x28;
-
-        if (0 != max_streams_input )
-            max_stream_count = max_streams_input;
-        
-        printf("Trying headers with stream counts from 1 to %"PRIdFAST32"...\n",
-                max_stream_count);
-        fflush(stdout);
-
-        for (uint_fast32_t stream_count = 1;
-                stream_count <= max_stream_count;
-                stream_count ++ )
+        uint_fast32_t max = max_table_size(hs, hs->stream_count, hs->fsb_type);
+
+        if (hs->table_size <= max && 0x28*hs->stream_count <= max)
+        {
+            item->stream_count = hs->stream_count;
+            item->fsb_type = hs->fsb_type;
+            item->first_table_size = hs->table_size;
+            item->last_table_size = max;
+            if (max - hs->table_size >= TABLE_SIZES_PER_ITEM)
+            {
+                item->last_table_size = hs->table_size + TABLE_SIZES_PER_ITEM - 1;
+            }
+            hs->table_size = item->last_table_size + 1;
+            found = 1;
+
+            // the last item of this type
+            if (item->last_table_size != max) continue;
+        }
+
+        // on to the next type or stream count
+        if (++hs->fsb_type == FSB_TYPES)
         {
-            if (stream_count % 20 == 0)
-                printf("trying %" PRIuFAST32 " streams\n", stream_count);
-            fflush(stdout);
+            hs->fsb_type = 0;
+            hs->stream_count ++;
 
-            // Guess an FSB type
-            for (int fsb_type = 0; fsb_type < FSB_TYPES; fsb_type++)
+            if (hs->stream_count % 20 == 0)
             {
-                // We know the first 4 bytes (Magic)
+                printf("trying %" PRIuFAST32 " streams\n", hs->stream_count);
+                fflush(stdout);
+            }
+        }
+        hs->table_size = 0x28*hs->stream_count;
+    }
+
+    pthread_mutex_unlock(&hs->lock);
+
+    return found;
+}
+
+static void search_header_item(const struct header_search *hs, const struct header_item *item)
+{
+    const uint8_t * const indata = hs->indata;
+    const uint_fast32_t stream_count = item->stream_count;
+    const int fsb_type = item->fsb_type;
+    uint8_t key[EASY_HEADER_SIZE];
+    uint8_t guessed_header[EASY_HEADER_SIZE];
+    int possible_length[EASY_HEADER_SIZE];
+
+    // We know the first 4 bytes (Magic) and the stream count
+    memcpy(guessed_header, fsb_magics[fsb_type], 4);
+    write_32_le(stream_count, &guessed_header[4]);
+    for (int i=0;i<8;i++) key[i] = indata[i] ^ guessed_header[i];
 
-                memcpy(guessed_header, fsb_magics[fsb_type], 4);
-                for (int i=0;i<4;i++) key[i] = indata[i] ^ guessed_header[i];
+    // which key lengths these 8 bytes already rule out, whatever the table
+    // size turns out to be
+    for (int key_length=1; key_length < EASY_HEADER_SIZE; key_length++)
+    {
+        int i;
+        for (i=key_length; i < 8 && key[i % key_length] == key[i]; i++) ;
+        possible_length[key_length] = (i >= 8);
+    }
+
+    for (uint_fast32_t table_size = item->first_table_size;
+            table_size <= item->last_table_size;
+            table_size ++ )
+    {
+        // From the file, header, and table size, compute the
+        // body size
+
+        uint_fast32_t body_size =
+            hs->whole_file_size - header_sizes[fsb_type] - table_size;
+
+        // If the key is < 16 bytes this will fill it in
+        write_32_le(table_size, &guessed_header[8]);
+        write_32_le(body_size, &guessed_header[0xc]);
+
+        for (int i=8;i<EASY_HEADER_SIZE;i++)
+            key[i] = indata[i] ^ guessed_header[i];
+
+        // look for a repeat (could be several or none)
+
+        for (int key_length=1; key_length < EASY_HEADER_SIZE;
+                key_length++)
+        {
+            if (!possible_length[key_length]) continue;
 
-                // Guess a table size, from 0x28*streams to 0xffff*streams
+            int key_length_check;
+            for (key_length_check=(key_length > 8 ? key_length : 8);
+                 key_length_check < EASY_HEADER_SIZE &&
+                 key[key_length_check % key_length] ==
+                 key[key_length_check];
+                 key_length_check++) ;
 
-                uint_fast32_t max_table_size = UINT32_MAX;
+            // use the repeat length as the key size
 
-                if (UINT64_C(0xffff)*stream_count < max_table_size)
+            if (key_length_check == EASY_HEADER_SIZE)
+            {
+                // consistency check on the header table
+                if (test_table (indata, key, key_length,
+                            stream_count, header_sizes[fsb_type],
+                            table_size, body_size))
                 {
-                    max_table_size = 0xffff*stream_count;
+                    process_matching_key(indata, hs->whole_file_size,
+                        key, key_length, hs->outfile, stream_count);
                 }
+            }   // end key length possibility
+        }   // end of key guess
+    }   // end of table size guess
+}
 
-                for (uint_fast32_t table_size = 0x28*stream_count;
-                        table_size <= max_table_size;
-                        table_size ++ )
-                {
-                    // From the file, header, and table size, compute the
-                    // body size
+static void *header_worker(void *v)
+{
+    struct header_search *hs = v;
+    struct header_item item;
+
+    while (next_header_item(hs, &item))
+    {
+        search_header_item(hs, &item);
+    }
+
+    pthread_mutex_lock(&hs->lock);
+    hs->running --;
+    pthread_cond_signal(&hs->finished);
+    pthread_mutex_unlock(&hs->lock);
+
+    return NULL;
+}
 
-                    uint_fast32_t body_size =
-                        whole_file_size - header_sizes[fsb_type] - table_size;
+// By guessing values for the header, we can find keys < 16 bytes
+void analyze_header(const uint8_t * const indata,
+                    long whole_file_size, long max_streams_input, FILE *outfile,
+                    long jobs, long max_seconds)
+{
+    struct header_search hs;
+
+    // Guess a stream count, starting from 1
+    // (max out at file size/0x28 which would be the whole file filled
+    // with minimal table entries)
+
+    hs.indata = indata;
+    hs.whole_file_size = whole_file_size;
+    hs.outfile = outfile;
+    hs.max_stream_count = whole_file_size / 0x28;
+
+    if (0 != max_streams_input )
+        hs.max_stream_count = max_streams_input;
+
+    hs.stream_count = 1;
+    hs.fsb_type = 0;
+    hs.table_size = 0x28;
+    hs.stop = 0;
+    hs.running = jobs;
+    pthread_mutex_init(&hs.lock, NULL);
+    pthread_cond_init(&hs.finished, NULL);
+
+    printf("Trying headers with stream counts from 1 to %"PRIuFAST32
+            " on %ld thread%s...\n",
+            hs.max_stream_count, jobs, (jobs == 1 ? "" : "s"));
+    fflush(stdout);
 
-                    // If the key is < 16 bytes this will fill it in
-                    write_32_le(stream_count, &guessed_header[4]);
-                    write_32_le(table_size, &guessed_header[8]);
-                    write_32_le(body_size, &guessed_header[0xc]);
+    pthread_t *threads = malloc(jobs * sizeof(pthread_t));
+    CHECK_ERRNO(!threads, "malloc");
 
-                    for (int i=4;i<EASY_HEADER_SIZE;i++)
-                        key[i] = indata[i] ^ guessed_header[i];
+    for (long i = 0; i < jobs; i++)
+    {
+        errno = pthread_create(&threads[i], NULL, header_worker, &hs);
+        CHECK_ERRNO(0 != errno, "pthread_create");
+    }
 
-                    // look for a repeat (could be several or none)
+    // wait for the threads, or the time limit
+    {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += max_seconds;
 
-                    for (int key_length=1; key_length < EASY_HEADER_SIZE;
-                            key_length++)
-                    {
-                        int key_length_check;
-                        for (key_length_check=key_length;
-                             key_length_check < EASY_HEADER_SIZE &&
-                             key[key_length_check % key_length] ==
-                             key[key_length_check];
-                             key_length_check++) ;
+        pthread_mutex_lock(&hs.lock);
+        while (hs.running > 0)
+        {
+            if (max_seconds > 0 && !hs.stop)
+            {
+                if (ETIMEDOUT == pthread_cond_timedwait(&hs.finished, &hs.lock, &deadline))
+                {
+                    printf("Time limit reached while trying %" PRIuFAST32 " streams\n",
+                            hs.stream_count);
+                    hs.stop = 1;
+                }
+            }
+            else
+            {
+                pthread_cond_wait(&hs.finished, &hs.lock);
+            }
+        }
+        pthread_mutex_unlock(&hs.lock);
+    }
 
-                        // use the repeat length as the key size
+    for (long i = 0; i < jobs; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
 
-                        if (key_length_check == EASY_HEADER_SIZE)
-                        {
-                            // consistency check on the header table
-                            if (test_table (indata, key, key_length,
-                                        stream_count, header_sizes[fsb_type],
-                                        table_size, body_size))
-                            {
-                                process_matching_key(indata, whole_file_size,
-                                    key, key_length, outfile);
-                            }
-                        }   // end key length possibility
-                    }   // end of key guess
-                }   // end of table size guess
-            }   // end of FSB type guess
-        }   // end of stream count guess
-    }   // done guessing
+    pthread_cond_destroy(&hs.finished);
+    pthread_mutex_destroy(&hs.lock);
 }
 
 // test a key on a FSB file, 0 for failure, 1 for success
@@ -255,9 +479,15 @@ int test_table(const uint8_t *indata, const uint8_t *key, const int key_length,
 
     int file_num;
 
+    // Checks are in order of cost, those that need only the entry size
+    // before reading the file size.
     for (file_num = 0; file_num < stream_count;
             file_num ++)
     {
+        // entry must be within the table
+        if (entry_offset + 0x28 > header_size + table_size)
+            return 0;
+
         uint_fast16_t entry_size = 
             read_16_le_xor(indata, entry_offset,
                     key, key_length);
@@ -270,6 +500,16 @@ int test_table(const uint8_t *indata, const uint8_t *key, const int key_length,
         if (entry_size < 0x28 || entry_size > table_size)
             return 0;
 
+        entry_total += entry_size;
+
+        // 6d. total entry sizes > table size
+        if (entry_total > table_size)
+            return 0;
+
+        // 6d'. no room left for the remaining entries
+        if ((stream_count - file_num - 1) * 0x28 > table_size - entry_total)
+            return 0;
+
         uint_fast32_t entry_file_size =
             read_32_le_xor(indata, entry_offset + 0x24,
                     key, key_length);
@@ -282,13 +522,8 @@ int test_table(const uint8_t *indata, const uint8_t *key, const int key_length,
         if (entry_file_size > body_size)
             return 0;
 
-        entry_total += entry_size;
         file_total += entry_file_size;
 
-        // 6d. total entry sizes > table size
-        if (entry_total > table_size)
-            return 0;
-
         // 6e. total file sizes > body size
         if (file_total > body_size)
             return 0;
@@ -370,12 +605,12 @@ void analyze_tail(const uint8_t * const indata, long whole_file_size,
                     if (test_key(indata, whole_file_size, key, key_length))
                     {
                         process_matching_key(indata, whole_file_size, key,
-                            key_length, outfile);
+                            key_length, outfile, 0);
                     }
                     else if (test_key(indata, 0, key, key_length))
                     {
                         if (process_matching_key(indata, whole_file_size, key,
-                            key_length, outfile))
+                            key_length, outfile, 0))
                         {
                             printf("^ Key decrypts consistent header, "
                                "but wrong file size. Multiple FSBs?\n");
@@ -471,36 +706,132 @@ static inline uint_fast16_t read_16_le_xor(const uint8_t *bytes, const long offs
         ((uint_fast32_t)b1);
 }
 
+// shortest length the key repeats with
+static int root_length(const uint8_t *key, int key_length)
+{
+    for (int length = 1; length < key_length; length++)
+    {
+        if (key_length % length != 0) continue;
+        if (!memcmp(key, key + length, key_length - length)) return length;
+    }
+    return key_length;
+}
+
+static size_t hash_key(const uint8_t *key, int length)
+{
+    uint32_t h = UINT32_C(2166136261);
+    for (int i = 0; i < length; i++)
+    {
+        h = (h ^ key[i]) * UINT32_C(16777619);
+    }
+    return h;
+}
+
+// find the slot for a key root, either holding it or free
+static struct match_s *find_slot(struct match_s *slots, size_t capacity,
+        const uint8_t *key, int length)
+{
+    size_t i = hash_key(key, length) & (capacity - 1);
+
+    while (slots[i].key &&
+            (slots[i].root_length != length ||
+             memcmp(slots[i].key, key, length)))
+    {
+        i = (i + 1) & (capacity - 1);
+    }
+    return &slots[i];
+}
+
+static void grow_key_set(struct key_set *set)
+{
+    size_t capacity = set->capacity ? set->capacity * 2 : 64;
+    struct match_s *slots = calloc(capacity, sizeof(struct match_s));
+    CHECK_ERRNO(!slots, "calloc");
+
+    for (size_t i = 0; i < set->capacity; i++)
+    {
+        if (set->slots[i].key)
+        {
+            *find_slot(slots, capacity, set->slots[i].key,
+                    set->slots[i].root_length) = set->slots[i];
+        }
+    }
+
+    free(set->slots);
+    set->slots = slots;
+    set->capacity = capacity;
+}
+
 // return 1 if unique, 0 otherwise
 int process_matching_key(const uint8_t *indata, long whole_file_size,
-              uint8_t const * key, size_t key_length, FILE *outfile)
+              uint8_t const * key, size_t key_length, FILE *outfile,
+              uint_fast32_t stream_count)
 {
+    const int length = root_length(key, key_length);
+    int unique = 0;
+
+    pthread_mutex_lock(&matches.lock);
+
     // check that we're not repeating keys
-    for (int i=0; i < match_count; i++)
+    if (matches.capacity == 0 ||
+            !find_slot(matches.slots, matches.capacity, key, length)->key)
     {
-        // if the new match is a multiple of the old match's length
-        if (key_length >= matches[i].length &&
-            key_length % matches[i].length == 0)
+        if ((matches.count + 1) * 2 > matches.capacity)
         {
-            int j;
-            // check that it isn't just repetition
-            for (j=0; j < key_length / matches[i].length; j++)
-            {
-                if ( memcmp(matches[i].key, key + j*matches[i].length, 
-                        matches[i].length) ) break;
-            }
-            if ( j == key_length / matches[i].length ) return 0;
+            grow_key_set(&matches);
         }
+
+        struct match_s *m = find_slot(matches.slots, matches.capacity, key, length);
+        m->key = malloc(key_length);
+        CHECK_ERRNO(!m->key, "malloc");
+        memcpy(m->key, key, key_length);
+        m->length = key_length;
+        m->root_length = length;
+        m->stream_count = stream_count;
+        m->count = ++matches.count;
+
+        print_key(key, key_length, m->count);
+        unique = 1;
     }
 
-    match_count ++;
-    matches = realloc(matches, match_count*sizeof(struct match_s));
-    matches[match_count-1].key = malloc(key_length);
-    CHECK_ERRNO(!matches[match_count-1].key, "malloc");
-    memcpy(matches[match_count-1].key, key, key_length);
-    matches[match_count-1].length = key_length;
+    pthread_mutex_unlock(&matches.lock);
+
+    return unique;
+}
+
+// most likely first: padding, then by the fewest streams
+static int compare_matches(const void *a, const void *b)
+{
+    const struct match_s *ma = a, *mb = b;
+
+    if (ma->stream_count != mb->stream_count)
+        return (ma->stream_count < mb->stream_count) ? -1 : 1;
+    return ma->count - mb->count;
+}
+
+void print_matches(void)
+{
+    int n = 0;
+    struct match_s *list = malloc((matches.count + 1) * sizeof(struct match_s));
+    CHECK_ERRNO(!list, "malloc");
+
+    for (size_t i = 0; i < matches.capacity; i++)
+    {
+        if (matches.slots[i].key) list[n++] = matches.slots[i];
+    }
+    qsort(list, n, sizeof(struct match_s), compare_matches);
 
-    print_key(key, key_length, match_count);
+    printf("\n%d possible key%s\n", n, (n == 1 ? "" : "s"));
+    for (int i = 0; i < n; i++)
+    {
+        if (list[i].stream_count)
+            printf("[%" PRIuFAST32 " streams] ", list[i].stream_count);
+        else
+            printf("[padding] ");
+        print_key(list[i].key, list[i].length, list[i].count);
+        free(list[i].key);
+    }
 
-    return 1;
+    free(list);
+    free(matches.slots);
 }
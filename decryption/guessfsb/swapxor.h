@@ -0,0 +1,31 @@
+#ifndef _SWAPXOR_H_INCLUDED
+#define _SWAPXOR_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+// FSB encryption: the bits of each byte are reversed, then the byte is
+// xored with a repeating key. swap_xor does both in one pass.
+
+// widest vector the kernel uses
+enum {SWAP_XOR_WIDTH = 32};
+
+// the key repeated out to a multiple of both its length and the vector
+// width, plus one more vector, so a vector of key can be loaded at any
+// position without wrapping
+struct swap_xor_key
+{
+    size_t length;
+    size_t period;
+    uint8_t *pattern;   // period + SWAP_XOR_WIDTH bytes
+};
+
+// key may be NULL (or key_length 0) to only swap bits
+void swap_xor_key_init(struct swap_xor_key *k, const uint8_t *key, size_t key_length);
+void swap_xor_key_free(struct swap_xor_key *k);
+
+// out[i] = reversed in[i] ^ key[(key_offset+i) % length]
+// out may be the same as in
+void swap_xor(uint8_t *out, const uint8_t *in, size_t size, const struct swap_xor_key *k, size_t key_offset);
+
+#endif // _SWAPXOR_H_INCLUDED
@@ -1,9 +1,13 @@
+#define _POSIX_C_SOURCE 200809L
 #include <stdio.h>
 #include <stdlib.h>
 #include <inttypes.h>
 #include <stdint.h>
 #include <string.h>
 #include <errno.h>
+#ifndef __MINGW32__
+#include <sys/mman.h>
+#endif
 
 #include "error_stuff.h"
 #include "util.h"
@@ -287,3 +291,46 @@ long pad(long current_offset, long pad_amount, FILE *outfile)
 
     return new_offset;
 }
+
+uint8_t *map_whole_file(FILE *infile, long *file_size_p, int *mapped_p)
+{
+    // get input file size
+    CHECK_ERRNO(-1 == fseek(infile, 0, SEEK_END), "fseek");
+    const long file_size = ftell(infile);
+    CHECK_ERRNO(-1 == file_size, "ftell");
+
+    *file_size_p = file_size;
+    *mapped_p = 0;
+
+#ifndef __MINGW32__
+    if (file_size > 0)
+    {
+        void *map = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fileno(infile), 0);
+        if (MAP_FAILED != map)
+        {
+            *mapped_p = 1;
+            return map;
+        }
+    }
+#endif
+
+    // can't map, read it in
+    uint8_t *indata = malloc(file_size > 0 ? file_size : 1);
+    CHECK_ERRNO(!indata, "malloc");
+    CHECK_ERRNO(fseek(infile, 0, SEEK_SET) != 0, "fseek");
+    CHECK_FILE(fread(indata, 1, file_size, infile) != file_size, infile, "fread");
+
+    return indata;
+}
+
+void unmap_whole_file(uint8_t *indata, long file_size, int mapped)
+{
+#ifndef __MINGW32__
+    if (mapped)
+    {
+        munmap(indata, file_size);
+        return;
+    }
+#endif
+    free(indata);
+}
@@ -11,6 +11,11 @@
 
 void dump(FILE *infile, FILE *outfile, long offset, size_t size);
 
+// map a whole file read-only (or read it in, where mapping isn't possible),
+// the file can be closed afterwards
+uint8_t *map_whole_file(FILE *infile, long *file_size_p, int *mapped_p);
+void unmap_whole_file(uint8_t *indata, long file_size, int mapped);
+
 uint32_t read_32_le(unsigned char bytes[4]);
 uint16_t read_16_le(unsigned char bytes[2]);
 uint64_t read_64_be(unsigned char bytes[8]);
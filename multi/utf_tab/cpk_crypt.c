@@ -6,6 +6,9 @@
 #include "error_stuff.h"
 #include "util.h"
 
+/* list every key that could decrypt a CPK's @UTF header; cpk_unpack
+   uses the first one on its own, this is for when that goes wrong */
+
 void analyze(reader_t *infile, long offset, long file_length);
 
 int main(int argc, char **argv)
@@ -21,11 +24,11 @@ int main(int argc, char **argv)
 
     analyze(infile, 0, file_length);
 
+    close_reader(infile);
+
     exit(EXIT_SUCCESS);
 }
 
-static const char UTF_signature[4] = "@UTF"; /* intentionally unterminated */
-
 void analyze(reader_t *infile, long offset, long file_length)
 {
     const long CpkHeader_offset = offset;
@@ -39,42 +42,22 @@ void analyze(reader_t *infile, long offset, long file_length)
     }
 
     const long CpkHeader_size = get_32_le_seek(CpkHeader_offset+8, infile);
+
     /* check CpkHeader */
     {
-        enum {bytes_to_check=0x18};
+        static const char UTF_signature[4] = "@UTF"; /* intentionally unterminated */
+        unsigned char buf[0x18];
+        struct utf_key keys[UINT8_MAX+1];
 
-        unsigned char buf[bytes_to_check];
-        get_bytes_seek(CpkHeader_offset+0x10, infile, buf, bytes_to_check);
+        get_bytes_seek(CpkHeader_offset+0x10, infile, buf, sizeof(buf));
         CHECK_ERROR (!memcmp(buf, UTF_signature, sizeof(UTF_signature)), "@UTF table looks unencrypted");
 
-        unsigned char expected_bytes[bytes_to_check];
-        // signature
-        memcpy(&expected_bytes[0], UTF_signature, 4);
-        // CPK chunk size
-        write_32_be(CpkHeader_size-8, &expected_bytes[4]);
-        // CPK table name string offset (7, first in table after "<NULL>\0")
-        write_32_be(7, &expected_bytes[0x14]);
-
-        uint8_t xor_bytes[bytes_to_check];
-
-        for (int i=0; i < bytes_to_check; i++) {
-            xor_bytes[i]=expected_bytes[i]^buf[i];
-        }
-
-        for (int mult=0; mult <= UINT8_MAX; mult++) {
-            uint8_t xor = xor_bytes[0];
-            for (int i=1; i < bytes_to_check; i++) {
-                xor *= mult;
-
-                if ((i >= 0 && i < 8) ||
-                    (i >= 0x14 && i < 0x18)) {
-                    if (xor != xor_bytes[i]) break;
-                }
+        int found = utf_guess_keys(buf, CpkHeader_size-8, keys, UINT8_MAX+1);
+        CHECK_ERROR (found == 0, "no key found");
 
-                if (i == bytes_to_check-1) {
-                    printf("s=%02"PRIx8" m=%02x\n",xor_bytes[0], (unsigned int)mult);
-                }
-            }
+        for (int i = 0; i < found; i++)
+        {
+            printf("s=%02x m=%02x\n", (unsigned int)keys[i].start, (unsigned int)keys[i].mult);
         }
     }
 }
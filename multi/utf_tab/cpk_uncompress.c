@@ -1,4 +1,6 @@
 #include <stdio.h>
+#include <string.h>
+#include <pthread.h>
 
 #include "cpk_uncompress.h"
 #include "util.h"
@@ -8,7 +10,7 @@ const uint64_t CRILAYLA_sig = UINT64_C(0x4352494C41594C41);
 
 // Decompress compressed segments in CRI CPK filesystems
 
-long uncompress(FILE *infile, long offset, long size, FILE *outfile);
+long uncompress(reader_t *infile, long offset, long size, FILE *outfile);
 
 #if 0
 int main(int argc, char **argv)
@@ -18,7 +20,7 @@ int main(int argc, char **argv)
         fprintf(stderr,"Incorrect program usage\n\nusage: %s input output\n",argv[0]);
 
     /* open input file */
-    FILE *infile = fopen(argv[1], "rb");
+    reader_t *infile = fopen(argv[1], "rb");
     CHECK_ERRNO(!infile, "fopen input");
 
     /* open output file */
@@ -42,115 +44,210 @@ int main(int argc, char **argv)
 }
 #endif
 
-// only for up to 16 bits
-static inline uint16_t get_next_bits(FILE *infile, long * const offset_p, uint8_t * const bit_pool_p, int * const bits_left_p, const int bit_count)
+static uint32_t read_le32(const uint8_t *p)
 {
-    uint16_t out_bits = 0;
-    int num_bits_produced = 0;
-    while (num_bits_produced < bit_count)
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t read_be64(const uint8_t *p)
+{
+    uint64_t result = 0;
+    for (int i=0; i<8; i++) result = (result << 8) | p[i];
+    return result;
+}
+
+long crilayla_decompressed_size(const uint8_t *in, size_t in_size)
+{
+    CHECK_ERROR_RETURN( in_size < 0x10 + 0x100, "compressed data too small");
+    CHECK_ERROR_RETURN( !(
+          (read_le32(in+0x00) == 0 && read_le32(in+0x04) == 0) ||
+          (read_be64(in+0x00) == CRILAYLA_sig)
+        ), "didn't find 0 or CRILAYLA signature for compressed data");
+    CHECK_ERROR_RETURN( (uint64_t)read_le32(in+0x0C) + 0x10 + 0x100 != in_size, "size mismatch");
+
+    return 0x100 + (long)read_le32(in+0x08);
+}
+
+/*
+ * Length ladder for back-references: 2, 3, 5 and then 8 bit fields, each
+ * saturated field meaning another follows. The first three levels fit in
+ * 10 bits, so they're decoded with one lookup on the next 10 bits.
+ */
+enum { vle_peek_bits = 10 };
+
+struct vle_entry
+{
+    uint8_t bits;       /* bits consumed */
+    uint8_t length;     /* added to the base length of 3 */
+    uint8_t more;       /* 8 bit levels follow */
+};
+
+static struct vle_entry vle_table[1 << vle_peek_bits];
+static pthread_once_t vle_table_once = PTHREAD_ONCE_INIT;
+
+static void init_vle_table(void)
+{
+    for (int i = 0; i < (1 << vle_peek_bits); i++)
     {
-        if (0 == *bits_left_p)
+        const int a = i >> 8, b = (i >> 5) & 7, c = i & 31;
+        struct vle_entry * const e = &vle_table[i];
+
+        if (a != 3)
         {
-            *bit_pool_p = get_byte_seek(*offset_p, infile);
-            *bits_left_p = 8;
-            --*offset_p;
+            e->bits = 2; e->length = a; e->more = 0;
+        }
+        else if (b != 7)
+        {
+            e->bits = 5; e->length = 3 + b; e->more = 0;
         }
-
-        int bits_this_round;
-        if (*bits_left_p > (bit_count - num_bits_produced))
-            bits_this_round = bit_count - num_bits_produced;
         else
-            bits_this_round = *bits_left_p;
+        {
+            e->bits = 10; e->length = 3 + 7 + c; e->more = (c == 31);
+        }
+    }
+}
 
-        out_bits <<= bits_this_round;
-        out_bits |=
-            (*bit_pool_p >> (*bits_left_p - bits_this_round)) &
-            ((1 << bits_this_round) - 1);
+/* bits are read from the end of the compressed data backwards, MSB first */
+struct reverse_bits
+{
+    uint64_t pool;  /* left justified */
+    int count;
+    const uint8_t *next;
+    const uint8_t *start;
+};
 
-        *bits_left_p -= bits_this_round;
-        num_bits_produced += bits_this_round;
+static inline void refill_bits(struct reverse_bits *rb)
+{
+    while (rb->count <= 56 && rb->next >= rb->start)
+    {
+        rb->pool |= (uint64_t)*rb->next-- << (56 - rb->count);
+        rb->count += 8;
     }
-
-    return out_bits;
 }
 
-#define GET_NEXT_BITS(bit_count) get_next_bits(infile, &input_offset, &bit_pool, &bits_left, bit_count)
+static inline unsigned int peek_bits(const struct reverse_bits *rb, int bit_count)
+{
+    return (unsigned int)(rb->pool >> (64 - bit_count));
+}
 
-long uncompress(FILE *infile, long offset, long input_size, FILE *outfile)
+static inline void consume_bits(struct reverse_bits *rb, int bit_count)
 {
-    unsigned char *output_buffer = NULL;
-    CHECK_ERROR( !(
-          (get_32_le_seek(offset+0x00, infile) == 0 &&
-           get_32_le_seek(offset+0x04, infile) == 0) ||
-          (get_64_be_seek(offset+0x00, infile) == CRILAYLA_sig)
-        ), "didn't find 0 or CRILAYLA signature for compressed data");
+    rb->pool <<= bit_count;
+    rb->count -= bit_count;
+}
+
+#define NEED_BITS(bit_count) \
+    CHECK_ERROR_RETURN(rb.count < (bit_count), "ran out of compressed data")
 
-    const long uncompressed_size = 
-        get_32_le_seek(offset+0x08, infile);
+long crilayla_decompress(const uint8_t *in, size_t in_size,
+        uint8_t *out, size_t out_size)
+{
+    const long output_size = crilayla_decompressed_size(in, in_size);
+    if (output_size < 0) return -1;
+    CHECK_ERROR_RETURN( (size_t)output_size > out_size, "output buffer too small");
 
-    const long uncompressed_header_offset =
-        offset + get_32_le_seek(offset+0x0C, infile)+0x10;
+    pthread_once(&vle_table_once, init_vle_table);
 
-    CHECK_ERROR( uncompressed_header_offset + 0x100 != offset + input_size, "size mismatch");
+    const size_t compressed_size = read_le32(in+0x0C);
 
-    output_buffer = malloc(uncompressed_size + 0x100);
-    CHECK_ERROR(!output_buffer, "malloc");
+    memcpy(out, in + 0x10 + compressed_size, 0x100);
 
-    get_bytes_seek(uncompressed_header_offset, infile, output_buffer, 0x100);
+    struct reverse_bits rb;
+    rb.pool = 0;
+    rb.count = 0;
+    rb.start = in + 0x10;
+    rb.next = in + 0x10 + compressed_size - 1;
 
-    const long input_end = offset + input_size - 0x100 - 1;
-    long input_offset = input_end;
-    const long output_end = 0x100 + uncompressed_size - 1;
-    uint8_t bit_pool = 0;
-    int bits_left = 0;
-    long bytes_output = 0;
+    /* output is produced from the end backwards too */
+    uint8_t * const output_low = out + 0x100;
+    uint8_t * const output_end = out + output_size - 1;
+    uint8_t *o = output_end;
 
-    while ( bytes_output < uncompressed_size )
+    while (o >= output_low)
     {
-        if (GET_NEXT_BITS(1))
+        refill_bits(&rb);
+        NEED_BITS(1);
+
+        if (peek_bits(&rb, 1))
         {
-            long backreference_offset =
-                output_end-bytes_output+GET_NEXT_BITS(13)+3;
-            long backreference_length = 3;
-
-            // decode variable length coding for length
-            enum { vle_levels = 4 };
-            int vle_lens[vle_levels] = { 2, 3, 5, 8 };
-            int vle_level;
-            for (vle_level = 0; vle_level < vle_levels; vle_level++)
-            {
-                int this_level = GET_NEXT_BITS(vle_lens[vle_level]);
-                backreference_length += this_level;
-                if (this_level != ((1 << vle_lens[vle_level])-1)) break;
-            }
-            if (vle_level == vle_levels)
+            NEED_BITS(1 + 13);
+            const long distance = (peek_bits(&rb, 1 + 13) & 0x1fff) + 3;
+            consume_bits(&rb, 1 + 13);
+
+            const struct vle_entry *e = &vle_table[peek_bits(&rb, vle_peek_bits)];
+            NEED_BITS(e->bits);
+            consume_bits(&rb, e->bits);
+            long length = 3 + e->length;
+
+            if (e->more)
             {
-                int this_level;
+                unsigned int this_level;
                 do
                 {
-                    this_level = GET_NEXT_BITS(8);
-                    backreference_length += this_level;
+                    refill_bits(&rb);
+                    NEED_BITS(8);
+                    this_level = peek_bits(&rb, 8);
+                    consume_bits(&rb, 8);
+                    length += this_level;
                 } while (this_level == 255);
             }
 
-            //printf("0x%08lx backreference to 0x%lx, length 0x%lx\n", output_end-bytes_output, backreference_offset, backreference_length);
-            for (int i=0;i<backreference_length;i++)
+            CHECK_ERROR_RETURN( distance > output_end - o, "backreference out of range");
+            CHECK_ERROR_RETURN( length > o - output_low + 1, "backreference overruns output");
+
+            /* copy in chunks that never overlap their source */
+            while (length > 0)
             {
-                output_buffer[output_end-bytes_output] = output_buffer[backreference_offset--];
-                bytes_output++;
+                const long chunk = length < distance ? length : distance;
+                o -= chunk;
+                memcpy(o + 1, o + 1 + distance, chunk);
+                length -= chunk;
             }
         }
         else
         {
             // verbatim byte
-            output_buffer[output_end-bytes_output] = GET_NEXT_BITS(8);
-            //printf("0x%08lx verbatim byte\n", output_end-bytes_output);
-            bytes_output++;
+            NEED_BITS(1 + 8);
+            *o-- = peek_bits(&rb, 1 + 8) & 0xff;
+            consume_bits(&rb, 1 + 8);
         }
     }
 
-    put_bytes_seek(0, outfile, output_buffer, 0x100 + uncompressed_size);
+    return output_size;
+}
+
+#undef NEED_BITS
+
+long uncompress(reader_t *infile, long offset, long input_size, FILE *outfile)
+{
+    unsigned char *input_buffer = NULL;
+    unsigned char *output_buffer = NULL;
+
+    CHECK_ERROR( input_size < 0x10 + 0x100, "compressed data too small");
+
+    /* decode straight from the mapping if there is one */
+    const unsigned char *input = reader_view(infile, offset, input_size);
+    if (!input)
+    {
+        input_buffer = malloc(input_size);
+        CHECK_ERRNO(!input_buffer, "malloc");
+        get_bytes_seek(offset, infile, input_buffer, input_size);
+        input = input_buffer;
+    }
+
+    const long output_size = crilayla_decompressed_size(input, input_size);
+    CHECK_ERROR( output_size < 0, "bad compressed data");
+
+    output_buffer = malloc(output_size);
+    CHECK_ERRNO(!output_buffer, "malloc");
+
+    CHECK_ERROR( crilayla_decompress(input, input_size,
+                output_buffer, output_size) != output_size,
+            "decompression failed");
+
+    put_bytes_seek(0, outfile, output_buffer, output_size);
     free(output_buffer);
+    free(input_buffer);
 
-    return 0x100 + bytes_output;
+    return output_size;
 }
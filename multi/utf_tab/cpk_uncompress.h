@@ -2,7 +2,19 @@
 #define _CPK_UNCOMPRESS_H_INCLUDED
 
 #include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
 
-long uncompress(FILE *infile, long offset, long size, FILE *outfile);
+#include "util.h"
+
+long uncompress(reader_t *infile, long offset, long size, FILE *outfile);
+
+/* In-memory CRILAYLA, in is the whole compressed segment (header,
+   compressed data and the 0x100 byte uncompressed header).
+   Both return -1 if the data isn't valid CRILAYLA. */
+long crilayla_decompressed_size(const uint8_t *in, size_t in_size);
+
+long crilayla_decompress(const uint8_t *in, size_t in_size,
+        uint8_t *out, size_t out_size);
 
 #endif
@@ -1,75 +1,307 @@
 #include <stdio.h>
 #include <limits.h>
+#include <pthread.h>
 
 #include "utf_tab.h"
 #include "cpk_uncompress.h"
 #include "util.h"
 #include "error_stuff.h"
 
-void analyze_CPK(FILE *infile, const char *base_name, long file_length);
+/* how @UTF tables and file data are encrypted, if at all */
+struct cpk_crypt
+{
+    int key_given;      /* --utf-key, otherwise detected */
+    int tables;
+    int bodies;         /* --decrypt-body */
+    struct utf_key key;
+};
+
+void analyze_CPK(reader_t *infile, const char *infile_name, const char *base_name, long file_length, int jobs, struct cpk_crypt *crypt);
+
+void usage(const char *name)
+{
+    fflush(stdout);
+    fprintf(stderr,"Incorrect program usage\n\nusage: %s [-j N] [--utf-key s=XX,m=XX] [--decrypt-body] file\n\n"
+            "-j N : extract with N threads\n"
+            "--utf-key s=XX,m=XX : @UTF tables are encrypted with this key\n"
+            "                      (normally detected)\n"
+            "--decrypt-body : also decrypt file data with the @UTF key\n", name);
+    exit(EXIT_FAILURE);
+}
 
 int main(int argc, char **argv)
 {
+    int jobs = 1;
+    const char *infile_name = NULL;
+    struct cpk_crypt crypt = {0};
+
     printf("cpk_unpack " VERSION "\n\n");
-    if (argc != 2)
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-j") && i+1 < argc)
+        {
+            jobs = read_long(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--utf-key") && i+1 < argc)
+        {
+            crypt.key = read_utf_key(argv[++i]);
+            crypt.key_given = 1;
+        }
+        else if (!strcmp(argv[i], "--decrypt-body"))
+        {
+            crypt.bodies = 1;
+        }
+        else if (!infile_name && argv[i][0] != '-')
+        {
+            infile_name = argv[i];
+        }
+        else
+        {
+            usage(argv[0]);
+        }
+    }
+    if (!infile_name)
     {
-        fprintf(stderr,"Incorrect program usage\n\nusage: %s file\n",argv[0]);
-        exit(EXIT_FAILURE);
+        usage(argv[0]);
     }
+    CHECK_ERROR(jobs < 1, "need at least one job");
 
-    /* open file */
-    FILE *infile = fopen(argv[1], "rb");
+    /* open file, mapped if possible */
+    reader_t *infile = open_reader_mmap(infile_name);
+    if (!infile) infile = open_reader_file(infile_name);
     CHECK_ERRNO(!infile, "fopen");
 
     const char *base_postfix = "_unpacked";
-    char *base_name = malloc(strlen(argv[1])+strlen(base_postfix)+1);
+    char *base_name = malloc(strlen(infile_name)+strlen(base_postfix)+1);
     CHECK_ERRNO(!base_name, "malloc");
-    strcpy(base_name, strip_path(argv[1]));
+    strcpy(base_name, strip_path(infile_name));
     strcat(base_name, base_postfix);
 
-    /* get file size */
-    CHECK_ERRNO(fseek(infile, 0 , SEEK_END) != 0, "fseek");
-    long file_length = ftell(infile);
-    CHECK_ERRNO(file_length == -1, "ftell");
-
-    rewind(infile);
+    long file_length = reader_length(infile);
 
-    analyze_CPK(infile, base_name, file_length);
+    analyze_CPK(infile, infile_name, base_name, file_length, jobs, &crypt);
 
     free(base_name);
 
     exit(EXIT_SUCCESS);
 }
 
-void analyze_CPK(FILE *infile, const char *base_name, long file_length)
+struct toc_entry
 {
-    const long CpkHeader_offset = 0x0;
-    char *toc_string_table = NULL;
+    const char *file_name;
+    const char *dir_name;
+    long file_size;
+    long extract_size;
+    long file_offset;
+    char *id_name;      /* ITOC entries are named by ID */
 
-    /* check header */
+    long uncompressed_size;
+    int done;
+};
+
+/* write one file out, returns uncompressed size (or -1 if stored) */
+static long extract_entry(reader_t *infile, const char *base_name, const struct toc_entry *e,
+        const struct cpk_crypt *crypt)
+{
+    long uncompressed_size = -1;
+    reader_t *data_infile = infile;
+
+    if (crypt->bodies)
     {
-        unsigned char buf[4];
-        static const char CPK_signature[4] = "CPK "; /* intentionally unterminated */
-        get_bytes_seek(CpkHeader_offset, infile, buf, 4);
-        CHECK_ERROR (memcmp(buf, CPK_signature, sizeof(CPK_signature)), "CPK signature not found");
+        data_infile = open_reader_crypt(infile, e->file_offset, crypt->key.start, crypt->key.mult);
     }
 
-    /* check CpkHeader */
+    FILE *outfile = open_file_in_directory(base_name, e->dir_name, '/', e->file_name, "w+b");
+    CHECK_ERRNO(!outfile, "fopen");
+
+    if (e->extract_size > e->file_size)
+    {
+        uncompressed_size =
+            uncompress(data_infile, e->file_offset, e->file_size, outfile);
+    }
+    else
     {
-        struct utf_query_result result = query_utf_nofail(infile, CpkHeader_offset+0x10, NULL);
+        dump(data_infile, outfile, e->file_offset, e->file_size);
+    }
+    CHECK_ERRNO(fclose(outfile) != 0, "fclose");
 
-        CHECK_ERROR (result.rows != 1, "wrong number of rows in CpkHeader");
+    if (data_infile != infile)
+    {
+        close_reader(data_infile);
     }
 
-    /* get TOC offset */
-    long toc_offset = query_utf_8byte(infile, CpkHeader_offset+0x10, 0, "TocOffset");
+    return uncompressed_size;
+}
 
-    /* get content offset */
-    long content_offset = query_utf_8byte(infile, CpkHeader_offset+0x10, 0, "ContentOffset");
+static void report_entry(const struct toc_entry *e)
+{
+    if (!e->dir_name)
+    {
+        printf("%s 0x%lx %ld\n",
+                e->file_name, (unsigned long)e->file_offset, e->file_size);
+        return;
+    }
 
-    /* get file count from CpkHeader */
-    long CpkHeader_count = query_utf_4byte(infile, CpkHeader_offset+0x10, 0, "Files");
+    printf("%s/%s 0x%lx %ld\n",
+            e->dir_name, e->file_name, (unsigned long)e->file_offset, e->file_size);
+}
+
+static void report_uncompressed(const struct toc_entry *e)
+{
+    if (e->extract_size > e->file_size)
+    {
+        printf("   uncompressed to %ld\n", e->uncompressed_size);
+
+        CHECK_ERROR( e->uncompressed_size != e->extract_size ,
+                "uncompressed size != ExtractSize");
+    }
+}
+
+/* shared state for -j: workers take entries in file offset order,
+   the main thread reports them in TOC order as they finish */
+struct extract_queue
+{
+    const char *infile_name;
+    const char *base_name;
+    const struct cpk_crypt *crypt;
+    struct toc_entry **order;
+    long count;
+    long next;
+
+    pthread_mutex_t lock;
+    pthread_cond_t done_cond;
+};
 
+static int compare_entry_offset(const void *a, const void *b)
+{
+    const struct toc_entry *ea = *(const struct toc_entry * const *)a;
+    const struct toc_entry *eb = *(const struct toc_entry * const *)b;
+
+    if (ea->file_offset != eb->file_offset)
+    {
+        return ea->file_offset < eb->file_offset ? -1 : 1;
+    }
+
+    /* keep TOC order for ties so the schedule is reproducible */
+    return ea < eb ? -1 : (ea > eb);
+}
+
+static void *extract_worker(void *arg)
+{
+    struct extract_queue *q = arg;
+
+    /* each worker has its own reader */
+    reader_t *infile = open_reader_mmap(q->infile_name);
+    if (!infile) infile = open_reader_file(q->infile_name);
+    CHECK_ERRNO(!infile, "fopen");
+
+    for (;;)
+    {
+        struct toc_entry *e;
+
+        pthread_mutex_lock(&q->lock);
+        e = (q->next < q->count) ? q->order[q->next++] : NULL;
+        pthread_mutex_unlock(&q->lock);
+
+        if (!e) break;
+
+        long uncompressed_size = extract_entry(infile, q->base_name, e, q->crypt);
+
+        pthread_mutex_lock(&q->lock);
+        e->uncompressed_size = uncompressed_size;
+        e->done = 1;
+        pthread_cond_broadcast(&q->done_cond);
+        pthread_mutex_unlock(&q->lock);
+    }
+
+    close_reader(infile);
+
+    return NULL;
+}
+
+static void extract_parallel(const char *infile_name, const char *base_name,
+        struct toc_entry *entries, long count, int jobs, const struct cpk_crypt *crypt)
+{
+    struct extract_queue q;
+    pthread_t *threads;
+
+    if (jobs > count) jobs = count;
+    if (jobs < 1) return;
+
+    q.infile_name = infile_name;
+    q.base_name = base_name;
+    q.crypt = crypt;
+    q.count = count;
+    q.next = 0;
+    q.order = malloc(sizeof(struct toc_entry *) * count);
+    CHECK_ERRNO(!q.order, "malloc");
+    for (long i = 0; i < count; i++)
+    {
+        q.order[i] = &entries[i];
+    }
+    qsort(q.order, count, sizeof(struct toc_entry *), compare_entry_offset);
+
+    CHECK_ERROR(pthread_mutex_init(&q.lock, NULL) != 0, "pthread_mutex_init");
+    CHECK_ERROR(pthread_cond_init(&q.done_cond, NULL) != 0, "pthread_cond_init");
+
+    threads = malloc(sizeof(pthread_t) * jobs);
+    CHECK_ERRNO(!threads, "malloc");
+    for (int i = 0; i < jobs; i++)
+    {
+        CHECK_ERROR(pthread_create(&threads[i], NULL, extract_worker, &q) != 0,
+                "pthread_create");
+    }
+
+    /* report in TOC order, same as the serial path */
+    for (long i = 0; i < count; i++)
+    {
+        pthread_mutex_lock(&q.lock);
+        while (!entries[i].done)
+        {
+            pthread_cond_wait(&q.done_cond, &q.lock);
+        }
+        pthread_mutex_unlock(&q.lock);
+
+        report_entry(&entries[i]);
+        report_uncompressed(&entries[i]);
+    }
+
+    for (int i = 0; i < jobs; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    pthread_cond_destroy(&q.done_cond);
+    pthread_mutex_destroy(&q.lock);
+    free(threads);
+    free(q.order);
+}
+
+/* tables are read through a decrypting layer keyed from their own start */
+static reader_t *open_table_reader(reader_t *infile, long offset, const struct cpk_crypt *crypt)
+{
+    if (!crypt->tables) return infile;
+
+    return open_reader_crypt(infile, offset, crypt->key.start, crypt->key.mult);
+}
+
+static void close_table_reader(reader_t *table_infile, reader_t *infile)
+{
+    if (table_infile != infile) close_reader(table_infile);
+}
+
+/* 8 byte column, 0 if the table doesn't have it */
+static uint64_t optional_8byte(const utf_table_t *table, const char *name)
+{
+    const int column = utf_table_column_index(table, name);
+
+    return column < 0 ? 0 : utf_table_8byte(table, 0, column);
+}
+
+static struct toc_entry *read_TOC(reader_t *infile, long toc_offset,
+        long content_offset, long CpkHeader_count, const struct cpk_crypt *crypt,
+        utf_table_t **toc_p)
+{
     /* check TOC header */
     {
         unsigned char buf[4];
@@ -78,40 +310,44 @@ void analyze_CPK(FILE *infile, const char *base_name, long file_length)
         CHECK_ERROR (memcmp(buf, TOC_signature, sizeof(TOC_signature)), "TOC signature not found");
     }
 
-    /* get TOC entry count, string table */
-    long toc_entries;
-    {
-        struct utf_query_result result = query_utf_nofail(infile, toc_offset+0x10, NULL);
-
-        toc_entries = result.rows;
-        toc_string_table = load_utf_string_table(infile, toc_offset+0x10);
-    }
+    /* load the TOC once, get entry count */
+    reader_t *toc_infile = open_table_reader(infile, toc_offset+0x10, crypt);
+    utf_table_t *toc = load_utf_table_nofail(toc_infile, toc_offset+0x10);
+    close_table_reader(toc_infile, infile);
+    long toc_entries = toc->info.rows;
 
     /* check that counts match */
     CHECK_ERROR( toc_entries != CpkHeader_count, "CpkHeader file count and TOC entry count do not match" );
 
-    /* extract files */
+    /* look up the columns we need */
+    const int FileName_column = utf_table_column(toc, "FileName");
+    const int DirName_column = utf_table_column(toc, "DirName");
+    const int FileSize_column = utf_table_column(toc, "FileSize");
+    const int ExtractSize_column = utf_table_column(toc, "ExtractSize");
+    const int FileOffset_column = utf_table_column(toc, "FileOffset");
+
+    /* build the entry list up front */
+    struct toc_entry *entries = malloc(sizeof(struct toc_entry) * (toc_entries + 1));
+    CHECK_ERRNO(!entries, "malloc");
+
     for (int i = 0; i < toc_entries; i++)
     {
+        struct toc_entry * const e = &entries[i];
+
         /* get file name */
-        const char *file_name = query_utf_string(infile, toc_offset+0x10, i,
-                "FileName", toc_string_table);
+        e->file_name = utf_table_string(toc, i, FileName_column);
 
         /* get directory name */
-        const char *dir_name = query_utf_string(infile, toc_offset+0x10, i,
-                "DirName", toc_string_table);
+        e->dir_name = utf_table_string(toc, i, DirName_column);
 
         /* get file size */
-        long file_size = query_utf_4byte(infile, toc_offset+0x10, i,
-                "FileSize");
+        e->file_size = utf_table_4byte(toc, i, FileSize_column);
 
         /* get extract size */
-        long extract_size = query_utf_4byte(infile, toc_offset+0x10, i,
-                "ExtractSize");
+        e->extract_size = utf_table_4byte(toc, i, ExtractSize_column);
 
         /* get file offset */
-        uint64_t file_offset_raw = 
-            query_utf_8byte(infile, toc_offset+0x10, i, "FileOffset");
+        uint64_t file_offset_raw = utf_table_8byte(toc, i, FileOffset_column);
         if (content_offset < toc_offset)
         {
             file_offset_raw += content_offset;
@@ -122,32 +358,244 @@ void analyze_CPK(FILE *infile, const char *base_name, long file_length)
         }
 
         CHECK_ERROR( file_offset_raw > LONG_MAX, "File offset too large, will be unable to seek" );
-        long file_offset = file_offset_raw;
+        e->file_offset = file_offset_raw;
+
+        e->id_name = NULL;
+        e->uncompressed_size = -1;
+        e->done = 0;
+    }
+
+    *toc_p = toc;
+    return entries;
+}
+
+/* ITOC has no names or offsets, just sizes by ID split into DataL (2 byte
+   sizes) and DataH (4 byte sizes); IDs may be sparse. Files are stored in
+   ID order from ContentOffset, each padded to Align. */
+static struct toc_entry *read_ITOC(reader_t *infile, long itoc_offset,
+        long content_offset, long CpkHeader_count, int align,
+        const struct cpk_crypt *crypt)
+{
+    /* check ITOC header */
+    {
+        unsigned char buf[4];
+        static const char ITOC_signature[4] = "ITOC"; /* intentionally unterminated */
+        get_bytes_seek(itoc_offset, infile, buf, 4);
+        CHECK_ERROR (memcmp(buf, ITOC_signature, sizeof(ITOC_signature)), "ITOC signature not found");
+    }
+
+    /* DataL and DataH are tables inside the ITOC, encrypted along with it */
+    reader_t *itoc_infile = open_table_reader(infile, itoc_offset+0x10, crypt);
+    utf_table_t *itoc = load_utf_table_nofail(itoc_infile, itoc_offset+0x10);
+    CHECK_ERROR( itoc->info.rows != 1, "Expected 1 ITOC entry" );
+
+    const long itoc_filesl = utf_table_4byte(itoc, 0, utf_table_column(itoc, "FilesL"));
+    const long itoc_filesh = utf_table_4byte(itoc, 0, utf_table_column(itoc, "FilesH"));
+    CHECK_ERROR( itoc_filesl + itoc_filesh != CpkHeader_count, "CpkHeader file count and ITOC file counts do not match" );
+
+    const long itoc_data_offset = itoc_offset+0x10+8+itoc->info.data_offset;
+    const long datal_offset = itoc_data_offset +
+        utf_table_data(itoc, 0, utf_table_column(itoc, "DataL")).offset;
+    const long datah_offset = itoc_data_offset +
+        utf_table_data(itoc, 0, utf_table_column(itoc, "DataH")).offset;
+
+    utf_table_t *datal = load_utf_table_nofail(itoc_infile, datal_offset);
+    CHECK_ERROR( datal->info.rows != itoc_filesl, "FilesL count does not match DataL rows");
+    utf_table_t *datah = load_utf_table_nofail(itoc_infile, datah_offset);
+    CHECK_ERROR( datah->info.rows != itoc_filesh, "FilesH count does not match DataH rows");
+
+    close_table_reader(itoc_infile, infile);
+    free_utf_table(itoc);
 
-        printf("%s/%s 0x%lx %ld\n",
-                dir_name, file_name, (unsigned long)file_offset, file_size);
-        FILE *outfile = open_file_in_directory(base_name, dir_name, '/', file_name, "w+b");
-        CHECK_ERRNO(!outfile, "fopen");
+    const int l_ID_column = utf_table_column(datal, "ID");
+    const int l_FileSize_column = utf_table_column(datal, "FileSize");
+    const int l_ExtractSize_column = utf_table_column(datal, "ExtractSize");
+    const int h_ID_column = utf_table_column(datah, "ID");
+    const int h_FileSize_column = utf_table_column(datah, "FileSize");
+    const int h_ExtractSize_column = utf_table_column(datah, "ExtractSize");
 
-        if (extract_size > file_size)
+    /* pad names for CpkHeader_count files, as when IDs are dense they are
+       just the file index, or for the highest ID if sparse ones go past it */
+    long max_id = CpkHeader_count;
+    if (itoc_filesl > 0)
+    {
+        const long last_l_id = utf_table_2byte(datal, itoc_filesl-1, l_ID_column);
+        if (last_l_id > max_id) max_id = last_l_id;
+    }
+    if (itoc_filesh > 0)
+    {
+        const long last_h_id = utf_table_2byte(datah, itoc_filesh-1, h_ID_column);
+        if (last_h_id > max_id) max_id = last_h_id;
+    }
+
+    struct toc_entry *entries = malloc(sizeof(struct toc_entry) * (CpkHeader_count + 1));
+    CHECK_ERRNO(!entries, "malloc");
+
+    /* merge DataL and DataH by ascending ID */
+    long file_offset = content_offset;
+    long datal_i = 0, datah_i = 0;
+    for (long i = 0; i < CpkHeader_count; i++)
+    {
+        struct toc_entry * const e = &entries[i];
+        long next_l_id = LONG_MAX, next_h_id = LONG_MAX;
+        long id;
+
+        if (datal_i < itoc_filesl)
+        {
+            next_l_id = utf_table_2byte(datal, datal_i, l_ID_column);
+        }
+        if (datah_i < itoc_filesh)
         {
-            long uncompressed_size =
-                uncompress(infile, file_offset, file_size, outfile);
-            printf("   uncompressed to %ld\n", uncompressed_size);
-            
-            CHECK_ERROR( uncompressed_size != extract_size ,
-                    "uncompressed size != ExtractSize");
+            next_h_id = utf_table_2byte(datah, datah_i, h_ID_column);
+        }
+
+        CHECK_ERROR( next_l_id == next_h_id, "duplicate ID in ITOC" );
+
+        if (next_l_id < next_h_id)
+        {
+            e->file_size = utf_table_2byte(datal, datal_i, l_FileSize_column);
+            e->extract_size = utf_table_2byte(datal, datal_i, l_ExtractSize_column);
+            id = next_l_id;
+            datal_i++;
+        }
+        else
+        {
+            e->file_size = utf_table_4byte(datah, datah_i, h_FileSize_column);
+            e->extract_size = utf_table_4byte(datah, datah_i, h_ExtractSize_column);
+            id = next_h_id;
+            datah_i++;
+        }
+
+        e->id_name = number_name("", ".bin", id, max_id);
+        e->file_name = e->id_name;
+        e->dir_name = NULL;
+        e->file_offset = file_offset;
+        e->uncompressed_size = -1;
+        e->done = 0;
+
+        if (align != 0)
+        {
+            file_offset += (e->file_size + align-1)/align*align;
         }
         else
         {
-            dump(infile, outfile, file_offset, file_size);
+            file_offset += e->file_size;
+        }
+    }
+
+    free_utf_table(datah);
+    free_utf_table(datal);
+
+    return entries;
+}
+
+void analyze_CPK(reader_t *infile, const char *infile_name, const char *base_name, long file_length, int jobs, struct cpk_crypt *crypt)
+{
+    const long CpkHeader_offset = 0x0;
+    utf_table_t *CpkHeader = NULL;
+    utf_table_t *toc = NULL;
+
+    /* check header */
+    {
+        unsigned char buf[4];
+        static const char CPK_signature[4] = "CPK "; /* intentionally unterminated */
+        get_bytes_seek(CpkHeader_offset, infile, buf, 4);
+        CHECK_ERROR (memcmp(buf, CPK_signature, sizeof(CPK_signature)), "CPK signature not found");
+    }
+
+    /* are the @UTF tables encrypted? the chunk size pins down the key */
+    if (crypt->key_given)
+    {
+        crypt->tables = 1;
+    }
+    else
+    {
+        const long CpkHeader_size = get_32_le_seek(CpkHeader_offset+8, infile);
+
+        crypt->tables = utf_detect_key(infile, CpkHeader_offset+0x10,
+                CpkHeader_size-8, &crypt->key);
+        if (crypt->tables)
+        {
+            printf("@UTF tables encrypted, key s=%02x m=%02x\n\n",
+                    (unsigned int)crypt->key.start, (unsigned int)crypt->key.mult);
+        }
+    }
+    CHECK_ERROR (crypt->bodies && !crypt->tables, "--decrypt-body needs encrypted tables or --utf-key");
+
+    /* check CpkHeader */
+    {
+        reader_t *header_infile = open_table_reader(infile, CpkHeader_offset+0x10, crypt);
+        CpkHeader = load_utf_table_nofail(header_infile, CpkHeader_offset+0x10);
+        close_table_reader(header_infile, infile);
+    }
+    CHECK_ERROR (CpkHeader->info.rows != 1, "wrong number of rows in CpkHeader");
+
+    /* get TOC offset, or ITOC offset if there is no TOC */
+    long toc_offset = optional_8byte(CpkHeader, "TocOffset");
+    long itoc_offset = 0;
+    if (toc_offset == 0)
+    {
+        itoc_offset = optional_8byte(CpkHeader, "ItocOffset");
+        CHECK_ERROR (itoc_offset == 0, "neither TOC nor ITOC offset found");
+    }
+
+    /* get content offset */
+    long content_offset = utf_table_8byte(CpkHeader, 0,
+            utf_table_column(CpkHeader, "ContentOffset"));
+
+    /* get file count from CpkHeader */
+    long CpkHeader_count = utf_table_4byte(CpkHeader, 0,
+            utf_table_column(CpkHeader, "Files"));
+
+    /* get alignment, only needed to lay out ITOC files */
+    int align = 0;
+    {
+        const int Align_column = utf_table_column_index(CpkHeader, "Align");
+        if (Align_column >= 0)
+        {
+            align = utf_table_2byte(CpkHeader, 0, Align_column);
         }
-        CHECK_ERRNO(fclose(outfile) != 0, "fclose");
     }
 
-    if (toc_string_table)
+    free_utf_table(CpkHeader);
+    CpkHeader = NULL;
+
+    struct toc_entry *entries;
+    if (toc_offset)
     {
-        free_utf_string_table(toc_string_table);
-        toc_string_table = NULL;
+        entries = read_TOC(infile, toc_offset, content_offset, CpkHeader_count,
+                crypt, &toc);
+    }
+    else
+    {
+        printf("Using ITOC, no names available\n\n");
+
+        entries = read_ITOC(infile, itoc_offset, content_offset, CpkHeader_count,
+                align, crypt);
     }
+
+    /* extract files */
+    if (jobs > 1)
+    {
+        extract_parallel(infile_name, base_name, entries, CpkHeader_count, jobs, crypt);
+    }
+    else
+    {
+        for (int i = 0; i < CpkHeader_count; i++)
+        {
+            report_entry(&entries[i]);
+            entries[i].uncompressed_size =
+                extract_entry(infile, base_name, &entries[i], crypt);
+            report_uncompressed(&entries[i]);
+        }
+    }
+
+    for (int i = 0; i < CpkHeader_count; i++)
+    {
+        free(entries[i].id_name);
+    }
+    free(entries);
+
+    free_utf_table(toc);
+    toc = NULL;
 }
@@ -0,0 +1,224 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "cpk_uncompress.h"
+#include "util.h"
+#include "error_stuff.h"
+
+// Compare crilayla_decompress against the old file-based bit-at-a-time
+// decoder on every CRILAYLA segment found in a file (a .cpk works).
+
+// old decoder, kept here as the reference
+static inline uint16_t get_next_bits(reader_t *infile, long * const offset_p, uint8_t * const bit_pool_p, int * const bits_left_p, const int bit_count)
+{
+    uint16_t out_bits = 0;
+    int num_bits_produced = 0;
+    while (num_bits_produced < bit_count)
+    {
+        if (0 == *bits_left_p)
+        {
+            *bit_pool_p = get_byte_seek(*offset_p, infile);
+            *bits_left_p = 8;
+            --*offset_p;
+        }
+
+        int bits_this_round;
+        if (*bits_left_p > (bit_count - num_bits_produced))
+            bits_this_round = bit_count - num_bits_produced;
+        else
+            bits_this_round = *bits_left_p;
+
+        out_bits <<= bits_this_round;
+        out_bits |=
+            (*bit_pool_p >> (*bits_left_p - bits_this_round)) &
+            ((1 << bits_this_round) - 1);
+
+        *bits_left_p -= bits_this_round;
+        num_bits_produced += bits_this_round;
+    }
+
+    return out_bits;
+}
+
+#define GET_NEXT_BITS(bit_count) get_next_bits(infile, &input_offset, &bit_pool, &bits_left, bit_count)
+
+static long legacy_uncompress(reader_t *infile, long offset, long input_size, unsigned char *output_buffer)
+{
+    const long uncompressed_size =
+        get_32_le_seek(offset+0x08, infile);
+
+    const long uncompressed_header_offset =
+        offset + get_32_le_seek(offset+0x0C, infile)+0x10;
+
+    get_bytes_seek(uncompressed_header_offset, infile, output_buffer, 0x100);
+
+    const long input_end = offset + input_size - 0x100 - 1;
+    long input_offset = input_end;
+    const long output_end = 0x100 + uncompressed_size - 1;
+    uint8_t bit_pool = 0;
+    int bits_left = 0;
+    long bytes_output = 0;
+
+    while ( bytes_output < uncompressed_size )
+    {
+        if (GET_NEXT_BITS(1))
+        {
+            long backreference_offset =
+                output_end-bytes_output+GET_NEXT_BITS(13)+3;
+            long backreference_length = 3;
+
+            // decode variable length coding for length
+            enum { vle_levels = 4 };
+            int vle_lens[vle_levels] = { 2, 3, 5, 8 };
+            int vle_level;
+            for (vle_level = 0; vle_level < vle_levels; vle_level++)
+            {
+                int this_level = GET_NEXT_BITS(vle_lens[vle_level]);
+                backreference_length += this_level;
+                if (this_level != ((1 << vle_lens[vle_level])-1)) break;
+            }
+            if (vle_level == vle_levels)
+            {
+                int this_level;
+                do
+                {
+                    this_level = GET_NEXT_BITS(8);
+                    backreference_length += this_level;
+                } while (this_level == 255);
+            }
+
+            for (int i=0;i<backreference_length;i++)
+            {
+                output_buffer[output_end-bytes_output] = output_buffer[backreference_offset--];
+                bytes_output++;
+            }
+        }
+        else
+        {
+            // verbatim byte
+            output_buffer[output_end-bytes_output] = GET_NEXT_BITS(8);
+            bytes_output++;
+        }
+    }
+
+    return 0x100 + bytes_output;
+}
+
+struct segment
+{
+    long offset;
+    long size;
+    long output_size;
+};
+
+int main(int argc, char **argv)
+{
+    printf("crilayla_bench\n\n");
+    if (argc != 2 && argc != 3)
+    {
+        fprintf(stderr,"Incorrect program usage\n\nusage: %s file [iterations]\n",argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    const long iterations = (argc == 3) ? read_long(argv[2]) : 1;
+    CHECK_ERROR(iterations < 1, "need at least one iteration");
+
+    reader_t *infile = open_reader_file(argv[1]);
+    CHECK_ERRNO(!infile, "fopen");
+
+    const long file_length = reader_length(infile);
+
+    unsigned char *file_buffer = malloc(file_length);
+    CHECK_ERRNO(!file_buffer, "malloc");
+    get_bytes_seek(0, infile, file_buffer, file_length);
+
+    /* find segments */
+    struct segment *segments = NULL;
+    long segment_count = 0;
+    long max_output = 0;
+    long total_input = 0, total_output = 0;
+    for (long i = 0; i + 0x10 + 0x100 <= file_length; i++)
+    {
+        if (memcmp(file_buffer + i, "CRILAYLA", 8)) continue;
+
+        const long size = 0x10 + 0x100 + (long)read_32_le(file_buffer + i + 0x0C);
+        if (size > file_length - i) continue;
+
+        const long output_size = crilayla_decompressed_size(file_buffer + i, size);
+        if (output_size < 0) continue;
+
+        segments = realloc(segments, sizeof(struct segment) * (segment_count + 1));
+        CHECK_ERRNO(!segments, "realloc");
+        segments[segment_count].offset = i;
+        segments[segment_count].size = size;
+        segments[segment_count].output_size = output_size;
+        segment_count++;
+
+        if (output_size > max_output) max_output = output_size;
+        total_input += size;
+        total_output += output_size;
+    }
+
+    CHECK_ERROR(segment_count == 0, "no CRILAYLA segments found");
+    printf("%ld segments, 0x%lx bytes compressed, 0x%lx uncompressed\n",
+            segment_count, (unsigned long)total_input, (unsigned long)total_output);
+
+    unsigned char *old_output = malloc(max_output);
+    unsigned char *new_output = malloc(max_output);
+    CHECK_ERRNO(!old_output || !new_output, "malloc");
+
+    /* check that both agree */
+    for (long i = 0; i < segment_count; i++)
+    {
+        const struct segment *s = &segments[i];
+
+        CHECK_ERROR(legacy_uncompress(infile, s->offset, s->size, old_output) != s->output_size,
+                "old decoder size mismatch");
+        CHECK_ERROR(crilayla_decompress(file_buffer + s->offset, s->size,
+                    new_output, max_output) != s->output_size,
+                "new decoder failed");
+        if (memcmp(old_output, new_output, s->output_size))
+        {
+            fprintf(stderr, "output mismatch for segment at 0x%lx\n", (unsigned long)s->offset);
+            exit(EXIT_FAILURE);
+        }
+    }
+    printf("outputs match\n");
+
+    /* time the old decoder, which reads from the file */
+    clock_t start = clock();
+    for (long n = 0; n < iterations; n++)
+    {
+        for (long i = 0; i < segment_count; i++)
+        {
+            legacy_uncompress(infile, segments[i].offset, segments[i].size, old_output);
+        }
+    }
+    const double old_seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    /* time the new decoder, including the one read of each segment */
+    start = clock();
+    for (long n = 0; n < iterations; n++)
+    {
+        for (long i = 0; i < segment_count; i++)
+        {
+            get_bytes_seek(segments[i].offset, infile, file_buffer + segments[i].offset, segments[i].size);
+            crilayla_decompress(file_buffer + segments[i].offset, segments[i].size,
+                    new_output, max_output);
+        }
+    }
+    const double new_seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    const double mb = (double)total_output * iterations / (1024*1024);
+    printf("old: %.3f s (%.1f MB/s)\n", old_seconds, old_seconds > 0 ? mb / old_seconds : 0);
+    printf("new: %.3f s (%.1f MB/s)\n", new_seconds, new_seconds > 0 ? mb / new_seconds : 0);
+
+    free(new_output);
+    free(old_output);
+    free(segments);
+    free(file_buffer);
+    close_reader(infile);
+
+    exit(EXIT_SUCCESS);
+}
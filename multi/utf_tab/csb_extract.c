@@ -5,7 +5,7 @@
 #include "util.h"
 #include "error_stuff.h"
 
-void analyze_CSB(FILE *infile, long file_length);
+void analyze_CSB(reader_t *infile, long file_length);
 
 int main(int argc, char **argv)
 {
@@ -16,51 +16,45 @@ int main(int argc, char **argv)
         exit(EXIT_FAILURE);
     }
 
-    /* open file */
-    FILE *infile = fopen(argv[1], "rb");
+    /* open file, mapped if possible */
+    reader_t *infile = open_reader_mmap(argv[1]);
+    if (!infile) infile = open_reader_file(argv[1]);
     CHECK_ERRNO(!infile, "fopen");
 
-    /* get file size */
-    CHECK_ERRNO(fseek(infile, 0 , SEEK_END) != 0, "fseek");
-    long file_length = ftell(infile);
-    CHECK_ERRNO(file_length == -1, "ftell");
-
-    rewind(infile);
+    long file_length = reader_length(infile);
 
     analyze_CSB(infile, file_length);
 
     exit(EXIT_SUCCESS);
 }
 
-void analyze_CSB(FILE *infile, long file_length)
+void analyze_CSB(reader_t *infile, long file_length)
 {
     const long TBLCSB_offset = 0x0;
-    char *csb_string_table = NULL;
-    char *sdl_string_table = NULL;
+    utf_table_t *csb_table = NULL;
+    utf_table_t *sdl_table = NULL;
 
     /* get TBLCSB entry count, string table, data offset */
     int csb_rows;
     long csb_data_offset;
     {
-        struct utf_query_result result = query_utf_nofail(infile, TBLCSB_offset, NULL);
-        csb_rows = result.rows;
-        csb_data_offset = TBLCSB_offset + 8 + result.data_offset;
-
-        /* load string table */
-        csb_string_table = load_utf_string_table(infile, TBLCSB_offset);
+        csb_table = load_utf_table_nofail(infile, TBLCSB_offset);
+        csb_rows = csb_table->info.rows;
+        csb_data_offset = TBLCSB_offset + 8 + csb_table->info.data_offset;
 
         /* check that this is in fact a TBLCSB table */
-        CHECK_ERROR(strcmp(csb_string_table + result.name_offset,
+        CHECK_ERROR(strcmp(csb_table->info.table_name,
                     "TBLCSB"), "first table in file is not TBLCSB");
     }
 
     /* find entry for sound elements */
     int csb_sdl_index;
     {
+        const int name_column = utf_table_column(csb_table, "name");
+
         for (csb_sdl_index = 0; csb_sdl_index < csb_rows; csb_sdl_index++)
         {
-            if (!strcmp(query_utf_string(infile, TBLCSB_offset,
-                    csb_sdl_index, "name", csb_string_table),
+            if (!strcmp(utf_table_string(csb_table, csb_sdl_index, name_column),
                         "SOUND_ELEMENT"))
             {
                 break;
@@ -72,34 +66,34 @@ void analyze_CSB(FILE *infile, long file_length)
     }
     
     /* get sound element table offset */
-    long sdl_offset = csb_data_offset + query_utf_data(infile, TBLCSB_offset, csb_sdl_index, "utf").offset;
+    long sdl_offset = csb_data_offset + utf_table_data(csb_table, csb_sdl_index,
+            utf_table_column(csb_table, "utf")).offset;
 
     /* get sound element entry count, string table, data offset */
     int sdl_rows;
     long sdl_data_offset;
     {
-        struct utf_query_result result = query_utf_nofail(infile, sdl_offset, NULL);
-        sdl_rows = result.rows;
-        sdl_data_offset = sdl_offset + 8 + result.data_offset;
-
-        /* load string table */
-        sdl_string_table = load_utf_string_table(infile, sdl_offset);
+        sdl_table = load_utf_table_nofail(infile, sdl_offset);
+        sdl_rows = sdl_table->info.rows;
+        sdl_data_offset = sdl_offset + 8 + sdl_table->info.data_offset;
 
         /* check that this is in fact a TBLSDL table */
-        CHECK_ERROR(strcmp(sdl_string_table + result.name_offset,
+        CHECK_ERROR(strcmp(sdl_table->info.table_name,
                     "TBLSDL"), "SOUND_ELEMENT table in is not TBLSDL");
     }
 
+    const int sdl_name_column = utf_table_column(sdl_table, "name");
+    const int sdl_data_column = utf_table_column(sdl_table, "data");
+
     /* extract files */
     for (int i = 0; i < sdl_rows; i++)
     {
         /* get file name */
-        const char *file_name = query_utf_string(infile, sdl_offset, i,
-                "name", sdl_string_table);
+        const char *file_name = utf_table_string(sdl_table, i, sdl_name_column);
 
         /* get file size and offset */
         struct offset_size_pair offset_size =
-            query_utf_data(infile, sdl_offset, i, "data");
+            utf_table_data(sdl_table, i, sdl_data_column);
         long file_offset = sdl_data_offset + offset_size.offset;
         long file_size = offset_size.size;
 
@@ -122,19 +116,15 @@ void analyze_CSB(FILE *infile, long file_length)
 
             /* check type, add extension */
             do {
-                char *file_string_table = NULL;
-                struct utf_query_result result = query_utf(infile, file_offset, NULL);
+                utf_table_t *file_table = load_utf_table(infile, file_offset);
 
-                if (!result.valid) break;
+                if (!file_table) break;
 
-                /* load string table */
-                file_string_table = load_utf_string_table(infile, file_offset);
-
-                if (!strcmp(file_string_table + result.name_offset, "AAX"))
+                if (!strcmp(file_table->info.table_name, "AAX"))
                 {
                     strcat(out_file_name, ".aax");
                 }
-                free_utf_string_table(file_string_table);
+                free_utf_table(file_table);
             } while (0);
 
             printf("%s %lx %ld\n", out_file_name, (unsigned long)file_offset, file_size);
@@ -148,15 +138,9 @@ void analyze_CSB(FILE *infile, long file_length)
         CHECK_ERRNO(fclose(outfile) != 0, "fclose");
     }
 
-    if (csb_string_table)
-    {
-        free_utf_string_table(csb_string_table);
-        csb_string_table = NULL;
-    }
+    free_utf_table(csb_table);
+    csb_table = NULL;
 
-    if (sdl_string_table)
-    {
-        free_utf_string_table(sdl_string_table);
-        sdl_string_table = NULL;
-    }
+    free_utf_table(sdl_table);
+    sdl_table = NULL;
 }
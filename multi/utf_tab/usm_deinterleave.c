@@ -5,16 +5,18 @@
 #include "util.h"
 #include "error_stuff.h"
 
-void analyze_CRID(FILE *infile, const char *infile_name, long file_length, int verbosity);
+void analyze_CRID(reader_t *infile, const char *infile_name, long file_length, int verbosity, size_t high_water, int stats);
 
 void usage(void)
 {
     fflush(stdout);
     fprintf(stderr,
-        "Incorrect program usage\n\nusage: usm_deinterleave file [-v|-vv|-q]\n\n"
+        "Incorrect program usage\n\nusage: usm_deinterleave file [-v|-vv|-q] [-b bytes] [--stats]\n\n"
         "-v  : verbose (header info)\n"
         "-vv : more verbose (header and block info)\n"
-        "-q  : quiet (only output on error)\n");
+        "-q  : quiet (only output on error)\n"
+        "-b  : per-stream write buffer size (default 0x100000)\n"
+        "--stats : report throughput and per-stream byte counts\n");
 }
 
 enum
@@ -28,28 +30,37 @@ enum
 int main(int argc, char **argv)
 {
     int verbosity = verbose_normal;
-    int args_ok = 0;
+    int args_ok = (argc >= 2);
+    size_t high_water = 0x100000;
+    int stats = 0;
 
-    if (argc == 2)
+    for (int i = 2; args_ok && i < argc; i++)
     {
-    args_ok = 1;
-    }
-    else if (argc == 3)
-    {
-        if (!strcmp(argv[2],"-v"))
+        if (!strcmp(argv[i],"-v"))
         {
             verbosity = verbose_headers;
-            args_ok = 1;
         }
-        else if (!strcmp(argv[2],"-vv"))
+        else if (!strcmp(argv[i],"-vv"))
         {
             verbosity = verbose_blocks;
-            args_ok = 1;
         }
-        else if (!strcmp(argv[2],"-q"))
+        else if (!strcmp(argv[i],"-q"))
         {
             verbosity = verbose_quiet;
-            args_ok = 1;
+        }
+        else if (!strcmp(argv[i],"-b") && i+1 < argc)
+        {
+            long size = read_long(argv[++i]);
+            CHECK_ERROR (size < 1, "buffer size must be positive");
+            high_water = size;
+        }
+        else if (!strcmp(argv[i],"--stats"))
+        {
+            stats = 1;
+        }
+        else
+        {
+            args_ok = 0;
         }
     }
 
@@ -64,31 +75,148 @@ int main(int argc, char **argv)
         exit(EXIT_FAILURE);
     }
 
-    /* open file */
-    FILE *infile = fopen(argv[1], "rb");
+    /* open file, mapped if possible */
+    reader_t *infile = open_reader_mmap(argv[1]);
+    if (!infile) infile = open_reader_file(argv[1]);
     CHECK_ERRNO(!infile, "fopen");
 
-    /* get file size */
-    CHECK_ERRNO(fseek(infile, 0 , SEEK_END) != 0, "fseek");
-    long file_length = ftell(infile);
-    CHECK_ERRNO(file_length == -1, "ftell");
+    long file_length = reader_length(infile);
 
-    rewind(infile);
-
-    analyze_CRID(infile, argv[1], file_length, verbosity);
+    analyze_CRID(infile, argv[1], file_length, verbosity, high_water, stats);
 
     exit(EXIT_SUCCESS);
 }
 
-void analyze_CRID(FILE *infile, const char *infile_name, long file_length, int verbosity)
+/* sequential input, read ahead in large aligned chunks (or straight from
+   the mapping) so block headers and payloads don't each cost a read */
+struct usm_input
+{
+    reader_t *infile;
+    long length;
+    long offset;
+
+    unsigned char *buf;
+    size_t buf_size;
+    long buf_offset;
+    size_t buf_fill;
+};
+
+enum
+{
+    readahead_size = 0x100000,
+    readahead_align = 0x10000
+};
+
+static const unsigned char *usm_read(struct usm_input *in, size_t size)
+{
+    const unsigned char *p;
+
+    CHECK_ERROR (in->offset > in->length ||
+            size > (size_t)(in->length - in->offset), "unexpected EOF");
+
+    p = reader_view(in->infile, in->offset, size);
+    if (!p)
+    {
+        if (in->offset < in->buf_offset ||
+            in->offset + size > in->buf_offset + in->buf_fill)
+        {
+            const long start = in->offset / readahead_align * readahead_align;
+            size_t want = in->offset + size - start;
+
+            if (want > in->buf_size)
+            {
+                in->buf_size = (want + readahead_align - 1) / readahead_align * readahead_align;
+                in->buf = realloc(in->buf, in->buf_size);
+                CHECK_ERRNO (!in->buf, "realloc");
+            }
+
+            want = in->buf_size;
+            if (want > (size_t)(in->length - start)) want = in->length - start;
+
+            get_bytes_seek(start, in->infile, in->buf, want);
+            in->buf_offset = start;
+            in->buf_fill = want;
+        }
+
+        p = in->buf + (in->offset - in->buf_offset);
+    }
+
+    in->offset += size;
+
+    return p;
+}
+
+/* output for one stream, writes are coalesced up to the high water mark */
+struct stream_output
+{
+    FILE *file;
+    unsigned char *buf;
+    size_t fill;
+    long writes;
+};
+
+static void stream_flush(struct stream_output *out)
+{
+    if (out->fill)
+    {
+        put_bytes(out->file, out->buf, out->fill);
+        out->fill = 0;
+        out->writes ++;
+    }
+}
+
+static void stream_write(struct stream_output *out, const unsigned char *data, size_t size, size_t high_water)
+{
+    if (out->fill + size > high_water)
+    {
+        stream_flush(out);
+    }
+
+    if (size >= high_water)
+    {
+        put_bytes(out->file, data, size);
+        out->writes ++;
+    }
+    else
+    {
+        memcpy(out->buf + out->fill, data, size);
+        out->fill += size;
+    }
+}
+
+void analyze_CRID(reader_t *infile, const char *infile_name, long file_length, int verbosity, size_t high_water, int stats)
 {
     long stream_count = 0;
     struct stream_info *streams = NULL;
-    char *CRIUSF_string_table = NULL;
+    utf_table_t *CRIUSF_table = NULL;
 
-    FILE **outfiles = NULL;
+    struct stream_output *outputs = NULL;
     char **outfile_names = NULL;
 
+    const double start_time = wall_seconds();
+
+    struct usm_input in;
+    in.infile = infile;
+    in.length = file_length;
+    in.offset = 0;
+    in.buf = NULL;
+    in.buf_size = readahead_size;
+    in.buf_offset = 0;
+    in.buf_fill = 0;
+    if (!reader_view(infile, 0, 0))
+    {
+        in.buf = malloc(in.buf_size);
+        CHECK_ERRNO (!in.buf, "malloc");
+    }
+
+    /* stream index by the last byte of stmid (V, A, ...),
+       -1 for none, -2 if shared and a search is needed */
+    int stream_by_tag[256];
+    for (int i = 0; i < 256; i++)
+    {
+        stream_by_tag[i] = -1;
+    }
+
     enum
     {
         CRID_stmid = 0x43524944,  /* CRID */
@@ -119,8 +247,10 @@ void analyze_CRID(FILE *infile, const char *infile_name, long file_length, int v
     /* dispense justice! */
     do
     {
-        uint32_t stmid = get_32_be(infile);
-        uint32_t block_size = get_32_be(infile);
+        const long block_offset = in.offset;
+        const unsigned char *block_header = usm_read(&in, 8 + 0x18);
+        uint32_t stmid = read_32_be((unsigned char *)block_header);
+        uint32_t block_size = read_32_be((unsigned char *)block_header + 4);
         uint32_t block_type;
         uint16_t header_size, footer_size;
         size_t payload_bytes;
@@ -134,14 +264,19 @@ void analyze_CRID(FILE *infile, const char *infile_name, long file_length, int v
         {
             CHECK_ERROR (0 == stream_count, "0 stream count should be impossible");
             /* find the stream */
-            for (stream_idx=1; stream_idx < stream_count; stream_idx++)
+            stream_idx = stream_by_tag[stmid & 0xff];
+            if (-2 == stream_idx)
             {
-                if (stmid == streams[stream_idx].stmid)
+                for (stream_idx=1; stream_idx < stream_count; stream_idx++)
                 {
-                    break;
+                    if (stmid == streams[stream_idx].stmid)
+                    {
+                        break;
+                    }
                 }
             }
-            CHECK_ERROR (stream_idx == stream_count, "unknown stmid");
+            CHECK_ERROR (stream_idx < 0 || stream_idx == stream_count ||
+                    stmid != streams[stream_idx].stmid, "unknown stmid");
 
             CHECK_ERROR (!streams[stream_idx].alive, "stream was supposed to be ended");
 
@@ -150,24 +285,25 @@ void analyze_CRID(FILE *infile, const char *infile_name, long file_length, int v
 
         if (verbosity >= verbose_blocks)
         {
-            printf("%08lx %d block_size: %08"PRIx32" ", (unsigned long)ftell(infile)-8, stream_idx, block_size);
+            printf("%08lx %d block_size: %08"PRIx32" ", (unsigned long)block_offset, stream_idx, block_size);
         }
 
         /* block control */
         {
-            header_size = get_16_be(infile);
-            footer_size = get_16_be(infile);
+            header_size = read_16_be((unsigned char *)block_header + 8);
+            footer_size = read_16_be((unsigned char *)block_header + 10);
             if (verbosity >= verbose_blocks)
             {
                 printf("%04"PRIx16" %04"PRIx16"\n", header_size, footer_size);
             }
 
             CHECK_ERROR( 0x18 != header_size, "expected header size 0x18" );
+            CHECK_ERROR( block_size < (uint32_t)header_size + footer_size, "block too small" );
             payload_bytes = block_size - header_size - footer_size;
         }
 
         /* block typs */
-        block_type = get_32_be(infile);
+        block_type = read_32_be((unsigned char *)block_header + 12);
         if (verbosity >= verbose_blocks)
         {
             printf("type %08"PRIx32"\n", block_type);
@@ -177,10 +313,10 @@ void analyze_CRID(FILE *infile, const char *infile_name, long file_length, int v
         {
             uint32_t byte1,byte2,byte3,byte4;
 
-            byte1 = get_32_be(infile); /* granule (1/100 of a frame) */
-            byte2 = get_32_be(infile); /* samples (based on whole block size at avg bitrate) */
-            byte3 = get_32_be(infile);
-            byte4 = get_32_be(infile);
+            byte1 = read_32_be((unsigned char *)block_header + 16); /* granule (1/100 of a frame) */
+            byte2 = read_32_be((unsigned char *)block_header + 20); /* samples (based on whole block size at avg bitrate) */
+            byte3 = read_32_be((unsigned char *)block_header + 24);
+            byte4 = read_32_be((unsigned char *)block_header + 28);
 
             if (verbosity >= verbose_blocks)
             {
@@ -199,8 +335,7 @@ void analyze_CRID(FILE *infile, const char *infile_name, long file_length, int v
         {
             /* handle first block, which describes the subsequent streams */
 
-            long CRIUSF_offset = ftell(infile);
-            CHECK_ERROR (-1 == CRIUSF_offset, "ftell");
+            long CRIUSF_offset = in.offset;
 
             /* seems like it ought to be type 2, but it's type 1 */
             CHECK_ERROR (1 != block_type, "CRID should be type 1");
@@ -212,17 +347,13 @@ void analyze_CRID(FILE *infile, const char *infile_name, long file_length, int v
 
             /* check CRIUSF stream list */
             {
-                struct utf_query_result result = query_utf_nofail(infile, CRIUSF_offset, NULL);
-                long CRIUSF_data_offset;
-
-                CHECK_ERROR (result.rows < 1, "expected at least one row in CRIUSF");
-                stream_count = result.rows;
-                CRIUSF_data_offset = CRIUSF_offset + result.data_offset;
+                CRIUSF_table = load_utf_table_nofail(infile, CRIUSF_offset);
 
-                CRIUSF_string_table = load_utf_string_table(infile, CRIUSF_offset);
+                CHECK_ERROR (CRIUSF_table->info.rows < 1, "expected at least one row in CRIUSF");
+                stream_count = CRIUSF_table->info.rows;
 
                 /* check that we're actually looking at a CRIUSF table */
-                CHECK_ERROR (strcmp(&CRIUSF_string_table[result.name_offset],
+                CHECK_ERROR (strcmp(CRIUSF_table->info.table_name,
                             "CRIUSF_DIR_STREAM"), "expected CRIUSF_DIR_STREAM");
 
             }
@@ -230,6 +361,14 @@ void analyze_CRID(FILE *infile, const char *infile_name, long file_length, int v
             /* check streams */
             {
                 int i, j;
+                const int filename_column = utf_table_column(CRIUSF_table, "filename");
+                const int filesize_column = utf_table_column(CRIUSF_table, "filesize");
+                const int datasize_column = utf_table_column(CRIUSF_table, "datasize");
+                const int stmid_column    = utf_table_column(CRIUSF_table, "stmid");
+                const int chno_column     = utf_table_column(CRIUSF_table, "chno");
+                const int minchk_column   = utf_table_column(CRIUSF_table, "minchk");
+                const int minbuf_column   = utf_table_column(CRIUSF_table, "minbuf");
+                const int avbps_column    = utf_table_column(CRIUSF_table, "avbps");
 
                 streams = malloc(sizeof(struct stream_info)*stream_count);
                 CHECK_ERRNO (!streams, "malloc");
@@ -238,14 +377,14 @@ void analyze_CRID(FILE *infile, const char *infile_name, long file_length, int v
                 for (i = 0; i < stream_count; i ++)
                 {
                     struct stream_info * const s = &streams[i];
-                    s->filename = query_utf_string(infile, CRIUSF_offset, i, "filename", CRIUSF_string_table);
-                    s->filesize = query_utf_4byte(infile, CRIUSF_offset, i, "filesize");
-                    s->datasize = query_utf_4byte(infile, CRIUSF_offset, i, "datasize");
-                    s->stmid    = query_utf_4byte(infile, CRIUSF_offset, i, "stmid");
-                    s->chno     = query_utf_2byte(infile, CRIUSF_offset, i, "chno");
-                    s->minchk   = query_utf_2byte(infile, CRIUSF_offset, i, "minchk");
-                    s->minbuf   = query_utf_4byte(infile, CRIUSF_offset, i, "minbuf");
-                    s->avbps    = query_utf_4byte(infile, CRIUSF_offset, i, "avbps");
+                    s->filename = utf_table_string(CRIUSF_table, i, filename_column);
+                    s->filesize = utf_table_4byte(CRIUSF_table, i, filesize_column);
+                    s->datasize = utf_table_4byte(CRIUSF_table, i, datasize_column);
+                    s->stmid    = utf_table_4byte(CRIUSF_table, i, stmid_column);
+                    s->chno     = utf_table_2byte(CRIUSF_table, i, chno_column);
+                    s->minchk   = utf_table_2byte(CRIUSF_table, i, minchk_column);
+                    s->minbuf   = utf_table_4byte(CRIUSF_table, i, minbuf_column);
+                    s->avbps    = utf_table_4byte(CRIUSF_table, i, avbps_column);
 
                     if (0 == i)
                     {
@@ -292,8 +431,9 @@ void analyze_CRID(FILE *infile, const char *infile_name, long file_length, int v
             /* open output files */
             {
                 int i;
-                outfiles = malloc(sizeof(FILE*)*stream_count);
-                CHECK_ERRNO (!outfiles, "malloc");
+                outputs = malloc(sizeof(struct stream_output)*stream_count);
+                CHECK_ERRNO (!outputs, "malloc");
+                memset(outputs, 0, sizeof(struct stream_output)*stream_count);
                 outfile_names = malloc(sizeof(char*)*stream_count);
                 CHECK_ERRNO (!outfile_names, "malloc");
 
@@ -301,7 +441,6 @@ void analyze_CRID(FILE *infile, const char *infile_name, long file_length, int v
                 {
                     if (0 == i)
                     {
-                        outfiles[i] = NULL;
                         outfile_names[i] = NULL;
                     }
                     else
@@ -320,13 +459,28 @@ void analyze_CRID(FILE *infile, const char *infile_name, long file_length, int v
                                 break;
                         }
                         outfile_names[i] = name;
-                        outfiles[i] = fopen(name, "wb");
+                        outputs[i].file = fopen(name, "wb");
+
+                        CHECK_ERRNO(!outputs[i].file, "fopen");
 
-                        CHECK_ERRNO(!outfiles[i], "fopen");
+                        /* we do our own buffering */
+                        setvbuf(outputs[i].file, NULL, _IONBF, 0);
+                        outputs[i].buf = malloc(high_water);
+                        CHECK_ERRNO (!outputs[i].buf, "malloc");
                     }
                 }
             }
 
+            /* index streams by tag */
+            {
+                int i;
+                for (i = 1; i < stream_count; i++)
+                {
+                    int * const slot = &stream_by_tag[streams[i].stmid & 0xff];
+                    *slot = (-1 == *slot) ? i : -2;
+                }
+            }
+
             /* initialize streams */
             {
                 int i;
@@ -342,8 +496,8 @@ void analyze_CRID(FILE *infile, const char *infile_name, long file_length, int v
 
             streams_setup = 1;
 
-            /* seek to footer for check below */
-            fseek(infile, CRIUSF_offset+payload_bytes, SEEK_SET);
+            /* skip to footer for check below */
+            usm_read(&in, payload_bytes);
         }
         else    /* stream setup already complete */
         {
@@ -352,30 +506,27 @@ void analyze_CRID(FILE *infile, const char *infile_name, long file_length, int v
             {
 
                 case 0: /* data */
-                    dump_from_here(infile, outfiles[stream_idx], payload_bytes);
+                    stream_write(&outputs[stream_idx], usm_read(&in, payload_bytes),
+                            payload_bytes, high_water);
                     streams[stream_idx].payload_bytes += payload_bytes;
                     break;
                 case 1: /* header */
                 case 3: /* metadata */
                     /* skip */
                     {
-                        long current_offset = ftell(infile);
-                        CHECK_ERROR (-1 == current_offset, "ftell");
+                        long current_offset = in.offset;
                         if (
                             (block_type == 1 && verbosity >= verbose_headers) ||
                             (block_type == 3 && verbosity >= verbose_blocks))
                         {
                             analyze_utf(infile, current_offset, 0, 1, NULL);
                         }
-                        fseek(infile, current_offset+payload_bytes, SEEK_SET);
+                        usm_read(&in, payload_bytes);
                     }
                     break;
                 case 2: /* stream metadata */
                     {
-                        char *metadata = malloc(payload_bytes);
-                        CHECK_ERROR (!metadata, "malloc");
-
-                        get_bytes(infile, (unsigned char *)metadata, payload_bytes);
+                        const char *metadata = (const char *)usm_read(&in, payload_bytes);
 
                         if (!strncmp(metadata, "#HEADER END     ===============", payload_bytes))
                         {
@@ -404,9 +555,10 @@ void analyze_CRID(FILE *infile, const char *infile_name, long file_length, int v
         /* check footer (0 padding) */
         {
             int i;
+            const unsigned char *footer = usm_read(&in, footer_size);
             for (i = 0; i < footer_size; i++)
             {
-                CHECK_ERROR (0 != get_byte(infile), "nonzero padding");
+                CHECK_ERROR (0 != footer[i], "nonzero padding");
             }
         }
     }
@@ -414,33 +566,51 @@ void analyze_CRID(FILE *infile, const char *infile_name, long file_length, int v
 
     CHECK_ERROR (!streams_setup, "no CRID found");
 
-    if (ftell(infile) != file_length)
+    if (in.offset != file_length)
     {
         printf("Warning: read only 0x%lx bytes of 0x%lx byte file\n",
-            (unsigned long)ftell(infile), (unsigned long)file_length);
+            (unsigned long)in.offset, (unsigned long)file_length);
     }
 
     /* cleanup */
-    if (outfiles)
+    if (outputs)
     {
         int i;
         for (i=0; i < stream_count; i++)
         {
-            if (outfiles[i])
+            if (outputs[i].file)
             {
+                stream_flush(&outputs[i]);
                 if (verbosity >= verbose_normal)
                 {
                     printf("%d: %s: read %ld bytes, %ld bytes payload\n",
                             i, outfile_names[i], streams[i].bytes_read, streams[i].payload_bytes);
                 }
-                int rc = fclose(outfiles[i]);
+                int rc = fclose(outputs[i].file);
                 CHECK_ERRNO (EOF == rc, "fclose");
+                free(outputs[i].buf);
             }
         }
+    }
 
-        free(outfiles);
+    if (stats)
+    {
+        const double seconds = wall_seconds() - start_time;
+        const double mb = (double)in.offset / (1024*1024);
+        int i;
+
+        printf("%.1f MB in %.3f s, %.1f MB/s\n", mb, seconds,
+                seconds > 0 ? mb / seconds : 0);
+        for (i=1; i < stream_count; i++)
+        {
+            printf("%d: %ld bytes read, %ld bytes payload, %ld writes\n",
+                    i, streams[i].bytes_read, streams[i].payload_bytes, outputs[i].writes);
+        }
     }
 
+    free(outputs);
+    free(in.buf);
+
     if (outfile_names)
     {
         int i;
@@ -461,9 +631,6 @@ void analyze_CRID(FILE *infile, const char *infile_name, long file_length, int v
         streams = NULL;
     }
 
-    if (CRIUSF_string_table)
-    {
-        free_utf_string_table(CRIUSF_string_table);
-        CRIUSF_string_table = NULL;
-    }
+    free_utf_table(CRIUSF_table);
+    CRIUSF_table = NULL;
 }
@@ -8,409 +8,648 @@
 #include "util.h"
 #include "utf_tab.h"
 
-struct utf_query_result analyze_utf(FILE *infile, const long offset, int indent, int print, const struct utf_query *query)
+static int column_width(uint8_t type)
 {
-    unsigned char buf[4];
-    struct utf_table_info table_info;
-    char *string_table = NULL;
-    struct utf_column_info * schema = NULL;
-    struct utf_query_result result;
-    
-    result.valid = 0;
+    switch (type & COLUMN_TYPE_MASK)
+    {
+        case COLUMN_TYPE_STRING:
+            return 4;
+        case COLUMN_TYPE_8BYTE:
+        case COLUMN_TYPE_DATA:
+            return 8;
+        case COLUMN_TYPE_FLOAT:
+        case COLUMN_TYPE_4BYTE2:
+        case COLUMN_TYPE_4BYTE:
+            return 4;
+        case COLUMN_TYPE_2BYTE2:
+        case COLUMN_TYPE_2BYTE:
+            return 2;
+        case COLUMN_TYPE_1BYTE2:
+        case COLUMN_TYPE_1BYTE:
+            return 1;
+        default:
+            return -1;
+    }
+}
 
-    if (print)
+/* FNV-1a */
+uint32_t utf_name_hash(const char *name)
+{
+    uint32_t hash = UINT32_C(0x811c9dc5);
+
+    for (; *name; name++)
     {
-        fprintf_indent(stdout, indent);
-        printf("{\n");
+        hash ^= (unsigned char)*name;
+        hash *= UINT32_C(0x01000193);
     }
 
-    indent += INDENT_LEVEL;
+    return hash;
+}
 
-    table_info.table_offset = offset;
+/* "s=5f,m=15", both hex */
+struct utf_key read_utf_key(const char *text)
+{
+    struct utf_key key;
+    unsigned int start, mult;
+    int end = 0;
 
-    /* check header */
+    CHECK_ERROR(sscanf(text, "s=%x,m=%x%n", &start, &mult, &end) != 2 ||
+            text[end] != '\0' || start > UINT8_MAX || mult > UINT8_MAX,
+            "bad key format, expected s=XX,m=XX");
+
+    key.start = start;
+    key.mult = mult;
+
+    return key;
+}
+
+/* Find keys that turn the first 0x18 bytes of an encrypted table into a
+   plausible header: the signature, the table size (if known, 0 if not),
+   and a table name at 7, first in the string table after "<NULL>".
+   start falls out of the signature, so only the 256 mults are tried.
+   Returns the number of keys found, up to max_keys are stored. */
+int utf_guess_keys(const unsigned char *buf, uint32_t table_size,
+        struct utf_key *keys, int max_keys)
+{
+    enum {bytes_to_check=0x18};
     static const char UTF_signature[4] = "@UTF"; /* intentionally unterminated */
-    get_bytes_seek(offset, infile, buf, 4);
-    if (memcmp(buf, UTF_signature, sizeof(UTF_signature)))
+    unsigned char expected_bytes[bytes_to_check];
+    unsigned char known[bytes_to_check];
+    uint8_t xor_bytes[bytes_to_check];
+    int found = 0;
+
+    memset(known, 0, sizeof(known));
+    memcpy(&expected_bytes[0], UTF_signature, 4);
+    memset(known, 1, 4);
+    if (table_size)
     {
-        if (print)
-        {
-            fprintf_indent(stdout, indent);
-            printf("not a @UTF table at %08" PRIx32 "\n", (uint32_t)offset);
-        }
-        goto cleanup;
+        write_32_be(table_size, &expected_bytes[4]);
+        memset(known+4, 1, 4);
     }
+    write_32_be(7, &expected_bytes[0x14]);
+    memset(known+0x14, 1, 4);
 
-    /* get table size */
-    table_info.table_size = get_32_be(infile);
-
-    table_info.schema_offset = 0x20;
-    table_info.rows_offset = get_32_be(infile);
-    table_info.string_table_offset = get_32_be(infile);
-    table_info.data_offset = get_32_be(infile);
-    const uint32_t table_name_string = get_32_be(infile);
-    table_info.columns = get_16_be(infile);
-    table_info.row_width = get_16_be(infile);
-    table_info.rows = get_32_be(infile);
-
-    /* allocate for string table */
-    const int string_table_size =
-        table_info.data_offset-table_info.string_table_offset;
-    string_table = malloc(string_table_size+1);
-    CHECK_ERRNO(!string_table, "malloc");
-    table_info.string_table = string_table;
-    memset(string_table, 0, string_table_size+1);
+    for (int i = 0; i < bytes_to_check; i++)
+    {
+        xor_bytes[i] = expected_bytes[i]^buf[i];
+    }
 
-    /* load schema */
-    schema = malloc(sizeof(struct utf_column_info) * table_info.columns);
-    CHECK_ERRNO(!schema, "malloc");
+    for (int mult = 0; mult <= UINT8_MAX; mult++)
     {
+        uint8_t xor = xor_bytes[0];
         int i;
-        for (i = 0; i < table_info.columns; i++)
+        for (i = 1; i < bytes_to_check; i++)
         {
-            schema[i].type = get_byte(infile);
-            schema[i].column_name = string_table + get_32_be(infile);
+            xor *= mult;
+            if (known[i] && xor != xor_bytes[i]) break;
+        }
 
-            if ((schema[i].type & COLUMN_STORAGE_MASK) == COLUMN_STORAGE_CONSTANT)
+        if (i == bytes_to_check)
+        {
+            if (found < max_keys)
             {
-                schema[i].constant_offset = ftell(infile);
-                switch (schema[i].type & COLUMN_TYPE_MASK)
-                {
-                    case COLUMN_TYPE_STRING:
-                        get_32_be(infile);
-                        break;
-                    case COLUMN_TYPE_8BYTE:
-                    case COLUMN_TYPE_DATA:
-                        get_32_be(infile);
-                        get_32_be(infile);
-                        break;
-                    case COLUMN_TYPE_FLOAT:
-                    case COLUMN_TYPE_4BYTE2:
-                    case COLUMN_TYPE_4BYTE:
-                        get_32_be(infile);
-                        break;
-                    case COLUMN_TYPE_2BYTE2:
-                    case COLUMN_TYPE_2BYTE:
-                        get_16_be(infile);
-                        break;
-                    case COLUMN_TYPE_1BYTE2:
-                    case COLUMN_TYPE_1BYTE:
-                        get_byte(infile);
-                        break;
-                    default:
-                        CHECK_ERROR(1, "unknown type for constant");
-                }
+                keys[found].start = xor_bytes[0];
+                keys[found].mult = mult;
             }
+            found++;
         }
     }
 
-    table_info.schema = schema;
+    return found;
+}
 
-    /* read string table */
-    get_bytes_seek(table_info.string_table_offset+8+offset,
-            infile, (unsigned char *)string_table, string_table_size);
-    table_info.table_name = table_info.string_table+table_name_string;
+/* 0 if there is a plain @UTF table at offset, 1 if it looks encrypted and
+   a key was found for it */
+int utf_detect_key(reader_t *infile, long offset, uint32_t table_size,
+        struct utf_key *key)
+{
+    static const char UTF_signature[4] = "@UTF"; /* intentionally unterminated */
+    unsigned char buf[0x18];
 
-#if 0
-    if (print)
+    get_bytes_seek(offset, infile, buf, sizeof(buf));
+    if (!memcmp(buf, UTF_signature, sizeof(UTF_signature)))
     {
-        fprintf_table_info(stdout, &table_info, indent);
+        return 0;
     }
-#endif
 
-    /* fill in the default stuff */
-    result.valid = 1;
-    result.found = 0;
-    result.rows = table_info.rows;
-    result.name_offset = table_name_string;
-    result.string_table_offset = table_info.string_table_offset;
-    result.data_offset = table_info.data_offset;
+    CHECK_ERROR(utf_guess_keys(buf, table_size, key, 1) == 0,
+            "no @UTF table or key found");
+
+    return 1;
+}
+
+utf_table_t *load_utf_table(reader_t *infile, const long offset)
+{
+    unsigned char header[0x20];
+    utf_table_t *table;
 
-    /* explore the values */
-    if (query || print) {
-        int i, j;
+    /* check header */
+    static const char UTF_signature[4] = "@UTF"; /* intentionally unterminated */
+    get_bytes_seek(offset, infile, header, 4);
+    if (memcmp(header, UTF_signature, sizeof(UTF_signature)))
+    {
+        return NULL;
+    }
+    get_bytes(infile, header+4, sizeof(header)-4);
+
+    table = malloc(sizeof(utf_table_t));
+    CHECK_ERRNO(!table, "malloc");
+    memset(table, 0, sizeof(utf_table_t));
+
+    struct utf_table_info * const info = &table->info;
+    info->table_offset = offset;
+    info->table_size = read_32_be(header+0x04);
+    info->schema_offset = 0x20;
+    info->rows_offset = read_32_be(header+0x08);
+    info->string_table_offset = read_32_be(header+0x0c);
+    info->data_offset = read_32_be(header+0x10);
+    table->name_offset = read_32_be(header+0x14);
+    info->columns = read_16_be(header+0x18);
+    info->row_width = read_16_be(header+0x1a);
+    info->rows = read_32_be(header+0x1c);
+
+    CHECK_ERROR(info->rows_offset + 8 < info->schema_offset ||
+            info->rows_offset > info->table_size ||
+            info->string_table_offset > info->data_offset ||
+            info->data_offset > info->table_size,
+            "bad @UTF table layout");
+    CHECK_ERROR((uint64_t)info->rows * info->row_width >
+            info->table_size - info->rows_offset,
+            "rows overrun the table");
+
+    /* the 8 byte header and table_size after it have to be in the input */
+    CHECK_ERROR((uint64_t)info->table_size + 8 >
+            (uint64_t)(reader_length(infile) - offset),
+            "@UTF table overruns the input");
+
+    /* read the whole table at once */
+    const size_t buffer_size = (size_t)info->table_size + 8;
+    table->buffer = malloc(buffer_size);
+    CHECK_ERRNO(!table->buffer, "malloc");
+    get_bytes_seek(offset, infile, table->buffer, buffer_size);
+
+    /* string table, with a terminator in case the last string lacks one */
+    const uint32_t string_table_size =
+        info->data_offset - info->string_table_offset;
+    table->string_table = malloc(string_table_size + 1);
+    CHECK_ERRNO(!table->string_table, "malloc");
+    memcpy(table->string_table,
+            table->buffer + 8 + info->string_table_offset, string_table_size);
+    table->string_table[string_table_size] = '\0';
+    info->string_table = table->string_table;
+
+    CHECK_ERROR(table->name_offset > string_table_size, "bad table name offset");
+    info->table_name = table->string_table + table->name_offset;
+
+    /* schema, with precomputed offsets */
+    table->schema = malloc(sizeof(struct utf_column_info) * (info->columns + 1));
+    CHECK_ERRNO(!table->schema, "malloc");
+    info->schema = table->schema;
+    {
+        const long schema_end = info->rows_offset + 8;
+        long schema_offset = info->schema_offset;
+        long row_offset = 0;
+        int i;
 
-        for (i = 0; i < table_info.rows; i++)
+        for (i = 0; i < info->columns; i++)
         {
-            if (!print && query && i != query->index) continue;
+            struct utf_column_info * const column = &table->schema[i];
+
+            CHECK_ERROR(schema_offset + 5 > schema_end, "schema overrun");
+            column->type = table->buffer[schema_offset];
+            const uint32_t name_offset =
+                read_32_be(table->buffer + schema_offset + 1);
+            schema_offset += 5;
+
+            CHECK_ERROR(name_offset > string_table_size, "bad column name offset");
+            column->column_name = table->string_table + name_offset;
+            column->name_hash = utf_name_hash(column->column_name);
+            column->constant_offset = 0;
+            column->row_offset = row_offset;
 
-            uint32_t row_offset =
-                table_info.table_offset + 8 + table_info.rows_offset +
-                i * table_info.row_width;
-            const uint32_t row_start_offset = row_offset;
+            const int width = column_width(column->type);
 
-            if (print)
+            switch (column->type & COLUMN_STORAGE_MASK)
             {
-                fprintf_indent(stdout, indent);
-                printf("%s[%d] = {\n", table_info.table_name, i);
+                case COLUMN_STORAGE_PERROW:
+                    CHECK_ERROR(width < 0, "unknown normal type");
+                    row_offset += width;
+                    break;
+                case COLUMN_STORAGE_CONSTANT:
+                    CHECK_ERROR(width < 0, "unknown type for constant");
+                    CHECK_ERROR(schema_offset + width > schema_end, "schema overrun");
+                    column->constant_offset = schema_offset;
+                    schema_offset += width;
+                    break;
+                case COLUMN_STORAGE_ZERO:
+                    break;
+                default:
+                    CHECK_ERROR(1, "unknown storage class");
             }
-            indent += INDENT_LEVEL;
-            for (j = 0; j < table_info.columns; j++)
+        }
+
+        CHECK_ERROR(info->rows != 0 && row_offset != info->row_width,
+                "column widths do now add up to row width");
+    }
+
+    /* column name hash, at most half full */
+    {
+        uint32_t hash_size = 1;
+        int i;
+
+        while (hash_size < 2u * info->columns) hash_size *= 2;
+        table->column_hash_mask = hash_size - 1;
+        table->column_hash = malloc(sizeof(uint16_t) * hash_size);
+        CHECK_ERRNO(!table->column_hash, "malloc");
+        memset(table->column_hash, 0, sizeof(uint16_t) * hash_size);
+
+        for (i = 0; i < info->columns; i++)
+        {
+            uint32_t slot = table->schema[i].name_hash & table->column_hash_mask;
+
+            /* a repeated name replaces the earlier column */
+            while (table->column_hash[slot] &&
+                    strcmp(table->schema[table->column_hash[slot]-1].column_name,
+                        table->schema[i].column_name))
             {
-                uint8_t type = table_info.schema[j].type;
-                long constant_offset = table_info.schema[j].constant_offset;
-                int constant = 0;
+                slot = (slot + 1) & table->column_hash_mask;
+            }
+            table->column_hash[slot] = i + 1;
+        }
+    }
 
-                int qthis = (query && i == query->index &&
-                        !strcmp(table_info.schema[j].column_name, query->name));
+    return table;
+}
 
-                if (print)
-                {
-                    fprintf_indent(stdout, indent);
+utf_table_t *load_utf_table_nofail(reader_t *infile, const long offset)
+{
+    utf_table_t *table = load_utf_table(infile, offset);
+
+    CHECK_ERROR (!table, "didn't find valid @UTF table where one was expected");
+
+    return table;
+}
+
+void free_utf_table(utf_table_t *table)
+{
+    if (!table) return;
+
+    free(table->column_hash);
+    free(table->schema);
+    free(table->string_table);
+    free(table->buffer);
+    free(table);
+}
+
+int utf_table_column_index(const utf_table_t *table, const char *name)
+{
+    uint32_t slot = utf_name_hash(name) & table->column_hash_mask;
+
+    while (table->column_hash[slot])
+    {
+        const int column = table->column_hash[slot] - 1;
+        if (!strcmp(table->schema[column].column_name, name))
+        {
+            return column;
+        }
+        slot = (slot + 1) & table->column_hash_mask;
+    }
+
+    return -1;
+}
+
+int utf_table_column(const utf_table_t *table, const char *name)
+{
+    const int column = utf_table_column_index(table, name);
+
+    CHECK_ERROR (column < 0, "key not found");
+
+    return column;
+}
+
+/* location of a cell, NULL for zero storage; type -1 skips the type check */
+static unsigned char *utf_table_cell(const utf_table_t *table, uint32_t row,
+        int column, int type)
+{
+    const struct utf_column_info *info;
+
+    CHECK_ERROR (column < 0 || column >= table->info.columns, "bad column");
+    CHECK_ERROR (row >= table->info.rows, "key not found");
+
+    info = &table->schema[column];
+    switch (type)
+    {
+        case COLUMN_TYPE_8BYTE:
+            CHECK_ERROR((info->type & COLUMN_TYPE_MASK) != type, "value is not an 8 byte uint");
+            break;
+        case COLUMN_TYPE_4BYTE:
+            CHECK_ERROR((info->type & COLUMN_TYPE_MASK) != type, "value is not a 4 byte uint");
+            break;
+        case COLUMN_TYPE_2BYTE:
+            CHECK_ERROR((info->type & COLUMN_TYPE_MASK) != type, "value is not a 2 byte uint");
+            break;
+        case COLUMN_TYPE_1BYTE:
+            CHECK_ERROR((info->type & COLUMN_TYPE_MASK) != type, "value is not a 1 byte uint");
+            break;
+        case COLUMN_TYPE_STRING:
+            CHECK_ERROR((info->type & COLUMN_TYPE_MASK) != type, "value is not a string");
+            break;
+        case COLUMN_TYPE_DATA:
+            CHECK_ERROR((info->type & COLUMN_TYPE_MASK) != type, "value is not data");
+            break;
+    }
+
+    switch (info->type & COLUMN_STORAGE_MASK)
+    {
+        case COLUMN_STORAGE_PERROW:
+            return table->buffer + 8 + table->info.rows_offset +
+                (size_t)row * table->info.row_width + info->row_offset;
+        case COLUMN_STORAGE_CONSTANT:
+            return table->buffer + info->constant_offset;
+        default:
+            return NULL;
+    }
+}
+
+uint8_t utf_table_1byte(const utf_table_t *table, uint32_t row, int column)
+{
+    const unsigned char *cell = utf_table_cell(table, row, column, COLUMN_TYPE_1BYTE);
+    return cell ? cell[0] : 0;
+}
+
+uint16_t utf_table_2byte(const utf_table_t *table, uint32_t row, int column)
+{
+    unsigned char *cell = utf_table_cell(table, row, column, COLUMN_TYPE_2BYTE);
+    return cell ? read_16_be(cell) : 0;
+}
+
+uint32_t utf_table_4byte(const utf_table_t *table, uint32_t row, int column)
+{
+    unsigned char *cell = utf_table_cell(table, row, column, COLUMN_TYPE_4BYTE);
+    return cell ? read_32_be(cell) : 0;
+}
+
+uint64_t utf_table_8byte(const utf_table_t *table, uint32_t row, int column)
+{
+    unsigned char *cell = utf_table_cell(table, row, column, COLUMN_TYPE_8BYTE);
+    return cell ? read_64_be(cell) : 0;
+}
+
+const char *utf_table_string(const utf_table_t *table, uint32_t row, int column)
+{
+    unsigned char *cell = utf_table_cell(table, row, column, COLUMN_TYPE_STRING);
+    const uint32_t string_offset = cell ? read_32_be(cell) : 0;
+
+    CHECK_ERROR(string_offset >
+            table->info.data_offset - table->info.string_table_offset,
+            "bad string offset");
+
+    return table->string_table + string_offset;
+}
+
+struct offset_size_pair utf_table_data(const utf_table_t *table, uint32_t row, int column)
+{
+    unsigned char *cell = utf_table_cell(table, row, column, COLUMN_TYPE_DATA);
+    struct offset_size_pair result = {0, 0};
+
+    if (cell)
+    {
+        result.offset = read_32_be(cell);
+        result.size = read_32_be(cell+4);
+    }
+
+    return result;
+}
+
+static void print_utf_rows(reader_t *infile, const utf_table_t *table, int indent)
+{
+    const struct utf_table_info * const table_info = &table->info;
+    uint32_t i;
+    int j;
+
+    for (i = 0; i < table_info->rows; i++)
+    {
+        const unsigned char * const row = table->buffer + 8 +
+            table_info->rows_offset + (size_t)i * table_info->row_width;
+
+        fprintf_indent(stdout, indent);
+        printf("%s[%d] = {\n", table_info->table_name, (int)i);
+
+        indent += INDENT_LEVEL;
+        for (j = 0; j < table_info->columns; j++)
+        {
+            const struct utf_column_info * const column = &table->schema[j];
+            const uint8_t type = column->type;
+            unsigned char *data;
+
+            fprintf_indent(stdout, indent);
 #if 1
-                    printf("%08x %02x %s = ", row_offset-row_start_offset, type, table_info.schema[j].column_name);
+            printf("%08lx %02x %s = ", column->row_offset, type, column->column_name);
 #else
-                    printf("%s = ", table_info.schema[j].column_name);
+            printf("%s = ", column->column_name);
 #endif
-                }
 
-                if (qthis)
-                {
-                    result.found = 1;
-                    result.type = schema[j].type & COLUMN_TYPE_MASK;
-                }
+            switch (type & COLUMN_STORAGE_MASK)
+            {
+                case COLUMN_STORAGE_PERROW:
+                    data = (unsigned char *)row + column->row_offset;
+                    break;
+                case COLUMN_STORAGE_CONSTANT:
+                    data = table->buffer + column->constant_offset;
+                    printf("constant ");
+                    break;
+                default:
+                    printf("UNDEFINED\n");
+                    continue;
+            }
 
-                switch (schema[j].type & COLUMN_STORAGE_MASK)
-                {
-                    case COLUMN_STORAGE_PERROW:
-                        break;
-                    case COLUMN_STORAGE_CONSTANT:
-                        constant = 1;
-                        break;
-                    case COLUMN_STORAGE_ZERO:
-                        if (print)
+            switch (type & COLUMN_TYPE_MASK)
+            {
+                case COLUMN_TYPE_STRING:
+                    {
+                        const uint32_t string_offset = read_32_be(data);
+                        if (string_offset <= table_info->data_offset - table_info->string_table_offset)
                         {
-                            printf("UNDEFINED\n");
+                            printf("\"%s\"\n", table_info->string_table + string_offset);
                         }
-                        if (qthis)
+                        else
                         {
-                            memset(&result.value, 0,
-                                    sizeof(result.value));
+                            printf("(bad string offset 0x%08" PRIx32 ")\n", string_offset);
                         }
-                        continue;
-                    default:
-                        CHECK_ERROR(1, "unknown storage class");
-                }
+                    }
+                    break;
+                case COLUMN_TYPE_DATA:
+                    {
+                        const uint32_t vardata_offset = read_32_be(data);
+                        const uint32_t vardata_size = read_32_be(data+4);
 
-                if (1)
-                {
-                    long data_offset;
-                    int bytes_read;
+                        printf("[0x%08" PRIx32 "]", vardata_offset);
+                        printf(" (size 0x%08" PRIx32 ")\n", vardata_size);
 
-                    if (constant)
-                    {
-                        data_offset = constant_offset;
-                        if (print)
+                        if (vardata_size != 0)
                         {
-                            printf("constant ");
+                            /* assume that the data is another table */
+                            analyze_utf(infile,
+                                    table_info->table_offset + 8 +
+                                    table_info->data_offset +
+                                    vardata_offset,
+                                    indent,
+                                    1,
+                                    NULL
+                                    );
                         }
                     }
-                    else
+                    break;
+                case COLUMN_TYPE_8BYTE:
+                    printf("0x%" PRIx64 "\n", read_64_be(data));
+                    break;
+                case COLUMN_TYPE_4BYTE2:
+                    printf("type 2 ");
+                case COLUMN_TYPE_4BYTE:
+                    printf("%" PRId32 "\n", read_32_be(data));
+                    break;
+                case COLUMN_TYPE_2BYTE2:
+                    printf("type 2 ");
+                case COLUMN_TYPE_2BYTE:
+                    printf("%" PRId16 "\n", read_16_be(data));
+                    break;
+                case COLUMN_TYPE_FLOAT:
+                    if (sizeof(float) == 4)
                     {
-                        data_offset = row_offset;
-                    }
+                        union {
+                            float float_value;
+                            uint32_t int_value;
+                        } int_float;
 
-                    switch (type & COLUMN_TYPE_MASK)
-                    {
-                        case COLUMN_TYPE_STRING:
-                            {
-                                uint32_t string_offset;
-                                string_offset = get_32_be_seek(data_offset, infile);
-                                bytes_read = 4;
-                                if (print)
-                                {
-                                    printf("\"%s\"\n", table_info.string_table + string_offset);
-                                }
-                                if (qthis)
-                                {
-                                    result.value.value_string = string_offset;
-                                }
-                            }
-                            break;
-                        case COLUMN_TYPE_DATA:
-                            {
-                                uint32_t vardata_offset, vardata_size;
-
-                                vardata_offset = get_32_be_seek(data_offset, infile);
-                                vardata_size = get_32_be(infile);
-                                bytes_read = 8;
-                                if (print)
-                                {
-                                    printf("[0x%08" PRIx32 "]", vardata_offset);
-                                    printf(" (size 0x%08" PRIx32 ")\n", vardata_size);
-                                }
-                                if (qthis)
-                                {
-                                    result.value.value_data.offset = vardata_offset;
-                                    result.value.value_data.size = vardata_size;
-                                }
-
-                                if (vardata_size != 0 && print)
-                                {
-                                    /* assume that the data is another table */
-                                    analyze_utf(infile,
-                                            table_info.table_offset + 8 +
-                                            table_info.data_offset +
-                                            vardata_offset,
-                                            indent,
-                                            print,
-                                            NULL
-                                            );
-                                }
-                            }
-                            break;
-
-                        case COLUMN_TYPE_8BYTE:
-                            {
-                                uint64_t value =
-                                    get_64_be_seek(data_offset, infile);
-                                if (print)
-                                {
-                                    printf("0x%" PRIx64 "\n", value);
-                                }
-                                if (qthis)
-                                {
-                                    result.value.value_u64 = value;
-                                }
-                                bytes_read = 8;
-                                break;
-                            }
-                        case COLUMN_TYPE_4BYTE2:
-                            if (print)
-                            {
-                                printf("type 2 ");
-                            }
-                        case COLUMN_TYPE_4BYTE:
-                            {
-                                uint32_t value =
-                                    get_32_be_seek(data_offset, infile);
-                                if (print)
-                                {
-                                    printf("%" PRId32 "\n", value);
-                                }
-                                if (qthis)
-                                {
-                                    result.value.value_u32 = value;
-                                }
-                                bytes_read = 4;
-                            }
-                            break;
-                        case COLUMN_TYPE_2BYTE2:
-                            if (print)
-                            {
-                                printf("type 2 ");
-                            }
-                        case COLUMN_TYPE_2BYTE:
-                            {
-                                uint16_t value = 
-                                    get_16_be_seek(data_offset, infile);
-                                if (print)
-                                {
-                                    printf("%" PRId16 "\n", value);
-                                }
-                                if (qthis)
-                                {
-                                    result.value.value_u16 = value;
-                                }
-                                bytes_read = 2;
-                            }
-                            break;
-                        case COLUMN_TYPE_FLOAT:
-                            if (sizeof(float) == 4)
-                            {
-                                union {
-                                    float float_value;
-                                    uint32_t int_value;
-                                } int_float;
-
-                                int_float.int_value = get_32_be_seek(data_offset, infile);
-                                if (print)
-                                {
-                                    printf("%f\n", int_float.float_value);
-                                }
-                                if (qthis)
-                                {
-                                    result.value.value_float = int_float.float_value;
-                                }
-                            }
-                            else
-                            {
-                                get_32_be_seek(data_offset, infile);
-                                if (print)
-                                {
-                                    printf("float\n");
-                                }
-                                if (qthis)
-                                {
-                                    CHECK_ERROR(1, "float is wrong size, can't return");
-                                }
-                            }
-                            bytes_read = 4;
-                            break;
-                        case COLUMN_TYPE_1BYTE2:
-                            if (print)
-                            {
-                                printf("type 2 ");
-                            }
-                        case COLUMN_TYPE_1BYTE:
-                            {
-                                uint8_t value =
-                                    get_byte_seek(data_offset, infile);
-                                if (print)
-                                {
-                                    printf("%" PRId8 "\n", value);
-                                }
-                                if (qthis)
-                                {
-                                    result.value.value_u8 = value;
-                                }
-                                bytes_read = 1;
-                            }
-                            break;
-                        default:
-                            CHECK_ERROR(1, "unknown normal type");
+                        int_float.int_value = read_32_be(data);
+                        printf("%f\n", int_float.float_value);
                     }
-
-                    if (!constant)
+                    else
                     {
-                        row_offset += bytes_read;
+                        printf("float\n");
                     }
-                } /* useless if end */
-            } /* column for loop end */
-            indent -= INDENT_LEVEL;
-            if (print)
-            {
-                fprintf_indent(stdout,indent);
-                printf("}\n");
+                    break;
+                case COLUMN_TYPE_1BYTE2:
+                    printf("type 2 ");
+                case COLUMN_TYPE_1BYTE:
+                    printf("%" PRId8 "\n", data[0]);
+                    break;
             }
+        }
+        indent -= INDENT_LEVEL;
 
-            CHECK_ERROR(row_offset - row_start_offset != table_info.row_width,
-                    "column widths do now add up to row width");
+        fprintf_indent(stdout,indent);
+        printf("}\n");
+    }
+}
 
-            if (query && !print && i >= query->index) break;
-        } /* row for loop end */
-    } /* explore values block end */
+struct utf_query_result analyze_utf(reader_t *infile, const long offset, int indent, int print, const struct utf_query *query)
+{
+    struct utf_query_result result;
+    utf_table_t *table;
+
+    result.valid = 0;
 
-cleanup:
-    indent -= INDENT_LEVEL;
     if (print)
     {
         fprintf_indent(stdout, indent);
-        printf("}\n");
+        printf("{\n");
     }
 
-    if (string_table)
+    indent += INDENT_LEVEL;
+
+    table = load_utf_table(infile, offset);
+    if (!table)
     {
-        free(string_table);
-        string_table = NULL;
+        if (print)
+        {
+            fprintf_indent(stdout, indent);
+            printf("not a @UTF table at %08" PRIx32 "\n", (uint32_t)offset);
+        }
+        goto cleanup;
     }
 
-    if (schema)
+    /* fill in the default stuff */
+    result.valid = 1;
+    result.found = 0;
+    result.rows = table->info.rows;
+    result.name_offset = table->name_offset;
+    result.string_table_offset = table->info.string_table_offset;
+    result.data_offset = table->info.data_offset;
+
+    if (query)
     {
-        free(schema);
-        schema = NULL;
+        const int column = utf_table_column_index(table, query->name);
+
+        if (column >= 0 && query->index >= 0 &&
+                (uint32_t)query->index < table->info.rows)
+        {
+            const uint32_t row = query->index;
+            const uint8_t type = table->schema[column].type;
+            unsigned char *data = utf_table_cell(table, row, column, -1);
+
+            result.found = 1;
+            result.type = type & COLUMN_TYPE_MASK;
+            memset(&result.value, 0, sizeof(result.value));
+
+            if (data)
+            {
+                switch (type & COLUMN_TYPE_MASK)
+                {
+                    case COLUMN_TYPE_STRING:
+                        result.value.value_string = read_32_be(data);
+                        break;
+                    case COLUMN_TYPE_DATA:
+                        result.value.value_data.offset = read_32_be(data);
+                        result.value.value_data.size = read_32_be(data+4);
+                        break;
+                    case COLUMN_TYPE_8BYTE:
+                        result.value.value_u64 = read_64_be(data);
+                        break;
+                    case COLUMN_TYPE_4BYTE2:
+                    case COLUMN_TYPE_4BYTE:
+                        result.value.value_u32 = read_32_be(data);
+                        break;
+                    case COLUMN_TYPE_2BYTE2:
+                    case COLUMN_TYPE_2BYTE:
+                        result.value.value_u16 = read_16_be(data);
+                        break;
+                    case COLUMN_TYPE_FLOAT:
+                        CHECK_ERROR(sizeof(float) != 4, "float is wrong size, can't return");
+                        {
+                            union {
+                                float float_value;
+                                uint32_t int_value;
+                            } int_float;
+
+                            int_float.int_value = read_32_be(data);
+                            result.value.value_float = int_float.float_value;
+                        }
+                        break;
+                    case COLUMN_TYPE_1BYTE2:
+                    case COLUMN_TYPE_1BYTE:
+                        result.value.value_u8 = data[0];
+                        break;
+                }
+            }
+        }
+    }
+
+    if (print)
+    {
+        print_utf_rows(infile, table, indent);
+    }
+
+cleanup:
+    indent -= INDENT_LEVEL;
+    if (print)
+    {
+        fprintf_indent(stdout, indent);
+        printf("}\n");
     }
 
+    free_utf_table(table);
+
     return result;
 }
 
@@ -449,12 +688,12 @@ void fprintf_table_info(FILE *outfile, const struct utf_table_info *table_info,
             table_info->row_width * table_info->rows);
 }
 
-struct utf_query_result query_utf(FILE *infile, const long offset, const struct utf_query *query)
+struct utf_query_result query_utf(reader_t *infile, const long offset, const struct utf_query *query)
 {
     return analyze_utf(infile, offset, 0, 0, query);
 }
 
-struct utf_query_result query_utf_nofail(FILE *infile, const long offset, const struct utf_query *query)
+struct utf_query_result query_utf_nofail(reader_t *infile, const long offset, const struct utf_query *query)
 {
     const struct utf_query_result result = query_utf(infile, offset, query);
 
@@ -464,7 +703,7 @@ struct utf_query_result query_utf_nofail(FILE *infile, const long offset, const
     return result;
 }
 
-struct utf_query_result query_utf_key(FILE *infile, const long offset, int index, const char *name)
+struct utf_query_result query_utf_key(reader_t *infile, const long offset, int index, const char *name)
 {
     struct utf_query query;
     query.index = index;
@@ -473,28 +712,28 @@ struct utf_query_result query_utf_key(FILE *infile, const long offset, int index
     return query_utf_nofail(infile, offset, &query);
 }
 
-uint64_t query_utf_8byte(FILE *infile, const long offset, int index, const char *name)
+uint64_t query_utf_8byte(reader_t *infile, const long offset, int index, const char *name)
 {
     struct utf_query_result result = query_utf_key(infile, offset, index, name);
     CHECK_ERROR(result.type != COLUMN_TYPE_8BYTE, "value is not an 8 byte uint");
     return result.value.value_u64;
 }
 
-uint32_t query_utf_4byte(FILE *infile, const long offset, int index, const char *name)
+uint32_t query_utf_4byte(reader_t *infile, const long offset, int index, const char *name)
 {
     struct utf_query_result result = query_utf_key(infile, offset, index, name);
     CHECK_ERROR(result.type != COLUMN_TYPE_4BYTE, "value is not a 4 byte uint");
     return result.value.value_u32;
 }
 
-uint16_t query_utf_2byte(FILE *infile, const long offset, int index, const char *name)
+uint16_t query_utf_2byte(reader_t *infile, const long offset, int index, const char *name)
 {
     struct utf_query_result result = query_utf_key(infile, offset, index, name);
     CHECK_ERROR(result.type != COLUMN_TYPE_2BYTE, "value is not a 2 byte uint");
     return result.value.value_u16;
 }
 
-char *load_utf_string_table(FILE *infile, const long offset)
+char *load_utf_string_table(reader_t *infile, const long offset)
 {
     const struct utf_query_result result = query_utf_nofail(infile, offset, NULL);
 
@@ -515,7 +754,7 @@ void free_utf_string_table(char *string_table)
     free(string_table);
 }
 
-const char *query_utf_string(FILE *infile, const long offset,
+const char *query_utf_string(reader_t *infile, const long offset,
         int index, const char *name, const char *string_table)
 {
     struct utf_query_result result = query_utf_key(infile, offset, index, name);
@@ -523,7 +762,7 @@ const char *query_utf_string(FILE *infile, const long offset,
     return string_table + result.value.value_string;
 }
 
-struct offset_size_pair query_utf_data(FILE *infile, const long offset,
+struct offset_size_pair query_utf_data(reader_t *infile, const long offset,
         int index, const char *name)
 {
     struct utf_query_result result = query_utf_key(infile, offset, index, name);
@@ -8,9 +8,10 @@
 #include <string.h>
 
 #include "error_stuff.h"
+#include "util.h"
 
 /* common version across the suite */
-#define VERSION "0.7 beta 3"
+#define VERSION "0.7 beta 8"
 
 struct utf_query
 {
@@ -48,35 +49,35 @@ struct utf_query_result
     uint32_t data_offset;
 };
 
-struct utf_query_result analyze_utf(FILE *infile, long offset, int indent,
+struct utf_query_result analyze_utf(reader_t *infile, long offset, int indent,
         int print, const struct utf_query *query);
 
-struct utf_query_result query_utf(FILE *infile, long offset,
+struct utf_query_result query_utf(reader_t *infile, long offset,
         const struct utf_query *query);
 
-struct utf_query_result query_utf_nofail(FILE *infile, const long offset,
+struct utf_query_result query_utf_nofail(reader_t *infile, const long offset,
         const struct utf_query *query);
 
-struct utf_query_result query_utf_key(FILE *infile, const long offset,
+struct utf_query_result query_utf_key(reader_t *infile, const long offset,
         int index, const char *name);
 
-uint64_t query_utf_8byte(FILE *infile, const long offset,
+uint64_t query_utf_8byte(reader_t *infile, const long offset,
         int index, const char *name);
 
-uint32_t query_utf_4byte(FILE *infile, const long offset,
+uint32_t query_utf_4byte(reader_t *infile, const long offset,
         int index, const char *name);
 
-uint16_t query_utf_2byte(FILE *infile, const long offset,
+uint16_t query_utf_2byte(reader_t *infile, const long offset,
         int index, const char *name);
 
-char *load_utf_string_table(FILE *infile, const long offset);
+char *load_utf_string_table(reader_t *infile, const long offset);
 
 void free_utf_string_table(char *string_table);
 
-const char *query_utf_string(FILE *infile, const long offset,
+const char *query_utf_string(reader_t *infile, const long offset,
         int index, const char *name, const char *string_table);
 
-struct offset_size_pair query_utf_data(FILE *infile, const long offset,
+struct offset_size_pair query_utf_data(reader_t *infile, const long offset,
         int index, const char *name);
 
 #define COLUMN_STORAGE_MASK         0xf0
@@ -103,7 +104,9 @@ struct utf_column_info
 {
     uint8_t type;
     const char *column_name;
-    long constant_offset;
+    uint32_t name_hash;
+    long constant_offset;   /* relative to table start, for constants */
+    long row_offset;        /* relative to row start */
 };
 
 struct utf_table_info
@@ -125,4 +128,62 @@ struct utf_table_info
 
 void fprintf_table_info(FILE *outfile, const struct utf_table_info *table_info, int indent);
 
+/* A whole @UTF table parsed once into memory: look up columns by name once
+   with utf_table_column, then read cells directly by (row, column). */
+struct utf_table_s
+{
+    struct utf_table_info info;
+    uint32_t name_offset;
+
+    unsigned char *buffer;  /* the whole table, from the @UTF signature */
+    char *string_table;     /* terminated copy of the string table */
+    struct utf_column_info *schema;
+
+    /* open addressing hash of column names, holds column index+1 */
+    uint16_t *column_hash;
+    uint32_t column_hash_mask;
+};
+typedef struct utf_table_s utf_table_t;
+
+utf_table_t *load_utf_table(reader_t *infile, long offset);
+
+utf_table_t *load_utf_table_nofail(reader_t *infile, long offset);
+
+void free_utf_table(utf_table_t *table);
+
+uint32_t utf_name_hash(const char *name);
+
+int utf_table_column_index(const utf_table_t *table, const char *name);
+
+int utf_table_column(const utf_table_t *table, const char *name);
+
+uint8_t utf_table_1byte(const utf_table_t *table, uint32_t row, int column);
+
+uint16_t utf_table_2byte(const utf_table_t *table, uint32_t row, int column);
+
+uint32_t utf_table_4byte(const utf_table_t *table, uint32_t row, int column);
+
+uint64_t utf_table_8byte(const utf_table_t *table, uint32_t row, int column);
+
+const char *utf_table_string(const utf_table_t *table, uint32_t row, int column);
+
+struct offset_size_pair utf_table_data(const utf_table_t *table, uint32_t row, int column);
+
+/* Some games xor their @UTF tables: byte n of a table (counting from the
+   @UTF signature) is xored with start*mult^n. Read such tables through
+   open_reader_crypt(infile, table_offset, key.start, key.mult). */
+struct utf_key
+{
+    uint8_t start;
+    uint8_t mult;
+};
+
+struct utf_key read_utf_key(const char *text);
+
+int utf_guess_keys(const unsigned char *buf, uint32_t table_size,
+        struct utf_key *keys, int max_keys);
+
+int utf_detect_key(reader_t *infile, long offset, uint32_t table_size,
+        struct utf_key *key);
+
 #endif /* _UTF_TAB_H_INCLUDED */
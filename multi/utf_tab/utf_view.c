@@ -4,12 +4,24 @@
 #include "error_stuff.h"
 #include "util.h"
 
-void analyze(FILE *infile, long offset, long file_length);
+void analyze(reader_t *infile, long offset, long file_length, const struct utf_key *key);
 
 int main(int argc, char **argv)
 {
     printf("utf_view " VERSION "\n\n");
-    CHECK_ERROR(argc != 2 && argc != 3, "Incorrect program usage\n\nusage: utf_tab file [offset]");
+
+    /* optional key for encrypted tables, otherwise detected */
+    struct utf_key key;
+    const struct utf_key *key_p = NULL;
+    if (argc >= 3 && !strcmp(argv[1], "--utf-key"))
+    {
+        key = read_utf_key(argv[2]);
+        key_p = &key;
+        argc -= 2;
+        argv += 2;
+    }
+
+    CHECK_ERROR(argc != 2 && argc != 3, "Incorrect program usage\n\nusage: utf_tab [--utf-key s=XX,m=XX] file [offset]");
 
     long offset = 0;
     if (argc == 3)
@@ -17,25 +29,44 @@ int main(int argc, char **argv)
         offset = read_long(argv[2]);
     }
 
-    /* open file */
-    FILE *infile = fopen(argv[1], "rb");
+    /* open file, mapped if possible */
+    reader_t *infile = open_reader_mmap(argv[1]);
+    if (!infile) infile = open_reader_file(argv[1]);
     CHECK_ERRNO(!infile, "fopen");
 
-    /* get file size */
-    CHECK_ERRNO(fseek(infile, 0 , SEEK_END) != 0, "fseek");
-    long file_length = ftell(infile);
-    CHECK_ERRNO(file_length == -1, "ftell");
+    long file_length = reader_length(infile);
 
-    rewind(infile);
+    /* not a plain table? see if it decrypts to one */
+    if (!key_p && offset >= 0 && offset + 0x18 <= file_length)
+    {
+        unsigned char buf[0x18];
+        get_bytes_seek(offset, infile, buf, sizeof(buf));
+        if (memcmp(buf, "@UTF", 4) && utf_guess_keys(buf, 0, &key, 1) > 0)
+        {
+            printf("encrypted, key s=%02x m=%02x\n\n",
+                    (unsigned int)key.start, (unsigned int)key.mult);
+            key_p = &key;
+        }
+    }
 
-    analyze(infile, offset, file_length);
+    analyze(infile, offset, file_length, key_p);
 
     exit(EXIT_SUCCESS);
 }
 
-void analyze(FILE *infile, long offset, long file_length)
+void analyze(reader_t *infile, long offset, long file_length, const struct utf_key *key)
 {
     int indent = 0;
 
+    if (key)
+    {
+        reader_t *crypt_infile = open_reader_crypt(infile, offset, key->start, key->mult);
+
+        analyze_utf(crypt_infile, offset, indent, 1, NULL);
+
+        close_reader(crypt_infile);
+        return;
+    }
+
     analyze_utf(infile, offset, indent, 1, NULL);
 }
@@ -1,17 +1,305 @@
+#ifndef __MINGW32__
+#define _POSIX_C_SOURCE 200112L
+#endif
 #include <stdio.h>
 #include <stdlib.h>
 #include <inttypes.h>
 #include <stdint.h>
 #include <string.h>
 #include <errno.h>
+#include <limits.h>
 #ifdef __MINGW32__
 #include <io.h>
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
 #endif
 #include <sys/stat.h>
+#include <time.h>
 
 #include "error_stuff.h"
 #include "util.h"
 
+struct reader_s {
+    FILE *file;
+    const unsigned char *map;   /* whole file, if mapped */
+    long length;
+    long offset;
+    size_t (*read_fcn)(void * buf, size_t size, reader_t *r);
+    int (*seek_fcn)(reader_t *r, long offset);
+    long (*tell_fcn)(reader_t *r);
+    void (*close_fcn)(reader_t *r);
+
+    /* decrypting layer only */
+    reader_t *inner;
+    long base_offset;
+    uint8_t start;
+    uint8_t mult;
+};
+
+/* like CHECK_FILE, but mapped readers have no FILE to ask about EOF */
+#define CHECK_READ(condition,r) \
+do {if ((r)->file) { \
+    CHECK_FILE(condition, (r)->file, "fread"); \
+} else { \
+    CHECK_ERROR(condition, "unexpected EOF"); \
+}}while(0)
+
+static size_t reader_read(void * buf, size_t size, reader_t *r) {
+    return fread(buf, 1, size, r->file);
+}
+static int reader_seek(reader_t * r, long offset) {
+    return fseek(r->file, offset, SEEK_SET);
+}
+static long reader_ftell(reader_t *r) {
+    return ftell(r->file);
+}
+
+static void reader_close(reader_t *r) {
+    fclose(r->file);
+    free(r);
+}
+
+long reader_length(reader_t *r) {
+    return r->length;
+}
+
+long reader_tell(reader_t *r) {
+    return r->tell_fcn(r);
+}
+
+void close_reader(reader_t *r) {
+    r->close_fcn(r);
+}
+
+reader_t * open_reader_file(const char *file_name) {
+    FILE *infile = fopen(file_name, "rb");
+    if (!infile) return NULL;
+
+    reader_t *r = malloc(sizeof(reader_t));
+    CHECK_ERRNO(!r, "malloc");
+    r->file = infile;
+    r->map = NULL;
+    r->inner = NULL;
+    r->offset = 0;
+    r->read_fcn = reader_read;
+    r->seek_fcn = reader_seek;
+    r->tell_fcn = reader_ftell;
+    r->close_fcn = reader_close;
+
+    /* get file size */
+    CHECK_ERRNO(fseek(infile, 0 , SEEK_END) != 0, "fseek");
+    r->length = ftell(infile);
+    CHECK_ERRNO(r->length == -1, "ftell");
+    rewind(infile);
+
+    return r;
+}
+
+/* mapped reader, reads are just copies out of the view */
+static size_t reader_read_mmap(void * buf, size_t size, reader_t *r) {
+    if (r->offset >= r->length) return 0;
+    if (size > (size_t)(r->length - r->offset)) size = r->length - r->offset;
+
+    memcpy(buf, r->map + r->offset, size);
+    r->offset += size;
+
+    return size;
+}
+static int reader_seek_mmap(reader_t *r, long offset) {
+    if (offset < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    r->offset = offset;
+    return 0;
+}
+static long reader_tell_mmap(reader_t *r) {
+    return r->offset;
+}
+
+static void reader_close_mmap(reader_t *r) {
+#ifdef __MINGW32__
+    UnmapViewOfFile((void *)r->map);
+#else
+    munmap((void *)r->map, r->length);
+#endif
+    free(r);
+}
+
+/* NULL if the file can't be mapped (empty, too large, not a regular file),
+   open_reader_file still works in that case */
+reader_t * open_reader_mmap(const char *file_name) {
+    const unsigned char *map = NULL;
+    long length = 0;
+
+#ifdef __MINGW32__
+    HANDLE file = CreateFileA(file_name, GENERIC_READ, FILE_SHARE_READ, NULL,
+            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) return NULL;
+
+    LARGE_INTEGER size;
+    if (GetFileSizeEx(file, &size) && size.QuadPart > 0 &&
+        size.QuadPart <= LONG_MAX && (uint64_t)size.QuadPart <= SIZE_MAX) {
+        HANDLE mapping = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mapping) {
+            map = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            length = size.QuadPart;
+            /* the view keeps the mapping alive */
+            CloseHandle(mapping);
+        }
+    }
+    CloseHandle(file);
+#else
+    int fd = open(file_name, O_RDONLY);
+    if (fd == -1) return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 &&
+        st.st_size <= LONG_MAX && (uint64_t)st.st_size <= SIZE_MAX) {
+        void *p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (p != MAP_FAILED) {
+            map = p;
+            length = st.st_size;
+        }
+    }
+    close(fd);
+#endif
+
+    if (!map) return NULL;
+
+    reader_t *r = malloc(sizeof(reader_t));
+    CHECK_ERRNO(!r, "malloc");
+    r->file = NULL;
+    r->map = map;
+    r->inner = NULL;
+    r->length = length;
+    r->offset = 0;
+    r->read_fcn = reader_read_mmap;
+    r->seek_fcn = reader_seek_mmap;
+    r->tell_fcn = reader_tell_mmap;
+    r->close_fcn = reader_close_mmap;
+
+    return r;
+}
+
+size_t fread_reader(void * buf, size_t size, reader_t *r) {
+    return r->read_fcn(buf, size, r);
+}
+int fseek_reader(reader_t *r, long offset) {
+    return r->seek_fcn(r, offset);
+}
+
+/* xor buf with the stream x, x*mult, x*mult^2, ... and return the next x.
+   The order of any unit mod 256 divides 64, so for odd mult the stream
+   repeats every 64 bytes; for even mult it is zero after 8. Either way one
+   period is built once and applied a word at a time. */
+uint8_t xor_stream(unsigned char *buf, size_t size, uint8_t x, uint8_t mult)
+{
+    unsigned char pad[64];
+
+    if (size <= sizeof(pad)) {
+        for (size_t i = 0; i < size; i++) {
+            buf[i] ^= x;
+            x *= mult;
+        }
+        return x;
+    }
+
+    for (size_t i = 0; i < sizeof(pad); i++) {
+        pad[i] = x;
+        x *= mult;
+    }
+
+    if (!(mult & 1)) {
+        for (size_t i = 0; i < sizeof(pad); i++) buf[i] ^= pad[i];
+        return 0;
+    }
+
+    size_t i = 0;
+    for (; i + sizeof(pad) <= size; i += sizeof(pad)) {
+        for (size_t j = 0; j < sizeof(pad); j += 8) {
+            uint64_t word, key;
+            memcpy(&word, buf + i + j, 8);
+            memcpy(&key, pad + j, 8);
+            word ^= key;
+            memcpy(buf + i + j, &word, 8);
+        }
+    }
+    for (size_t j = 0; i < size; i++, j++) buf[i] ^= pad[j];
+
+    return pad[size % sizeof(pad)];
+}
+
+/* decrypting layer: reads go to the inner reader in one piece, then the
+   whole buffer is xored with the key stream from base_offset on */
+static uint8_t crypt_xor_at(const reader_t *r, long offset) {
+    uint8_t x = r->start, m = r->mult;
+
+    for (unsigned long n = offset - r->base_offset; n; n >>= 1) {
+        if (n & 1) x *= m;
+        m *= m;
+    }
+
+    return x;
+}
+static size_t reader_read_crypt(void * buf, size_t size, reader_t *r) {
+    size_t rc = fread_reader(buf, size, r->inner);
+
+    xor_stream(buf, rc, crypt_xor_at(r, r->offset), r->mult);
+    r->offset += rc;
+
+    return rc;
+}
+static int reader_seek_crypt(reader_t *r, long offset) {
+    CHECK_ERROR(offset < r->base_offset, "crypt seek before start");
+
+    int rc = fseek_reader(r->inner, offset);
+    if (rc == 0) r->offset = offset;
+
+    return rc;
+}
+static long reader_tell_crypt(reader_t *r) {
+    return r->offset;
+}
+static void reader_close_crypt(reader_t *r) {
+    /* the inner reader belongs to the caller */
+    free(r);
+}
+
+/* stack decryption on any reader, byte n from base_offset is xored with
+   start*mult^n; the layer is only good for offsets past base_offset */
+reader_t * open_reader_crypt(reader_t *inner, long base_offset, uint8_t start, uint8_t mult) {
+    reader_t *r = malloc(sizeof(reader_t));
+    CHECK_ERRNO(!r, "malloc");
+    r->file = NULL;
+    r->map = NULL;
+    r->inner = inner;
+    r->length = inner->length;
+    r->offset = base_offset;
+    r->base_offset = base_offset;
+    r->start = start;
+    r->mult = mult;
+    r->read_fcn = reader_read_crypt;
+    r->seek_fcn = reader_seek_crypt;
+    r->tell_fcn = reader_tell_crypt;
+    r->close_fcn = reader_close_crypt;
+
+    CHECK_ERRNO(fseek_reader(inner, base_offset) != 0, "fseek");
+
+    return r;
+}
+
+/* direct pointer to size bytes at offset, or NULL if not mapped */
+const unsigned char * reader_view(reader_t *r, long offset, size_t size) {
+    if (!r->map || offset < 0 || offset > r->length ||
+        size > (size_t)(r->length - offset)) return NULL;
+
+    return r->map + offset;
+}
+
 FILE * open_file_in_directory(const char *base_name, const char *dir_name, const char orig_sep, const char *file_name, const char *perms)
 {
     FILE *f = NULL;
@@ -96,17 +384,28 @@ const char *strip_path(const char *path)
     }
 }
 
-void dump_from_here(FILE *infile, FILE *outfile, size_t size)
+void dump_from_here(reader_t *infile, FILE *outfile, size_t size)
 {
     unsigned char buf[0x800];
 
+    if (infile->map)
+    {
+        /* write straight out of the mapping */
+        const unsigned char *p = reader_view(infile, infile->offset, size);
+        CHECK_ERROR(!p, "unexpected EOF");
+
+        put_bytes(outfile, p, size);
+        infile->offset += size;
+        return;
+    }
+
     while (size > 0)
     {
         size_t bytes_to_copy = sizeof(buf);
         if (bytes_to_copy > size) bytes_to_copy = size;
 
-        size_t bytes_read = fread(buf, 1, bytes_to_copy, infile);
-        CHECK_FILE(bytes_read != bytes_to_copy, infile, "fread");
+        size_t bytes_read = fread_reader(buf, bytes_to_copy, infile);
+        CHECK_READ(bytes_read != bytes_to_copy, infile);
 
         size_t bytes_written = fwrite(buf, 1, bytes_to_copy, outfile);
         CHECK_FILE(bytes_written != bytes_to_copy, outfile, "fwrite");
@@ -115,9 +414,9 @@ void dump_from_here(FILE *infile, FILE *outfile, size_t size)
     }
 }
 
-void dump(FILE *infile, FILE *outfile, long offset, size_t size)
+void dump(reader_t *infile, FILE *outfile, long offset, size_t size)
 {
-    CHECK_ERRNO(fseek(infile, offset, SEEK_SET) != 0, "fseek");
+    CHECK_ERRNO(fseek_reader(infile, offset) != 0, "fseek");
 
     dump_from_here(infile, outfile, size);
 }
@@ -173,102 +472,102 @@ void write_16_le(uint16_t value, unsigned char bytes[2])
     for (int i=0; i<2; i++, value >>= 8) bytes[i] = value & 0xff;
 }
 
-uint8_t get_byte(FILE *infile)
+uint8_t get_byte(reader_t *infile)
 {
     unsigned char buf[1];
 
-    size_t bytes_read = fread(buf, 1, 1, infile);
-    CHECK_FILE(bytes_read != 1, infile, "fread");
+    size_t bytes_read = fread_reader(buf, 1, infile);
+    CHECK_READ(bytes_read != 1, infile);
 
     return buf[0];
 }
-uint8_t get_byte_seek(long offset, FILE *infile)
+uint8_t get_byte_seek(long offset, reader_t *infile)
 {
-    CHECK_ERRNO(fseek(infile, offset, SEEK_SET) != 0, "fseek");
+    CHECK_ERRNO(fseek_reader(infile, offset) != 0, "fseek");
 
     return get_byte(infile);
 }
 
-uint16_t get_16_be(FILE *infile)
+uint16_t get_16_be(reader_t *infile)
 {
     unsigned char buf[2];
-    size_t bytes_read = fread(buf, 1, 2, infile);
-    CHECK_FILE(bytes_read != 2, infile, "fread");
+    size_t bytes_read = fread_reader(buf, 2, infile);
+    CHECK_READ(bytes_read != 2, infile);
 
     return read_16_be(buf);
 }
-uint16_t get_16_be_seek(long offset, FILE *infile)
+uint16_t get_16_be_seek(long offset, reader_t *infile)
 {
-    CHECK_ERRNO(fseek(infile, offset, SEEK_SET) != 0, "fseek");
+    CHECK_ERRNO(fseek_reader(infile, offset) != 0, "fseek");
 
     return get_16_be(infile);
 }
-uint16_t get_16_le(FILE *infile)
+uint16_t get_16_le(reader_t *infile)
 {
     unsigned char buf[2];
-    size_t bytes_read = fread(buf, 1, 2, infile);
-    CHECK_FILE(bytes_read != 2, infile, "fread");
+    size_t bytes_read = fread_reader(buf, 2, infile);
+    CHECK_READ(bytes_read != 2, infile);
 
     return read_16_le(buf);
 }
-uint16_t get_16_le_seek(long offset, FILE *infile)
+uint16_t get_16_le_seek(long offset, reader_t *infile)
 {
-    CHECK_ERRNO(fseek(infile, offset, SEEK_SET) != 0, "fseek");
+    CHECK_ERRNO(fseek_reader(infile, offset) != 0, "fseek");
 
     return get_16_le(infile);
 }
-uint32_t get_32_be(FILE *infile)
+uint32_t get_32_be(reader_t *infile)
 {
     unsigned char buf[4];
-    size_t bytes_read = fread(buf, 1, 4, infile);
-    CHECK_FILE(bytes_read != 4, infile, "fread");
+    size_t bytes_read = fread_reader(buf, 4, infile);
+    CHECK_READ(bytes_read != 4, infile);
 
     return read_32_be(buf);
 }
-uint32_t get_32_be_seek(long offset, FILE *infile)
+uint32_t get_32_be_seek(long offset, reader_t *infile)
 {
-    CHECK_ERRNO(fseek(infile, offset, SEEK_SET) != 0, "fseek");
+    CHECK_ERRNO(fseek_reader(infile, offset) != 0, "fseek");
 
     return get_32_be(infile);
 }
-uint32_t get_32_le(FILE *infile)
+uint32_t get_32_le(reader_t *infile)
 {
     unsigned char buf[4];
-    size_t bytes_read = fread(buf, 1, 4, infile);
-    CHECK_FILE(bytes_read != 4, infile, "fread");
+    size_t bytes_read = fread_reader(buf, 4, infile);
+    CHECK_READ(bytes_read != 4, infile);
 
     return read_32_le(buf);
 }
-uint32_t get_32_le_seek(long offset, FILE *infile)
+uint32_t get_32_le_seek(long offset, reader_t *infile)
 {
-    CHECK_ERRNO(fseek(infile, offset, SEEK_SET) != 0, "fseek");
+    CHECK_ERRNO(fseek_reader(infile, offset) != 0, "fseek");
 
     return get_32_le(infile);
 }
-uint64_t get_64_be(FILE *infile)
+uint64_t get_64_be(reader_t *infile)
 {
     unsigned char buf[8];
-    size_t bytes_read = fread(buf, 1, 8, infile);
-    CHECK_FILE(bytes_read != 8, infile, "fread");
+    size_t bytes_read = fread_reader(buf, 8, infile);
+    CHECK_READ(bytes_read != 8, infile);
 
     return read_64_be(buf);
 }
-uint64_t get_64_be_seek(long offset, FILE *infile)
+uint64_t get_64_be_seek(long offset, reader_t *infile)
 {
-    CHECK_ERRNO(fseek(infile, offset, SEEK_SET) != 0, "fseek");
+    CHECK_ERRNO(fseek_reader(infile, offset) != 0, "fseek");
 
     return get_64_be(infile);
 }
 
-void get_bytes(FILE *infile, unsigned char *buf, size_t byte_count)
+void get_bytes(reader_t *infile, unsigned char *buf, size_t byte_count)
 {
-    size_t bytes_read = fread(buf, 1, byte_count, infile);
-    CHECK_FILE(bytes_read != byte_count, infile, "fread");
+    size_t bytes_read = fread_reader(buf, byte_count, infile);
+    CHECK_READ(bytes_read != byte_count, infile);
 }
 
-void get_bytes_seek(long offset, FILE *infile, unsigned char *buf, size_t byte_count)
+void get_bytes_seek(long offset, reader_t *infile, unsigned char *buf, size_t byte_count)
 {
-    CHECK_ERRNO(fseek(infile, offset, SEEK_SET) != 0, "fseek");
+    CHECK_ERRNO(fseek_reader(infile, offset) != 0, "fseek");
     get_bytes(infile, buf, byte_count);
 }
 
@@ -351,11 +650,45 @@ void put_bytes_seek(long offset, FILE *outfile, const unsigned char *buf, size_t
     put_bytes(outfile, buf, byte_count);
 }
 
+/* monotonic wall clock, for throughput reports */
+double wall_seconds(void)
+{
+#ifdef __MINGW32__
+    LARGE_INTEGER count, frequency;
+    QueryPerformanceCounter(&count);
+    QueryPerformanceFrequency(&frequency);
+    return (double)count.QuadPart / frequency.QuadPart;
+#else
+    struct timespec ts;
+    CHECK_ERRNO(clock_gettime(CLOCK_MONOTONIC, &ts) != 0, "clock_gettime");
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+}
+
 void fprintf_indent(FILE *outfile, int indent)
 {
         fprintf(outfile, "%*s",indent,"");
 }
 
+/* name_head, id zero padded to the width of max_id, name_tail */
+char * number_name(const char * name_head, const char * name_tail, unsigned int id, unsigned int max_id)
+{
+    CHECK_ERROR(id > max_id, "id > max");
+
+    int numberlen = 1;
+    for (unsigned int n = max_id; n >= 10; n /= 10) numberlen++;
+
+    size_t namelen = strlen(name_head) + numberlen + strlen(name_tail) + 1;
+
+    char * name = malloc(namelen);
+    CHECK_ERRNO(!name, "malloc");
+
+    snprintf(name, namelen, "%s%0*u%s",
+        name_head, numberlen, id, name_tail);
+
+    return name;
+}
+
 long read_long(char *text)
 {
     char *endptr;
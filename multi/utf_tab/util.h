@@ -15,15 +15,31 @@
 #define DIRSEP '/'
 #endif
 
+struct reader_s;
+typedef struct reader_s reader_t;
+
 void make_directory(const char *name);
 
 FILE * open_file_in_directory(const char *base_name, const char *dir_name, const char orig_sep, const char *file_name, const char *perms);
 
 const char * strip_path(const char * path);
 
-void dump(FILE *infile, FILE *outfile, long offset, size_t size);
+reader_t * open_reader_file(const char *file_name);
+reader_t * open_reader_mmap(const char *file_name);
+reader_t * open_reader_crypt(reader_t *inner, long base_offset, uint8_t start, uint8_t mult);
+size_t fread_reader(void * buf, size_t size, reader_t *r);
+int fseek_reader(reader_t *r, long offset);
+long reader_length(reader_t *r);
+long reader_tell(reader_t *r);
+const unsigned char * reader_view(reader_t *r, long offset, size_t size);
+
+void close_reader(reader_t *r);
+
+uint8_t xor_stream(unsigned char *buf, size_t size, uint8_t x, uint8_t mult);
 
-void dump_from_here(FILE *infile, FILE *outfile, size_t size);
+void dump(reader_t *infile, FILE *outfile, long offset, size_t size);
+
+void dump_from_here(reader_t *infile, FILE *outfile, size_t size);
 
 uint32_t read_32_le(unsigned char bytes[4]);
 uint16_t read_16_le(unsigned char bytes[2]);
@@ -35,20 +51,20 @@ void write_32_le(uint32_t value, unsigned char bytes[4]);
 void write_16_be(uint16_t value, unsigned char bytes[2]);
 void write_16_le(uint16_t value, unsigned char bytes[2]);
 
-uint8_t get_byte(FILE *infile);
-uint8_t get_byte_seek(long offset, FILE *infile);
-uint16_t get_16_be(FILE *infile);
-uint16_t get_16_be_seek(long offset, FILE *infile);
-uint16_t get_16_le(FILE *infile);
-uint16_t get_16_le_seek(long offset, FILE *infile);
-uint32_t get_32_be(FILE *infile);
-uint32_t get_32_be_seek(long offset, FILE *infile);
-uint32_t get_32_le(FILE *infile);
-uint32_t get_32_le_seek(long offset, FILE *infile);
-uint64_t get_64_be(FILE *infile);
-uint64_t get_64_be_seek(long offset, FILE *infile);
-void get_bytes(FILE *infile, unsigned char *buf, size_t byte_count);
-void get_bytes_seek(long offset, FILE *infile, unsigned char *buf, size_t byte_count);
+uint8_t get_byte(reader_t *infile);
+uint8_t get_byte_seek(long offset, reader_t *infile);
+uint16_t get_16_be(reader_t *infile);
+uint16_t get_16_be_seek(long offset, reader_t *infile);
+uint16_t get_16_le(reader_t *infile);
+uint16_t get_16_le_seek(long offset, reader_t *infile);
+uint32_t get_32_be(reader_t *infile);
+uint32_t get_32_be_seek(long offset, reader_t *infile);
+uint32_t get_32_le(reader_t *infile);
+uint32_t get_32_le_seek(long offset, reader_t *infile);
+uint64_t get_64_be(reader_t *infile);
+uint64_t get_64_be_seek(long offset, reader_t *infile);
+void get_bytes(reader_t *infile, unsigned char *buf, size_t byte_count);
+void get_bytes_seek(long offset, reader_t *infile, unsigned char *buf, size_t byte_count);
 
 void put_byte(uint8_t value, FILE *outfile);
 void put_byte_seek(uint8_t value, long offset, FILE *outfile);
@@ -66,8 +82,12 @@ void put_bytes_seek(long offset, FILE *outfile, const unsigned char *buf, size_t
 #define INDENT_LEVEL 2
 void fprintf_indent(FILE *outfile, int indent);
 
+char * number_name(const char * name_head, const char * name_tail, unsigned int id, unsigned int max_id);
+
 long read_long(char *text);
 
+double wall_seconds(void);
+
 long pad(long current_offset, long pad_amount, FILE *outfile);
 
 #endif /* _UTIL_H_INCLUDED */
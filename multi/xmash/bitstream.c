@@ -9,7 +9,7 @@
 struct bitstream_reader
 {
     const uint8_t *pool;
-    size_t pool_size;
+    size_t pool_size;       // bytes not yet in the reservoir
 
     // parameters of the layout
     size_t consecutive_bits;
@@ -17,8 +17,9 @@ struct bitstream_reader
 
     // current state
     size_t consecutive_bits_left;
-    uint8_t bit_buffer;
-    unsigned int bits_left; // in buffer
+    uint64_t reservoir;     // next bits at the top
+    unsigned int bits_left; // in reservoir
+    int underflow;          // tried to read past the end
 };
 
 struct bitstream_reader *init_bitstream_reader(const uint8_t *pool, size_t pool_size, size_t consecutive_bits, size_t skip_bits)
@@ -31,70 +32,167 @@ struct bitstream_reader *init_bitstream_reader(const uint8_t *pool, size_t pool_
     bs->consecutive_bits = bs->consecutive_bits_left = consecutive_bits;
     bs->skip_bits = skip_bits;
 
+    bs->reservoir = 0;
     bs->bits_left = 0;
+    bs->underflow = 0;
 
     return bs;
 }
 
-unsigned int get_bit(struct bitstream_reader *bs)
+// top up the reservoir to at least 57 bits, or whatever is left
+static inline void refill(struct bitstream_reader *bs)
 {
-    if (bs->consecutive_bits && bs->consecutive_bits_left == 0)
+    while (bs->bits_left <= 56 && bs->pool_size > 0)
     {
-        // hit the end of a packet, skip over the skip bits
-        bs->consecutive_bits_left = bs->skip_bits;
-        // recursive call to throw away bits
-        while (bs->consecutive_bits_left) get_bit(bs);
+        bs->reservoir |= (uint64_t)*(bs->pool++) << (56 - bs->bits_left);
+        bs->bits_left += 8;
+        bs->pool_size --;
+    }
+}
 
-        bs->consecutive_bits_left = bs->consecutive_bits;
+// take 1 to 32 bits, ignoring the layout, past the end they're zeroes
+static inline uint32_t take_bits(struct bitstream_reader *bs, unsigned int bits)
+{
+    if (bs->bits_left < bits)
+    {
+        refill(bs);
+        if (bs->bits_left < bits)
+        {
+            bs->underflow = 1;
+            bs->bits_left = bits;
+        }
     }
 
-    if (0 == bs->bits_left)
+    uint32_t val = bs->reservoir >> (64 - bits);
+    bs->reservoir <<= bits;
+    bs->bits_left -= bits;
+
+    return val;
+}
+
+// drop bits, ignoring the layout, without reading what's skipped
+static void drop_bits(struct bitstream_reader *bs, size_t bits)
+{
+    if (bits < bs->bits_left)
     {
-        CHECK_ERROR(0 == bs->pool_size, "bitstream underflow");
-        bs->bit_buffer = *(bs->pool++);
-        bs->bits_left = 8;
+        bs->reservoir <<= bits;
+        bs->bits_left -= bits;
+        return;
+    }
 
-        bs->pool_size --;
+    bits -= bs->bits_left;
+    bs->reservoir = 0;
+    bs->bits_left = 0;
+
+    if (bits / 8 > bs->pool_size)
+    {
+        bs->underflow = 1;
+        bs->pool += bs->pool_size;
+        bs->pool_size = 0;
+        return;
+    }
+    bs->pool += bits / 8;
+    bs->pool_size -= bits / 8;
+
+    if (bits % 8 != 0)
+    {
+        take_bits(bs, bits % 8);
     }
-    bs->bits_left --;
-    if (bs->consecutive_bits) bs->consecutive_bits_left --;
-    return ( ( bs->bit_buffer & ( 1 << bs->bits_left ) ) != 0);
+}
+
+// bits that can be read before the next skip, skipping first if at one
+static inline size_t bits_until_skip(struct bitstream_reader *bs)
+{
+    if (bs->consecutive_bits_left == 0)
+    {
+        // hit the end of a packet, skip over the skip bits
+        drop_bits(bs, bs->skip_bits);
+        bs->consecutive_bits_left = bs->consecutive_bits;
+    }
+
+    return bs->consecutive_bits_left;
+}
+
+unsigned int get_bit(struct bitstream_reader *bs)
+{
+    return get_bits(bs, 1);
 }
 
 uint32_t get_bits(struct bitstream_reader *bs, unsigned int bits)
 {
     CHECK_ERROR( bits > 32, "max 32 bits" );
 
+    if (0 == bs->consecutive_bits)
+    {
+        return bits ? take_bits(bs, bits) : 0;
+    }
+
     uint32_t total = 0;
 
-    for (unsigned int i = 0; i < bits; i++)
+    while (bits > 0)
     {
+        size_t bits_this_time = bits_until_skip(bs);
+        if (bits_this_time > bits) bits_this_time = bits;
+
+        // two steps so that a shift is never by 32
+        total <<= bits_this_time - 1;
         total <<= 1;
+        total |= take_bits(bs, bits_this_time);
 
-        if (get_bit(bs))
-        {
-            total |= 1;
-        }
+        bs->consecutive_bits_left -= bits_this_time;
+        bits -= bits_this_time;
     }
 
     return total;
 }
 
+void skip_bits(struct bitstream_reader *bs, size_t bits)
+{
+    if (0 == bs->consecutive_bits)
+    {
+        drop_bits(bs, bits);
+        return;
+    }
+
+    while (bits > 0)
+    {
+        size_t bits_this_time = bits_until_skip(bs);
+        if (bits_this_time > bits) bits_this_time = bits;
+
+        drop_bits(bs, bits_this_time);
+
+        bs->consecutive_bits_left -= bits_this_time;
+        bits -= bits_this_time;
+    }
+}
+
+int bitstream_underflow(const struct bitstream_reader *bs)
+{
+    return bs->underflow;
+}
+
 void free_bitstream_reader(struct bitstream_reader *bs)
 {
     free(bs);
 }
 
+////////////////
+
+enum {WRITER_BUFFER_SIZE = 0x10000};
+
 struct bitstream_writer
 {
     FILE *outfile;
 
-    uint8_t bit_buffer;
+    // whole bytes waiting to be written
+    uint8_t buffer[WRITER_BUFFER_SIZE];
+    size_t buffer_used;
+
+    // bits not yet making a whole byte, at the bottom
+    uint64_t bit_buffer;
     unsigned int bits_used;
 };
 
-////////////////
-
 struct bitstream_writer *init_bitstream_writer(FILE *outfile)
 {
     struct bitstream_writer *bs = malloc(sizeof(struct bitstream_writer));
@@ -102,35 +200,83 @@ struct bitstream_writer *init_bitstream_writer(FILE *outfile)
     CHECK_ERRNO(!bs, "malloc");
 
     bs->outfile = outfile;
-    
+
+    bs->buffer_used = 0;
     bs->bit_buffer = 0;
     bs->bits_used = 0;
 
     return bs;
 }
 
-void put_bit(struct bitstream_writer *bs, unsigned int val)
+static void write_buffer(struct bitstream_writer *bs)
 {
-    if (8 == bs->bits_used)
+    if (0 != bs->buffer_used)
     {
-        flush_bitstream_writer(bs);
-    }
+        size_t written = fwrite(bs->buffer, 1, bs->buffer_used, bs->outfile);
+        CHECK_FILE(written != bs->buffer_used, bs->outfile, "fwrite");
 
-    if (val)
-    {
-        bs->bit_buffer |= (0x80 >> bs->bits_used);
+        bs->buffer_used = 0;
     }
+}
 
-    bs->bits_used ++;
+void put_bit(struct bitstream_writer *bs, unsigned int val)
+{
+    put_bits(bs, val != 0, 1);
 }
 
 void put_bits(struct bitstream_writer *bs, uint32_t val, unsigned int bits)
 {
     CHECK_ERROR( bits > 32, "max 32 bits" );
 
-    for (unsigned int i = 0; i < bits; i++)
+    if (0 == bits) return;
+
+    bs->bit_buffer = bs->bit_buffer << bits | (val & (UINT64_C(0xffffffff) >> (32 - bits)));
+    bs->bits_used += bits;
+
+    while (bs->bits_used >= 8)
+    {
+        if (WRITER_BUFFER_SIZE == bs->buffer_used)
+        {
+            write_buffer(bs);
+        }
+
+        bs->bits_used -= 8;
+        bs->buffer[bs->buffer_used++] = bs->bit_buffer >> bs->bits_used;
+    }
+}
+
+void copy_bits(struct bitstream_reader *ibs, struct bitstream_writer *obs, size_t bits)
+{
+    for (; bits >= 32; bits -= 32)
+    {
+        put_bits(obs, get_bits(ibs, 32), 32);
+    }
+    put_bits(obs, get_bits(ibs, bits), bits);
+}
+
+void put_bits_from(struct bitstream_writer *bs, const uint8_t *src, size_t bit_offset, size_t bits)
+{
+    src += bit_offset / 8;
+    const unsigned int shift = bit_offset % 8;
+
+    // whole bytes from the source, 32 bits at a time
+    for (; bits >= 32; bits -= 32, src += 4)
     {
-        put_bit(bs, val & (1 << (bits-1-i)));
+        uint64_t v = (uint64_t)read_32_be(src) << 8;
+        if (shift) v |= src[4];
+        put_bits(bs, (uint32_t)(v >> (8 - shift)), 32);
+    }
+
+    // what's left, only touching the bytes it's in
+    if (bits > 0)
+    {
+        uint64_t v = 0;
+        const unsigned int bytes = (shift + bits + 7) / 8;
+        for (unsigned int i = 0; i < bytes; i++)
+        {
+            v = v << 8 | src[i];
+        }
+        put_bits(bs, (uint32_t)(v >> (bytes * 8 - shift - bits)), bits);
     }
 }
 
@@ -138,15 +284,15 @@ void flush_bitstream_writer(struct bitstream_writer *bs)
 {
     if (0 != bs->bits_used)
     {
-        int rc = fputc(bs->bit_buffer, bs->outfile);
-        CHECK_FILE(EOF == rc, bs->outfile, "fputc");
-
-        bs->bit_buffer = 0;
-        bs->bits_used = 0;
+        put_bits(bs, 0, 8 - bs->bits_used);
     }
+
+    write_buffer(bs);
 }
 
 void free_bitstream_writer(struct bitstream_writer *bs)
 {
+    // whole bytes at least shouldn't be lost
+    write_buffer(bs);
     free(bs);
 }
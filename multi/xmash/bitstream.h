@@ -11,6 +11,10 @@ struct bitstream_reader;
 struct bitstream_reader *init_bitstream_reader(const uint8_t *pool, size_t pool_size, size_t consecutive_bits, size_t skip_bits);
 unsigned int get_bit(struct bitstream_reader *bs);
 uint32_t get_bits(struct bitstream_reader *bs, unsigned int bits);
+// throw away bits, as if read
+void skip_bits(struct bitstream_reader *bs, size_t bits);
+// whether reading went past the end (reading on from there gives zeroes)
+int bitstream_underflow(const struct bitstream_reader *bs);
 void free_bitstream_reader(struct bitstream_reader *bs);
 
 // bitstream writing
@@ -19,6 +23,11 @@ struct bitstream_writer;
 struct bitstream_writer *init_bitstream_writer(FILE *outfile);
 void put_bit(struct bitstream_writer *bs, unsigned int val);
 void put_bits(struct bitstream_writer *bs, uint32_t val, unsigned int bits);
+// move bits from a reader to a writer
+void copy_bits(struct bitstream_reader *ibs, struct bitstream_writer *obs, size_t bits);
+// write bits straight from memory, starting bit_offset bits (MSB first) into src
+void put_bits_from(struct bitstream_writer *bs, const uint8_t *src, size_t bit_offset, size_t bits);
+// write out everything, padding the last byte with zeroes
 void flush_bitstream_writer(struct bitstream_writer *bs);
 void free_bitstream_writer(struct bitstream_writer *bs);
 
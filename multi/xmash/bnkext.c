@@ -1,10 +1,12 @@
 #include <stdint.h>
 #include <inttypes.h>
 #include "util.h"
+#include "window.h"
 #include "error_stuff.h"
 #include "fsbext.h"
 #include "riffext.h"
 #include "bnkext.h"
+#include "wwbank.h"
 #include "xma_rebuild.h"
 
 // wwise bank
@@ -22,7 +24,9 @@ struct chunk_info
     uint32_t size;
 };
 
-static int find_chunks(const uint8_t *infile, long file_size, struct chunk_info * chunk_info, int chunk_info_count, int ignore_unknown)
+// look through the chunks in [base, base+file_size) of the reader,
+// offsets found are from base
+static int find_chunks(struct window_reader *in, long base, long file_size, struct chunk_info * chunk_info, int chunk_info_count, int ignore_unknown)
 {
     long offset = 0;
     for (int i = 0; i < chunk_info_count; i++)
@@ -39,8 +43,11 @@ static int find_chunks(const uint8_t *infile, long file_size, struct chunk_info
 
         if (offset + 8 > file_size) return 1;
 
-        chunk_id = read_32_be(&infile[offset+0]);
-        chunk_size = read_32_be(&infile[offset+4]);
+        const uint8_t *chunk = window_at(in, base + offset, 8);
+        if (!chunk) return 1;
+
+        chunk_id = read_32_be(&chunk[0]);
+        chunk_size = read_32_be(&chunk[4]);
 
         if (offset + 8 + chunk_size > file_size) return 1;
 
@@ -90,86 +97,143 @@ static int find_chunks(const uint8_t *infile, long file_size, struct chunk_info
     return 0;
 }
 
-static int try_ww_xma_riff(const uint8_t *infile, long file_size, const char *stream_name, subfile_callback_t *cb, void *cbv);
+static int try_ww_xma_riff(struct window_reader *in, long base, long file_size, const char *stream_name, subfile_callback_t *cb, void *cbv);
 
-int try_wwbnk(const uint8_t *infile, long file_size, subfile_callback_t *cb, void *cbv)
+static int read_window(void *handle, long offset, uint8_t *buf, long size)
 {
-    struct chunk_info chunks[] =
+    const uint8_t *p = window_at(handle, offset, size);
+    if (!p) return 1;
+
+    memcpy(buf, p, size);
+
+    return 0;
+}
+
+static int extract_file(struct window_reader *in, const struct wwbank_index *bank, int idx, subfile_callback_t *cb, void *cbv)
+{
+    const struct wwbank_file *f = &bank->files[idx];
+
+    char crc_string[11+1];
+    memset(crc_string, 0, sizeof(crc_string));
+    snprintf(crc_string, sizeof(crc_string), "%"PRIu32"_", f->id);
+    char *file_name = number_name(crc_string, "_", idx, bank->file_count);
+
+    int rc = try_ww_xma_riff(in, f->offset, f->size, file_name, cb, cbv);
+
+    if (rc == 2)
+    {
+        printf("subfile %"PRIu32" not XMA\n", f->id);
+        cb(in, f->offset, f->size, 0, NULL, 0, 0, 0, 0, 0, file_name, cbv);
+    }
+
+    free(file_name);
+
+    return rc == 1;
+}
+
+static int by_int(const void *a, const void *b)
+{
+    return *(const int *)a - *(const int *)b;
+}
+
+int try_wwbnk(struct window_reader *in, const uint32_t *ids, int id_count, subfile_callback_t *cb, void *cbv)
+{
+    const long file_size = window_reader_size(in);
+
+    static const uint32_t chunk_ids[] =
     {
-        { .id = 0x424B4844 }, // 0 BKHD
-        { .id = 0x44494458 }, // 1 DIDX
-        { .id = 0x44415441 }, // 2 DATA
-        { .id = 0x48495243 }, // 3 HIRC
-        { .id = 0x53544944 }, // 4 STID
+        WWBANK_BKHD, WWBANK_DIDX, WWBANK_DATA, WWBANK_HIRC, WWBANK_STID
     };
+    const int chunk_id_count = sizeof(chunk_ids)/sizeof(chunk_ids[0]);
 
-    const int DIDX_IDX = 1;
-    const int DATA_IDX = 2;
+    struct wwbank_index bank;
 
-    if (0 != find_chunks(infile, file_size, chunks, sizeof(chunks)/sizeof(chunks[0]), 0))
+    if (0 != wwbank_index_init(&bank, read_window, in, 0, file_size))
     {
         return 1;
     }
-        
-    // parse DIDX
+
+    // exactly the chunks expected, each once, and nothing after them
+    int ok = (bank.end == file_size && bank.chunk_count == chunk_id_count);
+    for (int i = 0; ok && i < bank.chunk_count; i++)
     {
-        const int DIDX_ENTRY_SIZE = 0xC;
+        int known = 0;
+        for (int j = 0; j < chunk_id_count; j++)
+        {
+            if (bank.chunks[i].id == chunk_ids[j]) known = 1;
+        }
 
-        long offset = chunks[DIDX_IDX].offset;
-        long didx_size = chunks[DIDX_IDX].size;
-        long data_offset = chunks[DATA_IDX].offset;
-        long data_size = chunks[DATA_IDX].size;
+        ok = known && wwbank_find_chunk(&bank, bank.chunks[i].id) == &bank.chunks[i];
+    }
 
-        if (didx_size % DIDX_ENTRY_SIZE != 0) return 1;
+    if (!ok)
+    {
+        wwbank_index_free(&bank);
+        return 1;
+    }
 
-        int file_count = didx_size / DIDX_ENTRY_SIZE;
+    int rc = 0;
 
-        for (int idx = 0; idx < file_count; idx ++)
+    if (0 == id_count)
+    {
+        for (int idx = 0; 0 == rc && idx < bank.file_count; idx ++)
         {
-            uint32_t crc = read_32_be(&infile[offset + 0]);
-            long subfile_offset = data_offset + read_32_be(&infile[offset + 4]);
-            long subfile_size = read_32_be(&infile[offset + 8]);
+            rc = extract_file(in, &bank, idx, cb, cbv);
+        }
+    }
+    else
+    {
+        // only the files asked for, looked up in the index and taken in
+        // bank order, nothing else is read
+        int *wanted = malloc(id_count * sizeof(int));
+        CHECK_ERRNO(!wanted, "malloc");
+        int wanted_count = 0;
 
-            if (subfile_offset + subfile_size > data_offset + data_size)
+        for (int i = 0; i < id_count; i++)
+        {
+            int idx = wwbank_find_file(&bank, ids[i]);
+            if (idx < 0)
             {
-                return 1;
+                printf("no file %"PRIu32" in bank\n", ids[i]);
+                continue;
             }
 
-            char crc_string[11+1];
-            memset(crc_string, 0, sizeof(crc_string));
-            snprintf(crc_string, sizeof(crc_string), "%"PRIu32"_", crc);
-            char *file_name = number_name(crc_string, "_", idx, file_count);
-
-            int rc = try_ww_xma_riff(infile + subfile_offset, subfile_size, file_name, cb, cbv);
-
-            if (rc == 2)
-            {
-                printf("subfile %"PRIu32" not XMA\n", crc);
-                cb(infile + subfile_offset, subfile_size, 0, NULL, 0, 0, 0, 0, 0, file_name, cbv);
-            }
+            wanted[wanted_count++] = idx;
+        }
 
-            free(file_name);
-            file_name = NULL;
+        qsort(wanted, wanted_count, sizeof(int), by_int);
 
-            if (rc == 1)
-            {
-                return 1;
-            }
+        for (int i = 0; 0 == rc && i < wanted_count; i++)
+        {
+            if (i > 0 && wanted[i] == wanted[i-1]) continue;
 
-            offset += DIDX_ENTRY_SIZE;
+            rc = extract_file(in, &bank, wanted[i], cb, cbv);
         }
+
+        free(wanted);
     }
 
-    return 0;
+    wwbank_index_free(&bank);
+
+    return rc;
+}
+
+// a lone Wwise RIFX, as found in a bank
+int try_wwriff(struct window_reader *in, subfile_callback_t *cb, void *cbv)
+{
+    return try_ww_xma_riff(in, 0, window_reader_size(in), "RIFX_", cb, cbv) != 0;
 }
 
-static int try_ww_xma_riff(const uint8_t *infile, long file_size, const char *stream_name, subfile_callback_t *cb, void *cbv)
+static int try_ww_xma_riff(struct window_reader *in, long base, long file_size, const char *stream_name, subfile_callback_t *cb, void *cbv)
 {
     uint32_t (*read_32)(const unsigned char []) = NULL;
     uint16_t (*read_16)(const unsigned char []) = NULL;
 
     if (file_size < 12) return 1;
 
+    const uint8_t *infile = window_at(in, base, 12);
+    if (!infile) return 1;
+
     if (!memcmp(infile, "RIFX", 4))
     {
         read_32 = read_32_be;
@@ -212,7 +276,7 @@ static int try_ww_xma_riff(const uint8_t *infile, long file_size, const char *st
     const int DATA_IDX = 1;
     const int XMAC_IDX = 2;
 
-    if (0 != find_chunks(infile + 12, file_size - 12, chunks, sizeof(chunks)/sizeof(chunks[0]), 1))
+    if (0 != find_chunks(in, base + 12, file_size - 12, chunks, sizeof(chunks)/sizeof(chunks[0]), 1))
     {
         return 1;
     }
@@ -222,11 +286,13 @@ static int try_ww_xma_riff(const uint8_t *infile, long file_size, const char *st
         return 2;
     }
 
-    long fmt_offset = 12 + chunks[FMT_IDX].offset;
-    uint16_t codec = read_16(&infile[fmt_offset+0]);
-    uint16_t channels = read_16(&infile[fmt_offset+2]);
-    uint32_t sample_rate = read_32(&infile[fmt_offset+4]);
-    uint16_t fmt_extra = read_16(&infile[fmt_offset+0x10]);
+    const uint8_t *fmt = window_at(in, base + 12 + chunks[FMT_IDX].offset, 0x20);
+    if (!fmt) return 1;
+
+    uint16_t codec = read_16(&fmt[0]);
+    uint16_t channels = read_16(&fmt[2]);
+    uint32_t sample_rate = read_32(&fmt[4]);
+    uint16_t fmt_extra = read_16(&fmt[0x10]);
 
     if (codec != 0x166)
     {
@@ -245,16 +311,16 @@ static int try_ww_xma_riff(const uint8_t *infile, long file_size, const char *st
         return 1;
     }
 
-    uint32_t sample_count = read_32(&infile[fmt_offset + 0x18]);
-    uint32_t block_size = read_32(&infile[fmt_offset + 0x1C]);
+    uint32_t sample_count = read_32(&fmt[0x18]);
+    uint32_t block_size = read_32(&fmt[0x1C]);
 
-    long data_offset = 12 + chunks[DATA_IDX].offset;
+    long data_offset = base + 12 + chunks[DATA_IDX].offset;
     long data_size = chunks[DATA_IDX].size;
 
     int * stream_channels = malloc(sizeof(int));
     stream_channels[0] = channels;
 
-    if (0 != cb(infile + data_offset, data_size, 1, stream_channels,
+    if (0 != cb(in, data_offset, data_size, 1, stream_channels,
             sample_count, sample_rate, block_size,
             0, 0, // TODO: collect loop info
             stream_name, cbv))
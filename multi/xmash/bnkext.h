@@ -1,6 +1,8 @@
 #ifndef _BNKEXT_H
 #define _BNKEXT_H
 
-int try_wwbnk(const uint8_t *infile, long file_size, subfile_callback_t *cb, void *cbv);
+// with id_count > 0, only the embedded files with those ids are extracted
+int try_wwbnk(struct window_reader *in, const uint32_t *ids, int id_count, subfile_callback_t *cb, void *cbv);
+int try_wwriff(struct window_reader *in, subfile_callback_t *cb, void *cbv);
 
 #endif
@@ -6,6 +6,7 @@
 #include "xma_rebuild.h"
 #include "fsbext.h"
 #include "util.h"
+#include "window.h"
 #include "error_stuff.h"
 
 /* extract fsb substreams */
@@ -24,8 +25,10 @@ enum fsb_type_t {
     fsb3, fsb4
 };
 
-int try_multistream_fsb(const uint8_t *infile, long file_size, subfile_callback_t *cb, void *cbv)
+int try_multistream_fsb(struct window_reader *in, subfile_callback_t *cb, void *cbv)
 {
+    const long file_size = window_reader_size(in);
+    const uint8_t *infile;
     int32_t stream_count;
     int32_t table_size;
     int32_t body_size;
@@ -33,7 +36,11 @@ int try_multistream_fsb(const uint8_t *infile, long file_size, subfile_callback_
     enum fsb_type_t fsb_type;
 
     /* read header */
-    CHECK_ERROR(file_size < 4, "too small to be FSB");
+    infile = window_at(in, 0, 4);
+    if (!infile)
+    {
+        return 1;
+    }
 
     {
         if (!memcmp(&infile[0],fsb3headmagic,4))
@@ -54,7 +61,8 @@ int try_multistream_fsb(const uint8_t *infile, long file_size, subfile_callback_
             return 1;
         }
 
-        if (header_size > file_size)
+        infile = window_at(in, 0, header_size);
+        if (!infile)
         {
             return 1;
         }
@@ -108,15 +116,21 @@ int try_multistream_fsb(const uint8_t *infile, long file_size, subfile_callback_
             char name_buf[0x1e + 1 + 1];
             char *stream_name;
             const int entry_min_size = 0x40;
+            const uint8_t *entry = window_at(in, table_offset, entry_min_size + 2);
+
+            if (!entry)
+            {
+                return 1;
+            }
 
-            entry_size = read_16_le(&infile[table_offset+0x00]);
+            entry_size = read_16_le(&entry[0x00]);
             if (entry_size < entry_min_size)
             {
                 return 1;
             }
             padding_size = 0x10 - (header_size + entry_size) % 0x10;
 
-            entry_file_size = read_32_le(&infile[table_offset+0x24]);
+            entry_file_size = read_32_le(&entry[0x24]);
 
             if (gBodyPadding != 0)
             {
@@ -131,7 +145,7 @@ int try_multistream_fsb(const uint8_t *infile, long file_size, subfile_callback_
 
             /* copy the name somewhere we can play with it */
             memset(name_buf, 0, sizeof(name_buf));
-            memcpy(name_buf, &infile[table_offset+0x02], 0x1e);
+            memcpy(name_buf, &entry[0x02], 0x1e);
             name_buf[strlen(name_buf)]='_';
 
 #if 0
@@ -164,20 +178,20 @@ int try_multistream_fsb(const uint8_t *infile, long file_size, subfile_callback_
                        (uint32_t)body_offset);
 
             /* get sample rate */
-            uint32_t srate = read_32_le(&infile[table_offset+0x34]);
+            uint32_t srate = read_32_le(&entry[0x34]);
 
             /* get channel count */
-            uint16_t channels = read_32_le(&infile[table_offset+0x3e]);
+            uint16_t channels = read_32_le(&entry[0x3e]);
             int substreams = (channels + 1) / 2;
 
             /* get sample count */
-            uint32_t samples = read_32_le(&infile[table_offset+0x20]);
+            uint32_t samples = read_32_le(&entry[0x20]);
 
             printf("%"PRIu32" Hz %"PRIu16" channel%s (%d streams), %"PRIu32" samples\n\n",
                     srate, channels, (1==channels?"":"s"), substreams, samples);
 
             // invoke callback
-            if (0 != cb(infile + body_offset, entry_file_size, substreams, NULL,
+            if (0 != cb(in, body_offset, entry_file_size, substreams, NULL,
                         samples, srate, default_block_size,
                         0, 0, // TODO: collect loop info
                         stream_name, cbv))
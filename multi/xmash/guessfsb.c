@@ -5,6 +5,7 @@
 #include "guessfsb.h"
 #include "error_stuff.h"
 #include "util.h"
+#include "swapxor.h"
 
 // FMOD fsb key guessing
 // based on guessfsb 0.4
@@ -26,10 +27,21 @@ struct guessfsb_state
 
     int match_count;
 
-    uint8_t *indata;
+    const uint8_t *infile;  // as given, encrypted
+    struct growable_buffer *decrypted;  // only filled once a key passes
     long file_size;
 };
 
+// the file as a key would decrypt it, read straight from the original so
+// checking a key only touches the bytes the checks look at
+struct xor_view
+{
+    const uint8_t *data;
+    const uint8_t *swap_table;
+    const uint8_t *key;
+    int key_length;
+};
+
 #if 0
 static void analyze_header(const uint8_t * const indata,
                     long whole_file_size, long max_streams);
@@ -40,15 +52,17 @@ static int analyze_padding(struct guessfsb_state *s, good_key_callback_t *cb, vo
 static int test_key(struct guessfsb_state *s, const uint8_t *key,
              const int key_length);
 
-static int test_table(const uint8_t *indata, const uint8_t *key, const int key_length,
+static int test_table(const struct xor_view *v,
                const uint_fast32_t stream_count,
                const uint_fast32_t header_size,
                const uint_fast32_t table_size,
                const uint_fast32_t body_size);
 
-static inline uint_fast32_t read_32_le_xor(const uint8_t *bytes, const long offset, const uint8_t *key, const int key_length);
+static inline uint8_t view_byte(const struct xor_view *v, const long offset);
 
-static inline uint_fast16_t read_16_le_xor(const uint8_t *bytes, const long offset, const uint8_t *key, const int key_length);
+static inline uint_fast32_t read_32_le_xor(const struct xor_view *v, const long offset);
+
+static inline uint_fast16_t read_16_le_xor(const struct xor_view *v, const long offset);
 
 static void print_key(const uint8_t *key, const int key_length, const int count);
 
@@ -58,7 +72,7 @@ static void decrypt_file(struct guessfsb_state *s, uint8_t const * key, long key
 
 // interface
 
-int guess_fsb_keys(const uint8_t *infile, long file_size, good_key_callback_t *cb, void *cbv)
+int guess_fsb_keys(const uint8_t *infile, long file_size, struct growable_buffer *decrypted, good_key_callback_t *cb, void *cbv)
 {
     int success = 0;
     struct guessfsb_state *s = malloc(sizeof(struct guessfsb_state));
@@ -78,17 +92,13 @@ int guess_fsb_keys(const uint8_t *infile, long file_size, good_key_callback_t *c
             (i&0x80) >> 7;
     }
 
-    s->indata = malloc(file_size);
-    CHECK_ERRNO(!s->indata, "malloc for guessfsb indata");
+    s->infile = infile;
+    s->decrypted = decrypted;
     s->file_size = file_size;
 
     s->matches = NULL;
     s->match_count = 0;
 
-    // swap everything up front
-    for (long i=0; i < s->file_size; i++)
-        s->indata[i] = s->swap_table[infile[i]];
-
     // guess!
 
     if (0 == analyze_padding(s, cb, cbv))
@@ -113,7 +123,6 @@ int guess_fsb_keys(const uint8_t *infile, long file_size, good_key_callback_t *c
         }
         free(s->matches);
     }
-    free(s->indata);
     free(s);
 
     if (success)
@@ -231,12 +240,16 @@ void analyze_header(const uint8_t * const indata,
 int test_key(struct guessfsb_state *s, const uint8_t *key,
              const int key_length)
 {
+    const struct xor_view v = {s->infile, s->swap_table, key, key_length};
     uint8_t fsb_magic[4];
     uint_fast32_t stream_count, header_size, table_size, body_size;
 
+    // room for the magic and sizes
+    if (s->file_size < 0x10) return 0;
+
     // attempted decrypted magic
     for (int i=0;i<4;i++)
-        fsb_magic[i] = key[i%key_length] ^ s->indata[i];
+        fsb_magic[i] = view_byte(&v, i);
 
     int fsb_type;
     for (fsb_type=0; fsb_type < FSB_TYPES; fsb_type++)
@@ -249,21 +262,21 @@ int test_key(struct guessfsb_state *s, const uint8_t *key,
     }
     if (fsb_type == FSB_TYPES) return 0;
 
-    stream_count = read_32_le_xor(s->indata, 4, key, key_length);
-    table_size = read_32_le_xor(s->indata, 8, key, key_length);
-    body_size = read_32_le_xor(s->indata, 0xc, key, key_length);
+    stream_count = read_32_le_xor(&v, 4);
+    table_size = read_32_le_xor(&v, 8);
+    body_size = read_32_le_xor(&v, 0xc);
 
     if (s->file_size != 0 &&
         header_size + table_size + body_size != s->file_size) return 0;
     if (stream_count < 1) return 0;
     if (stream_count * 0x28 > table_size) return 0;
 
-    return test_table(s->indata, key, key_length, stream_count, header_size,
+    return test_table(&v, stream_count, header_size,
             table_size, body_size);
 }
 
 // test a key on the header table, 0 for failure, 1 for success
-int test_table(const uint8_t *indata, const uint8_t *key, const int key_length,
+int test_table(const struct xor_view *v,
                const uint_fast32_t stream_count,
                const uint_fast32_t header_size,
                const uint_fast32_t table_size,
@@ -281,9 +294,12 @@ int test_table(const uint8_t *indata, const uint8_t *key, const int key_length,
     for (file_num = 0; file_num < stream_count;
             file_num ++)
     {
+        // entry must be within the table (and the file)
+        if (entry_offset + 0x28 > header_size + table_size)
+            return 0;
+
         uint_fast16_t entry_size = 
-            read_16_le_xor(indata, entry_offset,
-                    key, key_length);
+            read_16_le_xor(v, entry_offset);
 #if 0
         printf("[%d] entry_size = %"PRIxFAST16"\n",
                 file_num,entry_size);
@@ -294,8 +310,7 @@ int test_table(const uint8_t *indata, const uint8_t *key, const int key_length,
             return 0;
 
         uint_fast32_t entry_file_size =
-            read_32_le_xor(indata, entry_offset + 0x24,
-                    key, key_length);
+            read_32_le_xor(v, entry_offset + 0x24);
 #if 0
         printf("[%d] entry_file_size = %"PRIxFAST16"\n",
                 file_num,entry_file_size);
@@ -364,9 +379,13 @@ static int analyze_padding(struct guessfsb_state *s, good_key_callback_t *cb, vo
     enum {max_key_length = 0x40};
     enum {min_key_length = 0x10};
 
+    // the bit swap doesn't change which bytes repeat, so this looks at the
+    // original bytes and only swaps to make the key
+    const uint8_t *indata = s->infile;
+
     for (long repeat_end = 0; repeat_end < s->file_size; repeat_end++)
     {
-        if (0 != byte_count[s->indata[repeat_end]])
+        if (0 != byte_count[indata[repeat_end]])
         {
             // check for match ending here
             for (long repeat_length = min_key_length;
@@ -379,7 +398,7 @@ static int analyze_padding(struct guessfsb_state *s, good_key_callback_t *cb, vo
                 for (long check_offset = repeat_end;
                         checked_length < repeat_length &&
                         check_offset-repeat_length > 0 &&
-                        s->indata[check_offset] == s->indata[check_offset-repeat_length];
+                        indata[check_offset] == indata[check_offset-repeat_length];
                         checked_length++, check_offset--) ;
 
                 if (checked_length == repeat_length)
@@ -394,26 +413,24 @@ static int analyze_padding(struct guessfsb_state *s, good_key_callback_t *cb, vo
                         for (int i=0; i < key_length; i++)
                         {
                             key[(repeat_end-i)%key_length] = 
-                                s->indata[repeat_end-i] ^ pad;
+                                s->swap_table[indata[repeat_end-i]] ^ pad;
                         }
 
                         if (test_key(s, key, key_length))
                         {
                             if (process_matching_key(s, key, key_length))
                             {
-                                // decrypt file in place to give to callback
+                                // only now make a decrypted copy for the callback
                                 decrypt_file(s, key, key_length);
 
                                 // invoke callback
-                                if (0 == cb(s->indata, s->file_size, cbv))
+                                if (0 == cb(s->decrypted->data, s->file_size, key, key_length, cbv))
                                 {
                                     // callback was satisfied with the file
                                     return 0;
                                 }
 
                                 printf("Trying padding again...\n");
-                                // reencrypt so we can continue
-                                decrypt_file(s, key, key_length);
                             }
                         }
                     } // end loop through paddings
@@ -423,12 +440,12 @@ static int analyze_padding(struct guessfsb_state *s, good_key_callback_t *cb, vo
 
         if (repeat_end-min_key_length+1 >= 0)
         {
-            byte_count[s->indata[repeat_end-min_key_length+1]] ++;
+            byte_count[indata[repeat_end-min_key_length+1]] ++;
         }
 
         if (repeat_end-max_key_length*2 >= 0)
         {
-            byte_count[s->indata[repeat_end-max_key_length*2]] --;
+            byte_count[indata[repeat_end-max_key_length*2]] --;
         }
     }
 
@@ -458,36 +475,25 @@ void print_key(const uint8_t *key, const int key_length, const int count)
     fflush(stdout);
 }
 
-static inline uint_fast32_t read_32_le_xor(const uint8_t *bytes, const long offset, const uint8_t *key, const int key_length)
+static inline uint8_t view_byte(const struct xor_view *v, const long offset)
+{
+    return v->swap_table[v->data[offset]] ^ v->key[offset % v->key_length];
+}
+
+static inline uint_fast32_t read_32_le_xor(const struct xor_view *v, const long offset)
 {
-    uint_fast32_t b1,b2,b3,b4;
-    int key_offset = offset % key_length;
-    b1 = bytes[offset + 0] ^ key[key_offset ++];
-    if (key_offset == key_length) key_offset = 0;
-    b2 = bytes[offset + 1] ^ key[key_offset ++];
-    if (key_offset == key_length) key_offset = 0;
-    b3 = bytes[offset + 2] ^ key[key_offset ++];
-    if (key_offset == key_length) key_offset = 0;
-    b4 = bytes[offset + 3] ^ key[key_offset];
-
-    return 
-        ((uint_fast32_t)b4) << 24 |
-        ((uint_fast32_t)b3) << 16 |
-        ((uint_fast32_t)b2) <<  8 |
-        ((uint_fast32_t)b1);
+    return
+        ((uint_fast32_t)view_byte(v, offset + 3)) << 24 |
+        ((uint_fast32_t)view_byte(v, offset + 2)) << 16 |
+        ((uint_fast32_t)view_byte(v, offset + 1)) <<  8 |
+        ((uint_fast32_t)view_byte(v, offset + 0));
 }
 
-static inline uint_fast16_t read_16_le_xor(const uint8_t *bytes, const long offset, const uint8_t *key, const int key_length)
+static inline uint_fast16_t read_16_le_xor(const struct xor_view *v, const long offset)
 {
-    uint_fast16_t b1,b2;
-    int key_offset = offset % key_length;
-    b1 = bytes[offset + 0] ^ key[key_offset ++];
-    if (key_offset == key_length) key_offset = 0;
-    b2 = bytes[offset + 1] ^ key[key_offset];
-
-    return 
-        ((uint_fast32_t)b2) <<  8 |
-        ((uint_fast32_t)b1);
+    return
+        ((uint_fast16_t)view_byte(v, offset + 1)) <<  8 |
+        ((uint_fast16_t)view_byte(v, offset + 0));
 }
 
 // return 1 if unique, 0 otherwise
@@ -533,10 +539,14 @@ static int process_matching_key(struct guessfsb_state *s,
     return 1;
 }
 
+// swap and decrypt from the original in one pass, into the copy
 static void decrypt_file(struct guessfsb_state *s, uint8_t const * key, long key_length)
 {
-    for (long i = 0; i < s->file_size; i++)
-    {
-        s->indata[i] ^= key[i%key_length];
-    }
+    struct swap_xor_key xor_key;
+
+    uint8_t *decrypted = grow_buffer(s->decrypted, s->file_size);
+
+    swap_xor_key_init(&xor_key, key, key_length);
+    swap_xor(decrypted, s->infile, s->file_size, &xor_key, 0);
+    swap_xor_key_free(&xor_key);
 }
@@ -4,8 +4,10 @@
 #include <stdint.h>
 
 // should return 1 to check more keys, 0 to finish
-typedef int good_key_callback_t(const uint8_t *, long file_size, void *);
+typedef int good_key_callback_t(const uint8_t *, long file_size, const uint8_t *key, int key_length, void *);
 
-int guess_fsb_keys(const uint8_t *infile, long file_size, good_key_callback_t *cb, void *cbv);
+// the file is decrypted into decrypted, which is grown as needed
+struct growable_buffer;
+int guess_fsb_keys(const uint8_t *infile, long file_size, struct growable_buffer *decrypted, good_key_callback_t *cb, void *cbv);
 
 #endif // _GUESSFSB_H_INCLUDED
@@ -0,0 +1,211 @@
+#include <stdint.h>
+#include <string.h>
+#include "util.h"
+#include "window.h"
+#include "probe.h"
+
+// enough for any header we look at, and for a few key lengths
+enum {PROBE_SIZE = 0x1000};
+
+// same as guessfsb
+enum {min_key_length = 0x10, max_key_length = 0x40};
+
+static int probe_fsb(const uint8_t *head, long head_size, long file_size)
+{
+    int score = 0;
+    long header_size;
+
+    if (head_size >= 4 && !memcmp(head, "FSB3", 4))
+    {
+        header_size = 0x18;
+    }
+    else if (head_size >= 4 && !memcmp(head, "FSB4", 4))
+    {
+        header_size = 0x30;
+    }
+    else
+    {
+        return 0;
+    }
+    score += 40;
+
+    if (head_size < header_size) return score;
+
+    const int32_t stream_count = read_32_le(&head[4]);
+    const int32_t table_size = read_32_le(&head[8]);
+    const int32_t body_size = read_32_le(&head[12]);
+
+    if (stream_count <= 0 || table_size <= 0 || body_size <= 0) return score;
+    score += 30;
+
+    if (header_size + (uint64_t)table_size + body_size <= (uint64_t)file_size)
+    {
+        score += 30;
+    }
+
+    return score;
+}
+
+static int probe_riff(const uint8_t *head, long head_size, long file_size, const char *magic)
+{
+    int score = 0;
+
+    if (head_size < 12 || memcmp(head, magic, 4)) return 0;
+    score += 40;
+
+    if (!memcmp(&head[8], "WAVE", 4))
+    {
+        score += 30;
+    }
+
+    if (!memcmp(magic, "RIFF", 4))
+    {
+        if ((uint64_t)read_32_le(&head[4]) + 8 <= (uint64_t)file_size)
+        {
+            score += 30;
+        }
+    }
+    else
+    {
+        // big endian, or the Wwise little endian size of the whole thing
+        if ((uint64_t)read_32_be(&head[4]) + 8 == (uint64_t)file_size ||
+            read_32_le(&head[4]) == file_size)
+        {
+            score += 30;
+        }
+    }
+
+    return score;
+}
+
+static int probe_bnk(const uint8_t *head, long head_size, long file_size)
+{
+    int score = 0;
+
+    if (head_size < 8 || memcmp(head, "BKHD", 4)) return 0;
+    score += 40;
+
+    const uint64_t next = 8 + (uint64_t)read_32_be(&head[4]);
+    if (next > (uint64_t)file_size) return score;
+    score += 30;
+
+    if (next == (uint64_t)file_size) return score;
+
+    if (next + 4 <= (uint64_t)head_size)
+    {
+        const uint8_t *id = &head[next];
+        if (!memcmp(id, "DIDX", 4) || !memcmp(id, "DATA", 4) ||
+            !memcmp(id, "HIRC", 4) || !memcmp(id, "STID", 4))
+        {
+            score += 30;
+        }
+    }
+
+    return score;
+}
+
+static uint8_t bit_swap(uint8_t b)
+{
+    b = (b & 0xF0) >> 4 | (b & 0x0F) << 4;
+    b = (b & 0xCC) >> 2 | (b & 0x33) << 2;
+    b = (b & 0xAA) >> 1 | (b & 0x55) << 1;
+    return b;
+}
+
+// an FSB encrypted with a repeating key shows the key wherever it covers
+// constant padding; look for a repeat of a key length, and see whether the
+// key it gives (for some padding byte) turns the start into an FSB magic
+static int find_key_repeat(const uint8_t *buf, long buf_size, long buf_offset, const uint8_t *head, long head_size)
+{
+    int score = 0;
+
+    for (int key_length = min_key_length; key_length <= max_key_length; key_length++)
+    {
+        long run = 0;
+
+        for (long i = key_length; i < buf_size; i++)
+        {
+            run = (buf[i] == buf[i - key_length]) ? run + 1 : 0;
+            if (run < key_length) continue;
+
+            // constant bytes repeat at any length, that's just padding
+            const uint8_t *rep = &buf[i - key_length + 1];
+            int constant = 1;
+            for (int k = 1; constant && k < key_length; k++)
+            {
+                constant = (rep[k] == rep[0]);
+            }
+            if (constant) continue;
+
+            if (score < 50) score = 50;
+
+            if (head_size < 4) return score;
+
+            uint8_t key[4];
+            for (int k = 0; k < 4; k++)
+            {
+                // the byte of the repeat that lines up with offset k
+                long j = (k - (buf_offset + i - key_length + 1)) % key_length;
+                if (j < 0) j += key_length;
+                key[k] = bit_swap(rep[j]);
+            }
+
+            for (int pad = 0; pad <= 255; pad++)
+            {
+                uint8_t magic[4];
+                for (int k = 0; k < 4; k++)
+                {
+                    magic[k] = bit_swap(head[k]) ^ key[k] ^ pad;
+                }
+
+                if (!memcmp(magic, "FSB3", 4) || !memcmp(magic, "FSB4", 4))
+                {
+                    return 100;
+                }
+            }
+
+            // only the first repeat at this length
+            break;
+        }
+    }
+
+    return score;
+}
+
+void probe_file(struct window_reader *in, int score[PROBE_FORMATS])
+{
+    const long file_size = window_reader_size(in);
+    uint8_t head[PROBE_SIZE], tail[PROBE_SIZE];
+    const long head_size = (file_size < PROBE_SIZE) ? file_size : PROBE_SIZE;
+    const long tail_offset = (file_size > 2*PROBE_SIZE) ? file_size - PROBE_SIZE : head_size;
+    const long tail_size = file_size - tail_offset;
+
+    for (int i = 0; i < PROBE_FORMATS; i++)
+    {
+        score[i] = 0;
+    }
+
+    const uint8_t *p = window_at(in, 0, head_size);
+    if (!p || head_size == 0) return;
+    memcpy(head, p, head_size);
+
+    if (tail_size > 0)
+    {
+        p = window_at(in, tail_offset, tail_size);
+        if (!p) return;
+        memcpy(tail, p, tail_size);
+    }
+
+    score[PROBE_FSB] = probe_fsb(head, head_size, file_size);
+    score[PROBE_RIFF] = probe_riff(head, head_size, file_size, "RIFF");
+    score[PROBE_RIFX] = probe_riff(head, head_size, file_size, "RIFX");
+    score[PROBE_BNK] = probe_bnk(head, head_size, file_size);
+
+    int enc = find_key_repeat(head, head_size, 0, head, head_size);
+    if (enc < 100 && tail_size > 0)
+    {
+        int tail_enc = find_key_repeat(tail, tail_size, tail_offset, head, head_size);
+        if (tail_enc > enc) enc = tail_enc;
+    }
+    score[PROBE_FSB_ENCRYPTED] = enc;
+}
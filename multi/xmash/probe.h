@@ -0,0 +1,21 @@
+#ifndef _PROBE_H_INCLUDED
+#define _PROBE_H_INCLUDED
+
+// guess what a file is from its first and last few KB, before trying to
+// extract anything
+
+enum probe_format {
+    PROBE_FSB,
+    PROBE_RIFF,
+    PROBE_RIFX,
+    PROBE_BNK,
+    PROBE_FSB_ENCRYPTED,
+    PROBE_FORMATS
+};
+
+struct window_reader;
+
+// score every format, 0 for no to 100 for sure
+void probe_file(struct window_reader *in, int score[PROBE_FORMATS]);
+
+#endif /* _PROBE_H_INCLUDED */
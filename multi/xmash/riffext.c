@@ -1,6 +1,8 @@
 #include <stdint.h>
+#include <stdlib.h>
 #include "fsbext.h"
 #include "util.h"
+#include "window.h"
 #include "error_stuff.h"
 #include "xma_rebuild.h"
 
@@ -8,8 +10,10 @@
 // based on vgmstream r918
 
 // returns 0 if all was ok, 1 otherwise
-int try_xma_riff(const uint8_t *infile, long file_size, subfile_callback_t *cb, void *cbv)
+int try_xma_riff(struct window_reader *in, subfile_callback_t *cb, void *cbv)
 {
+    const long file_size = window_reader_size(in);
+    const uint8_t *infile;
     uint32_t riff_size = 0;
     uint32_t data_size = 0;
     long start_offset = -1;
@@ -30,6 +34,8 @@ int try_xma_riff(const uint8_t *infile, long file_size, subfile_callback_t *cb,
     int i;
 
     /* check header */
+    infile = window_at(in, 0, 12);
+    if (!infile) goto fail;
     if ((uint32_t)read_32_be(&infile[0])!=0x52494646) /* "RIFF" */
         goto fail;
     /* check for WAVE form */
@@ -46,8 +52,11 @@ int try_xma_riff(const uint8_t *infile, long file_size, subfile_callback_t *cb,
         long current_chunk = 0xc; /* start with first chunk */
 
         while (current_chunk < file_size && current_chunk < riff_size+8) {
-            uint32_t chunk_type = read_32_be(&infile[current_chunk]);
-            long chunk_size = read_32_le(&infile[current_chunk+4]);
+            const uint8_t *chunk = window_at(in, current_chunk, 8);
+            if (!chunk) goto fail;
+
+            uint32_t chunk_type = read_32_be(&chunk[0]);
+            long chunk_size = read_32_le(&chunk[4]);
 
             if (current_chunk+8+chunk_size > file_size) goto fail;
 
@@ -57,26 +66,29 @@ int try_xma_riff(const uint8_t *infile, long file_size, subfile_callback_t *cb,
                     if (FormatChunkFound) goto fail;
                     FormatChunkFound = 1;
 
-                    sample_rate = read_32_le(&infile[current_chunk+0x0c]);
-                    channel_count = read_16_le(&infile[current_chunk+0x0a]);
+                    chunk = window_at(in, current_chunk, 0x38);
+                    if (!chunk) goto fail;
+
+                    sample_rate = read_32_le(&chunk[0x0c]);
+                    channel_count = read_16_le(&chunk[0x0a]);
 
                     /* coding */
-                    if (0x166 != read_16_le(&infile[current_chunk+0x8]))
+                    if (0x166 != read_16_le(&chunk[0x8]))
                         goto fail;
 
                     /* XMA2 extra stuff */
-                    if (0x22 != read_16_le(&infile[current_chunk+0x18]))
+                    if (0x22 != read_16_le(&chunk[0x18]))
                         goto fail;
 
-                    stream_count = read_16_le(&infile[current_chunk+0x1a]);
-                    sample_count = read_32_le(&infile[current_chunk+0x20]);
-                    block_size = read_32_le(&infile[current_chunk+0x24]);
+                    stream_count = read_16_le(&chunk[0x1a]);
+                    sample_count = read_32_le(&chunk[0x20]);
+                    block_size = read_32_le(&chunk[0x24]);
 #if 0
-                    play_start = read_32_le(&infile[current_chunk+0x28]);
-                    play_length = read_32_le(&infile[current_chunk+0x2c]);
+                    play_start = read_32_le(&chunk[0x28]);
+                    play_length = read_32_le(&chunk[0x2c]);
 #endif
-                    loop_start = read_32_le(&infile[current_chunk+0x30]);
-                    loop_end = loop_start+read_32_le(&infile[current_chunk+0x34]);
+                    loop_start = read_32_le(&chunk[0x30]);
+                    loop_end = loop_start+read_32_le(&chunk[0x34]);
                     /* don't count first frame */
                     sample_count -= samples_per_frame;
                     break;
@@ -98,18 +110,24 @@ int try_xma_riff(const uint8_t *infile, long file_size, subfile_callback_t *cb,
                     if (XMA2ChunkFound) goto fail;
                     XMA2ChunkFound = 1;
 
-                    sample_rate = read_32_be(&infile[current_chunk+0x14]);
+                    chunk = window_at(in, current_chunk, 0x30);
+                    if (!chunk) goto fail;
+
+                    sample_rate = read_32_be(&chunk[0x14]);
+
+                    stream_count = chunk[0x9];
+                    sample_count = read_32_be(&chunk[0x24]);
+                    block_size = read_32_be(&chunk[0x20]);
+                    loop_start = read_32_be(&chunk[0xC]);
+                    loop_end = read_32_be(&chunk[0x10]);
 
-                    stream_count = infile[current_chunk+0x9];
-                    sample_count = read_32_be(&infile[current_chunk+0x24]);
-                    block_size = read_32_be(&infile[current_chunk+0x20]);
-                    loop_start = read_32_be(&infile[current_chunk+0xC]);
-                    loop_end = read_32_be(&infile[current_chunk+0x10]);
+                    chunk = window_at(in, current_chunk, 0x30 + stream_count*4);
+                    if (!chunk) goto fail;
 
                     stream_channels = calloc(stream_count, sizeof(int));
                     for (i = 0; i < stream_count; i++)
                     {
-                        stream_channels[i] = infile[current_chunk+0x30+i*4];
+                        stream_channels[i] = chunk[0x30+i*4];
                     }
 
                     break;
@@ -125,8 +143,9 @@ int try_xma_riff(const uint8_t *infile, long file_size, subfile_callback_t *cb,
 
     if (!(FormatChunkFound || XMA2ChunkFound) || !DataChunkFound) goto fail;
 
-    return cb(&infile[start_offset], data_size, stream_count, stream_channels, sample_count, sample_rate, block_size, loop_start, loop_end, "RIFF_", cbv);
+    return cb(in, start_offset, data_size, stream_count, stream_channels, sample_count, sample_rate, block_size, loop_start, loop_end, "RIFF_", cbv);
 
 fail:
+    free(stream_channels);
     return 1;
 }
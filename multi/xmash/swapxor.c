@@ -0,0 +1,192 @@
+#include <stdlib.h>
+#include <string.h>
+#include "swapxor.h"
+#include "error_stuff.h"
+
+// where the compiler can build a kernel for a CPU it wasn't told to target,
+// build them all and pick one for the CPU it runs on; otherwise only the
+// kernel the compile flags allow
+#if (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__clang__) || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define SWAP_XOR_DISPATCH
+#define TARGET(t) __attribute__((target(t)))
+#else
+#define TARGET(t)
+#endif
+
+#if defined(SWAP_XOR_DISPATCH) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+// bits of a nibble reversed
+static const uint8_t reverse_nibble[16] = {
+    0x0, 0x8, 0x4, 0xc, 0x2, 0xa, 0x6, 0xe,
+    0x1, 0x9, 0x5, 0xd, 0x3, 0xb, 0x7, 0xf
+};
+
+static inline uint8_t reverse_byte(uint8_t b)
+{
+    return reverse_nibble[b & 0xf] << 4 | reverse_nibble[b >> 4];
+}
+
+static size_t gcd(size_t a, size_t b)
+{
+    while (b != 0)
+    {
+        size_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+void swap_xor_key_init(struct swap_xor_key *k, const uint8_t *key, size_t key_length)
+{
+    if (!key || key_length == 0)
+    {
+        key = NULL;
+        key_length = 1;
+    }
+
+    k->length = key_length;
+    k->period = key_length / gcd(key_length, SWAP_XOR_WIDTH) * SWAP_XOR_WIDTH;
+    k->pattern = malloc(k->period + SWAP_XOR_WIDTH);
+    CHECK_ERRNO(!k->pattern, "malloc");
+
+    for (size_t i = 0; i < k->period + SWAP_XOR_WIDTH; i++)
+    {
+        k->pattern[i] = key ? key[i % key_length] : 0;
+    }
+}
+
+void swap_xor_key_free(struct swap_xor_key *k)
+{
+    free(k->pattern);
+    k->pattern = NULL;
+}
+
+// the kernels do whole vectors, returning how many bytes that was, and leave
+// pos at the key for the first byte after them
+
+#if defined(SWAP_XOR_DISPATCH) || defined(__AVX2__)
+// reverse each nibble with a 16-entry shuffle, then swap the nibbles
+TARGET("avx2")
+static size_t swap_xor_avx2(uint8_t *out, const uint8_t *in, size_t size, const uint8_t *pattern, size_t period, size_t *pos)
+{
+    const __m256i lut = _mm256_setr_epi8(
+            0x0, 0x8, 0x4, 0xc, 0x2, 0xa, 0x6, 0xe, 0x1, 0x9, 0x5, 0xd, 0x3, 0xb, 0x7, 0xf,
+            0x0, 0x8, 0x4, 0xc, 0x2, 0xa, 0x6, 0xe, 0x1, 0x9, 0x5, 0xd, 0x3, 0xb, 0x7, 0xf);
+    const __m256i low = _mm256_set1_epi8(0x0f);
+    size_t p = *pos;
+    size_t i = 0;
+
+    for (; i + 32 <= size; i += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(in + i));
+        __m256i lo = _mm256_shuffle_epi8(lut, _mm256_and_si256(v, low));
+        __m256i hi = _mm256_shuffle_epi8(lut, _mm256_and_si256(_mm256_srli_epi16(v, 4), low));
+        v = _mm256_or_si256(_mm256_slli_epi16(lo, 4), hi);
+        v = _mm256_xor_si256(v, _mm256_loadu_si256((const __m256i *)(pattern + p)));
+        _mm256_storeu_si256((__m256i *)(out + i), v);
+
+        p += 32;
+        if (p >= period) p -= period;
+    }
+
+    *pos = p;
+    return i;
+}
+#endif
+
+#if defined(SWAP_XOR_DISPATCH) || defined(__SSSE3__)
+// the same 16 bytes at a time
+TARGET("ssse3")
+static size_t swap_xor_ssse3(uint8_t *out, const uint8_t *in, size_t size, const uint8_t *pattern, size_t period, size_t *pos)
+{
+    const __m128i lut = _mm_setr_epi8(
+            0x0, 0x8, 0x4, 0xc, 0x2, 0xa, 0x6, 0xe, 0x1, 0x9, 0x5, 0xd, 0x3, 0xb, 0x7, 0xf);
+    const __m128i low = _mm_set1_epi8(0x0f);
+    size_t p = *pos;
+    size_t i = 0;
+
+    for (; i + 16 <= size; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(in + i));
+        __m128i lo = _mm_shuffle_epi8(lut, _mm_and_si128(v, low));
+        __m128i hi = _mm_shuffle_epi8(lut, _mm_and_si128(_mm_srli_epi16(v, 4), low));
+        v = _mm_or_si128(_mm_slli_epi16(lo, 4), hi);
+        v = _mm_xor_si128(v, _mm_loadu_si128((const __m128i *)(pattern + p)));
+        _mm_storeu_si128((__m128i *)(out + i), v);
+
+        p += 16;
+        if (p >= period) p -= period;
+    }
+
+    *pos = p;
+    return i;
+}
+#endif
+
+#if defined(SWAP_XOR_DISPATCH) || defined(__SSE2__)
+// no byte shuffle, swap bits, pairs and nibbles with shifts and masks
+TARGET("sse2")
+static size_t swap_xor_sse2(uint8_t *out, const uint8_t *in, size_t size, const uint8_t *pattern, size_t period, size_t *pos)
+{
+    const __m128i m1 = _mm_set1_epi8(0x55);
+    const __m128i m2 = _mm_set1_epi8(0x33);
+    const __m128i m4 = _mm_set1_epi8(0x0f);
+    size_t p = *pos;
+    size_t i = 0;
+
+    for (; i + 16 <= size; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(in + i));
+        v = _mm_or_si128(_mm_and_si128(_mm_srli_epi16(v, 1), m1), _mm_slli_epi16(_mm_and_si128(v, m1), 1));
+        v = _mm_or_si128(_mm_and_si128(_mm_srli_epi16(v, 2), m2), _mm_slli_epi16(_mm_and_si128(v, m2), 2));
+        v = _mm_or_si128(_mm_and_si128(_mm_srli_epi16(v, 4), m4), _mm_slli_epi16(_mm_and_si128(v, m4), 4));
+        v = _mm_xor_si128(v, _mm_loadu_si128((const __m128i *)(pattern + p)));
+        _mm_storeu_si128((__m128i *)(out + i), v);
+
+        p += 16;
+        if (p >= period) p -= period;
+    }
+
+    *pos = p;
+    return i;
+}
+#endif
+
+void swap_xor(uint8_t *out, const uint8_t *in, size_t size, const struct swap_xor_key *k, size_t key_offset)
+{
+    const uint8_t *pattern = k->pattern;
+    const size_t period = k->period;
+    size_t pos = key_offset % k->length;
+    size_t i = 0;
+
+#if defined(SWAP_XOR_DISPATCH)
+    if (__builtin_cpu_supports("avx2"))
+    {
+        i = swap_xor_avx2(out, in, size, pattern, period, &pos);
+    }
+    else if (__builtin_cpu_supports("ssse3"))
+    {
+        i = swap_xor_ssse3(out, in, size, pattern, period, &pos);
+    }
+    else if (__builtin_cpu_supports("sse2"))
+    {
+        i = swap_xor_sse2(out, in, size, pattern, period, &pos);
+    }
+#elif defined(__AVX2__)
+    i = swap_xor_avx2(out, in, size, pattern, period, &pos);
+#elif defined(__SSSE3__)
+    i = swap_xor_ssse3(out, in, size, pattern, period, &pos);
+#elif defined(__SSE2__)
+    i = swap_xor_sse2(out, in, size, pattern, period, &pos);
+#endif
+
+    for (; i < size; i++)
+    {
+        out[i] = reverse_byte(in[i]) ^ pattern[pos];
+        if (++pos == period) pos = 0;
+    }
+}
@@ -1,3 +1,4 @@
+#define _POSIX_C_SOURCE 200809L
 #include <stdio.h>
 #include <stdlib.h>
 #include <inttypes.h>
@@ -9,6 +10,9 @@
 #include <io.h>
 #endif
 #include <sys/stat.h>
+#ifndef __MINGW32__
+#include <sys/mman.h>
+#endif
 
 #include "error_stuff.h"
 #include "util.h"
@@ -408,3 +412,76 @@ char * number_name(const char * name_head, const char * name_tail, unsigned int
 
     return name;
 }
+
+uint8_t *grow_buffer(struct growable_buffer *b, size_t size)
+{
+    if (size > b->capacity)
+    {
+        size_t capacity = b->capacity * 2;
+        if (capacity < size) capacity = size;
+
+        uint8_t *data = realloc(b->data, capacity);
+        CHECK_ERRNO(!data, "realloc");
+
+        b->data = data;
+        b->capacity = capacity;
+    }
+
+    return b->data;
+}
+
+void free_growable_buffer(struct growable_buffer *b)
+{
+    free(b->data);
+    b->data = NULL;
+    b->capacity = 0;
+}
+
+uint8_t *map_whole_file_into(FILE *infile, long *file_size_p, int *mapped_p, struct growable_buffer *b)
+{
+    // get input file size
+    long file_size = -1;
+    if (-1 == fseek(infile, 0, SEEK_END) ||
+        -1 == (file_size = ftell(infile)))
+    {
+        perror("sizing input");
+        return NULL;
+    }
+
+    *file_size_p = file_size;
+    *mapped_p = 0;
+
+#ifndef __MINGW32__
+    if (file_size > 0)
+    {
+        void *map = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fileno(infile), 0);
+        if (MAP_FAILED != map)
+        {
+            *mapped_p = 1;
+            return map;
+        }
+    }
+#endif
+
+    // can't map, read it in
+    uint8_t *indata = grow_buffer(b, file_size > 0 ? file_size : 1);
+    if (fseek(infile, 0, SEEK_SET) != 0 ||
+        fread(indata, 1, file_size, infile) != file_size)
+    {
+        fprintf(stderr, "reading input: %s\n",
+                feof(infile) ? "unexpected EOF" : strerror(errno));
+        return NULL;
+    }
+
+    return indata;
+}
+
+void unmap_whole_file(uint8_t *indata, long file_size, int mapped)
+{
+#ifndef __MINGW32__
+    if (mapped)
+    {
+        munmap(indata, file_size);
+    }
+#endif
+}
@@ -45,6 +45,24 @@ void get_bytes_seek(long offset, FILE *infile, unsigned char *buf, size_t byte_c
 
 uint8_t *get_whole_file(FILE *infile, long *file_size_p);
 
+// a buffer kept around to be reused, which only ever grows
+struct growable_buffer
+{
+    uint8_t *data;
+    size_t capacity;
+};
+
+// make room for at least size bytes, keeping what's there
+uint8_t *grow_buffer(struct growable_buffer *b, size_t size);
+void free_growable_buffer(struct growable_buffer *b);
+
+// map a whole file read-only (or read it into b, where mapping isn't
+// possible), the file can be closed afterwards; NULL if it can't be sized or
+// read
+uint8_t *map_whole_file_into(FILE *infile, long *file_size_p, int *mapped_p, struct growable_buffer *b);
+// undo a mapping, b keeps whatever was read into it
+void unmap_whole_file(uint8_t *indata, long file_size, int mapped);
+
 // self-checking file writes 
 void put_byte(uint8_t value, FILE *outfile);
 void put_byte_seek(uint8_t value, long offset, FILE *outfile);
@@ -0,0 +1,141 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "error_stuff.h"
+#include "util.h"
+#include "window.h"
+
+struct window_reader
+{
+    // either a file
+    FILE *infile;
+    char *path;
+
+    // or memory
+    const uint8_t *memory;
+
+    long size;
+    long window_size;
+
+    // what of the file is loaded
+    struct growable_buffer buffer;
+    long buffer_offset;
+    long buffer_used;
+};
+
+static struct window_reader *new_window_reader(void)
+{
+    struct window_reader *w = malloc(sizeof(struct window_reader));
+    CHECK_ERRNO(!w, "malloc");
+
+    memset(w, 0, sizeof(*w));
+
+    return w;
+}
+
+struct window_reader *init_window_reader(const char *path, long window_size)
+{
+    struct window_reader *w = new_window_reader();
+
+    w->path = malloc(strlen(path) + 1);
+    CHECK_ERRNO(!w->path, "malloc");
+    strcpy(w->path, path);
+
+    // in batch mode one bad file mustn't stop the rest, so leave it to
+    // the caller to give up on it
+    w->infile = fopen(path, "rb");
+    if (!w->infile ||
+        -1 == fseek(w->infile, 0, SEEK_END) ||
+        -1 == (w->size = ftell(w->infile)))
+    {
+        fprintf(stderr, "can't read %s: %s\n", path, strerror(errno));
+        free_window_reader(w);
+        return NULL;
+    }
+
+    w->window_size = window_size;
+
+    return w;
+}
+
+struct window_reader *init_window_reader_memory(const uint8_t *data, long size)
+{
+    struct window_reader *w = new_window_reader();
+
+    w->memory = data;
+    w->size = size;
+
+    return w;
+}
+
+struct window_reader *clone_window_reader(const struct window_reader *w, long window_size)
+{
+    if (w->memory)
+    {
+        return init_window_reader_memory(w->memory, w->size);
+    }
+
+    return init_window_reader(w->path, window_size);
+}
+
+void free_window_reader(struct window_reader *w)
+{
+    if (w->infile)
+    {
+        fclose(w->infile);
+    }
+    free(w->path);
+    free_growable_buffer(&w->buffer);
+    free(w);
+}
+
+long window_reader_size(const struct window_reader *w)
+{
+    return w->size;
+}
+
+const uint8_t *window_at(struct window_reader *w, long offset, long size)
+{
+    if (offset < 0 || size < 0 || offset > w->size || size > w->size - offset)
+    {
+        return NULL;
+    }
+
+    if (w->memory)
+    {
+        return w->memory + offset;
+    }
+
+    // already have it?
+    if (offset >= w->buffer_offset &&
+        offset + size <= w->buffer_offset + w->buffer_used)
+    {
+        return w->buffer.data + (offset - w->buffer_offset);
+    }
+
+    // load from here, with some lookahead
+    long load_size = (size > w->window_size) ? size : w->window_size;
+    if (load_size > w->size - offset)
+    {
+        load_size = w->size - offset;
+    }
+
+    uint8_t *data = grow_buffer(&w->buffer, load_size > 0 ? load_size : 1);
+
+    if (0 != fseek(w->infile, offset, SEEK_SET) ||
+        (size_t)load_size != fread(data, 1, load_size, w->infile))
+    {
+        // changed since it was opened, or worse
+        fprintf(stderr, "can't read %s: %s\n", w->path,
+                feof(w->infile) ? "unexpected EOF" : strerror(errno));
+        w->buffer_used = 0;
+        return NULL;
+    }
+
+    w->buffer_offset = offset;
+    w->buffer_used = load_size;
+
+    return data;
+}
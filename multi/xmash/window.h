@@ -0,0 +1,28 @@
+#ifndef _WINDOW_H_INCLUDED
+#define _WINDOW_H_INCLUDED
+
+#include <stdint.h>
+
+// read-only access to a file through a window, so only the part being
+// looked at needs to be in memory; or the same over memory already there
+
+enum {default_window_size = 0x10000};
+
+struct window_reader;
+
+// reads at least window_size bytes at a time (more if asked for more);
+// NULL (having said why) if the file can't be opened or sized
+struct window_reader *init_window_reader(const char *path, long window_size);
+struct window_reader *init_window_reader_memory(const uint8_t *data, long size);
+// another reader of the same thing, for use on another thread, NULL if
+// the file can't be opened again
+struct window_reader *clone_window_reader(const struct window_reader *w, long window_size);
+void free_window_reader(struct window_reader *w);
+
+long window_reader_size(const struct window_reader *w);
+
+// bytes [offset, offset+size), or NULL if that isn't all in the file (or
+// can't be read); only good until the next call
+const uint8_t *window_at(struct window_reader *w, long offset, long size);
+
+#endif /* _WINDOW_H_INCLUDED */
@@ -0,0 +1,67 @@
+#ifndef _WWBANK_H_INCLUDED
+#define _WWBANK_H_INCLUDED
+
+#include <stdint.h>
+
+// index of a Wwise soundbank: its chunks (BKHD, DIDX, DATA, ...) and the
+// embedded files DIDX lists, so files can be found by id and read without
+// walking the rest of the bank
+// sizes and ids are big endian, as on the 360
+
+// read size bytes at offset into buf, return 0 if they were all there
+typedef int wwbank_read_t(void *handle, long offset, uint8_t *buf, long size);
+
+struct wwbank_chunk
+{
+    uint32_t id;
+    long offset;        // of the contents, after the id and size
+    uint32_t size;
+};
+
+struct wwbank_file
+{
+    uint32_t id;
+    long offset;        // in the bank
+    uint32_t size;
+};
+
+struct wwbank_file_id
+{
+    uint32_t id;
+    int index;          // into files
+};
+
+struct wwbank_index
+{
+    struct wwbank_chunk *chunks;
+    int chunk_count;
+    long end;           // where the chunks stop, at padding or the end
+
+    struct wwbank_file *files;  // in DIDX order
+    int file_count;
+    struct wwbank_file_id *by_id;   // sorted by id, then index
+};
+
+// index the chunks from start up to bank_size (or a zero id, taken as
+// padding), and the files in DIDX if there is one
+// returns 0 on success, 1 if the chunks or the files don't fit
+int wwbank_index_init(struct wwbank_index *idx, wwbank_read_t *read, void *handle, long start, long bank_size);
+// just the chunks, leaving files empty, for when DIDX isn't needed
+// returns 0 on success, 1 if the chunks don't fit
+int wwbank_index_chunks(struct wwbank_index *idx, wwbank_read_t *read, void *handle, long start, long bank_size);
+void wwbank_index_free(struct wwbank_index *idx);
+
+// the first chunk with this id, or NULL
+const struct wwbank_chunk *wwbank_find_chunk(const struct wwbank_index *idx, uint32_t id);
+// the index in files of the file with this id, or -1
+int wwbank_find_file(const struct wwbank_index *idx, uint32_t id);
+
+enum {
+    WWBANK_BKHD = UINT32_C(0x424B4844),
+    WWBANK_DIDX = UINT32_C(0x44494458),
+    WWBANK_DATA = UINT32_C(0x44415441),
+    WWBANK_HIRC = UINT32_C(0x48495243),
+    WWBANK_STID = UINT32_C(0x53544944),
+};
+
+#endif /* _WWBANK_H_INCLUDED */
@@ -5,6 +5,7 @@
 #include "util.h"
 #include "error_stuff.h"
 #include "bitstream.h"
+#include "window.h"
 
 // rebuild XMA2 streams as XMA
 // based on xma_parse 0.12
@@ -31,10 +32,28 @@ struct xma2_packet_header
     unsigned packet_skip    : 8;
 };
 
+enum {max_frames_per_packet = 64};  // frame_count is 6 bits
+
+// where a frame starting in a packet is, in bits counted from the start of
+// the packet's payload (skipping other packets' data like the reader does)
+struct frame_span
+{
+    unsigned long offset;
+    unsigned int bits;
+};
+
+// the payload bits of a packet and any it overflows into
+struct packet_source
+{
+    const uint8_t *pool;
+    size_t consecutive_bits;
+    size_t skip_bits;
+};
+
 static void write_XMA_packet_header(struct bitstream_writer *obs, const struct xma_packet_header *h);
 static long build_XMA_from_XMA2_block(const uint8_t *indata, struct bitstream_writer *obs, long offset, long block_size, struct xma_build_context *ctx, bool stereo, bool strict, bool last, bool verbose);
-static long parse_frames(struct bitstream_reader *ibs, unsigned int frame_count, bool known_frame_count, unsigned int * total_bits_p, unsigned int max_bits, bool stereo, bool strict, bool verbose);
-static int packetize(struct bitstream_reader *ibs, struct bitstream_writer *obs, struct xma_build_context * ctx, unsigned int frame_count, bool strict, bool last);
+static long parse_frames(struct bitstream_reader *ibs, unsigned int frame_count, bool known_frame_count, unsigned int * total_bits_p, unsigned int max_bits, struct frame_span *spans, unsigned long first_offset, bool stereo, bool strict, bool verbose);
+static void packetize(const struct packet_source *src, const struct frame_span *spans, struct bitstream_writer *obs, struct xma_build_context * ctx, unsigned int frame_count, bool last);
 
 uint8_t *make_xma_header(uint32_t srate, uint32_t size, int channels)
 {
@@ -76,13 +95,18 @@ uint8_t *make_xma_header(uint32_t srate, uint32_t size, int channels)
     return h;
 }
 
-int build_XMA_from_XMA2(const uint8_t *indata, long data_size, FILE *outfile, long block_size, int channels, long *samples_p)
+int build_XMA_from_XMA2(struct window_reader *in, long data_offset, long data_size, FILE *outfile, long block_size, int channels, long *samples_p)
 {
     long total_sample_count = 0;
 
     struct xma_build_context ctx;
     struct bitstream_writer *obs;
 
+    if (block_size <= 0)
+    {
+        return 1;
+    }
+
     // initialize
     obs = init_bitstream_writer(outfile);
     {
@@ -110,11 +134,20 @@ int build_XMA_from_XMA2(const uint8_t *indata, long data_size, FILE *outfile, lo
             usable_block_size = data_size - block_offset;
         }
 
-        sample_count = build_XMA_from_XMA2_block(indata, obs, block_offset, usable_block_size, &ctx, (channels > 1),
+        // only a block needs to be in memory at once
+        const uint8_t *block = window_at(in, data_offset + block_offset, usable_block_size);
+        if (!block)
+        {
+            free_bitstream_writer(obs);
+            return 1;
+        }
+
+        sample_count = build_XMA_from_XMA2_block(block, obs, 0, usable_block_size, &ctx, (channels > 1),
             strict, (block_offset + block_size >= data_size), verbose);
 
         if (-1 == sample_count)
         {
+            free_bitstream_writer(obs);
             return 1;
         }
 
@@ -127,8 +160,13 @@ int build_XMA_from_XMA2(const uint8_t *indata, long data_size, FILE *outfile, lo
 
     // finish
     // pad with ones
-    for (; ctx.bits_written < packet_size_bytes * 8; ctx.bits_written ++) {
-        put_bit(obs, 1);
+    for (; ctx.bits_written + 32 <= packet_size_bytes * 8; ctx.bits_written += 32) {
+        put_bits(obs, 0xffffffff, 32);
+    }
+    // a frame too big for the packet can leave us past the end already
+    if (ctx.bits_written < packet_size_bytes * 8) {
+        put_bits(obs, 0xffffffff, packet_size_bytes * 8 - ctx.bits_written);
+        ctx.bits_written = packet_size_bytes * 8;
     }
     flush_bitstream_writer(obs);
     free_bitstream_writer(obs);
@@ -149,12 +187,14 @@ static void write_XMA_packet_header(struct bitstream_writer *obs, const struct x
     put_bits(obs, h->packet_skip, 11);
 }
 
-static void read_XMA2_packet_header(struct bitstream_reader *ibs, struct xma2_packet_header *h)
+static void read_XMA2_packet_header(const uint8_t *bytes, struct xma2_packet_header *h)
 {
-    h->frame_count = get_bits(ibs, 6);
-    h->skip_bits = get_bits(ibs, 15);
-    h->metadata = get_bits(ibs, 3);
-    h->packet_skip = get_bits(ibs, 8);
+    uint32_t v = read_32_be(bytes);
+
+    h->frame_count = v >> 26;
+    h->skip_bits = (v >> 11) & 0x7fff;
+    h->metadata = (v >> 8) & 7;
+    h->packet_skip = v & 0xff;
 }
 
 static long build_XMA_from_XMA2_block(const uint8_t *indata, struct bitstream_writer *obs, long offset, long block_size, struct xma_build_context *ctx, bool stereo, bool strict, bool last, bool verbose)
@@ -165,12 +205,13 @@ static long build_XMA_from_XMA2_block(const uint8_t *indata, struct bitstream_wr
 
     for (unsigned packet_number = 0; offset < last_offset; packet_number++) {
         struct xma2_packet_header ph;
+        struct frame_span spans[max_frames_per_packet];
 
+        if (last_offset - offset < packet_header_size_bytes)
         {
-            struct bitstream_reader *ibs = init_bitstream_reader(indata+offset, packet_header_size_bytes, 0, 0);
-            read_XMA2_packet_header(ibs, &ph);
-            free_bitstream_reader(ibs);
+            return -1;
         }
+        read_XMA2_packet_header(indata+offset, &ph);
 
         if (verbose) {
             printf("Packet #%u (offset 0x%lx)\n", packet_number, (unsigned long)offset);
@@ -212,7 +253,7 @@ static long build_XMA_from_XMA2_block(const uint8_t *indata, struct bitstream_wr
             long packet_sample_count;
 
             // skip initial bits (overflow from a previous packet)
-            for (unsigned int i = 0; i < ph.skip_bits; i++) get_bit(ibs);
+            skip_bits(ibs, ph.skip_bits);
 
             if (ph.skip_bits != last_packet_overflow_bits) {
                 //throw Skip_mismatch(ph.skip_bits,last_packet_overflow_bits);
@@ -220,8 +261,10 @@ static long build_XMA_from_XMA2_block(const uint8_t *indata, struct bitstream_wr
                 return -1;
             }
 
-            packet_sample_count = parse_frames(ibs, ph.frame_count, true, &total_bits, (packet_size_bytes - packet_header_size_bytes)*8 - ph.skip_bits, stereo, strict, verbose);
-            if (-1 == packet_sample_count)
+            packet_sample_count = parse_frames(ibs, ph.frame_count, true, &total_bits, (packet_size_bytes - packet_header_size_bytes)*8 - ph.skip_bits, spans, ph.skip_bits, stereo, strict, verbose);
+            // frames running off the end of the block are as bad as
+            // any other parse error
+            if (-1 == packet_sample_count || bitstream_underflow(ibs))
             {
                 free_bitstream_reader(ibs);
                 return -1;
@@ -238,33 +281,17 @@ static long build_XMA_from_XMA2_block(const uint8_t *indata, struct bitstream_wr
 
         free_bitstream_reader(ibs);
 
-        // We've successfully examined this packet, dump it out
-        {
-            struct bitstream_reader *dump_ibs = init_bitstream_reader(
-                // where's the data
+        // We've successfully examined this packet, dump out the frames
+        // found starting in it
+        if (ph.skip_bits != 0x7fff) {
+            const struct packet_source src = {
                 indata + offset + packet_header_size_bytes,
-                // should never reach past end of block
-                last_offset - (offset + packet_header_size_bytes),
-                // consecutive
                 (packet_size_bytes - packet_header_size_bytes) * 8,
-                // skip
                 (packet_header_size_bytes + ph.packet_skip * packet_size_bytes) * 8
-            );
+            };
 
-            // Do packet if not skipping
-            if (ph.skip_bits != 0x7fff) {
-                // skip initial bits (overflow from a previous packet)
-                for (unsigned int i = 0; i < ph.skip_bits; i++) get_bit(dump_ibs);
-
-                if (0 != packetize(dump_ibs, obs, ctx, ph.frame_count, strict,
-                        last && ((unsigned long)offset + (ph.packet_skip + 1) * packet_size_bytes >= (unsigned long)last_offset) ))
-                {
-                    free_bitstream_reader(dump_ibs);
-                    return -1;
-                }
-            }
-
-            free_bitstream_reader(dump_ibs);
+            packetize(&src, spans, obs, ctx, ph.frame_count,
+                    last && ((unsigned long)offset + (ph.packet_skip + 1) * packet_size_bytes >= (unsigned long)last_offset) );
         }
 
         // advance to next packet
@@ -274,7 +301,8 @@ static long build_XMA_from_XMA2_block(const uint8_t *indata, struct bitstream_wr
     return sample_count;
 }
 
-static long parse_frames(struct bitstream_reader *ibs, unsigned int frame_count, bool known_frame_count, unsigned int * total_bits_p, unsigned int max_bits, bool stereo, bool strict, bool verbose) {
+// spans gets where each frame is, if the frame count is known
+static long parse_frames(struct bitstream_reader *ibs, unsigned int frame_count, bool known_frame_count, unsigned int * total_bits_p, unsigned int max_bits, struct frame_span *spans, unsigned long first_offset, bool stereo, bool strict, bool verbose) {
     bool packet_end_seen = false;
     unsigned int sample_count = 0;
     unsigned int total_bits = 0;
@@ -290,6 +318,11 @@ static long parse_frames(struct bitstream_reader *ibs, unsigned int frame_count,
     {
 
         unsigned int frame_bits = get_bits(ibs, frame_header_size_bits);
+
+        if (known_frame_count) {
+            spans[frame_number].offset = first_offset + total_bits;
+            spans[frame_number].bits = frame_bits;
+        }
         total_bits += frame_bits;
 
         unsigned int bits_left = frame_bits - frame_header_size_bits;
@@ -349,20 +382,20 @@ static long parse_frames(struct bitstream_reader *ibs, unsigned int frame_count,
         bits_left --;
 #endif
 
-        for (; bits_left >= 4 + frame_trailer_size_bits; bits_left -= 4) {
-            unsigned int nybble = get_bits(ibs, 4);
-            if (verbose) {
+        if (verbose) {
+            for (; bits_left >= 4 + frame_trailer_size_bits; bits_left -= 4) {
+                unsigned int nybble = get_bits(ibs, 4);
                 printf("%1x\n", nybble);
             }
-        }
-        if (verbose) {
             printf(" ");
-        }
-        for (; bits_left > frame_trailer_size_bits; bits_left--) {
-            unsigned int bit = get_bit(ibs);
-            if (verbose) {
+            for (; bits_left > frame_trailer_size_bits; bits_left--) {
+                unsigned int bit = get_bit(ibs);
                 printf("%c", (bit ? '1' : '0'));
             }
+        } else if (bits_left > frame_trailer_size_bits) {
+            // payload isn't looked at, jump over it
+            skip_bits(ibs, bits_left - frame_trailer_size_bits);
+            bits_left = frame_trailer_size_bits;
         }
 
         // trailer
@@ -413,20 +446,33 @@ static long parse_frames(struct bitstream_reader *ibs, unsigned int frame_count,
     return sample_count;
 }
 
-static int packetize(struct bitstream_reader *ibs, struct bitstream_writer *obs, struct xma_build_context * ctx, unsigned int frame_count, bool strict, bool last) {
-    bool packet_end_seen = false;
-    unsigned int bits_written = ctx->bits_written;
-    unsigned int seqno = ctx->seqno;
+// copy bits of a packet's payload as laid out in the source
+static void copy_span(struct bitstream_writer *obs, const struct packet_source *src, unsigned long offset, unsigned long bits)
+{
+    while (bits > 0) {
+        unsigned long in_packet = src->consecutive_bits - offset % src->consecutive_bits;
+        unsigned long bits_this_time = (bits < in_packet) ? bits : in_packet;
 
-    if (frame_count == 0) {
-        //throw Zero_frames_not_skipped();
-        return -1;
+        put_bits_from(obs, src->pool,
+                offset + offset / src->consecutive_bits * src->skip_bits,
+                bits_this_time);
+
+        offset += bits_this_time;
+        bits -= bits_this_time;
     }
+}
+
+// write frames already checked by parse_frames, so nothing here can fail
+static void packetize(const struct packet_source *src, const struct frame_span *spans, struct bitstream_writer *obs, struct xma_build_context * ctx, unsigned int frame_count, bool last) {
+    unsigned int bits_written = ctx->bits_written;
+    unsigned int seqno = ctx->seqno;
 
     for (unsigned int frame_number = 0;
          frame_number < frame_count;
          frame_number++) {
-        unsigned int frame_bits = get_bits(ibs, frame_header_size_bits);
+        unsigned int frame_bits = spans[frame_number].bits;
+        // payload, without the frame header or the trailer bit
+        unsigned long payload_offset = spans[frame_number].offset + frame_header_size_bits;
 
         if (bits_written + frame_bits >= packet_size_bytes * 8) {
             unsigned int bits_this_packet = (packet_size_bytes * 8) - bits_written;
@@ -449,16 +495,13 @@ static int packetize(struct bitstream_reader *ibs, struct bitstream_writer *obs,
                 // frame fits packet exactly
 
                 // payload bits before packet end
-                for (unsigned int i = 0; i < bits_this_packet-1; i++) {
-                    put_bit(obs, get_bit(ibs));
-                }
+                copy_span(obs, src, payload_offset, bits_this_packet-1);
                 // trailer bit, no more frames in packet
                 put_bit(obs, 0);
             } else {
                 // payload bits 
-                for (unsigned int i = 0; i < bits_this_packet; i++) {
-                    put_bit(obs, get_bit(ibs));
-                }
+                copy_span(obs, src, payload_offset, bits_this_packet);
+                payload_offset += bits_this_packet;
             }
 
             write_XMA_packet_header(obs, &ph);
@@ -472,9 +515,7 @@ static int packetize(struct bitstream_reader *ibs, struct bitstream_writer *obs,
                 }
 
                 // payload bits in new packet
-                for (unsigned int i = 0; i < overflow_bits - 1; i++) {
-                    put_bit(obs, get_bit(ibs));
-                }
+                copy_span(obs, src, payload_offset, overflow_bits - 1);
                 bits_written += overflow_bits - 1;
 
                 // trailer bit, no more frames in packet
@@ -483,9 +524,7 @@ static int packetize(struct bitstream_reader *ibs, struct bitstream_writer *obs,
             }
         } else {
             put_bits(obs, frame_bits, frame_header_size_bits);
-            for (unsigned int i = 0; i < frame_bits - frame_header_size_bits - 1; i++) {
-                put_bit(obs, get_bit(ibs));
-            }
+            copy_span(obs, src, payload_offset, frame_bits - frame_header_size_bits - 1);
 
             // trailer bit
             if (last && frame_number == frame_count-1) {
@@ -498,29 +537,8 @@ static int packetize(struct bitstream_reader *ibs, struct bitstream_writer *obs,
 
             bits_written += frame_bits;
         }
-
-        // trailer
-        {
-            if (!get_bit(ibs))
-            {
-                if (strict && frame_number != frame_count-1)
-                {
-                    //throw Early_packet_end();
-                    return -1;
-                }
-                packet_end_seen = true;
-            }
-        }
-    }
-
-    if (strict && !packet_end_seen)
-    {
-        //throw Missing_packet_end();
-        return -1;
     }
 
     ctx->seqno = seqno;
     ctx->bits_written = bits_written;
-
-    return 0;
 }
@@ -17,7 +17,9 @@ enum {
 
 uint8_t *make_xma_header(uint32_t srate, uint32_t size, int channels);
 
+// rebuild the stream at data_offset in the reader, a block at a time
 // return 0 on success, 1 if a parse error was encountered
-int build_XMA_from_XMA2(const uint8_t *indata, long data_size, FILE *outfile, long block_size, int channels, long *samples_p);
+struct window_reader;
+int build_XMA_from_XMA2(struct window_reader *in, long data_offset, long data_size, FILE *outfile, long block_size, int channels, long *samples_p);
 
 #endif // _XMA_REBUILD_H
@@ -1,98 +1,325 @@
+#define _POSIX_C_SOURCE 200809L
 #include <stdio.h>
 #include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <sys/stat.h>
 #include "util.h"
 #include "bitstream.h"
 #include "guessfsb.h"
 #include "fsbext.h"
 #include "riffext.h"
 #include "bnkext.h"
+#include "probe.h"
 #include "xma_rebuild.h"
+#include "window.h"
 
 // XMAsh - decrypt, demux, and rebuild FSB XMA2
 // also minimal RIFF and WWise bnk support
 // cobbled together from:
 // romchu, guessfsb, decfsb, fsb_mpeg, xma_parse, vgmstream
 
-#define VERSION "0.8"
+#define VERSION "0.9"
 #define BIN_NAME "xmash"
 
-const char *dir_name;
+#define SUMMARY_NAME "xmash_summary.tsv"
 
+// everything needed to process a file, kept by a thread from file to file
 struct main_info {
+    const char *path;
     const char *file_name;
+    const char *dir_name;       // where output goes, NULL for here
+    const char *sub_dir;        // under dir_name, NULL for none
+    long stream_threads;
+    const uint32_t *ids;        // only these files from a bank, if any
+    int id_count;
+
+    // buffers reused from file to file, only for encrypted FSBs as the
+    // key search needs the whole file
+    struct growable_buffer indata;      // if it can't be mapped
+    struct growable_buffer decrypted;
+
+    // what was found in the current file
+    const char *format;
+    int subfiles;
+    int streams;
+    long samples;
+    uint8_t *key;
+    int key_length;
 };
 
-int try_key_callback(const uint8_t * d, long size, void *v);
-int subfile_callback(const uint8_t * infile, long size, int streams, int *stream_channels, long samples, long srate, long block_size, long loop_start, long loop_end, const char *stream_name, void *v);
+int try_key_callback(const uint8_t * d, long size, const uint8_t *key, int key_length, void *v);
+int subfile_callback(struct window_reader *in, long offset, long size, int streams, int *stream_channels, long samples, long srate, long block_size, long loop_start, long loop_end, const char *stream_name, void *v);
+
+static int process_file(const char *infile_name, struct main_info *mi);
+static int process_tree(const char *root, const char *dir_name, long jobs);
+static int probe_only(const char *infile_name);
+static int probe_tree(const char *root);
+static void free_main_info(struct main_info *mi);
 
 void usage(void);
 
 int main(int argc, char **argv)
 {
-    long file_size;
-    uint8_t *indata;
+    const char *infile_name = NULL;
+    const char *dir_name = NULL;
+    const char *tree_name = NULL;
+    long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    uint32_t *ids = NULL;
+    int id_count = 0;
+    int probe = 0;
 
-    int success = 0;
-
-    struct main_info mi;
+    if (jobs < 1) jobs = 1;
 
-    if (argc != 2 && (argc != 4 || (argc == 4 && strcmp(argv[2], "-o"))))
+    for (int i = 1; i < argc; i++)
     {
-        usage();
+        if (!strcmp(argv[i], "-o") && i+1 < argc)
+        {
+            dir_name = argv[++i];
+        }
+        else if (!strcmp(argv[i], "-r") && i+1 < argc)
+        {
+            tree_name = argv[++i];
+        }
+        else if (!strcmp(argv[i], "-j") && i+1 < argc)
+        {
+            jobs = read_long(argv[++i]);
+            CHECK_ERROR(jobs < 1 || jobs > 1024, "invalid thread count");
+        }
+        else if (!strcmp(argv[i], "--probe"))
+        {
+            probe = 1;
+        }
+        else if (!strcmp(argv[i], "-i") && i+1 < argc)
+        {
+            long id = read_long(argv[++i]);
+            CHECK_ERROR(id < 0 || id > UINT32_MAX, "invalid file id");
+
+            ids = realloc(ids, (id_count + 1) * sizeof(uint32_t));
+            CHECK_ERRNO(!ids, "realloc");
+            ids[id_count++] = id;
+        }
+        else if (argv[i][0] != '-' && !infile_name)
+        {
+            infile_name = argv[i];
+        }
+        else
+        {
+            usage();
+        }
     }
 
-    char * infile_name = argv[1];
+    if (probe)
+    {
+        if (!!tree_name == !!infile_name)
+        {
+            usage();
+        }
 
-    if (argc == 4)
+        return tree_name ? probe_tree(tree_name) : probe_only(infile_name);
+    }
+
+    if (tree_name)
     {
-        dir_name = argv[3];
+        if (infile_name || !dir_name || id_count)
+        {
+            usage();
+        }
+
+        return process_tree(tree_name, dir_name, jobs);
     }
-    else
+
+    if (!infile_name)
     {
-        dir_name = NULL;
+        usage();
     }
 
-    mi.file_name = strip_path(infile_name);
+    struct main_info mi = {
+        .file_name = strip_path(infile_name),
+        .dir_name = dir_name,
+        .stream_threads = jobs,
+        .ids = ids,
+        .id_count = id_count
+    };
+
+    int result = process_file(infile_name, &mi);
+
+    free_main_info(&mi);
+    free(ids);
+
+    return result;
+}
+
+void usage()
+{
+    fprintf(stderr, "XMAsh " VERSION " - decrypt, demux, and rebuild FSB, Wwise .bnk, RIFF XMA2\n");
+    fprintf(stderr, "usage:\n"
+                    "  " BIN_NAME " input.fsb.xen [-o dir] [-j threads]\n"
+                    "  " BIN_NAME " input.fsb [-o dir] [-j threads]\n"
+                    "  " BIN_NAME " input.xma [-o dir] [-j threads]\n"
+                    "  " BIN_NAME " input.bnk [-o dir] [-j threads] [-i id]...\n"
+                    "  " BIN_NAME " -r input_dir -o dir [-j threads]\n"
+                    "  " BIN_NAME " --probe input | -r input_dir\n"
+                    "\n"
+                    "-r processes every file under input_dir, with the output\n"
+                    "   in the same layout under dir, and writes a summary to\n"
+                    "   dir" "/" SUMMARY_NAME "\n"
+                    "-j threads to use (default: one per CPU), for the streams\n"
+                    "   of a file, or with -r for whole files\n"
+                    "-i only extract the file with this id from a .bnk, can be\n"
+                    "   repeated\n"
+                    "--probe prints the format each file looks like (and how\n"
+                    "   sure, out of 100) without extracting anything\n");
+    exit(EXIT_FAILURE);
+}
+
+static void free_main_info(struct main_info *mi)
+{
+    free_growable_buffer(&mi->indata);
+    free_growable_buffer(&mi->decrypted);
+    free(mi->key);
+}
+
+// forget what an unsuccessful try found
+static void start_try(struct main_info *mi, const char *format)
+{
+    mi->format = format;
+    mi->subfiles = 0;
+    mi->streams = 0;
+    mi->samples = 0;
+    mi->key_length = 0;
+}
+
+static int try_fsb_keys(struct window_reader *in, subfile_callback_t *cb, void *v)
+{
+    struct main_info *mi = v;
+
+    long file_size;
+    uint8_t *indata;
+    int mapped;
 
     {
         FILE *infile;
-        infile = fopen(infile_name, "rb");
-        CHECK_ERRNO(!infile, "open input failed");
-        indata = get_whole_file(infile, &file_size);
+        infile = fopen(mi->path, "rb");
+        if (!infile)
+        {
+            fprintf(stderr, "can't read %s: %s\n", mi->path, strerror(errno));
+            return 1;
+        }
+        indata = map_whole_file_into(infile, &file_size, &mapped, &mi->indata);
         fclose(infile);
+        if (!indata)
+        {
+            return 1;
+        }
     }
 
-    printf("%s\n\n", infile_name);
+    int result = guess_fsb_keys(indata, file_size, &mi->decrypted, try_key_callback, mi);
 
-    // try without decrypting
-    if (0 == try_multistream_fsb(indata, file_size, subfile_callback, &mi))
+    if (mapped)
     {
-        printf("success without decryption!\n");
-        success = 1;
+        unmap_whole_file(indata, file_size, mapped);
     }
-    // try RIFF
-    else if (0 == try_xma_riff(indata, file_size, subfile_callback, &mi))
+
+    return result;
+}
+
+static int try_bnk(struct window_reader *in, subfile_callback_t *cb, void *v)
+{
+    struct main_info *mi = v;
+
+    return try_wwbnk(in, mi->ids, mi->id_count, cb, v);
+}
+
+// how each format probe_file scores is extracted
+static const struct {
+    int (*try)(struct window_reader *, subfile_callback_t *, void *);
+    const char *format;
+    const char *success_message;
+} tries[PROBE_FORMATS] = {
+    [PROBE_FSB] = {try_multistream_fsb, "FSB", "success without decryption!"},
+    [PROBE_RIFF] = {try_xma_riff, "RIFF", "success with RIFF!"},
+    [PROBE_RIFX] = {try_wwriff, "RIFX", "success with WWise RIFX"},
+    [PROBE_BNK] = {try_bnk, "BNK", "success with WWise"},
+    // via guessfsb
+    [PROBE_FSB_ENCRYPTED] = {try_fsb_keys, "FSB encrypted", "success!"},
+};
+
+// the best scoring format not yet tried, other than encrypted FSB,
+// or -1 if none scored
+static int next_format(const int score[PROBE_FORMATS], const int tried[PROBE_FORMATS])
+{
+    int best = -1;
+
+    for (int i = 0; i < PROBE_FORMATS; i++)
     {
-        printf("success with RIFF!\n");
-        success = 1;
+        if (i == PROBE_FSB_ENCRYPTED || tried[i] || score[i] <= 0) continue;
+
+        if (best < 0 || score[i] > score[best])
+        {
+            best = i;
+        }
     }
-    else if (0 == try_wwbnk(indata, file_size, subfile_callback, &mi))
+
+    return best;
+}
+
+// returns 0 on success, 1 otherwise
+static int process_file(const char *infile_name, struct main_info *mi)
+{
+    int success = 0;
+
+    printf("%s\n\n", infile_name);
+
+    struct window_reader *in = init_window_reader(infile_name, default_window_size);
+    mi->path = infile_name;
+
+    if (!in)
     {
-        printf("success with WWise\n");
-        success = 1;
+        printf("failure.\n");
+        start_try(mi, NULL);
+        return 1;
     }
-    // try via guessfsb
-    else if (0 == guess_fsb_keys(indata, file_size, try_key_callback, &mi))
+
+    int score[PROBE_FORMATS];
+    int tried[PROBE_FORMATS] = {0};
+    int matched = 0;
+
+    probe_file(in, score);
+
+    // only what the probe matched, best first; guessing keys is slow, so
+    // that's only when nothing matched
+    for (;;)
     {
-        printf("success!\n");
-        success = 1;
+        int i = next_format(score, tried);
+        if (i < 0)
+        {
+            if (matched || tried[PROBE_FSB_ENCRYPTED]) break;
+            i = PROBE_FSB_ENCRYPTED;
+        }
+
+        tried[i] = 1;
+        matched = 1;
+        start_try(mi, tries[i].format);
+
+        if (0 == tries[i].try(in, subfile_callback, mi))
+        {
+            printf("%s\n", tries[i].success_message);
+            success = 1;
+            break;
+        }
     }
-    else
+
+    if (!success)
     {
         printf("failure.\n");
+        start_try(mi, NULL);
     }
 
-    free(indata);
+    free_window_reader(in);
 
     if (success)
     {
@@ -104,27 +331,191 @@ int main(int argc, char **argv)
     }
 }
 
-void usage()
+// print what a file looks like, without extracting anything
+static int probe_only(const char *infile_name)
 {
-    fprintf(stderr, "XMAsh " VERSION " - decrypt, demux, and rebuild FSB, Wwise .bnk, RIFF XMA2\n");
-    fprintf(stderr, "usage:\n"
-                    "  " BIN_NAME " input.fsb.xen [-o dir]\n"
-                    "  " BIN_NAME " input.fsb [-o dir]\n"
-                    "  " BIN_NAME " input.xma [-o dir]\n"
-                    "  " BIN_NAME " input.bnk [-o dir]\n");
-    exit(EXIT_FAILURE);
+    int score[PROBE_FORMATS];
+    int tried[PROBE_FORMATS] = {0};
+
+    struct window_reader *in = init_window_reader(infile_name, default_window_size);
+    if (!in)
+    {
+        return 1;
+    }
+    probe_file(in, score);
+    free_window_reader(in);
+
+    int i = next_format(score, tried);
+    if (i < 0 && score[PROBE_FSB_ENCRYPTED] > 0)
+    {
+        i = PROBE_FSB_ENCRYPTED;
+    }
+
+    printf("%s\t%s\t%d\n", infile_name, (i < 0) ? "unknown" : tries[i].format, (i < 0) ? 0 : score[i]);
+
+    return (i < 0) ? 1 : 0;
 }
 
 // called for each possibly valid key
-int try_key_callback(const uint8_t * indata, long size, void *v)
+int try_key_callback(const uint8_t * indata, long size, const uint8_t *key, int key_length, void *v)
 {
-    return try_multistream_fsb(indata, size, subfile_callback, v);
+    struct main_info *mi = v;
+
+    start_try(mi, mi->format);
+
+    uint8_t *key_copy = realloc(mi->key, key_length);
+    CHECK_ERRNO(!key_copy, "realloc");
+    memcpy(key_copy, key, key_length);
+    mi->key = key_copy;
+    mi->key_length = key_length;
+
+    struct window_reader *in = init_window_reader_memory(indata, size);
+    int result = try_multistream_fsb(in, subfile_callback, v);
+    free_window_reader(in);
+
+    return result;
+}
+
+// one interleaved stream of a subfile, rebuilt straight into its file
+struct stream_job
+{
+    struct window_reader *in;
+    long offset;
+    long size;
+    int channels;
+
+    char *name;
+    FILE *outfile;
+
+    int result;
+    long parsed_samples;
+};
+
+struct stream_pool
+{
+    struct stream_job *job;
+    int count;
+    long block_size;
+
+    pthread_mutex_t lock;
+    int next;
+};
+
+static void *stream_worker(void *v)
+{
+    struct stream_pool *sp = v;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&sp->lock);
+        int i = sp->next++;
+        pthread_mutex_unlock(&sp->lock);
+
+        if (i >= sp->count) break;
+
+        struct stream_job *j = &sp->job[i];
+        j->result = build_XMA_from_XMA2(j->in, j->offset, j->size,
+            j->outfile, sp->block_size, j->channels,
+            &j->parsed_samples);
+    }
+
+    return NULL;
+}
+
+// rebuild all the streams, at most one thread each
+static void rebuild_streams(struct stream_job *job, int count, long block_size, long jobs)
+{
+    struct stream_pool sp = {job, count, block_size};
+    long threads = (jobs < count) ? jobs : count;
+
+    pthread_mutex_init(&sp.lock, NULL);
+    sp.next = 0;
+
+    if (threads <= 1)
+    {
+        stream_worker(&sp);
+    }
+    else
+    {
+        pthread_t *thread = malloc(threads * sizeof(pthread_t));
+        CHECK_ERRNO(!thread, "malloc");
+
+        for (long i = 0; i < threads; i++)
+        {
+            errno = pthread_create(&thread[i], NULL, stream_worker, &sp);
+            CHECK_ERRNO(0 != errno, "pthread_create");
+        }
+        for (long i = 0; i < threads; i++)
+        {
+            pthread_join(thread[i], NULL);
+        }
+
+        free(thread);
+    }
+
+    pthread_mutex_destroy(&sp.lock);
+}
+
+// the full name of an output file, for removing it
+static char *output_path(const struct main_info *mip, const char *name)
+{
+    const char *dir = mip->dir_name ? mip->dir_name : ".";
+    const char *sub_dir = mip->sub_dir ? mip->sub_dir : "";
+
+    char *path = malloc(strlen(dir) + 1 + strlen(sub_dir) + 1 + strlen(name) + 1);
+    CHECK_ERRNO(!path, "malloc");
+
+    if (mip->sub_dir)
+    {
+        sprintf(path, "%s%c%s%c%s", dir, DIRSEP, sub_dir, DIRSEP, name);
+    }
+    else
+    {
+        sprintf(path, "%s%c%s", dir, DIRSEP, name);
+    }
+
+    return path;
+}
+
+static FILE *open_output(const struct main_info *mip, const char *name)
+{
+    if (mip->dir_name)
+    {
+        return open_file_in_directory(mip->dir_name, mip->sub_dir, DIRSEP, name, "wb");
+    }
+    else
+    {
+        return fopen(name, "wb");
+    }
+}
+
+// give up on streams from first on, their files are left out
+static void abandon_streams(const struct main_info *mip, struct stream_job *job, int first, int count)
+{
+    for (int str = first; str < count; str ++)
+    {
+        fclose(job[str].outfile);
+
+        char *path = output_path(mip, job[str].name);
+        remove(path);
+        free(path);
+    }
+}
+
+static void free_stream_jobs(struct stream_job *job, int count)
+{
+    for (int str = 0; str < count; str ++)
+    {
+        free_window_reader(job[str].in);
+        free(job[str].name);
+    }
+    free(job);
 }
 
 // called for each subfile in an FSB (or a RIFF body)
-int subfile_callback(const uint8_t * infile, long size, int streams, int * stream_channels, long samples, long srate, long block_size, long loop_start, long loop_end, const char *stream_name, void *v)
+int subfile_callback(struct window_reader *in, long offset, long size, int streams, int * stream_channels, long samples, long srate, long block_size, long loop_start, long loop_end, const char *stream_name, void *v)
 {
-    const struct main_info *mip = v;
+    struct main_info *mip = v;
 
     // build the name
     int name_base_len = strlen(mip->file_name) + 1 + strlen(stream_name);
@@ -140,81 +531,98 @@ int subfile_callback(const uint8_t * infile, long size, int streams, int * strea
         printf("dumping %s\n", strname);
 
         // just dump
-        if (dir_name)
-        {
-            outfile = open_file_in_directory(dir_name, NULL, DIRSEP, strname, "wb");
-        }
-        else
+        outfile = open_output(mip, strname);
+        CHECK_ERRNO(!outfile, "fopen output");
+        for (long done = 0; done < size; )
         {
-            outfile = fopen(strname, "wb");
+            long chunk_size = size - done;
+            if (chunk_size > default_window_size) chunk_size = default_window_size;
+
+            const uint8_t *chunk = window_at(in, offset + done, chunk_size);
+            if (!chunk)
+            {
+                printf("subfile past end of file\n");
+
+                fclose(outfile);
+                char *path = output_path(mip, strname);
+                remove(path);
+                free(path);
+                free(strname);
+                free(name_base);
+                return 1;
+            }
+            put_bytes(outfile, chunk, chunk_size);
+
+            done += chunk_size;
         }
-        put_bytes(outfile, infile, size);
         fclose(outfile);
         free(strname);
         free(name_base);
 
+        mip->subfiles ++;
+
         return 0;
     }
 
-    // rebuild each stream
+    // rebuild all streams at once, each with its own reader only holding
+    // a block (and one ahead) and writing to its own file
+    struct stream_job *job = calloc(streams, sizeof(struct stream_job));
+    CHECK_ERRNO(!job, "calloc");
     for (int str = 0; str < streams; str ++)
     {
-        long parsed_samples;
-        int channels;
-        long data_offset, data_size;
-        char *strname = number_name(name_base, ".xma", str+1, streams);
-        printf("%s\n", strname);
+        long data_offset = packet_size_bytes*str;
+        struct stream_job *j = &job[str];
 
-        FILE *outfile;
-        
-        if (dir_name)
-        {
-            outfile = open_file_in_directory(dir_name, NULL, DIRSEP, strname, "wb");
-        }
-        else
+        j->in = clone_window_reader(in, block_size * 2);
+        if (!j->in)
         {
-            outfile = fopen(strname, "wb");
+            abandon_streams(mip, job, 0, str);
+            free_stream_jobs(job, str);
+            free(name_base);
+            free(stream_channels);
+            return 1;
         }
-        CHECK_ERRNO(!outfile, "fopen output");
+        j->offset = offset + data_offset;
+        j->size = size-data_offset;
+        j->channels = stream_channels ? stream_channels[str] : 2;
+        j->result = 1;
+
+        j->name = number_name(name_base, ".xma", str+1, streams);
+        j->outfile = open_output(mip, j->name);
+        CHECK_ERRNO(!j->outfile, "fopen output");
         CHECK_ERRNO(
-            -1 == fseek(outfile, xma_header_size, SEEK_SET), "fseek past header");
+            -1 == fseek(j->outfile, xma_header_size, SEEK_SET), "fseek past header");
+    }
 
-        data_offset = packet_size_bytes*str;
-        data_size = size-data_offset;
+    rebuild_streams(job, streams, block_size, mip->stream_threads);
 
-        // rebuild!
-        if (stream_channels)
-        {
-            channels = stream_channels[str];
-        }
-        else
-        {
-            channels = 2;
-        }
-        if (0 != build_XMA_from_XMA2(infile + data_offset,
-                                     data_size,
-                                     outfile, block_size, channels,
-                                     &parsed_samples))
+    // finish them off in order
+    for (int str = 0; str < streams; str ++)
+    {
+        const struct stream_job *j = &job[str];
+        printf("%s\n", j->name);
+
+        if (0 != j->result)
         {
             // encountered an error while parsing
-            fclose(outfile);
-            free(strname);
+            abandon_streams(mip, job, str, streams);
+            free_stream_jobs(job, streams);
             free(name_base);
             free(stream_channels);
             return 1;
         }
 
-        if (parsed_samples != samples)
+        if (j->parsed_samples != samples)
         {
-            printf("parsed samples = %ld, expected %ld\n", parsed_samples, samples);
-            if (parsed_samples > samples)
+            printf("parsed samples = %ld, expected %ld\n", j->parsed_samples, samples);
+            if (j->parsed_samples > samples)
             {
                 printf("but that's more so we'll let it slide...\n");
             }
             else
             {
-                fclose(outfile);
-                free(strname);
+                abandon_streams(mip, job, str, streams);
+                free_stream_jobs(job, streams);
                 free(name_base);
                 free(stream_channels);
                 return 1;
@@ -222,31 +630,20 @@ int subfile_callback(const uint8_t * infile, long size, int streams, int * strea
         }
 
         // write header
-        long finish_offset = ftell(outfile);
-        uint8_t *xma_head = make_xma_header(srate, finish_offset-xma_header_size, channels);
+        long finish_offset = ftell(j->outfile);
+        uint8_t *xma_head = make_xma_header(srate, finish_offset-xma_header_size, j->channels);
         CHECK_ERRNO(
-            -1 == fseek(outfile, 0, SEEK_SET), "fseek to header");
-        CHECK_ERRNO( 1 != fwrite(xma_head, xma_header_size, 1, outfile) , "fwrite header");
+            -1 == fseek(j->outfile, 0, SEEK_SET), "fseek to header");
+        CHECK_ERRNO( 1 != fwrite(xma_head, xma_header_size, 1, j->outfile) , "fwrite header");
 
-        CHECK_ERRNO(EOF == fclose(outfile), "fclose");
+        CHECK_ERRNO(EOF == fclose(j->outfile), "fclose");
         free(xma_head);
 
-        free(strname);
-
         // write loop
         if (loop_end > 0)
         {
             char *pos_name = number_name(name_base, ".pos", str+1, streams);
-            FILE *posfile;
-            
-            if (dir_name)
-            {
-                posfile = open_file_in_directory(dir_name, NULL, DIRSEP, pos_name, "wb");
-            }
-            else
-            {
-                posfile = fopen(pos_name,"wb");
-            }
+            FILE *posfile = open_output(mip, pos_name);
 
             CHECK_ERRNO(!posfile, "fopen .pos");
             put_32_le(loop_start, posfile);
@@ -259,9 +656,310 @@ int subfile_callback(const uint8_t * infile, long size, int streams, int * strea
         }
     }
 
+    mip->subfiles ++;
+    mip->streams += streams;
+    mip->samples += samples;
+
+    free_stream_jobs(job, streams);
     free(name_base);
     free(stream_channels);
     return 0;
 }
 
+//////////////// batch mode
+
+struct tree_file
+{
+    char *path;
+    char *sub_dir;      // relative to the root, NULL at the top
+    long size;
+
+    // results
+    int result;
+    const char *format;
+    int subfiles;
+    int streams;
+    long samples;
+    char *key;          // hex, NULL if none
+    double seconds;
+};
+
+struct tree_files
+{
+    struct tree_file *file;
+    int count;
+    int capacity;
+};
+
+struct tree_pool
+{
+    struct tree_files *files;
+    const char *dir_name;
+
+    pthread_mutex_t lock;
+    int next;
+    int done;
+};
+
+static char *join_path(const char *dir, const char *name)
+{
+    char *path = malloc(strlen(dir) + 1 + strlen(name) + 1);
+    CHECK_ERRNO(!path, "malloc");
+    sprintf(path, "%s%c%s", dir, DIRSEP, name);
+    return path;
+}
+
+// find all the files under dir, sub_dir is where that is under the root
+static void find_files(const char *dir, const char *sub_dir, struct tree_files *tf)
+{
+    DIR *d = opendir(dir);
+    if (!d)
+    {
+        fprintf(stderr, "can't read %s: %s\n", dir, strerror(errno));
+        return;
+    }
 
+    for (struct dirent *de; NULL != (de = readdir(d)); )
+    {
+        if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+        {
+            continue;
+        }
+
+        char *path = join_path(dir, de->d_name);
+        struct stat st;
+
+#ifdef __MINGW32__
+        if (0 != stat(path, &st))
+#else
+        // don't follow links, so we can't loop
+        if (0 != lstat(path, &st))
+#endif
+        {
+            free(path);
+            continue;
+        }
+
+        if (S_ISDIR(st.st_mode))
+        {
+            char *sub = sub_dir ? join_path(sub_dir, de->d_name) : strdup(de->d_name);
+            CHECK_ERRNO(!sub, "strdup");
+            find_files(path, sub, tf);
+            free(sub);
+            free(path);
+        }
+        else if (S_ISREG(st.st_mode))
+        {
+            if (tf->count == tf->capacity)
+            {
+                tf->capacity = tf->capacity ? tf->capacity * 2 : 0x100;
+                tf->file = realloc(tf->file, tf->capacity * sizeof(struct tree_file));
+                CHECK_ERRNO(!tf->file, "realloc");
+            }
+
+            struct tree_file *f = &tf->file[tf->count++];
+            memset(f, 0, sizeof(*f));
+            f->path = path;
+            f->sub_dir = NULL;
+            if (sub_dir)
+            {
+                f->sub_dir = strdup(sub_dir);
+                CHECK_ERRNO(!f->sub_dir, "strdup");
+            }
+            f->size = st.st_size;
+            f->result = 1;
+        }
+        else
+        {
+            free(path);
+        }
+    }
+
+    closedir(d);
+}
+
+static int larger_first(const void *a, const void *b)
+{
+    const struct tree_file *fa = a, *fb = b;
+
+    if (fa->size != fb->size)
+    {
+        return (fa->size < fb->size) ? 1 : -1;
+    }
+    return strcmp(fa->path, fb->path);
+}
+
+static int by_path(const void *a, const void *b)
+{
+    const struct tree_file *fa = a, *fb = b;
+    return strcmp(fa->path, fb->path);
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    CHECK_ERRNO(0 != clock_gettime(CLOCK_MONOTONIC, &ts), "clock_gettime");
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *tree_worker(void *v)
+{
+    struct tree_pool *tp = v;
+
+    // the streams of a file are rebuilt on this thread, as there are
+    // already enough threads working on files
+    struct main_info mi = {
+        .dir_name = tp->dir_name,
+        .stream_threads = 1
+    };
+
+    for (;;)
+    {
+        pthread_mutex_lock(&tp->lock);
+        int i = tp->next++;
+        pthread_mutex_unlock(&tp->lock);
+
+        if (i >= tp->files->count) break;
+
+        struct tree_file *f = &tp->files->file[i];
+        mi.file_name = strip_path(f->path);
+        mi.sub_dir = f->sub_dir;
+
+        double start = now();
+        f->result = process_file(f->path, &mi);
+        f->seconds = now() - start;
+
+        f->format = mi.format;
+        f->subfiles = mi.subfiles;
+        f->streams = mi.streams;
+        f->samples = mi.samples;
+        if (0 == f->result && mi.key_length > 0)
+        {
+            f->key = malloc(mi.key_length * 2 + 1);
+            CHECK_ERRNO(!f->key, "malloc");
+            for (int k = 0; k < mi.key_length; k++)
+            {
+                sprintf(&f->key[k*2], "%02" PRIx8, mi.key[k]);
+            }
+        }
+
+        pthread_mutex_lock(&tp->lock);
+        int done = ++tp->done;
+        pthread_mutex_unlock(&tp->lock);
+
+        printf("%s %s (%d/%d)\n\n", f->path, (0 == f->result) ? "done" : "FAILED",
+                done, tp->files->count);
+    }
+
+    free_main_info(&mi);
+
+    return NULL;
+}
+
+// process a whole tree of files, biggest first, returns 0 if all succeeded
+static int process_tree(const char *root, const char *dir_name, long jobs)
+{
+    struct tree_files tf = {NULL, 0, 0};
+    int failed = 0;
+
+    find_files(root, NULL, &tf);
+    if (0 == tf.count)
+    {
+        fprintf(stderr, "no files found in %s\n", root);
+        return 1;
+    }
+
+    // the biggest take longest, get them going first so they don't end up
+    // finishing on their own
+    qsort(tf.file, tf.count, sizeof(struct tree_file), larger_first);
+
+    struct tree_pool tp = {&tf, dir_name};
+    pthread_mutex_init(&tp.lock, NULL);
+    tp.next = tp.done = 0;
+
+    long threads = (jobs < tf.count) ? jobs : tf.count;
+    if (threads <= 1)
+    {
+        tree_worker(&tp);
+    }
+    else
+    {
+        pthread_t *thread = malloc(threads * sizeof(pthread_t));
+        CHECK_ERRNO(!thread, "malloc");
+
+        for (long i = 0; i < threads; i++)
+        {
+            errno = pthread_create(&thread[i], NULL, tree_worker, &tp);
+            CHECK_ERRNO(0 != errno, "pthread_create");
+        }
+        for (long i = 0; i < threads; i++)
+        {
+            pthread_join(thread[i], NULL);
+        }
+
+        free(thread);
+    }
+
+    pthread_mutex_destroy(&tp.lock);
+
+    // summary, one tab separated line per file
+    qsort(tf.file, tf.count, sizeof(struct tree_file), by_path);
+
+    FILE *summary = open_file_in_directory(dir_name, NULL, DIRSEP, SUMMARY_NAME, "w");
+    CHECK_ERRNO(!summary, "fopen summary");
+
+    fprintf(summary, "file\tstatus\tformat\tsubfiles\tstreams\tsamples\tkey\tseconds\n");
+    for (int i = 0; i < tf.count; i++)
+    {
+        struct tree_file *f = &tf.file[i];
+
+        fprintf(summary, "%s\t%s\t%s\t%d\t%d\t%ld\t%s\t%.3f\n",
+                f->path, (0 == f->result) ? "ok" : "failed",
+                f->format ? f->format : "-",
+                f->subfiles, f->streams, f->samples,
+                f->key ? f->key : "-",
+                f->seconds);
+
+        if (0 != f->result) failed ++;
+
+        free(f->path);
+        free(f->sub_dir);
+        free(f->key);
+    }
+    CHECK_ERRNO(EOF == fclose(summary), "fclose summary");
+
+    printf("%d of %d files done, %d failed, summary in %s%c%s\n",
+            tf.count - failed, tf.count, failed, dir_name, DIRSEP, SUMMARY_NAME);
+
+    free(tf.file);
+
+    return (0 == failed) ? 0 : 1;
+}
+
+// probe every file under root, returns 0 if all were recognized
+static int probe_tree(const char *root)
+{
+    struct tree_files tf = {NULL, 0, 0};
+    int unknown = 0;
+
+    find_files(root, NULL, &tf);
+    if (0 == tf.count)
+    {
+        fprintf(stderr, "no files found in %s\n", root);
+        return 1;
+    }
+
+    qsort(tf.file, tf.count, sizeof(struct tree_file), by_path);
+
+    for (int i = 0; i < tf.count; i++)
+    {
+        if (0 != probe_only(tf.file[i].path)) unknown ++;
+
+        free(tf.file[i].path);
+        free(tf.file[i].sub_dir);
+    }
+
+    free(tf.file);
+
+    return (0 == unknown) ? 0 : 1;
+}
@@ -0,0 +1,194 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "error_stuff.h"
+#include "util.h"
+#include "wwbank.h"
+
+enum {DIDX_ENTRY_SIZE = 0xC};
+
+static int index_chunks(struct wwbank_index *idx, wwbank_read_t *read, void *handle, long start, long bank_size)
+{
+    int capacity = 0;
+    long offset = start;
+
+    while (offset < bank_size)
+    {
+        uint8_t head[8];
+
+        if (offset + 8 > bank_size) return 1;
+        if (0 != read(handle, offset, head, 8)) return 1;
+
+        const uint32_t chunk_id = read_32_be(&head[0]);
+        const uint32_t chunk_size = read_32_be(&head[4]);
+
+        if (0 == chunk_id)
+        {
+            // padding at the end
+            break;
+        }
+
+        if (offset + 8 + chunk_size > bank_size) return 1;
+
+        if (idx->chunk_count == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 8;
+            idx->chunks = realloc(idx->chunks, capacity * sizeof(struct wwbank_chunk));
+            CHECK_ERRNO(!idx->chunks, "realloc");
+        }
+
+        struct wwbank_chunk *c = &idx->chunks[idx->chunk_count++];
+        c->id = chunk_id;
+        c->offset = offset + 8;
+        c->size = chunk_size;
+
+        offset += 8 + chunk_size;
+    }
+
+    idx->end = offset;
+
+    return 0;
+}
+
+static int by_file_id(const void *a, const void *b)
+{
+    const struct wwbank_file_id *fa = a;
+    const struct wwbank_file_id *fb = b;
+
+    if (fa->id != fb->id) return (fa->id < fb->id) ? -1 : 1;
+    return fa->index - fb->index;
+}
+
+static int index_files(struct wwbank_index *idx, wwbank_read_t *read, void *handle)
+{
+    const struct wwbank_chunk *didx = wwbank_find_chunk(idx, WWBANK_DIDX);
+    const struct wwbank_chunk *data = wwbank_find_chunk(idx, WWBANK_DATA);
+
+    if (!didx)
+    {
+        return 0;
+    }
+
+    if (!data || didx->size % DIDX_ENTRY_SIZE != 0)
+    {
+        return 1;
+    }
+
+    const int file_count = didx->size / DIDX_ENTRY_SIZE;
+
+    uint8_t *entries = malloc(didx->size > 0 ? didx->size : 1);
+    CHECK_ERRNO(!entries, "malloc");
+    idx->files = malloc((file_count > 0 ? file_count : 1) * sizeof(struct wwbank_file));
+    CHECK_ERRNO(!idx->files, "malloc");
+    idx->by_id = malloc((file_count > 0 ? file_count : 1) * sizeof(struct wwbank_file_id));
+    CHECK_ERRNO(!idx->by_id, "malloc");
+
+    if (0 != read(handle, didx->offset, entries, didx->size))
+    {
+        free(entries);
+        return 1;
+    }
+
+    for (int i = 0; i < file_count; i++)
+    {
+        const uint8_t *e = &entries[i * DIDX_ENTRY_SIZE];
+        struct wwbank_file *f = &idx->files[i];
+
+        f->id = read_32_be(&e[0]);
+        f->offset = data->offset + read_32_be(&e[4]);
+        f->size = read_32_be(&e[8]);
+
+        if (f->offset + f->size > data->offset + data->size)
+        {
+            free(entries);
+            return 1;
+        }
+
+        idx->by_id[i].id = f->id;
+        idx->by_id[i].index = i;
+    }
+    idx->file_count = file_count;
+
+    free(entries);
+
+    // usually already in order, but can't count on it
+    qsort(idx->by_id, file_count, sizeof(struct wwbank_file_id), by_file_id);
+
+    return 0;
+}
+
+int wwbank_index_chunks(struct wwbank_index *idx, wwbank_read_t *read, void *handle, long start, long bank_size)
+{
+    memset(idx, 0, sizeof(*idx));
+
+    if (0 != index_chunks(idx, read, handle, start, bank_size))
+    {
+        wwbank_index_free(idx);
+        return 1;
+    }
+
+    return 0;
+}
+
+int wwbank_index_init(struct wwbank_index *idx, wwbank_read_t *read, void *handle, long start, long bank_size)
+{
+    if (0 != wwbank_index_chunks(idx, read, handle, start, bank_size))
+    {
+        return 1;
+    }
+
+    if (0 != index_files(idx, read, handle))
+    {
+        wwbank_index_free(idx);
+        return 1;
+    }
+
+    return 0;
+}
+
+void wwbank_index_free(struct wwbank_index *idx)
+{
+    free(idx->chunks);
+    free(idx->files);
+    free(idx->by_id);
+    memset(idx, 0, sizeof(*idx));
+}
+
+const struct wwbank_chunk *wwbank_find_chunk(const struct wwbank_index *idx, uint32_t id)
+{
+    for (int i = 0; i < idx->chunk_count; i++)
+    {
+        if (idx->chunks[i].id == id)
+        {
+            return &idx->chunks[i];
+        }
+    }
+
+    return NULL;
+}
+
+int wwbank_find_file(const struct wwbank_index *idx, uint32_t id)
+{
+    int lo = 0, hi = idx->file_count;
+
+    while (lo < hi)
+    {
+        int mid = lo + (hi - lo) / 2;
+
+        if (idx->by_id[mid].id < id)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    if (lo < idx->file_count && idx->by_id[lo].id == id)
+    {
+        return idx->by_id[lo].index;
+    }
+
+    return -1;
+}
@@ -5,6 +5,7 @@
 
 #include "util.h"
 #include "error_stuff.h"
+#include "wwbank.h"
 
 // WWise funky RIFX
 
@@ -13,11 +14,41 @@ uint8_t *make_xma_header(uint32_t srate, uint32_t size, int channels);
 
 const int xma_header_size = 0x3c;
 
+static int read_file(void *handle, long offset, uint8_t *buf, long size)
+{
+    FILE *infile = handle;
+
+    CHECK_ERRNO(-1 == fseek(infile, offset, SEEK_SET), "fseek failed");
+
+    return fread(buf, 1, size, infile) != (size_t)size;
+}
+
+// extract the subfile at subfile_offset, returns its size
+static uint32_t handle_subfile(FILE * infile, long subfile_offset, const char * outfile_prefix, int file_idx)
+{
+    CHECK_ERRNO(-1 == fseek(infile, subfile_offset, SEEK_SET), "fseek to subfile failed");
+
+    const uint32_t subfile_id = get_32_be(infile);
+    const uint32_t subfile_size = get_32_le(infile);    // SAY WHAT?!?
+    switch (subfile_id)
+    {
+        case UINT32_C(0x52494658):  // RIFX
+            break;
+        default:
+            CHECK_ERROR(1, "unexpected subfile type");
+            break;
+    }
+
+    handle_RIFX(subfile_size, infile, outfile_prefix, file_idx);
+
+    return subfile_size;
+}
+
 int main(int argc, char ** argv)
 {
-    if (argc != 3)
+    if (argc < 3)
     {
-        fprintf(stderr, "usage: %s infile.WwiseBank outfile_prefix\n", argv[0]);
+        fprintf(stderr, "usage: %s infile.WwiseBank outfile_prefix [file_id...]\n", argv[0]);
         return 1;
     }
 
@@ -29,75 +60,76 @@ int main(int argc, char ** argv)
 
     CHECK_ERROR(UINT32_C(-1) != get_32_be(infile), "missing magic -1");
 
+    CHECK_ERRNO(-1 == fseek(infile, 0, SEEK_END), "fseek to end failed");
+    const long file_size = ftell(infile);
+    CHECK_ERRNO(-1 == file_size, "ftell");
 
-    long DATA_offset = -1;
-    uint32_t DATA_size = 0;
-
+    // top level wwise chunks, up to 16 bytes padding at end starting with 0s
+    // DIDX is only read when there are ids to look up in it
+    struct wwbank_index bank;
+    if (argc > 3)
+    {
+        CHECK_ERROR(0 != wwbank_index_init(&bank, read_file, infile, 0x80, file_size), "bad chunk or DIDX size");
+    }
+    else
     {
-        int done = 0;
-        long chunk_start = 0x80;
+        CHECK_ERROR(0 != wwbank_index_chunks(&bank, read_file, infile, 0x80, file_size), "bad chunk size");
+    }
 
-        // top level wwise chunks loop
-        while (!done)
+    for (int i = 0; i < bank.chunk_count; i++)
+    {
+        switch (bank.chunks[i].id)
         {
-            CHECK_ERRNO(-1 == fseek(infile, chunk_start, SEEK_SET), "fseek to BKHD chunk failed");
+            case WWBANK_BKHD:   // Bank Header?
+            case WWBANK_DIDX:   // Data Index?
+            case WWBANK_HIRC:
+            case WWBANK_STID:   // Stream Identifier?
+            case WWBANK_DATA:   // body
+                break;
+            default:
+                CHECK_ERROR(1, "unknown chunk id");
+                break;
+        }
+    }
+
+    const struct wwbank_chunk *DATA = wwbank_find_chunk(&bank, WWBANK_DATA);
+    CHECK_ERROR(!DATA, "no DATA chunk found in BKHD");
 
-            const uint32_t chunk_id = get_32_be(infile);
-            const uint32_t chunk_size = get_32_be(infile);
+    if (argc > 3)
+    {
+        // just the files asked for, found through DIDX
+        CHECK_ERROR(!wwbank_find_chunk(&bank, WWBANK_DIDX), "no DIDX chunk to look up ids in");
 
-            switch (chunk_id)
+        for (int i = 3; i < argc; i++)
+        {
+            const long file_id = read_long(argv[i]);
+            const int file_idx = (file_id < 0 || file_id > UINT32_MAX) ? -1 : wwbank_find_file(&bank, file_id);
+
+            if (file_idx < 0)
             {
-                case UINT32_C(0x424B4844):  // BKHD: Bank Header?
-                case UINT32_C(0x44494458):  // DIDX: Data Index?
-                case UINT32_C(0x48495243):  // HIRC
-                case UINT32_C(0x53544944):  // STID: Stream Identifier?
-                    break;
-                case UINT32_C(0):
-                    // 16 bytes padding at end, starting with 0s
-                    done = 1;
-                    break;
-                case UINT32_C(0x44415441):  // DATA: body
-                    DATA_offset = chunk_start + 8;
-                    DATA_size = chunk_size;
-                    break;
-                default:
-                    CHECK_ERROR(1, "unknown chunk id");
-                    break;
+                printf("File id %s not in bank, skipping\n", argv[i]);
+                continue;
             }
 
-            chunk_start += 8 + chunk_size;
+            handle_subfile(infile, bank.files[file_idx].offset, outfile_prefix, file_idx);
         }
-
-        CHECK_ERROR(DATA_offset == -1, "no DATA chunk found in BKHD");
     }
-
+    else
     {
         int file_idx = 0;
 
-        long subfile_offset = DATA_offset;
+        long subfile_offset = DATA->offset;
 
         // subfile loop
-        while (subfile_offset < DATA_offset + DATA_size)
+        while (subfile_offset < DATA->offset + DATA->size)
         {
-            CHECK_ERRNO(-1 == fseek(infile, subfile_offset, SEEK_SET), "fseek to subfile failed");
-
-            const uint32_t subfile_id = get_32_be(infile);
-            const uint32_t subfile_size = get_32_le(infile);    // SAY WHAT?!?
-            switch (subfile_id)
-            {
-                case UINT32_C(0x52494658):  // RIFX
-                    break;
-                default:
-                    CHECK_ERROR(1, "unexpected subfile type");
-                    break;
-            }
-
-            handle_RIFX(subfile_size, infile, outfile_prefix, file_idx);
-            subfile_offset += subfile_size;
+            subfile_offset += handle_subfile(infile, subfile_offset, outfile_prefix, file_idx);
             file_idx ++;
         }
     }
 
+    wwbank_index_free(&bank);
+
     return 0;
 }
 